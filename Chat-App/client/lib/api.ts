@@ -109,4 +109,12 @@ export const roomApi = {
   },
 };
 
-export const getWebSocketURL = () => WS_URL;
+// The server refuses upgrades without the login token. room_id also
+// subscribes the connection to a room the user is already a member of.
+export const getWebSocketURL = (token: string, roomId?: number | null) => {
+  const params = new URLSearchParams({ token });
+  if (roomId) {
+    params.set('room_id', String(roomId));
+  }
+  return `${WS_URL}?${params.toString()}`;
+};
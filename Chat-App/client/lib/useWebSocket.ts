@@ -5,8 +5,10 @@ import { useChatStore, Message, User } from '@/lib/store';
 import { getWebSocketURL, roomApi } from '@/lib/api';
 
 interface WebSocketMessage {
-  type: 'message' | 'user_joined' | 'user_left' | 'message_history' | 'error' | 'connected' | 'pong' | 'ping';
+  type: 'message' | 'user_joined' | 'user_left' | 'message_history' | 'error' | 'connected' | 'pong' | 'ping' | 'resume' | 'resumed' | 'resync';
   room_id?: number;
+  seq?: number;
+  replayed?: number;
   user_id?: number;
   username?: string;
   content?: string;
@@ -52,6 +54,9 @@ export const useWebSocket = (
   const reconnectTimeoutRef = useRef<NodeJS.Timeout | null>(null);
   const pingIntervalRef = useRef<NodeJS.Timeout | null>(null);
   const messageQueueRef = useRef<WebSocketMessage[]>([]);
+  // Last per-room sequence number seen, used to resume after a reconnect
+  const lastSeqRef = useRef<Record<number, number>>({});
+  const resumingRef = useRef(false);
 
   const [isConnected, setIsConnected] = useState(false);
   const [connectionError, setConnectionError] = useState<string | null>(null);
@@ -72,9 +77,17 @@ export const useWebSocket = (
       return;
     }
 
+    // Upgrades are refused without a login token
+    if (!user?.token) {
+      return;
+    }
+
     try {
-      const wsUrl = getWebSocketURL();
-      console.log('[WebSocket] Connecting to:', wsUrl);
+      // Only a room already joined over HTTP; the server refuses others
+      const roomId = currentRoom?.room_id;
+      const subscribeRoom = roomId !== undefined && useChatStore.getState().isUserInRoom(roomId) ? roomId : null;
+      const wsUrl = getWebSocketURL(user.token, subscribeRoom);
+      console.log('[WebSocket] Connecting', subscribeRoom ? `(room ${subscribeRoom})` : '');
 
       wsRef.current = new WebSocket(wsUrl);
 
@@ -100,8 +113,9 @@ export const useWebSocket = (
 
       wsRef.current.onmessage = (event) => {
         try {
-          const message: WebSocketMessage = JSON.parse(event.data);
-          handleWebSocketMessage(message);
+          // Busy rooms deliver batches as an array of messages
+          const data: WebSocketMessage | WebSocketMessage[] = JSON.parse(event.data);
+          (Array.isArray(data) ? data : [data]).forEach(handleWebSocketMessage);
         } catch (error) {
           console.error('[WebSocket] Failed to parse message:', error, event.data);
         }
@@ -220,10 +234,21 @@ export const useWebSocket = (
    */
   const rejoinRoom = useCallback(() => {
     if (currentRoom && user) {
-      console.log('[WebSocket] Rejoining room:', currentRoom.room_id);
-      joinRoom(currentRoom.room_id);
+      const roomId = currentRoom.room_id;
+      const lastSeq = lastSeqRef.current[roomId];
+      console.log('[WebSocket] Rejoining room:', roomId);
+
+      // Ask only for what was missed instead of reloading the history
+      resumingRef.current = lastSeq !== undefined;
+      joinRoom(roomId).then((joined) => {
+        if (joined && lastSeq !== undefined) {
+          send({ type: 'resume', room_id: roomId, seq: lastSeq });
+        } else {
+          resumingRef.current = false;
+        }
+      });
     }
-  }, [currentRoom, user, joinRoom]);
+  }, [currentRoom, user, joinRoom, send]);
 
   /**
    * Send a chat message
@@ -329,6 +354,9 @@ export const useWebSocket = (
 
       switch (message.type) {
         case 'message':
+          if (message.room_id && message.seq !== undefined) {
+            lastSeqRef.current[message.room_id] = message.seq;
+          }
           if (message.room_id === currentRoom?.room_id) {
             const chatMessage: Message = {
               id: message.message_id || `${message.user_id}-${message.timestamp}`,
@@ -376,6 +404,20 @@ export const useWebSocket = (
           setError(message.data?.message || 'An error occurred');
           break;
 
+        case 'resumed':
+          resumingRef.current = false;
+          console.log('[WebSocket] Resumed room', message.room_id, 'replayed', message.replayed, 'messages');
+          break;
+
+        case 'resync':
+          // Missed too much to replay: reload the history
+          resumingRef.current = false;
+          if (message.room_id !== undefined && message.seq !== undefined) {
+            lastSeqRef.current[message.room_id] = message.seq;
+          }
+          fetchChatHistory();
+          break;
+
         case 'pong':
           console.log('[WebSocket] Pong received - connection alive');
           break;
@@ -388,7 +430,7 @@ export const useWebSocket = (
           console.warn('[WebSocket] Unknown message type:', message.type);
       }
     },
-    [currentRoom, addMessage, setMessages, setError]
+    [currentRoom, addMessage, setMessages, setError, fetchChatHistory]
   );
   const setPingInterval = useCallback(() => {
     if (pingIntervalRef.current) {
@@ -429,7 +471,7 @@ export const useWebSocket = (
    * Fetch chat history when current room changes
    */
   useEffect(() => {
-    if (currentRoom && isConnected) {
+    if (currentRoom && isConnected && !resumingRef.current) {
       // Add a small delay to ensure we're fully joined
       const timer = setTimeout(() => {
         fetchChatHistory();
@@ -0,0 +1,181 @@
+// Request body field extraction: the strstr lookups http_server used to
+// run once per field, against one json_index_parse pass plus lookups.
+// Bodies and field sets follow the HTTP routes.
+// Usage: json_bench [iterations-scale]
+#include "json_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+typedef struct {
+    const char *name;
+    const char *body;
+    const char *strings[3];
+    const char *ints[3];
+} Route;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ---- Previous implementation, kept as the baseline ----
+
+static int strstr_json_string(const char *json, const char *key, char *value, size_t max_len) {
+    char search_key[256];
+    snprintf(search_key, sizeof(search_key), "\"%s\":", key);
+
+    const char *pos = strstr(json, search_key);
+    if (!pos) return -1;
+    pos += strlen(search_key);
+    while (*pos && (*pos == ' ' || *pos == '\t' || *pos == ':')) pos++;
+
+    if (*pos == '"') {
+        pos++;
+        size_t i = 0;
+        while (*pos && *pos != '"' && i < max_len - 1) {
+            value[i++] = *pos++;
+        }
+        value[i] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+static int strstr_json_int(const char *json, const char *key, int *value) {
+    char search_key[256];
+    snprintf(search_key, sizeof(search_key), "\"%s\":", key);
+
+    const char *pos = strstr(json, search_key);
+    if (!pos) return -1;
+    pos += strlen(search_key);
+    while (*pos && (*pos == ' ' || *pos == '\t' || *pos == ':')) pos++;
+
+    if (*pos && (isdigit(*pos) || *pos == '-')) {
+        *value = atoi(pos);
+        return 0;
+    }
+    return -1;
+}
+
+// ---- Runs ----
+
+static int run_strstr(const Route *route, size_t len, char *out, int *sum) {
+    (void)len;
+    for (int i = 0; i < 3 && route->strings[i]; i++) {
+        if (strstr_json_string(route->body, route->strings[i], out, 512) < 0) return -1;
+    }
+    for (int i = 0; i < 3 && route->ints[i]; i++) {
+        int value;
+        if (strstr_json_int(route->body, route->ints[i], &value) < 0) return -1;
+        *sum += value;
+    }
+    return 0;
+}
+
+static int run_index(const Route *route, size_t len, char *out, int *sum) {
+    JSONIndex index;
+    if (json_index_parse(&index, route->body, len) < 0) return -1;
+    for (int i = 0; i < 3 && route->strings[i]; i++) {
+        if (json_index_string(&index, route->strings[i], out, 512) < 0) return -1;
+    }
+    for (int i = 0; i < 3 && route->ints[i]; i++) {
+        int value;
+        if (json_index_int(&index, route->ints[i], &value) < 0) return -1;
+        *sum += value;
+    }
+    return 0;
+}
+
+static int check_escapes() {
+    const char *body = "{\"message\": \"say \\\"hi\\\" \\u00e9\\ud83d\\ude00\\n\", \"room_id\": 7,"
+                       " \"meta\": {\"tags\": [1, \"}\", null]}, \"user_id\": -3}";
+    JSONIndex index;
+    char out[64];
+    int room_id, user_id;
+
+    if (json_index_parse(&index, body, strlen(body)) < 0 ||
+        json_index_string(&index, "message", out, sizeof(out)) < 0 ||
+        strcmp(out, "say \"hi\" \xc3\xa9\xf0\x9f\x98\x80\n") != 0 ||
+        json_index_int(&index, "room_id", &room_id) < 0 || room_id != 7 ||
+        json_index_int(&index, "user_id", &user_id) < 0 || user_id != -3 ||
+        json_index_get(&index, "tags") != NULL) {
+        return -1;
+    }
+
+    // Malformed objects are refused outright
+    const char *bad[] = {"{\"a\": 1,}", "{\"a\" 1}", "{\"a\": [1}", "{\"a\": \"x}", "{\"a\": 1} x", "[1]"};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        if (json_index_parse(&index, bad[i], strlen(bad[i])) == 0) return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    double scale = argc > 1 ? atof(argv[1]) : 1.0;
+    char long_message[1024];
+
+    snprintf(long_message, sizeof(long_message),
+             "{\"message\": \"%.*s\", \"user_id\": 12, \"room_id\": 3}", 400,
+             "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor "
+             "incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud "
+             "exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure "
+             "dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. "
+             "Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt.");
+
+    Route routes[] = {
+        {"login", "{\"username\": \"alice\", \"password\": \"password123\"}",
+         {"username", "password"}, {NULL}},
+        {"register", "{\"username\": \"bob\", \"password\": \"hunter22\", \"role\": \"user\"}",
+         {"username", "password", "role"}, {NULL}},
+        {"room create", "{\"room_name\": \"general\", \"user_id\": 1}",
+         {"room_name"}, {"user_id"}},
+        {"send short", "{\"message\": \"hello there, how is everyone?\", \"user_id\": 12, \"room_id\": 3}",
+         {"message"}, {"user_id", "room_id"}},
+        {"send 400 B", long_message, {"message"}, {"user_id", "room_id"}},
+    };
+    int route_count = sizeof(routes) / sizeof(routes[0]);
+
+    if (check_escapes() < 0) {
+        fprintf(stderr, "escape/validation check failed\n");
+        return 1;
+    }
+
+    printf("%-12s %8s %14s %14s %8s\n", "route", "bytes", "strstr ns/op", "index ns/op", "speedup");
+    double total_old = 0, total_new = 0;
+    for (int r = 0; r < route_count; r++) {
+        const Route *route = &routes[r];
+        size_t len = strlen(route->body);
+        long iterations = (long)(scale * 20000000.0 / (len + 64));
+        char out[512];
+        int sum_old = 0, sum_new = 0;
+
+        if (iterations < 1000) iterations = 1000;
+
+        double start = now_seconds();
+        for (long i = 0; i < iterations; i++) {
+            if (run_strstr(route, len, out, &sum_old) < 0) return 1;
+        }
+        double old_ns = (now_seconds() - start) * 1e9 / iterations;
+
+        start = now_seconds();
+        for (long i = 0; i < iterations; i++) {
+            if (run_index(route, len, out, &sum_new) < 0) return 1;
+        }
+        double new_ns = (now_seconds() - start) * 1e9 / iterations;
+
+        if (sum_old != sum_new) {
+            fprintf(stderr, "%s: results differ\n", route->name);
+            return 1;
+        }
+        printf("%-12s %8zu %14.1f %14.1f %7.2fx\n", route->name, len, old_ns, new_ns, old_ns / new_ns);
+        total_old += old_ns;
+        total_new += new_ns;
+    }
+    printf("%-12s %8s %14.1f %14.1f %7.2fx\n", "mix", "", total_old / route_count,
+           total_new / route_count, total_old / total_new);
+    return 0;
+}
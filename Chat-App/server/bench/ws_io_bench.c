@@ -0,0 +1,185 @@
+// Broadcast fan-out benchmark: one 128-byte frame to every connection,
+// with a send() per socket versus one batch of io_uring SEND SQEs.
+// Usage: ws_io_bench [connections] [broadcasts]
+#include "uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define FRAME_SIZE 128
+
+static int *g_senders;
+static int *g_receivers;
+static int g_count;
+static atomic_int g_draining = 1;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keep the receive side empty so sends never block on a full window
+static void* drain_thread(void *arg) {
+    int epfd = *(int*)arg;
+    struct epoll_event events[256];
+    char buf[65536];
+
+    while (atomic_load(&g_draining)) {
+        int n = epoll_wait(epfd, events, 256, 100);
+        for (int i = 0; i < n; i++) {
+            while (recv(events[i].data.fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+        }
+    }
+    return NULL;
+}
+
+static int connect_pairs(int count) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(listener, SOMAXCONN) < 0 || getsockname(listener, (struct sockaddr*)&addr, &len) < 0) {
+        perror("listener");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            return -1;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        g_senders[i] = fd;
+        g_receivers[i] = accept(listener, NULL, NULL);
+        if (g_receivers[i] < 0) {
+            perror("accept");
+            return -1;
+        }
+    }
+    close(listener);
+    return 0;
+}
+
+static void report(const char *name, double elapsed, int broadcasts, double syscalls) {
+    printf("%-10s %10.0f ns/broadcast %8.1f ns/send %10.1f syscalls/broadcast\n",
+           name, elapsed * 1e9 / broadcasts, elapsed * 1e9 / broadcasts / g_count,
+           syscalls / broadcasts);
+}
+
+static void bench_send(const unsigned char *frame, int broadcasts) {
+    double start = now_seconds();
+    for (int b = 0; b < broadcasts; b++) {
+        for (int i = 0; i < g_count; i++) {
+            if (send(g_senders[i], frame, FRAME_SIZE, MSG_NOSIGNAL) != FRAME_SIZE) {
+                perror("send");
+                exit(1);
+            }
+        }
+    }
+    report("send()", now_seconds() - start, broadcasts, (double)broadcasts * g_count);
+}
+
+#ifdef HAVE_IO_URING
+static void bench_uring(const unsigned char *frame, int broadcasts) {
+    Uring ring;
+    if (uring_init(&ring, 4096, 16384) < 0) {
+        printf("io_uring   unavailable: %s\n", strerror(errno));
+        return;
+    }
+
+    double start = now_seconds();
+    for (int b = 0; b < broadcasts; b++) {
+        int queued = 0;
+        for (int i = 0; i < g_count; i++) {
+            struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+            if (!sqe) {
+                uring_submit(&ring);
+                sqe = uring_get_sqe(&ring);
+            }
+            uring_prep_send(sqe, g_senders[i], frame, FRAME_SIZE, MSG_NOSIGNAL, (uint64_t)i);
+            queued++;
+        }
+
+        // One enter submits the whole fan-out and waits for it
+        uring_submit_and_wait(&ring, queued);
+        while (queued > 0) {
+            struct io_uring_cqe *cqe = uring_peek_cqe(&ring);
+            if (!cqe) {
+                uring_submit_and_wait(&ring, 1);
+                continue;
+            }
+            if (cqe->res != FRAME_SIZE) {
+                fprintf(stderr, "send: %s\n", cqe->res < 0 ? strerror(-cqe->res) : "short write");
+                exit(1);
+            }
+            uring_cqe_seen(&ring);
+            queued--;
+        }
+    }
+    report("io_uring", now_seconds() - start, broadcasts, (double)ring.enters);
+    uring_cleanup(&ring);
+}
+#endif
+
+int main(int argc, char **argv) {
+    g_count = argc > 1 ? atoi(argv[1]) : 1000;
+    int broadcasts = argc > 2 ? atoi(argv[2]) : 2000;
+    if (g_count <= 0 || broadcasts <= 0) return 1;
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)g_count * 2 + 64) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    g_senders = calloc(g_count, sizeof(int));
+    g_receivers = calloc(g_count, sizeof(int));
+    if (!g_senders || !g_receivers || connect_pairs(g_count) < 0) return 1;
+
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < g_count; i++) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = g_receivers[i]};
+        epoll_ctl(epfd, EPOLL_CTL_ADD, g_receivers[i], &ev);
+    }
+    pthread_t drainer;
+    pthread_create(&drainer, NULL, drain_thread, &epfd);
+
+    unsigned char frame[FRAME_SIZE];
+    memset(frame, 'x', sizeof(frame));
+
+    printf("Broadcasting %d-byte frames to %d loopback connections, %d rounds\n",
+           FRAME_SIZE, g_count, broadcasts);
+    bench_send(frame, broadcasts);
+#ifdef HAVE_IO_URING
+    bench_uring(frame, broadcasts);
+#endif
+
+    atomic_store(&g_draining, 0);
+    pthread_join(drainer, NULL);
+    for (int i = 0; i < g_count; i++) {
+        close(g_senders[i]);
+        close(g_receivers[i]);
+    }
+    close(epfd);
+    free(g_senders);
+    free(g_receivers);
+    return 0;
+}
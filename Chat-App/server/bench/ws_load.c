@@ -0,0 +1,670 @@
+// WebSocket load generator: opens N connections to a running chat server,
+// spread over M rooms, and publishes at a fixed total rate. Every delivery
+// is timed from the message's scheduled send time (not the moment the
+// send happened), so a stalled server or a lagging sender shows up as
+// latency instead of silently lowering the rate (coordinated omission).
+//
+// Usage: ws_load [-H host] [-p port] [-c connections] [-r rooms]
+//                [-u user,user,...] [-R msgs/s] [-d seconds] [-w warmup]
+//                [-s payload bytes] [-t threads] [-P server pid]
+//                [-o percentiles.hgrm] [-j]
+//
+// Connection i joins room (i % rooms) + 1 as the i-th user of the list,
+// so every user must be a member of the rooms it lands in (the seeded
+// database has user 1 in rooms 1 and 2 and user 2 in room 1). Exits 1 if
+// setup fails and 2 if any delivery went missing.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define MAX_USERS 64
+#define RX_INITIAL_SIZE 4096
+#define DRAIN_SECONDS 3
+#define BENCH_TS_KEY "\"bench_ts\":"
+
+// Log-linear histogram in microseconds (HdrHistogram layout): values below
+// 2048 are exact, above that each power of two is split into 1024 buckets,
+// so every recorded value keeps 3 significant digits up to ~19 hours.
+#define HDR_SUB_BITS 11
+#define HDR_SUB_COUNT (1 << HDR_SUB_BITS)
+#define HDR_HALF_COUNT (HDR_SUB_COUNT / 2)
+#define HDR_BUCKETS 26
+#define HDR_COUNTS ((HDR_BUCKETS + 1) * HDR_HALF_COUNT)
+#define HDR_MAX_VALUE ((1ULL << (HDR_SUB_BITS + HDR_BUCKETS - 1)) - 1)
+
+typedef struct {
+    uint64_t counts[HDR_COUNTS];
+    uint64_t total;
+    uint64_t max;
+    double sum;
+} Histogram;
+
+typedef struct {
+    int fd;
+    int room;
+    unsigned char *rx;
+    size_t rx_len;
+    size_t rx_cap;
+} Conn;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    Conn *conns;
+    int count;
+    int epfd;
+    int failed;
+    uint64_t sent;
+    uint64_t expected;        // deliveries the sent messages should cause
+    uint64_t received;
+    Histogram hist;
+} Worker;
+
+static const char *g_host = "127.0.0.1";
+static const char *g_port = "7070";
+static int g_connections = 100;
+static int g_rooms = 1;
+static int g_users[MAX_USERS] = {1, 2};
+static int g_user_count = 2;
+static double g_rate = 1000;
+static double g_duration = 10;
+static double g_warmup = 1;
+static int g_payload = 64;
+static int g_threads = 1;
+static int g_server_pid = 0;
+static const char *g_hgrm_path = NULL;
+static int g_json = 0;
+
+static int *g_room_members;   // connections per room, index 1..rooms
+static pthread_barrier_t g_connected;
+static pthread_barrier_t g_go;
+static int64_t g_start_ns;    // first scheduled send
+static int64_t g_record_ns;   // deliveries before this are warmup
+static int64_t g_stop_ns;     // no sends scheduled from here on
+static atomic_ullong g_total_expected = 0;
+static atomic_ullong g_total_received = 0;
+static atomic_int g_sending_done = 0;
+
+static int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Histogram
+
+static int hdr_index(uint64_t value) {
+    if (value > HDR_MAX_VALUE) value = HDR_MAX_VALUE;
+    if (value < HDR_SUB_COUNT) return (int)value;
+    int bucket = 63 - __builtin_clzll(value) - (HDR_SUB_BITS - 1);
+    return bucket * HDR_HALF_COUNT + (int)(value >> bucket);
+}
+
+// Highest value that lands in the same bucket as index
+static uint64_t hdr_value_at(int index) {
+    if (index < HDR_SUB_COUNT) return (uint64_t)index;
+    int bucket = index / HDR_HALF_COUNT - 1;
+    uint64_t sub = (uint64_t)(index - bucket * HDR_HALF_COUNT);
+    return ((sub + 1) << bucket) - 1;
+}
+
+static void hdr_record(Histogram *hist, uint64_t value) {
+    hist->counts[hdr_index(value)]++;
+    hist->total++;
+    hist->sum += (double)value;
+    if (value > hist->max) hist->max = value;
+}
+
+static void hdr_merge(Histogram *into, const Histogram *from) {
+    for (int i = 0; i < HDR_COUNTS; i++) into->counts[i] += from->counts[i];
+    into->total += from->total;
+    into->sum += from->sum;
+    if (from->max > into->max) into->max = from->max;
+}
+
+static uint64_t hdr_percentile(const Histogram *hist, double percentile) {
+    if (hist->total == 0) return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * hist->total + 0.5);
+    if (rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HDR_COUNTS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t value = hdr_value_at(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+// Percentile distribution in HdrHistogram's .hgrm text format, which the
+// usual plotters read
+static int hdr_write_hgrm(const Histogram *hist, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) return -1;
+
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    uint64_t seen = 0;
+    for (int i = 0; i < HDR_COUNTS && seen < hist->total; i++) {
+        if (!hist->counts[i]) continue;
+        seen += hist->counts[i];
+        double fraction = (double)seen / hist->total;
+        if (fraction < 1.0) {
+            fprintf(out, "%12.3f %2.12f %10lu %14.2f\n", (double)hdr_value_at(i), fraction,
+                    (unsigned long)seen, 1.0 / (1.0 - fraction));
+        } else {
+            fprintf(out, "%12.3f %2.12f %10lu\n", (double)hist->max, fraction, (unsigned long)seen);
+        }
+    }
+    double mean = hist->total ? hist->sum / hist->total : 0.0;
+    double variance = 0;
+    for (int i = 0; i < HDR_COUNTS; i++) {
+        double delta = (double)hdr_value_at(i) - mean;
+        variance += hist->counts[i] * delta * delta;
+    }
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+            mean, hist->total ? sqrt(variance / hist->total) : 0.0);
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12lu]\n",
+            (double)hist->max, (unsigned long)hist->total);
+    fclose(out);
+    return 0;
+}
+
+// Server memory
+
+static int find_server_pid() {
+    DIR *proc = opendir("/proc");
+    struct dirent *entry;
+    int pid = 0;
+
+    if (!proc) return 0;
+    while (!pid && (entry = readdir(proc))) {
+        char path[300], comm[64];
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        if (fgets(comm, sizeof(comm), f) && strcmp(comm, "chat_server\n") == 0) {
+            pid = atoi(entry->d_name);
+        }
+        fclose(f);
+    }
+    closedir(proc);
+    return pid;
+}
+
+// VmRSS or VmHWM in kB, -1 if unknown
+static long server_memory_kb(const char *field) {
+    char path[64], line[256];
+    long kb = -1;
+
+    if (g_server_pid <= 0) return -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", g_server_pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    size_t field_len = strlen(field);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, field_len) == 0 && line[field_len] == ':') {
+            kb = atol(line + field_len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// Client side of the protocol
+
+static int connect_upgrade(Conn *conn, int user_id, int *status_out) {
+    struct addrinfo hints = {0}, *addr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(g_host, g_port, &hints, &addr) != 0) return -1;
+
+    int fd = socket(addr->ai_family, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, addr->ai_addr, addr->ai_addrlen) < 0) {
+        freeaddrinfo(addr);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    freeaddrinfo(addr);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    char request[512];
+    int len = snprintf(request, sizeof(request),
+                       "GET /?token=%d.%ld&room_id=%d HTTP/1.1\r\n"
+                       "Host: %s:%s\r\n"
+                       "Upgrade: websocket\r\n"
+                       "Connection: Upgrade\r\n"
+                       "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                       "Sec-WebSocket-Version: 13\r\n\r\n",
+                       user_id, (long)time(NULL), conn->room, g_host, g_port);
+    if (send(fd, request, len, MSG_NOSIGNAL) != len) {
+        close(fd);
+        return -1;
+    }
+
+    // Frames may follow the response in the same read; they stay in rx
+    char *end = NULL;
+    while (!end) {
+        if (conn->rx_len == conn->rx_cap) break;
+        ssize_t n = recv(fd, conn->rx + conn->rx_len, conn->rx_cap - conn->rx_len, 0);
+        if (n <= 0) break;
+        conn->rx_len += n;
+        end = memmem(conn->rx, conn->rx_len, "\r\n\r\n", 4);
+    }
+    *status_out = conn->rx_len > 12 ? atoi((char*)conn->rx + 9) : 0;
+    if (!end || *status_out != 101) {
+        close(fd);
+        return -1;
+    }
+
+    size_t header_len = (unsigned char*)end + 4 - conn->rx;
+    memmove(conn->rx, conn->rx + header_len, conn->rx_len - header_len);
+    conn->rx_len -= header_len;
+    conn->fd = fd;
+    return 0;
+}
+
+// Client frames are masked; a zero mask keeps the payload readable and is
+// as valid as any other
+static size_t build_frame(unsigned char *out, int opcode, const char *payload, size_t len) {
+    size_t header = 2;
+
+    out[0] = 0x80 | opcode;
+    if (len < 126) {
+        out[1] = 0x80 | len;
+    } else {
+        out[1] = 0x80 | 126;
+        out[2] = (len >> 8) & 0xFF;
+        out[3] = len & 0xFF;
+        header = 4;
+    }
+    memset(out + header, 0, 4);
+    memcpy(out + header + 4, payload, len);
+    return header + 4 + len;
+}
+
+static int send_all(int fd, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_message(Conn *conn, int64_t scheduled_ns, const char *padding) {
+    char payload[65536];
+    unsigned char frame[65536 + 8];
+
+    int len = snprintf(payload, sizeof(payload), "{\"type\": \"message\", " BENCH_TS_KEY " %lld, \"content\": \"%s\"}",
+                       (long long)scheduled_ns, padding);
+    return send_all(conn->fd, frame, build_frame(frame, 0x1, payload, len));
+}
+
+// Time every message a frame carries (a coalesced frame holds several)
+static void record_payload(Worker *worker, const unsigned char *payload, size_t len, int64_t now) {
+    const unsigned char *p = payload;
+    const unsigned char *end = payload + len;
+    size_t key_len = strlen(BENCH_TS_KEY);
+
+    while ((p = memmem(p, end - p, BENCH_TS_KEY, key_len))) {
+        p += key_len;
+        while (p < end && *p == ' ') p++;
+        int64_t scheduled = 0;
+        while (p < end && *p >= '0' && *p <= '9') scheduled = scheduled * 10 + (*p++ - '0');
+
+        worker->received++;
+        if (scheduled >= g_record_ns) {
+            hdr_record(&worker->hist, now > scheduled ? (uint64_t)(now - scheduled) / 1000 : 0);
+        }
+    }
+}
+
+// Consume whole frames from rx; returns -1 if the server closed
+static int process_frames(Worker *worker, Conn *conn, int64_t now) {
+    size_t pos = 0;
+    int result = 0;
+
+    while (conn->rx_len - pos >= 2) {
+        unsigned char *frame = conn->rx + pos;
+        int opcode = frame[0] & 0x0F;
+        uint64_t len = frame[1] & 0x7F;
+        size_t header = 2;
+
+        if (len == 126) {
+            if (conn->rx_len - pos < 4) break;
+            len = ((uint64_t)frame[2] << 8) | frame[3];
+            header = 4;
+        } else if (len == 127) {
+            if (conn->rx_len - pos < 10) break;
+            len = 0;
+            for (int i = 0; i < 8; i++) len = (len << 8) | frame[2 + i];
+            header = 10;
+        }
+        if (conn->rx_len - pos - header < len) {
+            // Make room for the rest of a large frame
+            if (header + len > conn->rx_cap) {
+                unsigned char *grown = realloc(conn->rx, header + len);
+                if (!grown) return -1;
+                conn->rx = grown;
+                conn->rx_cap = header + len;
+            }
+            break;
+        }
+
+        unsigned char *payload = frame + header;
+        if (opcode == 0x1 || opcode == 0x2 || opcode == 0x0) {
+            record_payload(worker, payload, len, now);
+        } else if (opcode == 0x9) {
+            unsigned char pong[256];
+            if (send_all(conn->fd, pong, build_frame(pong, 0xA, (char*)payload, len)) < 0) result = -1;
+        } else if (opcode == 0x8) {
+            result = -1;
+        }
+        pos += header + len;
+    }
+
+    memmove(conn->rx, conn->rx + pos, conn->rx_len - pos);
+    conn->rx_len -= pos;
+    return result;
+}
+
+static void read_conn(Worker *worker, Conn *conn) {
+    for (;;) {
+        if (conn->rx_len == conn->rx_cap) {
+            unsigned char *grown = realloc(conn->rx, conn->rx_cap * 2);
+            if (!grown) break;
+            conn->rx = grown;
+            conn->rx_cap *= 2;
+        }
+        ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, conn->rx_cap - conn->rx_len, MSG_DONTWAIT);
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+                worker->failed++;
+            }
+            break;
+        }
+        conn->rx_len += n;
+        if (process_frames(worker, conn, now_ns()) < 0) {
+            epoll_ctl(worker->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+            worker->failed++;
+            break;
+        }
+    }
+}
+
+static void poll_conns(Worker *worker, int timeout_ms) {
+    struct epoll_event events[256];
+    int n = epoll_wait(worker->epfd, events, 256, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        read_conn(worker, &worker->conns[events[i].data.u32]);
+    }
+}
+
+static void* worker_main(void *arg) {
+    Worker *worker = arg;
+    char *padding = malloc(g_payload + 1);
+    memset(padding, 'x', g_payload);
+    padding[g_payload] = '\0';
+
+    worker->epfd = epoll_create1(0);
+    for (int i = 0; i < worker->count; i++) {
+        Conn *conn = &worker->conns[i];
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = (uint32_t)i};
+        epoll_ctl(worker->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+    }
+
+    pthread_barrier_wait(&g_connected);
+    pthread_barrier_wait(&g_go);
+
+    // Open loop: message k of this worker is due at a fixed time whatever
+    // happened to message k - 1
+    int64_t interval = (int64_t)(1e9 * g_threads / g_rate);
+    int64_t next = g_start_ns + (int64_t)worker->id * interval / g_threads;
+    int rr = 0;
+
+    while (next < g_stop_ns) {
+        int64_t now = now_ns();
+        while (next <= now && next < g_stop_ns && worker->count > 0) {
+            Conn *conn = &worker->conns[rr];
+            rr = (rr + 1) % worker->count;
+            if (send_message(conn, next, padding) == 0) {
+                worker->sent++;
+                worker->expected += g_room_members[conn->room] - 1;
+            }
+            next += interval;
+        }
+
+        // Millisecond waits would delay sends; spin through the last one
+        int64_t wait_ns = next - now_ns();
+        poll_conns(worker, wait_ns > 1000000 ? (int)(wait_ns / 1000000) : 0);
+    }
+
+    atomic_fetch_add(&g_total_expected, worker->expected);
+    atomic_fetch_add(&g_sending_done, 1);
+
+    // Drain until every delivery arrived (across all workers) or time is up
+    int64_t deadline = now_ns() + DRAIN_SECONDS * 1000000000LL;
+    uint64_t reported = 0;
+    while (now_ns() < deadline) {
+        poll_conns(worker, 10);
+        atomic_fetch_add(&g_total_received, worker->received - reported);
+        reported = worker->received;
+        if (atomic_load(&g_sending_done) == g_threads &&
+            atomic_load(&g_total_received) >= atomic_load(&g_total_expected)) {
+            break;
+        }
+    }
+
+    free(padding);
+    return NULL;
+}
+
+static int parse_users(const char *list) {
+    g_user_count = 0;
+    while (*list && g_user_count < MAX_USERS) {
+        char *end;
+        long id = strtol(list, &end, 10);
+        if (end == list || id <= 0) return -1;
+        g_users[g_user_count++] = (int)id;
+        list = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return -1;
+    }
+    return g_user_count > 0 ? 0 : -1;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: ws_load [-H host] [-p port] [-c connections] [-r rooms] [-u users]\n"
+            "               [-R msgs/s] [-d seconds] [-w warmup] [-s payload] [-t threads]\n"
+            "               [-P server pid] [-o file.hgrm] [-j]\n");
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:c:r:u:R:d:w:s:t:P:o:j")) != -1) {
+        switch (opt) {
+            case 'H': g_host = optarg; break;
+            case 'p': g_port = optarg; break;
+            case 'c': g_connections = atoi(optarg); break;
+            case 'r': g_rooms = atoi(optarg); break;
+            case 'u':
+                if (parse_users(optarg) < 0) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'R': g_rate = atof(optarg); break;
+            case 'd': g_duration = atof(optarg); break;
+            case 'w': g_warmup = atof(optarg); break;
+            case 's': g_payload = atoi(optarg); break;
+            case 't': g_threads = atoi(optarg); break;
+            case 'P': g_server_pid = atoi(optarg); break;
+            case 'o': g_hgrm_path = optarg; break;
+            case 'j': g_json = 1; break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (g_connections <= 0 || g_rooms <= 0 || g_rate <= 0 || g_duration <= 0 || g_warmup < 0 ||
+        g_payload < 0 || g_payload > 60000 || g_threads <= 0 || g_threads > g_connections) {
+        usage();
+        return 1;
+    }
+    if (g_server_pid == 0) g_server_pid = find_server_pid();
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)g_connections + 64) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    Conn *conns = calloc(g_connections, sizeof(Conn));
+    Worker *workers = calloc(g_threads, sizeof(Worker));
+    g_room_members = calloc(g_rooms + 1, sizeof(int));
+    if (!conns || !workers || !g_room_members) return 1;
+
+    long rss_idle = server_memory_kb("VmRSS");
+
+    // Connect sequentially: the rate measured is the server's accept +
+    // upgrade + authentication path, one handshake at a time
+    int64_t connect_start = now_ns();
+    for (int i = 0; i < g_connections; i++) {
+        Conn *conn = &conns[i];
+        int user_id = g_users[(i / g_rooms) % g_user_count];
+        int status = 0;
+
+        conn->room = i % g_rooms + 1;
+        conn->rx_cap = RX_INITIAL_SIZE;
+        conn->rx = malloc(conn->rx_cap);
+        if (!conn->rx || connect_upgrade(conn, user_id, &status) < 0) {
+            fprintf(stderr, "ws_load: connection %d (user %d, room %d) failed: %s\n", i, user_id,
+                    conn->room, status ? "upgrade refused" : strerror(errno));
+            if (status) fprintf(stderr, "ws_load: server answered %d\n", status);
+            return 1;
+        }
+        g_room_members[conn->room]++;
+    }
+    double connect_seconds = (now_ns() - connect_start) / 1e9;
+    long rss_connected = server_memory_kb("VmRSS");
+
+    // Contiguous slices: each worker owns its connections' sockets
+    pthread_barrier_init(&g_connected, NULL, g_threads + 1);
+    pthread_barrier_init(&g_go, NULL, g_threads + 1);
+    for (int t = 0; t < g_threads; t++) {
+        Worker *worker = &workers[t];
+        int first = (int)((long)g_connections * t / g_threads);
+        int last = (int)((long)g_connections * (t + 1) / g_threads);
+        worker->id = t;
+        worker->conns = conns + first;
+        worker->count = last - first;
+        pthread_create(&worker->thread, NULL, worker_main, worker);
+    }
+
+    pthread_barrier_wait(&g_connected);
+    g_start_ns = now_ns() + 10000000;
+    g_record_ns = g_start_ns + (int64_t)(g_warmup * 1e9);
+    g_stop_ns = g_record_ns + (int64_t)(g_duration * 1e9);
+    pthread_barrier_wait(&g_go);
+
+    Histogram *total = calloc(1, sizeof(Histogram));
+    uint64_t sent = 0, expected = 0, received = 0;
+    int failed = 0;
+    for (int t = 0; t < g_threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        hdr_merge(total, &workers[t].hist);
+        sent += workers[t].sent;
+        expected += workers[t].expected;
+        received += workers[t].received;
+        failed += workers[t].failed;
+    }
+    long rss_end = server_memory_kb("VmRSS");
+    long rss_peak = server_memory_kb("VmHWM");
+
+    double seconds = g_warmup + g_duration;
+    double delivered_pct = expected ? 100.0 * received / expected : 100.0;
+    double percentiles[] = {50, 90, 99, 99.9, 99.99};
+    const char *names[] = {"p50", "p90", "p99", "p99.9", "p99.99"};
+
+    if (g_json) {
+        printf("{\"connections\": %d, \"rooms\": %d, \"rate\": %.0f, \"duration_s\": %.1f, "
+               "\"payload_bytes\": %d, \"connect_s\": %.3f, \"connects_per_s\": %.0f, "
+               "\"sent\": %lu, \"expected\": %lu, \"delivered\": %lu, \"delivered_pct\": %.3f, "
+               "\"deliveries_per_s\": %.0f, \"dropped_connections\": %d, \"latency_us\": {",
+               g_connections, g_rooms, g_rate, g_duration, g_payload, connect_seconds,
+               g_connections / connect_seconds, (unsigned long)sent, (unsigned long)expected,
+               (unsigned long)received, delivered_pct, received / seconds, failed);
+        for (int i = 0; i < 5; i++) {
+            printf("\"%s\": %lu, ", names[i], (unsigned long)hdr_percentile(total, percentiles[i]));
+        }
+        printf("\"max\": %lu, \"mean\": %.1f, \"count\": %lu}, "
+               "\"server_rss_kb\": {\"idle\": %ld, \"connected\": %ld, \"end\": %ld, \"peak\": %ld}}\n",
+               (unsigned long)total->max, total->total ? total->sum / total->total : 0.0,
+               (unsigned long)total->total, rss_idle, rss_connected, rss_end, rss_peak);
+    } else {
+        printf("ws_load: %d connections over %d rooms, %.0f msg/s for %.1f s (+%.1f s warmup), "
+               "%d-byte payload, %d threads\n",
+               g_connections, g_rooms, g_rate, g_duration, g_warmup, g_payload, g_threads);
+        printf("connect:    %d in %.3f s (%.0f/s)\n", g_connections, connect_seconds,
+               g_connections / connect_seconds);
+        printf("sent:       %lu messages (%.0f/s)\n", (unsigned long)sent, sent / seconds);
+        printf("delivered:  %lu of %lu (%.2f%%), %.0f/s, %d connections dropped\n",
+               (unsigned long)received, (unsigned long)expected, delivered_pct,
+               received / seconds, failed);
+        printf("latency us:");
+        for (int i = 0; i < 5; i++) {
+            printf(" %s %lu ", names[i], (unsigned long)hdr_percentile(total, percentiles[i]));
+        }
+        printf(" max %lu  mean %.1f  (%lu samples)\n", (unsigned long)total->max,
+               total->total ? total->sum / total->total : 0.0, (unsigned long)total->total);
+        if (rss_idle >= 0) {
+            printf("server rss: %.1f MB idle, %.1f MB connected, %.1f MB end, %.1f MB peak (pid %d)\n",
+                   rss_idle / 1024.0, rss_connected / 1024.0, rss_end / 1024.0, rss_peak / 1024.0,
+                   g_server_pid);
+        } else {
+            printf("server rss: unavailable (pass -P pid for a server on this host)\n");
+        }
+    }
+
+    if (g_hgrm_path && hdr_write_hgrm(total, g_hgrm_path) < 0) {
+        fprintf(stderr, "ws_load: cannot write %s: %s\n", g_hgrm_path, strerror(errno));
+    }
+
+    for (int i = 0; i < g_connections; i++) {
+        close(conns[i].fd);
+        free(conns[i].rx);
+    }
+    free(conns);
+    free(workers);
+    free(total);
+    free(g_room_members);
+    pthread_barrier_destroy(&g_connected);
+    pthread_barrier_destroy(&g_go);
+    return received < expected ? 2 : 0;
+}
@@ -9,8 +9,14 @@ int auth_verify_password(const char *password, const char *hash);
 
 int auth_generate_token(int user_id, char *token_out, size_t token_size);
 
+// Tokens are "<user_id>.<issued_at>" and expire AUTH_TOKEN_TTL_SECONDS later
+#define AUTH_TOKEN_TTL_SECONDS 86400
+
 int auth_validate_token(const char *token, int *user_id_out);
 
+// When token stops validating; -1 if it is malformed
+time_t auth_token_expires_at(const char *token);
+
 int auth_login(const char *username, const char *password, int *user_id_out);
 
 int auth_register(const char *username, const char *password, UserRole role, int *user_id_out);
@@ -0,0 +1,90 @@
+#ifndef CHAT_BUS_H
+#define CHAT_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+// Relays room broadcasts between chat_server processes. Each process
+// publishes what its own clients and HTTP handlers send to a room; every
+// other process receives it on the bus thread and fans it out to its own
+// subscribers only. Each process numbers room messages itself, under its
+// own seq epoch, so a client resuming on another process is told to
+// resync rather than replayed an unrelated range.
+//
+// Transports, chosen by the spec given to chat_bus_open:
+//   unix:DIR         one host, no broker: every process binds a datagram
+//                    socket in DIR and publishes with one sendto per peer
+//   shm:DIR          one host, no copies through the kernel: every process
+//                    owns a shared-memory ring per peer it publishes to and
+//                    sleeps on a futex doorbell (see shm_ring.h); DIR only
+//                    holds the sockets used to hand ring fds over
+//   tcp:HOST:PORT    any number of hosts through chat_bus_broker, which
+//                    relays each message to every other connected process
+#define CHAT_BUS_MAX_PAYLOAD 65536
+#define CHAT_BUS_HEADER_SIZE 16       // magic, room id, origin process id
+
+// Called on the bus thread for each broadcast another process published
+typedef void (*chat_bus_handler)(int room_id, const unsigned char *payload, size_t len, void *arg);
+
+typedef struct ChatBus ChatBus;
+
+typedef struct {
+    const char *name;
+    // Start talking to address; may leave the link down for run to retry
+    int (*open)(ChatBus *bus, const char *address);
+    // Deliver a message, gathered from iov (header, payload), to every
+    // other process (any thread)
+    int (*send)(ChatBus *bus, const struct iovec *iov, int iovcnt);
+    // Receive loop on the bus thread: pass each message to chat_bus_dispatch
+    // until bus->wake_fd becomes readable
+    void (*run)(ChatBus *bus);
+    void (*close)(ChatBus *bus);
+} ChatBusTransport;
+
+struct ChatBus {
+    const ChatBusTransport *transport;
+    void *state;              // owned by the transport
+    uint64_t origin;          // random id stamped on this process's messages
+    chat_bus_handler handler;
+    void *arg;
+    int wake_fd;              // eventfd, signalled to stop the bus thread
+    pthread_t thread;
+    int thread_started;
+    atomic_ulong published;
+    atomic_ulong received;
+    atomic_ulong dropped;
+    atomic_int peers;         // processes reached by the last send, if known
+};
+
+typedef struct {
+    const char *transport;
+    unsigned long published;
+    unsigned long received;
+    unsigned long dropped;    // messages a peer or the link could not take
+    int peers;
+} ChatBusStats;
+
+// Connect per spec and start the bus thread. Returns NULL (logged) if the
+// spec is unknown or the transport cannot start.
+ChatBus* chat_bus_open(const char *spec, chat_bus_handler handler, void *arg);
+
+// Relay a broadcast to the other processes. Never blocks on a slow peer
+// for long: what cannot be delivered is dropped and counted.
+int chat_bus_publish(ChatBus *bus, int room_id, const unsigned char *payload, size_t len);
+
+// Stop the bus thread and release the transport
+void chat_bus_close(ChatBus *bus);
+
+void chat_bus_get_stats(ChatBus *bus, ChatBusStats *stats);
+
+// For transports: decode one received message and hand it to the handler
+void chat_bus_dispatch(ChatBus *bus, const unsigned char *msg, size_t len);
+
+extern const ChatBusTransport chat_bus_unix_transport;
+extern const ChatBusTransport chat_bus_shm_transport;
+extern const ChatBusTransport chat_bus_tcp_transport;
+
+#endif
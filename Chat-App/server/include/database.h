@@ -79,6 +79,7 @@ int db_create_room(const char *room_name, int created_by);
 ChatRoom* db_get_room_by_id(int room_id);
 int db_add_user_to_room(int room_id, int user_id);
 int db_remove_user_from_room(int room_id, int user_id);
+int db_is_user_in_room(int room_id, int user_id);
 int db_get_room_users(int room_id, int *user_ids, int max_count);
 ChatRoom* db_get_all_rooms(int *count);
 
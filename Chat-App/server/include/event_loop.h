@@ -0,0 +1,52 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "timer_wheel.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+
+// Anything registered with the loop embeds an EventSource as its first
+// member, so the callback can cast back to the owning structure.
+typedef struct EventSource EventSource;
+typedef void (*event_callback)(EventSource *src, uint32_t events);
+typedef void (*event_release)(EventSource *src);
+
+struct EventSource {
+    int fd;
+    event_callback on_event;
+    int retired;              // see event_loop_retire
+    event_release release;
+    EventSource *retired_next;
+};
+
+typedef struct {
+    int epoll_fd;
+    int wake_fd;              // eventfd used by event_loop_stop()
+    volatile int running;
+    TimerWheel timers;        // loop-thread timers, run between waits
+    EventSource *retired;     // released once the current batch is dispatched
+} EventLoop;
+
+int event_loop_init(EventLoop *loop);
+void event_loop_cleanup(EventLoop *loop);
+
+// Register / update / remove a source (events are EPOLLIN, EPOLLOUT, EPOLLET, ...)
+int event_loop_add(EventLoop *loop, EventSource *src, uint32_t events);
+int event_loop_mod(EventLoop *loop, EventSource *src, uint32_t events);
+int event_loop_del(EventLoop *loop, EventSource *src);
+
+// Unregister src and free it through release(src) once the events from
+// the current wait have all been dispatched, instead of straight away:
+// a timer or another source's callback may close a source whose events
+// are still in the batch. Those events are dropped. Loop thread only;
+// whatever is retired after the loop has stopped goes in cleanup.
+void event_loop_retire(EventLoop *loop, EventSource *src, event_release release);
+
+// Dispatch events and expired timers until event_loop_stop() is called (blocks)
+int event_loop_run(EventLoop *loop);
+
+// Safe to call from any thread
+void event_loop_stop(EventLoop *loop);
+void event_loop_wake(EventLoop *loop);    // interrupt a blocking wait
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_PARSER_MAX_HEADERS 32
+#define HTTP_DEFAULT_MAX_HEADER_SIZE 8192
+#define HTTP_DEFAULT_MAX_BODY_SIZE (64 * 1024)
+
+typedef enum {
+    HTTP_PARSE_INCOMPLETE = 0,
+    HTTP_PARSE_DONE,
+    HTTP_PARSE_ERROR
+} HTTPParseResult;
+
+// Byte range inside the request buffer
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+} HTTPSpan;
+
+typedef struct {
+    HTTPSpan name;
+    HTTPSpan value;
+} HTTPHeader;
+
+// Incremental HTTP/1.x request parser. Like ws_handshake, the caller
+// appends reads to one buffer and feeds its current length; each call
+// resumes where the last stopped, and the result is spans into the
+// buffer. A Content-Length body is left where it arrived. A chunked body
+// is decoded in place: chunk data is moved down over the framing as it
+// arrives, so the body is one span either way and nothing is allocated.
+typedef struct {
+    size_t max_header_size;   // request line, headers and chunked trailers
+    size_t max_body_size;     // decoded body
+
+    int state;                // internal
+    size_t scanned;           // bytes examined so far
+    size_t line_start;        // start of the line being scanned
+    size_t header_bytes;      // head and trailers, against max_header_size
+    size_t chunk_left;        // data bytes left in the current chunk
+    size_t request_len;       // whole request, body and framing, once done
+    int status;               // HTTP status to refuse with after an error
+
+    HTTPSpan method;
+    HTTPSpan target;          // path and query
+    HTTPSpan path;
+    HTTPSpan query;           // without the '?'; empty if there is none
+    int version_minor;        // HTTP/1.<minor>
+    HTTPHeader headers[HTTP_PARSER_MAX_HEADERS];
+    int header_count;
+
+    int keep_alive;           // per version and Connection header
+    int chunked;
+    int has_content_length;
+    size_t content_length;
+    HTTPSpan body;
+} HTTPParser;
+
+void http_parser_init(HTTPParser *parser, size_t max_header_size, size_t max_body_size);
+
+// Scan buf[0, len) from where the last call stopped. On DONE the request
+// occupies buf[0, request_len); on ERROR status holds the HTTP status
+// (400, 413, 431, 501 or 505). buf is written only to decode chunks.
+HTTPParseResult http_parser_parse(HTTPParser *parser, char *buf, size_t len);
+
+// First header called name (case-insensitive). Returns 1 if present.
+int http_parser_header(const HTTPParser *parser, const char *buf, const char *name, HTTPSpan *value);
+
+#endif
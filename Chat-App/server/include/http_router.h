@@ -0,0 +1,77 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <stddef.h>
+
+#define HTTP_ROUTER_MAX_PARAMS 8
+
+typedef enum {
+    HTTP_METHOD_GET = 0,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_PATCH,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_OPTIONS,
+    HTTP_METHOD_COUNT
+} HTTPMethod;
+
+typedef enum {
+    HTTP_PARAM_STRING = 1,    // {name}: any non-empty segment
+    HTTP_PARAM_INT            // {name:int}: decimal digits only
+} HTTPParamType;
+
+typedef enum {
+    HTTP_ROUTE_FOUND = 0,
+    HTTP_ROUTE_NOT_FOUND,     // no pattern matches the path
+    HTTP_ROUTE_NO_METHOD      // the path matches, but not for this method
+} HTTPRouteResult;
+
+// What a route leads to: any function pointer, cast back to its real
+// type by the caller
+typedef void (*HTTPRouteTarget)(void);
+
+// A path parameter; value points into the matched path
+typedef struct {
+    const char *name;
+    const char *value;
+    size_t len;
+    long long number;         // for HTTP_PARAM_INT
+} HTTPRouteParam;
+
+typedef struct {
+    HTTPRouteTarget target;   // as registered
+    int param_count;
+    HTTPRouteParam params[HTTP_ROUTER_MAX_PARAMS];
+} HTTPRouteMatch;
+
+typedef struct HTTPRouteNode HTTPRouteNode;
+
+// Path trie, one node per segment, with each node's literal children in
+// a hash table. At each node a literal segment is tried before
+// {name:int}, and that before {name}, so /api/rooms/create wins over
+// /api/rooms/{id} whatever order they were added in. Matching costs one
+// hash per segment (plus a step back when a more specific branch
+// dead-ends), however many routes exist. Routes are added before the
+// server starts; matching takes no locks.
+typedef struct {
+    HTTPRouteNode *root;
+} HTTPRouter;
+
+void http_router_init(HTTPRouter *router);
+void http_router_destroy(HTTPRouter *router);
+
+// Method name to HTTPMethod, or -1
+int http_method_from_name(const char *name);
+
+// Register target for method on pattern, e.g. "/api/rooms/{id:int}/join".
+// Returns -1 for a malformed pattern, a parameter that clashes with one
+// already at that position, or a method and pattern already taken.
+int http_router_add(HTTPRouter *router, int method, const char *pattern, HTTPRouteTarget target);
+
+// Match path[0, len) (without the query). method may be -1 for an
+// unknown method, which never matches.
+HTTPRouteResult http_router_match(const HTTPRouter *router, int method, const char *path, size_t len,
+                                  HTTPRouteMatch *match);
+
+#endif
@@ -1,24 +1,84 @@
 #ifndef HTTP_SERVER_H
 #define HTTP_SERVER_H
 
+#include "http_parser.h"
+#include "http_router.h"
+#include "json_index.h"
 #include <time.h>
 
 
+// A parsed request. The strings point into the connection's buffer, which
+// stays put until the response is sent; they are terminated in place.
 typedef struct {
-    char method[16];           // GET, POST, PUT, DELETE
-    char path[256];            // Request path
-    char query_string[512];    // Query parameters
-    char body[4096];           // Request body
-    int content_length;
-    int client_fd;
+    const char *method;        // GET, POST, PUT, DELETE
+    const char *path;          // Request path
+    const char *query_string;  // Query parameters ("" if none)
+    const char *body;          // Request body ("" if none; may contain NULs)
+    size_t content_length;     // body bytes, after chunked decoding
+    const HTTPParser *parser;  // headers, see http_request_header
+    const char *buf;
+    const JSONIndex *json;     // body members; empty unless it is a JSON object
+    const HTTPRouteMatch *route;  // path parameters, see http_request_param_int
 } HTTPRequest;
 
-typedef struct {
+#define HTTP_RESPONSE_CHUNK_SIZE (16 * 1024)   // streamed bodies go out in parts of about this
+
+typedef struct HTTPResponse HTTPResponse;
+
+// Produces a body too large to build at once, see http_response_stream
+typedef int (*HTTPBodyWriter)(HTTPResponse *resp, void *arg);
+
+// Responses come from a pool and their bodies grow as needed; they are
+// sent with one vectored write of static header fragments and the body
+struct HTTPResponse {
     int status_code;
-    char content_type[64];
-    char body[8192];
-} HTTPResponse;
+    const char *content_type;  // a short string that outlives the response
+    char *body;                // body_len bytes, NUL-terminated
+    size_t body_len;
+    size_t body_cap;
+    int error;                 // an append ran out of memory
+
+    HTTPBodyWriter writer;     // until the streamed body is complete
+    void *writer_arg;
+    void (*writer_free)(void *arg);
+
+    // Internal: sending state
+    int started;               // the head has been described
+    int chunked;
+    char head[192];
+    char chunk_line[24];
+    struct HTTPResponse *pool_next;
+};
+
+// Runs on a thread-pool worker; returns a response from http_response_create
+typedef HTTPResponse* (*HTTPHandler)(const HTTPRequest *req);
+
+#define HTTP_DEFAULT_IDLE_TIMEOUT_MS 5000
+#define HTTP_DEFAULT_MAX_REQUESTS 1000
+
+// Request size limits (0 keeps the default); larger requests are refused
+// with 431 or 413
+typedef struct {
+    size_t max_header_size;
+    size_t max_body_size;
+} HTTPLimitsConfig;
+
+// Persistent connections: a client may send further (and pipelined)
+// requests on one connection until it has been idle for idle_timeout_ms
+// or has sent max_requests (0 disables either limit)
+typedef struct {
+    int idle_timeout_ms;
+    int max_requests;
+} HTTPKeepAliveConfig;
 
+// One reactor per shard, each bound with SO_REUSEPORT. The reactors own
+// the connections; requests run on the thread pool.
+void http_server_set_shard_count(int shards);   // call before init; 0 = one per CPU
+void http_server_set_keepalive(const HTTPKeepAliveConfig *config);
+void http_server_set_limits(const HTTPLimitsConfig *config);
+// Add an endpoint, e.g. ("POST", "/api/rooms/{id:int}/join", handler); see
+// http_router.h for patterns. Call before http_server_start.
+int http_server_route(const char *method, const char *pattern, HTTPHandler handler);
 int http_server_init(int port);
 int http_server_start();
 void http_server_stop();
@@ -26,11 +86,22 @@ void http_server_cleanup();
 
 HTTPResponse* http_response_create(int status_code, const char *content_type);
 void http_response_set_body(HTTPResponse *resp, const char *body);
+int http_response_append(HTTPResponse *resp, const char *data, size_t len);
+int http_response_appendf(HTTPResponse *resp, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// Have writer produce the rest of the body, on a worker, each time the
+// part before it has been sent: it appends about HTTP_RESPONSE_CHUNK_SIZE
+// bytes and returns 1 while there is more, 0 when done and -1 to abort.
+// A body that is complete within the first part gets a Content-Length;
+// a longer one goes out with chunked transfer encoding (buffered whole
+// for HTTP/1.0 clients). free_arg, if set, releases arg afterwards.
+void http_response_stream(HTTPResponse *resp, HTTPBodyWriter writer, void *arg, void (*free_arg)(void *arg));
 void http_response_send(int client_fd, HTTPResponse *resp);
 void http_response_free(HTTPResponse *resp);
 
-void http_parse_request(const char *raw_request, HTTPRequest *req);
+// Value of a request header, NUL-terminated, or NULL if absent
+const char* http_request_header(const HTTPRequest *req, const char *name);
+// Path parameter captured by the route, as an int
+int http_request_param_int(const HTTPRequest *req, const char *name, int *out);
 void http_url_decode(const char *src, char *dest, size_t dest_size);
-int http_parse_json_string(const char *json, const char *key, char *value, size_t max_len);
 
 #endif 
@@ -0,0 +1,67 @@
+#ifndef JSON_INDEX_H
+#define JSON_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_INDEX_MAX_FIELDS 32
+#define JSON_INDEX_MAX_DEPTH 32
+
+typedef enum {
+    JSON_STRING = 1,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL,
+    JSON_OBJECT,
+    JSON_ARRAY
+} JSONType;
+
+// One member of the top-level object, as spans into the source text
+typedef struct {
+    const char *key;          // between the quotes, escapes left as sent
+    size_t key_len;
+    const char *value;        // raw text; strings keep their quotes
+    size_t value_len;
+    int type;                 // JSONType
+} JSONField;
+
+// The top-level members of a JSON object, found in one pass over the
+// text. Nested objects and arrays are validated and kept whole as a
+// single value. Nothing is copied until a string is asked for.
+typedef struct {
+    int count;
+    int truncated;            // more members than JSON_INDEX_MAX_FIELDS
+    JSONField fields[JSON_INDEX_MAX_FIELDS];
+} JSONIndex;
+
+// Index the object in json[0, len). Returns -1 unless the text is one
+// well-formed object; members past JSON_INDEX_MAX_FIELDS are checked but
+// not indexed. On error the index is left empty.
+int json_index_parse(JSONIndex *index, const char *json, size_t len);
+
+// First member called key, or NULL
+const JSONField* json_index_get(const JSONIndex *index, const char *key);
+
+// String member, unescaped and NUL-terminated into out. Returns -1 if it
+// is missing, not a string, does not fit in out_size or contains a NUL.
+int json_index_string(const JSONIndex *index, const char *key, char *out, size_t out_size);
+
+// Integer member within the range of int. Returns -1 otherwise.
+int json_index_int(const JSONIndex *index, const char *key, int *out);
+
+// Non-negative integer member no greater than max. Returns -1 otherwise.
+int json_index_uint(const JSONIndex *index, const char *key, uint64_t max, uint64_t *out);
+
+// 1 if key is a string member whose unescaped value is exactly value
+int json_index_string_is(const JSONIndex *index, const char *key, const char *value);
+
+// Unescape the string starting at v (its opening quote) into out, which
+// needs end - v bytes. Returns the length, or -1 if malformed.
+long json_read_string(const char *v, const char *end, char *out);
+
+// Write s quoted and escaped at p (up to 6 * len + 2 bytes); returns the
+// end of what was written
+char* json_put_string(char *p, const char *s, size_t len);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+// Lock-free ring of variable-length messages in a memfd mapping, shared
+// by two processes. Any number of threads of one producer process push;
+// one consumer reads messages in place, with no copy out of the ring.
+//
+// Each producer process gets its own ring per consumer, so a crashed
+// producer can only strand its own ring (a reserved, never committed
+// record stops the consumer there; it drops the ring once the producer's
+// socket closes). A crashed consumer leaves producers writing into a ring
+// nobody drains: they never wait for space, a full ring drops the message.
+#define SHM_RING_DEFAULT_CAPACITY (4 * 1024 * 1024)
+
+typedef struct ShmRingHeader ShmRingHeader;
+
+typedef struct {
+    ShmRingHeader *header;
+    unsigned char *data;
+    uint64_t capacity;        // data bytes, a power of two
+    size_t map_size;
+    int fd;
+} ShmRing;
+
+// Called for each message; data points into the ring and is only valid
+// during the call
+typedef void (*shm_ring_handler)(const unsigned char *data, size_t len, void *arg);
+
+// Create a ring in a new memfd (capacity rounded up to a power of two)
+int shm_ring_create(ShmRing *ring, size_t capacity);
+// Map a ring received from another process; takes ownership of fd and
+// rejects anything that is not a well-formed ring
+int shm_ring_attach(ShmRing *ring, int fd);
+void shm_ring_detach(ShmRing *ring);
+
+// Copy one message, gathered from iov, into the ring. Returns -1 without
+// waiting if it does not fit.
+int shm_ring_push(ShmRing *ring, const struct iovec *iov, int iovcnt);
+
+// Hand up to max committed messages to handler and release their space.
+// Returns the count, or -1 if the ring is corrupt.
+int shm_ring_consume(ShmRing *ring, shm_ring_handler handler, void *arg, int max);
+
+int shm_ring_empty(const ShmRing *ring);
+uint64_t shm_ring_dropped(const ShmRing *ring);
+
+// Futex doorbell a consumer sleeps on while its rings are empty. It lives
+// in its own shared page so one consumer can wait for many rings.
+// Producers only pay for a wake-up when the consumer is actually asleep.
+typedef struct {
+    _Atomic uint32_t seq;
+    _Atomic uint32_t sleeping;
+    _Atomic uint64_t wakeups;
+} ShmDoorbell;
+
+ShmDoorbell* shm_doorbell_create(int *fd_out);
+ShmDoorbell* shm_doorbell_attach(int fd);      // takes ownership of fd
+void shm_doorbell_detach(ShmDoorbell *bell);
+
+// Producer, after pushing: wake the consumer if it sleeps
+void shm_doorbell_ring(ShmDoorbell *bell);
+
+// Consumer: announce the intent to sleep and get the value to wait on,
+// re-check every ring, then either wait or cancel
+uint32_t shm_doorbell_prepare(ShmDoorbell *bell);
+void shm_doorbell_wait(ShmDoorbell *bell, uint32_t seq, int timeout_ms);
+void shm_doorbell_cancel(ShmDoorbell *bell);
+
+#endif
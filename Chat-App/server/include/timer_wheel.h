@@ -0,0 +1,56 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// Hierarchical timing wheel: O(1) schedule and cancel, amortized O(1)
+// expiry. Four levels of 256 slots at 1 ms per tick cover ~49 days.
+// A wheel belongs to one thread; timers are embedded in their owners,
+// so scheduling never allocates.
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+typedef struct Timer Timer;
+typedef void (*timer_callback)(Timer *timer, void *arg);
+
+struct Timer {
+    Timer *next, *prev;
+    Timer **slot;             // list head while scheduled, NULL otherwise
+    uint64_t expires;         // tick
+    uint64_t period;          // ticks between periodic runs, 0 = one-shot
+    timer_callback on_expire;
+    void *arg;
+};
+
+typedef struct {
+    uint64_t origin_ms;       // monotonic time of tick 0
+    uint64_t now;             // current tick
+    int count;                // scheduled timers
+    int level_count[TIMER_WHEEL_LEVELS];
+    Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *wheel);
+
+void timer_init(Timer *timer, timer_callback on_expire, void *arg);
+int timer_pending(const Timer *timer);
+
+// (Re)arm timer to fire after delay_ms; periodic timers re-arm themselves
+// every period_ms before their callback runs
+void timer_wheel_schedule(TimerWheel *wheel, Timer *timer, uint64_t delay_ms);
+void timer_wheel_schedule_periodic(TimerWheel *wheel, Timer *timer, uint64_t period_ms);
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer);
+
+// Run every timer due at now_ms (get_monotonic_ms). Callbacks may
+// schedule or cancel any timer.
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms);
+
+// Milliseconds until the next timer may be due (a lower bound: a timer on
+// an upper level is reported at its cascade point), or -1 if none
+int timer_wheel_next_timeout(const TimerWheel *wheel, uint64_t now_ms);
+
+// Time of the last advance, cheap to read from callbacks and handlers
+uint64_t timer_wheel_time_ms(const TimerWheel *wheel);
+
+#endif
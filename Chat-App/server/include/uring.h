@@ -0,0 +1,87 @@
+#ifndef URING_H
+#define URING_H
+
+// Minimal io_uring wrapper over the raw syscalls (no liburing dependency).
+// Only built with HAVE_IO_URING; callers fall back to epoll otherwise.
+#ifdef HAVE_IO_URING
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned features;
+
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_head;        // first SQE not yet handed to the kernel
+    unsigned sqe_tail;        // next SQE to fill
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_map_size;
+
+    unsigned long enters;     // io_uring_enter calls (for stats)
+} Uring;
+
+// Ring of kernel-selected receive buffers (IORING_REGISTER_PBUF_RING)
+typedef struct {
+    struct io_uring_buf_ring *ring;
+    unsigned char *bufs;
+    unsigned entries;
+    size_t buf_size;
+    uint16_t group;
+    uint16_t tail;
+    size_t ring_size;
+} UringBufRing;
+
+int uring_init(Uring *ring, unsigned entries, unsigned cq_entries);
+void uring_cleanup(Uring *ring);
+
+// 1 if the running kernel implements opcode
+int uring_opcode_supported(Uring *ring, int opcode);
+
+// Next free SQE (zeroed), or NULL if the submission queue is full
+struct io_uring_sqe* uring_get_sqe(Uring *ring);
+
+// Hand prepared SQEs to the kernel and optionally wait for completions.
+// Returns the number submitted, or -1 with errno set.
+int uring_submit(Uring *ring);
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr);
+// Same, but stop waiting after timeout_ms (fails with ETIME)
+int uring_submit_and_wait_timeout(Uring *ring, unsigned wait_nr, int timeout_ms);
+
+// Completion iteration: peek, handle, then mark seen
+struct io_uring_cqe* uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, int flags, uint64_t user_data);
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, uint16_t group, uint64_t user_data);
+void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *buf, size_t len, int flags, uint64_t user_data);
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, int flags, uint64_t user_data);
+void uring_prep_poll_multishot(struct io_uring_sqe *sqe, int fd, unsigned events, uint64_t user_data);
+
+// entries must be a power of two
+int uring_buf_ring_init(Uring *ring, UringBufRing *br, uint16_t group, unsigned entries, size_t buf_size);
+void uring_buf_ring_free(Uring *ring, UringBufRing *br);
+unsigned char* uring_buf_ring_get(UringBufRing *br, uint16_t bid);
+// Give a consumed buffer back to the kernel
+void uring_buf_ring_recycle(UringBufRing *br, uint16_t bid);
+
+#endif
+
+#endif
@@ -18,12 +18,18 @@ void json_add_int(char *buffer, size_t size, const char *key, int value);
 
 // Time utilities
 time_t get_current_timestamp();
+long long get_monotonic_ms();
 char* timestamp_to_string(time_t timestamp);
 
 // Socket utilities
 int socket_set_nonblocking(int fd);
 int socket_set_blocking(int fd);
 int socket_set_reuseaddr(int fd);
+int socket_set_reuseport(int fd);
+int socket_create_listener(int port, int backlog);
+
+// System utilities
+int get_cpu_count();
 
 // Logging
 void log_info(const char *format, ...);
@@ -1,36 +1,185 @@
 #ifndef WEBSOCKET_SERVER_H
 #define WEBSOCKET_SERVER_H
 
+#include "ws_deflate.h"
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Stable reference to a connected client: slot index in the low 32 bits,
+// slot generation in the high 32. A handle stops resolving as soon as the
+// client leaves, even if its slot or fd is reused. 0 is never valid.
+typedef uint64_t WSClientHandle;
+#define WS_INVALID_HANDLE 0
+
+#define WS_CLIENT_INLINE_ROOMS 4
+#define WS_MAX_ROOMS_PER_CLIENT 256
 
 typedef struct {
     int fd;                   
     int user_id;
-    int room_id;
-    pthread_t thread;
+    int room_id;              // default room for messages that name none (0 = none)
     int is_connected;
+    uint32_t generation;      // bumped whenever the slot is vacated
+    int link;                 // position in the active list, or next free slot
+
+    // Subscribed rooms as a sorted array: inline for the common handful,
+    // on the heap past WS_CLIENT_INLINE_ROOMS (valid under clients_mutex)
+    int room_count;
+    int room_cap;
+    int inline_rooms[WS_CLIENT_INLINE_ROOMS];
+    int *heap_rooms;
 } WebSocketClient;
 
+// What to do with a client whose outbound queue passes a high-water mark
+typedef enum {
+    WS_SLOW_DISCONNECT = 0,   // close the connection
+    WS_SLOW_DROP_OLDEST,      // discard the oldest unsent frames
+    WS_SLOW_COALESCE          // replace every unsent frame with the newest one
+} WSSlowConsumerPolicy;
+
+#define WS_DEFAULT_MAX_QUEUED_BYTES (1024 * 1024)
+#define WS_DEFAULT_MAX_QUEUED_FRAMES 1024
+#define WS_DEFAULT_MAX_LAG_MS 10000
+
 typedef struct {
-    WebSocketClient clients[1000];
+    WSSlowConsumerPolicy policy;
+    size_t max_queued_bytes;  // per-connection unsent bytes
+    int max_queued_frames;    // per-connection unsent frames
+    int max_lag_ms;           // age of the oldest unsent frame (0 = no limit)
+} WSOutboundConfig;
+
+#define WS_DEFAULT_PING_INTERVAL_MS 30000
+#define WS_DEFAULT_IDLE_TIMEOUT_MS 75000
+#define WS_DEFAULT_HANDSHAKE_TIMEOUT_MS 10000
+
+// Liveness timers, run on each shard's timer wheel (0 disables one)
+typedef struct {
+    int ping_interval_ms;     // ping a client that has been silent this long
+    int idle_timeout_ms;      // close a client that has been silent this long
+    int handshake_timeout_ms; // close a socket that has not upgraded by then
+} WSHeartbeatConfig;
+
+#define WS_COALESCE_MAX_WINDOW_MS 1000
+#define WS_COALESCE_MAX_MESSAGES 64
+
+// Coalescing for busy rooms: a message published within window_ms of the
+// room's previous send is held back, and the held messages go out together
+// as one JSON array frame per recipient when the window closes or
+// max_messages are waiting. A quiet room sends at once, so coalescing adds
+// no latency there. window_ms 0 disables it (the default).
+typedef struct {
+    int window_ms;
+    int max_messages;         // 0 = WS_COALESCE_MAX_MESSAGES
+} WSCoalesceConfig;
+
+// Snapshot of a connection with unsent data
+typedef struct {
+    int fd;
+    int user_id;
+    int room_id;
+    size_t queued_bytes;
+    int queued_frames;
+    long long lag_ms;         // age of the oldest unsent frame
+    long long max_lag_ms;     // worst lag seen on this connection
+    unsigned long dropped_frames;
+    unsigned long coalesced_frames;
+} WSClientLag;
+
+// Client slot map: O(1) add / remove / lookup by fd or handle.
+// Slots never move, so a slot index stays valid while the client is
+// connected; the table grows on demand with no fixed client limit.
+typedef struct {
+    WebSocketClient *clients; // slots, indexed by handle
+    int capacity;
+    int *active;              // dense list of occupied slots (for iteration)
     int client_count;
+    int free_head;            // first vacant slot, -1 if none
+    int *fd_slots;            // fd -> slot, -1 if not a client
+    int fd_capacity;
     pthread_mutex_t clients_mutex;
 } WebSocketServer;
 
-// Initialize WebSocket server
+// Per-shard I/O backend. io_uring batches each turn's sends into one
+// io_uring_enter and falls back to epoll when the kernel lacks support.
+typedef enum {
+    WS_IO_EPOLL = 0,
+    WS_IO_URING
+} WSIOBackend;
+
+// Initialize WebSocket server. websocket_start() runs one reactor per
+// shard (each with its own SO_REUSEPORT listener) and blocks until
+// websocket_stop().
+void websocket_set_shard_count(int shards);   // call before init; 0 = one per CPU
+void websocket_set_io_backend(WSIOBackend backend);  // call before init
+WSIOBackend websocket_get_io_backend();       // backend in use after init
 int websocket_init(int port);
 int websocket_start();
 void websocket_stop();
 void websocket_cleanup();
 
-// Client management
-int websocket_add_client(int fd, int user_id, int room_id);
+// Client management. websocket_add_client returns the new client's
+// handle, or WS_INVALID_HANDLE on failure.
+WSClientHandle websocket_add_client(int fd, int user_id, int room_id);
 int websocket_remove_client(int fd);
-int websocket_get_client_index(int fd);
+int websocket_get_client_index(int fd);        // slot index, caller holds clients_mutex
+WSClientHandle websocket_get_client_handle(int fd);
+int websocket_get_client(WSClientHandle handle, WebSocketClient *out);
+int websocket_set_client_room(int fd, int room_id);   // change the default room
+
+// Room subscriptions: a client receives broadcasts for every room it has
+// joined. Clients join and leave in-band with {"type": "user_joined" /
+// "user_left", "room_id": N}; membership in the room is required.
+int websocket_join_room(int fd, int room_id);
+int websocket_leave_room(int fd, int room_id);
+int websocket_is_subscribed(int fd, int room_id);
 
 // Broadcasting
 int websocket_broadcast_to_room(int room_id, const char *message);
 int websocket_send_to_client(int fd, const char *message);
+int websocket_send_to_handle(WSClientHandle handle, const char *message);
+
+// Room messages are numbered: each JSON object relayed to a room gains a
+// leading "seq" field, increasing by one per message in that room. Recent
+// messages are kept, so a reconnecting client sends {"type": "resume",
+// "room_id": R, "seq": S} with the last seq it saw and receives the
+// missed messages followed by {"type": "resumed", ...}. If S is too old,
+// or was assigned by another process (the high bits of a seq carry a
+// random per-process epoch, below 2^53), it gets {"type": "resync", ...}
+// and reloads the room's history.
+uint64_t websocket_get_room_seq(int room_id);
+
+// Live connections subscribed to a room (O(1) lookup in the room index)
+int websocket_get_room_member_count(int room_id);
+
+// Inbound limit for a single (possibly fragmented) message
+void websocket_set_max_message_size(size_t max_bytes);
+
+// permessage-deflate (on by default, see ws_deflate_config_default)
+void websocket_set_compression(const WSDeflateConfig *config);
+
+// Share room broadcasts with other chat_server processes (see chat_bus.h):
+// "unix:DIR" or "shm:DIR" on one host, "tcp:HOST:PORT" through
+// chat_bus_broker.
+// Call after websocket_init; returns -1 if the bus cannot be opened.
+int websocket_set_bus(const char *spec);
+
+// Browser origins allowed to upgrade, comma-separated exact matches
+// (e.g. "https://chat.example.com, http://localhost:3000"). NULL or empty
+// allows any origin; requests without an Origin header always pass.
+int websocket_set_allowed_origins(const char *origins);
+
+// Heartbeats and timeouts (apply to connections accepted afterwards)
+void websocket_set_heartbeat_config(const WSHeartbeatConfig *config);
+
+// Coalescing for one room, or the default for rooms indexed afterwards
+int websocket_set_room_coalescing(int room_id, const WSCoalesceConfig *config);
+void websocket_set_default_coalescing(const WSCoalesceConfig *config);
+
+// Outbound queues / slow consumers
+void websocket_set_outbound_config(const WSOutboundConfig *config);
+int websocket_get_lagging_clients(WSClientLag *out, int max_count);
+void websocket_print_stats();
 
 // Server operations
 int websocket_get_active_connections();
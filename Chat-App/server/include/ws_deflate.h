@@ -0,0 +1,59 @@
+#ifndef WS_DEFLATE_H
+#define WS_DEFLATE_H
+
+#include "ws_frame.h"
+#include <stddef.h>
+#include <zlib.h>
+
+// permessage-deflate (RFC 7692)
+
+#define WS_DEFLATE_MIN_WINDOW_BITS 9    // zlib cannot produce raw 8-bit windows
+#define WS_DEFLATE_MAX_WINDOW_BITS 15
+#define WS_DEFLATE_WINDOW_VARIANTS (WS_DEFLATE_MAX_WINDOW_BITS - WS_DEFLATE_MIN_WINDOW_BITS + 1)
+#define WS_DEFLATE_DEFAULT_LEVEL 6
+#define WS_DEFLATE_DEFAULT_MIN_SIZE 128
+
+// RSV1 marks a compressed message in the first frame header byte
+#define WS_FRAME_RSV1 0x40
+
+typedef struct {
+    int enabled;                     // accept permessage-deflate offers at all
+    int level;                       // zlib compression level (1-9)
+    int server_max_window_bits;      // largest window our compressor uses
+    int client_max_window_bits;      // largest window we ask clients to use
+    int client_no_context_takeover;  // always ask clients to reset per message
+    size_t min_size;                 // smaller payloads are sent uncompressed
+} WSDeflateConfig;
+
+// Parameters agreed with one client, plus its decompressor.
+// The server always runs with server_no_context_takeover, so every
+// outbound message compresses independently and can be shared.
+typedef struct {
+    int active;
+    int server_window_bits;
+    int client_window_bits;
+    int client_no_context_takeover;
+    z_stream *inflater;              // allocated on the first compressed message
+} WSDeflateState;
+
+void ws_deflate_config_default(WSDeflateConfig *config);
+
+// Pick the first acceptable offer from a Sec-WebSocket-Extensions value.
+// On success fills state and writes the response extension into response
+// and returns 1; returns 0 if no offer is acceptable.
+int ws_deflate_negotiate(const WSDeflateConfig *config, const char *offers,
+                         WSDeflateState *state, char *response, size_t response_size);
+
+// Compress payload into a single FIN frame with RSV1 set (refcount 1).
+// Returns NULL if compression fails or would not make the message smaller.
+WSOutFrame* ws_deflate_frame_create(int level, int window_bits, int opcode,
+                                    const void *payload, size_t len);
+
+// Decompress one message into *buf (grown as needed, never past max_len).
+// Returns the decompressed length, or -1 on corrupt or oversized input.
+long ws_deflate_inflate(WSDeflateState *state, const unsigned char *in, size_t in_len,
+                        unsigned char **buf, size_t *buf_cap, size_t max_len);
+
+void ws_deflate_state_free(WSDeflateState *state);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef WS_FRAME_H
+#define WS_FRAME_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+// Close status codes (RFC 6455 section 7.4.1)
+#define WS_CLOSE_POLICY_VIOLATION 1008
+
+// Encoded server->client frame, shared read-only by every recipient.
+// Built once per message; each queued send holds a reference and the
+// frame is freed when the last reference is dropped.
+typedef struct {
+    atomic_int refcount;
+    size_t len;               // header + payload bytes in data[]
+    unsigned char data[];
+} WSOutFrame;
+
+// Encode a single unmasked frame with FIN set (refcount starts at 1)
+WSOutFrame* ws_frame_create(int opcode, const void *payload, size_t payload_len);
+
+// Concatenate encoded frames into one buffer, so a batch goes out in a
+// single write (refcount starts at 1; the parts keep their references)
+WSOutFrame* ws_frame_concat(WSOutFrame *const *frames, int count);
+
+// Payload of a frame built by ws_frame_create
+const unsigned char* ws_frame_payload(const WSOutFrame *frame, size_t *len);
+
+WSOutFrame* ws_frame_ref(WSOutFrame *frame);
+void ws_frame_unref(WSOutFrame *frame);
+
+// Write a frame header into out (at least 10 bytes); returns header size
+size_t ws_frame_write_header(unsigned char *out, int opcode, int fin, size_t payload_len);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef WS_HANDSHAKE_H
+#define WS_HANDSHAKE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WS_HANDSHAKE_MAX_SIZE 8192
+#define WS_HANDSHAKE_MAX_HEADERS 64
+#define WS_HANDSHAKE_MAX_LIST 4       // repeated Extensions/Protocol lines kept
+#define WS_ACCEPT_KEY_SIZE 29         // base64 of a SHA-1 digest plus NUL
+
+typedef enum {
+    WS_HANDSHAKE_INCOMPLETE = 0,
+    WS_HANDSHAKE_DONE,
+    WS_HANDSHAKE_ERROR
+} WSHandshakeResult;
+
+// Byte range inside the request buffer
+typedef struct {
+    uint16_t off;
+    uint16_t len;
+} WSSpan;
+
+// Incremental parser for the HTTP upgrade request. The caller keeps the
+// request bytes in one buffer (appending as reads arrive) and feeds its
+// current length; each call resumes at the first unscanned byte, so a
+// request dripped in one byte at a time is still scanned once. Only the
+// request line and the headers the upgrade needs are recorded, as spans
+// into the caller's buffer: nothing is copied or allocated.
+typedef struct {
+    size_t scanned;           // bytes examined so far
+    size_t line_start;        // start of the line being scanned
+    size_t request_len;       // through the blank line, once done
+    int header_count;         // -1 until the request line is parsed
+    int status;               // HTTP status to refuse with after an error
+
+    WSSpan method;
+    WSSpan target;
+    WSSpan version;
+
+    WSSpan host;
+    WSSpan upgrade;
+    WSSpan connection;
+    WSSpan key;
+    WSSpan ws_version;
+    WSSpan origin;
+    WSSpan authorization;
+    WSSpan room_id;
+    WSSpan extensions[WS_HANDSHAKE_MAX_LIST];
+    WSSpan protocols[WS_HANDSHAKE_MAX_LIST];
+    int extension_count;
+    int protocol_count;
+} WSHandshake;
+
+void ws_handshake_init(WSHandshake *hs);
+
+// Scan buf[0, len) from where the last call stopped. On DONE the request
+// occupies buf[0, request_len); on ERROR status holds the HTTP status.
+WSHandshakeResult ws_handshake_parse(WSHandshake *hs, const char *buf, size_t len);
+
+// Check a parsed request is a valid RFC 6455 upgrade: GET over HTTP/1.1,
+// Host present, Upgrade naming websocket, Connection naming upgrade,
+// version 13 and a 16-byte key. origins is a comma-separated allow-list
+// (NULL or empty allows any origin; requests without Origin are not from
+// a browser and pass). Returns 0 or the HTTP status to refuse with (426
+// means the response must advertise Sec-WebSocket-Version: 13).
+int ws_handshake_validate(const WSHandshake *hs, const char *buf, const char *origins);
+
+// 1 if any instance of a list header holds token (exact match)
+int ws_handshake_list_contains(const char *buf, const WSSpan *spans, int count, const char *token);
+
+// Join the instances of a list header as "a, b" into out. Returns 0, or
+// -1 (out empty) if they do not fit: truncated offers would be misread.
+int ws_handshake_join_list(const char *buf, const WSSpan *spans, int count,
+                           char *out, size_t out_size);
+
+// Copy a header value into out. Returns 1 if present and fits.
+int ws_handshake_copy(const char *buf, WSSpan span, char *out, size_t out_size);
+
+// Copy query parameter name from the request target into out,
+// percent-decoded. Returns 1 if the parameter is present and fits.
+int ws_handshake_query_param(const WSHandshake *hs, const char *buf, const char *name,
+                             char *out, size_t out_size);
+
+// Sec-WebSocket-Accept for a validated key, NUL-terminated
+void ws_handshake_accept_key(const char *buf, WSSpan key, char accept[WS_ACCEPT_KEY_SIZE]);
+
+#endif
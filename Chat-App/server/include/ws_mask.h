@@ -0,0 +1,23 @@
+#ifndef WS_MASK_H
+#define WS_MASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XOR a client payload with its 4-byte masking key in place.
+// offset is the payload position of data[0] (for frames split across reads).
+typedef void (*ws_unmask_fn)(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset);
+
+// Fastest kernel for this CPU, picked once at startup
+void ws_unmask(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset);
+const char* ws_unmask_kernel_name();
+
+// Individual kernels (exposed for the microbenchmark)
+void ws_unmask_scalar(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset);
+void ws_unmask_word(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset);
+#if defined(__x86_64__) || defined(__i386__)
+void ws_unmask_sse2(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset);
+void ws_unmask_avx2(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset);
+#endif
+
+#endif
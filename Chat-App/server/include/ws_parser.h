@@ -0,0 +1,63 @@
+#ifndef WS_PARSER_H
+#define WS_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WS_DEFAULT_MAX_MESSAGE_SIZE (1024 * 1024)
+#define WS_MAX_CONTROL_PAYLOAD 125
+
+// Called once per complete message (text/binary, after reassembly) or
+// control frame. The payload is unmasked and only valid during the call;
+// compressed is set when the message had RSV1 (permessage-deflate).
+// Return 0 to keep parsing, 1 to stop (e.g. after a close), -1 on error.
+typedef int (*ws_message_callback)(void *ctx, int opcode, int compressed,
+                                   unsigned char *payload, size_t len);
+
+typedef enum {
+    WS_PARSE_HEADER = 0,
+    WS_PARSE_PAYLOAD
+} WSParseState;
+
+// Incremental client-frame parser. Bytes can arrive split at any point or
+// several frames per read; every byte handed to ws_parser_feed is consumed.
+// Frames that arrive whole are unmasked in place and delivered without a
+// copy; split frames and fragmented messages are assembled in msg_buf,
+// which is reused between messages instead of allocated per frame.
+typedef struct {
+    WSParseState state;
+    unsigned char header[14];
+    size_t header_len;
+
+    // Frame currently being read
+    int fin;
+    int opcode;
+    int compressed;           // RSV1 on this frame
+    unsigned char mask[4];
+    uint64_t payload_len;
+    uint64_t payload_read;
+
+    // Data message being reassembled (opcode 0 when none)
+    int msg_opcode;
+    int msg_compressed;
+    unsigned char *msg_buf;
+    size_t msg_len;
+    size_t msg_cap;
+
+    // Control frames may interleave with a fragmented message
+    unsigned char ctrl_buf[WS_MAX_CONTROL_PAYLOAD];
+    size_t ctrl_len;
+
+    size_t max_message_size;
+    int allow_compressed;     // RSV1 permitted (permessage-deflate negotiated)
+} WSParser;
+
+void ws_parser_init(WSParser *parser, size_t max_message_size);
+void ws_parser_free(WSParser *parser);
+
+// Returns 0 when all bytes were consumed, 1 if the callback asked to stop,
+// -1 on a protocol violation or oversized message
+int ws_parser_feed(WSParser *parser, unsigned char *data, size_t len,
+                   ws_message_callback on_message, void *ctx);
+
+#endif
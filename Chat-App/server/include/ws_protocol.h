@@ -0,0 +1,90 @@
+#ifndef WS_PROTOCOL_H
+#define WS_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Chat events on the wire. JSON text frames are the default; clients that
+// offer WS_SUBPROTOCOL_BINARY in Sec-WebSocket-Protocol get binary frames:
+//
+//   offset  size  field (little-endian)
+//   0       1     version (WS_BINARY_VERSION)
+//   1       1     type (WSEventType)
+//   2       2     field count
+//   4       4     room id
+//   8       8     room sequence number
+//   16      4     sender user id
+//   20      8     timestamp, ms since the epoch
+//   28      ...   fields: 1-byte tag, 2-byte length, UTF-8 bytes
+//
+// Zero header values mean "not set". Both encodings carry the same event,
+// so either can be produced from the other.
+#define WS_SUBPROTOCOL_JSON "chat.json.v1"
+#define WS_SUBPROTOCOL_BINARY "chat.binary.v1"
+
+#define WS_BINARY_VERSION 1
+#define WS_BINARY_HEADER_SIZE 28
+#define WS_EVENT_MAX_FIELDS 8
+
+typedef enum {
+    WS_PROTOCOL_JSON = 0,
+    WS_PROTOCOL_BINARY
+} WSProtocol;
+
+typedef enum {
+    WS_EVENT_OTHER = 0,       // name carried in WS_FIELD_TYPE_NAME
+    WS_EVENT_MESSAGE,
+    WS_EVENT_USER_JOINED,
+    WS_EVENT_USER_LEFT,
+    WS_EVENT_PING,
+    WS_EVENT_PONG,
+    WS_EVENT_RESUME,
+    WS_EVENT_RESUMED,
+    WS_EVENT_RESYNC,
+    WS_EVENT_ERROR,
+    WS_EVENT_TYPE_COUNT
+} WSEventType;
+
+typedef enum {
+    WS_FIELD_USERNAME = 1,
+    WS_FIELD_CONTENT,
+    WS_FIELD_MESSAGE_ID,
+    WS_FIELD_MESSAGE,         // error text
+    WS_FIELD_TYPE_NAME
+} WSEventField;
+
+typedef struct {
+    int tag;
+    const char *data;         // UTF-8, not NUL-terminated
+    size_t len;
+} WSEventValue;
+
+typedef struct {
+    int type;
+    uint32_t room_id;
+    uint64_t seq;
+    uint32_t sender_id;
+    uint64_t timestamp;
+    int field_count;
+    WSEventValue fields[WS_EVENT_MAX_FIELDS];
+} WSEvent;
+
+// Parse a JSON object with json_index. String values are unescaped into
+// scratch (at least len bytes), which the event's fields then point into.
+// Returns -1 if the payload is not a well-formed JSON object.
+int ws_event_from_json(WSEvent *event, const unsigned char *json, size_t len, char *scratch);
+
+// Parse a binary event; fields point into data. Returns -1 if malformed.
+int ws_event_from_binary(WSEvent *event, const unsigned char *data, size_t len);
+
+// Upper bounds for the encoders' output
+size_t ws_event_json_size(const WSEvent *event);
+size_t ws_event_binary_size(const WSEvent *event);
+
+// Encode into out (sized by the functions above); return bytes written
+size_t ws_event_to_json(const WSEvent *event, char *out);
+size_t ws_event_to_binary(const WSEvent *event, unsigned char *out);
+
+const char* ws_event_type_name(int type);
+
+#endif
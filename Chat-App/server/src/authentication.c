@@ -52,7 +52,7 @@ int auth_validate_token(const char *token, int *user_id_out) {
 
     
     time_t now = time(NULL);
-    if (now - timestamp > 86400) {
+    if (now - timestamp > AUTH_TOKEN_TTL_SECONDS) {
         return -2;  // Token expired
     }
     
@@ -60,6 +60,16 @@ int auth_validate_token(const char *token, int *user_id_out) {
     return 0;
 }
 
+time_t auth_token_expires_at(const char *token) {
+    int user_id;
+    long timestamp;
+
+    if (sscanf(token, "%d.%ld", &user_id, &timestamp) != 2) {
+        return -1;
+    }
+    return (time_t)timestamp + AUTH_TOKEN_TTL_SECONDS;
+}
+
 // User login
 int auth_login(const char *username, const char *password, int *user_id_out) {
 
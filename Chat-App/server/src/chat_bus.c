@@ -0,0 +1,143 @@
+#include "chat_bus.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <time.h>
+
+#define CHAT_BUS_MAGIC 0x31534243u   // "CBS1"
+
+static const ChatBusTransport *g_transports[] = {
+    &chat_bus_unix_transport,
+    &chat_bus_shm_transport,
+    &chat_bus_tcp_transport,
+};
+
+// Header fields are little-endian, like the binary event encoding
+static void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_le64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t get_le64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static void* chat_bus_thread(void *arg) {
+    ChatBus *bus = arg;
+    bus->transport->run(bus);
+    return NULL;
+}
+
+ChatBus* chat_bus_open(const char *spec, chat_bus_handler handler, void *arg) {
+    const ChatBusTransport *transport = NULL;
+    const char *address = NULL;
+
+    for (size_t i = 0; i < sizeof(g_transports) / sizeof(g_transports[0]); i++) {
+        size_t name_len = strlen(g_transports[i]->name);
+        if (strncmp(spec, g_transports[i]->name, name_len) == 0 && spec[name_len] == ':') {
+            transport = g_transports[i];
+            address = spec + name_len + 1;
+            break;
+        }
+    }
+    if (!transport || !*address) {
+        log_error("Unknown message bus '%s' (expected unix:DIR, shm:DIR or tcp:HOST:PORT)", spec);
+        return NULL;
+    }
+
+    ChatBus *bus = calloc(1, sizeof(ChatBus));
+    if (!bus) return NULL;
+    bus->transport = transport;
+    bus->handler = handler;
+    bus->arg = arg;
+    if (getrandom(&bus->origin, sizeof(bus->origin), 0) != sizeof(bus->origin)) {
+        bus->origin = ((uint64_t)getpid() << 32) ^ (uint64_t)time(NULL);
+    }
+
+    bus->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (bus->wake_fd < 0 || transport->open(bus, address) < 0) {
+        log_error("Failed to open %s message bus at %s", transport->name, address);
+        if (bus->wake_fd >= 0) close(bus->wake_fd);
+        free(bus);
+        return NULL;
+    }
+
+    if (pthread_create(&bus->thread, NULL, chat_bus_thread, bus) != 0) {
+        transport->close(bus);
+        close(bus->wake_fd);
+        free(bus);
+        return NULL;
+    }
+    bus->thread_started = 1;
+
+    log_info("Message bus: %s at %s", transport->name, address);
+    return bus;
+}
+
+int chat_bus_publish(ChatBus *bus, int room_id, const unsigned char *payload, size_t len) {
+    unsigned char header[CHAT_BUS_HEADER_SIZE];
+
+    if (!bus || room_id <= 0) return -1;
+    if (len > CHAT_BUS_MAX_PAYLOAD) {
+        atomic_fetch_add(&bus->dropped, 1);
+        return -1;
+    }
+
+    put_le32(header, CHAT_BUS_MAGIC);
+    put_le32(header + 4, (uint32_t)room_id);
+    put_le64(header + 8, bus->origin);
+
+    // The payload goes to the transport as is, never staged in between
+    struct iovec iov[2] = {{header, CHAT_BUS_HEADER_SIZE}, {(void*)payload, len}};
+    atomic_fetch_add(&bus->published, 1);
+    return bus->transport->send(bus, iov, 2);
+}
+
+void chat_bus_dispatch(ChatBus *bus, const unsigned char *msg, size_t len) {
+    if (len < CHAT_BUS_HEADER_SIZE || get_le32(msg) != CHAT_BUS_MAGIC) return;
+
+    uint32_t room_id = get_le32(msg + 4);
+    if (get_le64(msg + 8) == bus->origin || room_id == 0 || room_id > INT32_MAX) return;
+
+    atomic_fetch_add(&bus->received, 1);
+    bus->handler((int)room_id, msg + CHAT_BUS_HEADER_SIZE, len - CHAT_BUS_HEADER_SIZE, bus->arg);
+}
+
+void chat_bus_close(ChatBus *bus) {
+    if (!bus) return;
+
+    if (bus->thread_started) {
+        uint64_t one = 1;
+        ssize_t ignored = write(bus->wake_fd, &one, sizeof(one));
+        (void)ignored;
+        pthread_join(bus->thread, NULL);
+    }
+    bus->transport->close(bus);
+    close(bus->wake_fd);
+    free(bus);
+}
+
+void chat_bus_get_stats(ChatBus *bus, ChatBusStats *stats) {
+    memset(stats, 0, sizeof(ChatBusStats));
+    if (!bus) return;
+
+    stats->transport = bus->transport->name;
+    stats->published = atomic_load(&bus->published);
+    stats->received = atomic_load(&bus->received);
+    stats->dropped = atomic_load(&bus->dropped);
+    stats->peers = atomic_load(&bus->peers);
+}
@@ -0,0 +1,228 @@
+// Stand-in message broker for the tcp: bus transport. Every chat_server
+// process connects here; each length-prefixed message one sends is copied
+// to all the others. Messages are opaque to the broker. A process that
+// stops reading is disconnected once its backlog passes the limit, and
+// it reconnects on its own.
+//
+// Usage: chat_bus_broker [port]      (default 7071)
+#define _GNU_SOURCE
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define BROKER_DEFAULT_PORT 7071
+#define BROKER_MAX_PEERS 256
+#define BROKER_FRAME_MAX (4 + 16 + 65536)       // prefix, bus header, payload
+#define BROKER_RX_SIZE (2 * BROKER_FRAME_MAX)
+#define BROKER_MAX_BACKLOG (16 * 1024 * 1024)
+
+typedef struct {
+    int fd;
+    unsigned char *rx;
+    size_t rx_len;
+    unsigned char *tx;        // pending output, flushed on EPOLLOUT
+    size_t tx_len;
+    size_t tx_cap;
+    int writable_armed;       // EPOLLOUT registered
+    int closing;
+} Peer;
+
+static Peer *g_peers[BROKER_MAX_PEERS];
+static Peer *g_closed[BROKER_MAX_PEERS];   // freed once the event batch is done
+static int g_closed_count = 0;
+static int g_epfd = -1;
+static volatile sig_atomic_t g_running = 1;
+static unsigned long g_relayed = 0;
+
+static void broker_signal(int sig) {
+    (void)sig;
+    g_running = 0;
+}
+
+// Relaying can close a peer that still has an event pending in the same
+// batch, so the memory is only released by peers_reap
+static void peer_close(Peer *peer) {
+    if (peer->closing) return;
+    peer->closing = 1;
+    for (int i = 0; i < BROKER_MAX_PEERS; i++) {
+        if (g_peers[i] == peer) g_peers[i] = NULL;
+    }
+    epoll_ctl(g_epfd, EPOLL_CTL_DEL, peer->fd, NULL);
+    close(peer->fd);
+    log_info("Bus peer disconnected: fd=%d", peer->fd);
+    g_closed[g_closed_count++] = peer;
+}
+
+static void peers_reap() {
+    for (int i = 0; i < g_closed_count; i++) {
+        free(g_closed[i]->rx);
+        free(g_closed[i]->tx);
+        free(g_closed[i]);
+    }
+    g_closed_count = 0;
+}
+
+// Write what the socket takes; returns -1 if the peer is gone
+static int peer_flush(Peer *peer) {
+    size_t sent = 0;
+    while (sent < peer->tx_len) {
+        ssize_t n = send(peer->fd, peer->tx + sent, peer->tx_len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        sent += n;
+    }
+    memmove(peer->tx, peer->tx + sent, peer->tx_len - sent);
+    peer->tx_len -= sent;
+
+    int want_writable = peer->tx_len > 0;
+    if (want_writable != peer->writable_armed) {
+        struct epoll_event ev = {.events = EPOLLIN | (want_writable ? EPOLLOUT : 0), .data.ptr = peer};
+        epoll_ctl(g_epfd, EPOLL_CTL_MOD, peer->fd, &ev);
+        peer->writable_armed = want_writable;
+    }
+    return 0;
+}
+
+static int peer_queue(Peer *peer, const unsigned char *frame, size_t len) {
+    if (peer->tx_len + len > BROKER_MAX_BACKLOG) return -1;
+    if (peer->tx_len + len > peer->tx_cap) {
+        size_t cap = peer->tx_cap ? peer->tx_cap : 65536;
+        while (cap < peer->tx_len + len) cap *= 2;
+        unsigned char *grown = realloc(peer->tx, cap);
+        if (!grown) return -1;
+        peer->tx = grown;
+        peer->tx_cap = cap;
+    }
+    memcpy(peer->tx + peer->tx_len, frame, len);
+    peer->tx_len += len;
+    return 0;
+}
+
+// Copy one frame (with its prefix) to every peer except its sender
+static void relay(Peer *from, const unsigned char *frame, size_t len) {
+    for (int i = 0; i < BROKER_MAX_PEERS; i++) {
+        Peer *peer = g_peers[i];
+        if (!peer || peer == from) continue;
+        int queued_before = peer->tx_len > 0;
+        if (peer_queue(peer, frame, len) < 0) {
+            log_error("Bus peer fd=%d fell too far behind", peer->fd);
+            peer_close(peer);
+            continue;
+        }
+        // With a backlog, EPOLLOUT is already armed and keeps order
+        if (!queued_before && peer_flush(peer) < 0) peer_close(peer);
+    }
+    g_relayed++;
+}
+
+static int peer_read(Peer *peer) {
+    for (;;) {
+        ssize_t n = recv(peer->fd, peer->rx + peer->rx_len, BROKER_RX_SIZE - peer->rx_len, MSG_DONTWAIT);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        peer->rx_len += n;
+
+        size_t pos = 0;
+        while (peer->rx_len - pos >= 4) {
+            const unsigned char *p = peer->rx + pos;
+            size_t len = 4 + (p[0] | (p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24));
+            if (len > BROKER_FRAME_MAX) return -1;
+            if (peer->rx_len - pos < len) break;
+            relay(peer, p, len);
+            pos += len;
+        }
+        memmove(peer->rx, peer->rx + pos, peer->rx_len - pos);
+        peer->rx_len -= pos;
+    }
+}
+
+static void accept_peers(int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+
+        Peer *peer = calloc(1, sizeof(Peer));
+        int slot = -1;
+        for (int i = 0; i < BROKER_MAX_PEERS && slot < 0; i++) {
+            if (!g_peers[i]) slot = i;
+        }
+        if (!peer || slot < 0 || !(peer->rx = malloc(BROKER_RX_SIZE))) {
+            log_error("Bus peer refused: fd=%d", fd);
+            free(peer);
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        peer->fd = fd;
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = peer};
+        epoll_ctl(g_epfd, EPOLL_CTL_ADD, fd, &ev);
+        g_peers[slot] = peer;
+        log_info("Bus peer connected: fd=%d", fd);
+    }
+}
+
+int main(int argc, char **argv) {
+    int port = argc > 1 ? atoi(argv[1]) : BROKER_DEFAULT_PORT;
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "Usage: chat_bus_broker [port]\n");
+        return 1;
+    }
+
+    signal(SIGINT, broker_signal);
+    signal(SIGTERM, broker_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = socket_create_listener(port, SOMAXCONN);
+    g_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (listen_fd < 0 || g_epfd < 0) {
+        log_error("Failed to listen on port %d", port);
+        return 1;
+    }
+    struct epoll_event listen_ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, listen_fd, &listen_ev);
+    log_info("Message broker listening on port %d", port);
+
+    struct epoll_event events[64];
+    while (g_running) {
+        int n = epoll_wait(g_epfd, events, 64, 1000);
+        for (int i = 0; i < n; i++) {
+            Peer *peer = events[i].data.ptr;
+            if (!peer) {
+                accept_peers(listen_fd);
+                continue;
+            }
+
+            if (peer->closing) continue;
+            if (((events[i].events & EPOLLOUT) && peer_flush(peer) < 0) ||
+                ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && peer_read(peer) < 0)) {
+                peer_close(peer);
+            }
+        }
+        peers_reap();
+    }
+
+    for (int i = 0; i < BROKER_MAX_PEERS; i++) {
+        if (g_peers[i]) peer_close(g_peers[i]);
+    }
+    peers_reap();
+    close(listen_fd);
+    close(g_epfd);
+    log_info("Message broker stopped after relaying %lu messages", g_relayed);
+    return 0;
+}
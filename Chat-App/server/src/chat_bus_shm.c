@@ -0,0 +1,391 @@
+// Single-host bus transport over shared memory. Each process listens on
+// DIR/chat-<pid>.shm (SOCK_SEQPACKET) and owns a futex doorbell. To
+// publish to a peer, a process creates a ring, passes its fd over that
+// socket and gets the peer's doorbell fd back; from then on a message is
+// one copy into the ring and, only if the peer sleeps, one futex wake.
+// The peer reads messages in place and fans them out from the ring.
+//
+// The sockets stay open as liveness links: when either end dies the other
+// sees the hang-up, and only then unmaps the ring. A peer that hangs
+// without dying fills its rings and further messages to it are dropped.
+#define _GNU_SOURCE
+#include "chat_bus.h"
+#include "shm_ring.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define SHM_BUS_MAX_PEERS 64
+#define SHM_BUS_RESCAN_MS 1000
+#define SHM_BUS_MAINTAIN_MS 100     // accept, hang-up checks; also the longest sleep
+#define SHM_BUS_CONSUME_BATCH 256
+
+// A ring we publish into; usable once the peer's doorbell arrived
+typedef struct {
+    int fd;
+    char path[108];
+    ShmRing ring;
+    ShmDoorbell *bell;
+} ShmOutPeer;
+
+// A ring another process publishes into; usable once its fd arrived
+typedef struct {
+    int fd;
+    int attached;
+    ShmRing ring;
+} ShmInPeer;
+
+typedef struct {
+    char dir[80];
+    struct sockaddr_un self;
+    int listen_fd;
+    ShmDoorbell *bell;
+    int bell_fd;              // handed to every producer
+    pthread_rwlock_t out_lock;    // publishers read, the bus thread edits
+    ShmOutPeer out[SHM_BUS_MAX_PEERS];
+    int out_count;
+    ShmInPeer in[SHM_BUS_MAX_PEERS];    // bus thread only
+    int in_count;
+    long long scanned_ms;
+} ShmBus;
+
+static int shm_bus_is_socket_name(const char *name) {
+    size_t len = strlen(name);
+    return strncmp(name, "chat-", 5) == 0 && len > 9 && strcmp(name + len - 4, ".shm") == 0;
+}
+
+static int shm_bus_send_fd(int sock, int fd) {
+    char byte = 'R';
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+
+    memset(&control, 0, sizeof(control));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+// 1 with *fd set, 0 if nothing is pending, -1 on hang-up or a message
+// without an fd
+static int shm_bus_recv_fd(int sock, int *fd) {
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+
+    ssize_t n = recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    if (n == 0) return -1;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+        return -1;
+    }
+    memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    return 1;
+}
+
+// Nothing to read is fine; data or an error on an established link means
+// the other end went away (or is misbehaving)
+static int shm_bus_link_alive(int sock) {
+    char byte;
+    ssize_t n = recv(sock, &byte, 1, MSG_DONTWAIT | MSG_PEEK);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+static void shm_bus_update_peers(ChatBus *bus, ShmBus *state) {
+    int ready = 0;
+    for (int i = 0; i < state->out_count; i++) {
+        if (state->out[i].bell) ready++;
+    }
+    atomic_store(&bus->peers, ready);
+}
+
+// Bus thread, holding out_lock for writing
+static void shm_bus_drop_out(ShmBus *state, int index) {
+    ShmOutPeer *peer = &state->out[index];
+    shm_ring_detach(&peer->ring);
+    shm_doorbell_detach(peer->bell);
+    close(peer->fd);
+    state->out[index] = state->out[--state->out_count];
+}
+
+static void shm_bus_drop_in(ShmBus *state, int index) {
+    ShmInPeer *peer = &state->in[index];
+    if (peer->attached) shm_ring_detach(&peer->ring);
+    close(peer->fd);
+    state->in[index] = state->in[--state->in_count];
+}
+
+static void shm_bus_connect(ShmBus *state, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) return;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        // Nobody listens there any more: the process exited or crashed
+        if (errno == ECONNREFUSED) unlink(path);
+        close(fd);
+        return;
+    }
+
+    ShmOutPeer *peer = &state->out[state->out_count];
+    memset(peer, 0, sizeof(ShmOutPeer));
+    if (shm_ring_create(&peer->ring, SHM_RING_DEFAULT_CAPACITY) < 0) {
+        log_error("Failed to create a message ring for %s", path);
+        close(fd);
+        return;
+    }
+    if (shm_bus_send_fd(fd, peer->ring.fd) < 0) {
+        shm_ring_detach(&peer->ring);
+        close(fd);
+        return;
+    }
+
+    // Not used until the doorbell arrives, but visible to senders already
+    peer->fd = fd;
+    snprintf(peer->path, sizeof(peer->path), "%s", path);
+    pthread_rwlock_wrlock(&state->out_lock);
+    state->out_count++;
+    pthread_rwlock_unlock(&state->out_lock);
+}
+
+static void shm_bus_scan(ShmBus *state) {
+    DIR *dir = opendir(state->dir);
+    struct dirent *entry;
+    char path[108];
+
+    state->scanned_ms = get_monotonic_ms();
+    if (!dir) return;
+
+    while ((entry = readdir(dir)) && state->out_count < SHM_BUS_MAX_PEERS) {
+        if (!shm_bus_is_socket_name(entry->d_name)) continue;
+        if (snprintf(path, sizeof(path), "%s/%s", state->dir, entry->d_name) >= (int)sizeof(path) ||
+            strcmp(path, state->self.sun_path) == 0) {
+            continue;
+        }
+
+        int known = 0;
+        for (int i = 0; i < state->out_count && !known; i++) {
+            known = strcmp(state->out[i].path, path) == 0;
+        }
+        if (!known) shm_bus_connect(state, path);
+    }
+    closedir(dir);
+}
+
+static void shm_bus_accept(ShmBus *state) {
+    for (;;) {
+        int fd = accept4(state->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        if (state->in_count == SHM_BUS_MAX_PEERS) {
+            log_error("Message bus: too many producers, refusing one");
+            close(fd);
+            continue;
+        }
+        state->in[state->in_count++] = (ShmInPeer){.fd = fd};
+    }
+}
+
+static void shm_bus_deliver(const unsigned char *data, size_t len, void *arg) {
+    chat_bus_dispatch(arg, data, len);
+}
+
+// Hand waiting messages from every inbound ring to the bus; returns how
+// many there were
+static int shm_bus_drain(ChatBus *bus, ShmBus *state) {
+    int total = 0;
+
+    for (int i = state->in_count - 1; i >= 0; i--) {
+        if (!state->in[i].attached) continue;
+        int n = shm_ring_consume(&state->in[i].ring, shm_bus_deliver, bus, SHM_BUS_CONSUME_BATCH);
+        if (n < 0) {
+            log_error("Message bus: corrupt ring from a producer, dropping it");
+            shm_bus_drop_in(state, i);
+            continue;
+        }
+        total += n;
+    }
+    return total;
+}
+
+static int shm_bus_idle(ShmBus *state) {
+    for (int i = 0; i < state->in_count; i++) {
+        if (state->in[i].attached && !shm_ring_empty(&state->in[i].ring)) return 0;
+    }
+    return 1;
+}
+
+// Handshakes and hang-ups; -1 once the bus is asked to stop
+static int shm_bus_maintain(ChatBus *bus, ShmBus *state) {
+    uint64_t stop;
+    if (read(bus->wake_fd, &stop, sizeof(stop)) == sizeof(stop)) return -1;
+
+    shm_bus_accept(state);
+
+    // Inbound: attach the ring a producer sends, answer with our doorbell
+    for (int i = state->in_count - 1; i >= 0; i--) {
+        ShmInPeer *peer = &state->in[i];
+        if (peer->attached) {
+            if (!shm_bus_link_alive(peer->fd)) {
+                // Whatever the producer committed before it went is kept
+                shm_ring_consume(&peer->ring, shm_bus_deliver, bus, INT32_MAX);
+                shm_bus_drop_in(state, i);
+            }
+            continue;
+        }
+
+        int ring_fd;
+        int got = shm_bus_recv_fd(peer->fd, &ring_fd);
+        if (got == 0) continue;
+        if (got < 0 || shm_ring_attach(&peer->ring, ring_fd) < 0 ||
+            shm_bus_send_fd(peer->fd, state->bell_fd) < 0) {
+            if (got > 0 && peer->ring.header) shm_ring_detach(&peer->ring);
+            shm_bus_drop_in(state, i);
+            continue;
+        }
+        peer->attached = 1;
+    }
+
+    // Outbound: collect doorbells, forget consumers that went away
+    pthread_rwlock_wrlock(&state->out_lock);
+    for (int i = state->out_count - 1; i >= 0; i--) {
+        ShmOutPeer *peer = &state->out[i];
+        if (peer->bell) {
+            if (!shm_bus_link_alive(peer->fd)) shm_bus_drop_out(state, i);
+            continue;
+        }
+
+        int bell_fd;
+        int got = shm_bus_recv_fd(peer->fd, &bell_fd);
+        if (got > 0) peer->bell = shm_doorbell_attach(bell_fd);
+        if (got < 0 || (got > 0 && !peer->bell)) shm_bus_drop_out(state, i);
+    }
+    pthread_rwlock_unlock(&state->out_lock);
+
+    if (get_monotonic_ms() - state->scanned_ms >= SHM_BUS_RESCAN_MS) shm_bus_scan(state);
+    shm_bus_update_peers(bus, state);
+    return 0;
+}
+
+static int shm_bus_open(ChatBus *bus, const char *address) {
+    ShmBus *state = calloc(1, sizeof(ShmBus));
+    if (!state) return -1;
+
+    if (snprintf(state->dir, sizeof(state->dir), "%s", address) >= (int)sizeof(state->dir) ||
+        (mkdir(state->dir, 0700) < 0 && errno != EEXIST)) {
+        free(state);
+        return -1;
+    }
+
+    state->self.sun_family = AF_UNIX;
+    snprintf(state->self.sun_path, sizeof(state->self.sun_path), "%s/chat-%d.shm",
+             state->dir, (int)getpid());
+    unlink(state->self.sun_path);
+
+    state->bell = shm_doorbell_create(&state->bell_fd);
+    state->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (!state->bell || state->listen_fd < 0 ||
+        bind(state->listen_fd, (struct sockaddr*)&state->self, sizeof(state->self)) < 0 ||
+        listen(state->listen_fd, SHM_BUS_MAX_PEERS) < 0) {
+        if (state->listen_fd >= 0) close(state->listen_fd);
+        if (state->bell) {
+            shm_doorbell_detach(state->bell);
+            close(state->bell_fd);
+        }
+        free(state);
+        return -1;
+    }
+
+    pthread_rwlock_init(&state->out_lock, NULL);
+    bus->state = state;
+    return 0;
+}
+
+static int shm_bus_send(ChatBus *bus, const struct iovec *iov, int iovcnt) {
+    ShmBus *state = bus->state;
+    int failed = 0;
+
+    pthread_rwlock_rdlock(&state->out_lock);
+    for (int i = 0; i < state->out_count; i++) {
+        ShmOutPeer *peer = &state->out[i];
+        if (!peer->bell) continue;
+        if (shm_ring_push(&peer->ring, iov, iovcnt) < 0) {
+            // The consumer is behind by a whole ring; it misses this message
+            atomic_fetch_add(&bus->dropped, 1);
+            failed++;
+            continue;
+        }
+        shm_doorbell_ring(peer->bell);
+    }
+    pthread_rwlock_unlock(&state->out_lock);
+
+    return failed ? -1 : 0;
+}
+
+static void shm_bus_run(ChatBus *bus) {
+    ShmBus *state = bus->state;
+    long long maintained_ms = 0;
+
+    for (;;) {
+        int drained = shm_bus_drain(bus, state);
+
+        long long now = get_monotonic_ms();
+        if (now - maintained_ms >= SHM_BUS_MAINTAIN_MS) {
+            if (shm_bus_maintain(bus, state) < 0) break;
+            maintained_ms = now;
+        }
+        if (drained) continue;
+
+        uint32_t seq = shm_doorbell_prepare(state->bell);
+        if (!shm_bus_idle(state)) {
+            shm_doorbell_cancel(state->bell);
+            continue;
+        }
+        shm_doorbell_wait(state->bell, seq, SHM_BUS_MAINTAIN_MS);
+    }
+}
+
+static void shm_bus_close(ChatBus *bus) {
+    ShmBus *state = bus->state;
+    if (!state) return;
+
+    close(state->listen_fd);
+    unlink(state->self.sun_path);
+    while (state->in_count > 0) shm_bus_drop_in(state, state->in_count - 1);
+    while (state->out_count > 0) shm_bus_drop_out(state, state->out_count - 1);
+    shm_doorbell_detach(state->bell);
+    close(state->bell_fd);
+    pthread_rwlock_destroy(&state->out_lock);
+    free(state);
+    bus->state = NULL;
+}
+
+const ChatBusTransport chat_bus_shm_transport = {
+    .name = "shm",
+    .open = shm_bus_open,
+    .send = shm_bus_send,
+    .run = shm_bus_run,
+    .close = shm_bus_close,
+};
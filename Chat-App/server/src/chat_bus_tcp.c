@@ -0,0 +1,334 @@
+// Multi-host bus transport: one TCP connection to chat_bus_broker, which
+// relays every message to the other connected processes. Messages are
+// framed by a 4-byte little-endian length. Publishers never wait on the
+// broker: a frame the socket cannot take at once is queued, up to
+// TCP_BUS_MAX_BACKLOG, and the bus thread writes the queue out as the
+// socket drains. Past that, and while the broker is unreachable (the bus
+// thread reconnects every second), messages are dropped.
+#define _GNU_SOURCE
+#include "chat_bus.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+
+#define TCP_BUS_RECONNECT_MS 1000
+#define TCP_BUS_MAX_BACKLOG (4 * 1024 * 1024)
+#define TCP_BUS_TX_INITIAL 65536
+#define TCP_BUS_FRAME_MAX (CHAT_BUS_HEADER_SIZE + CHAT_BUS_MAX_PAYLOAD)
+
+typedef struct {
+    char host[128];
+    char port[16];
+    pthread_mutex_t lock;     // guards fd and tx between publishers and the bus thread
+    int fd;                   // -1 while disconnected
+    int kick_fd;              // eventfd: tx has become non-empty
+    unsigned char *tx;        // frames the socket has not taken yet
+    size_t tx_len;
+    size_t tx_cap;
+    size_t tx_head_left;      // unsent bytes of the frame at the front of tx
+    unsigned long tx_frames;  // frames in tx, the front one included
+    unsigned char *rx;
+    size_t rx_len;
+} TcpBus;
+
+static int tcp_bus_connect(TcpBus *state) {
+    struct addrinfo hints = {0}, *addrs, *addr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(state->host, state->port, &hints, &addrs) != 0) return -1;
+
+    int fd = -1;
+    for (addr = addrs; addr; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) == 0) break;
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addrs);
+    if (fd < 0) return -1;
+
+    // Publishers run on the reactors, so writes must never wait
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    pthread_mutex_lock(&state->lock);
+    state->fd = fd;
+    pthread_mutex_unlock(&state->lock);
+    state->rx_len = 0;
+    return 0;
+}
+
+// The queue is only meaningful on the connection it was started on
+static void tcp_bus_disconnect(ChatBus *bus, TcpBus *state) {
+    pthread_mutex_lock(&state->lock);
+    if (state->fd >= 0) close(state->fd);
+    state->fd = -1;
+    atomic_fetch_add(&bus->dropped, state->tx_frames);
+    state->tx_len = 0;
+    state->tx_head_left = 0;
+    state->tx_frames = 0;
+    pthread_mutex_unlock(&state->lock);
+    state->rx_len = 0;
+}
+
+// Account for n bytes written from the front of tx (or of a frame not yet
+// queued when tx is empty)
+static void tcp_bus_consume(TcpBus *state, size_t n) {
+    size_t pos = 0;
+
+    while (n > 0 && state->tx_head_left > 0) {
+        size_t take = n < state->tx_head_left ? n : state->tx_head_left;
+        state->tx_head_left -= take;
+        n -= take;
+        pos += take;
+        if (state->tx_head_left > 0) break;
+
+        // Next frame, if any: its length prefix is at the new front
+        state->tx_frames--;
+        if (pos < state->tx_len) {
+            const unsigned char *p = state->tx + pos;
+            state->tx_head_left = 4 + (p[0] | (p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24));
+        }
+    }
+    memmove(state->tx, state->tx + pos, state->tx_len - pos);
+    state->tx_len -= pos;
+}
+
+// Write out what the socket takes of tx, with the lock held; -1 if the
+// link is gone
+static int tcp_bus_flush(TcpBus *state) {
+    while (state->tx_len > 0) {
+        ssize_t n = send(state->fd, state->tx, state->tx_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        tcp_bus_consume(state, n);
+    }
+    return 0;
+}
+
+// Append iov[0, iovcnt) to tx as one frame, skipping its first skip bytes
+// (already written); -1 if the backlog is full
+static int tcp_bus_queue(TcpBus *state, const struct iovec *iov, int iovcnt, size_t len, size_t skip) {
+    if (state->tx_len + len - skip > TCP_BUS_MAX_BACKLOG) return -1;
+    if (state->tx_len + len - skip > state->tx_cap) {
+        size_t cap = state->tx_cap ? state->tx_cap : TCP_BUS_TX_INITIAL;
+        while (cap < state->tx_len + len - skip) cap *= 2;
+        unsigned char *grown = realloc(state->tx, cap);
+        if (!grown) return -1;
+        state->tx = grown;
+        state->tx_cap = cap;
+    }
+
+    if (state->tx_frames == 0) state->tx_head_left = len - skip;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t part = iov[i].iov_len;
+        if (skip >= part) {
+            skip -= part;
+            continue;
+        }
+        memcpy(state->tx + state->tx_len, (const unsigned char*)iov[i].iov_base + skip, part - skip);
+        state->tx_len += part - skip;
+        skip = 0;
+    }
+    state->tx_frames++;
+    return 0;
+}
+
+static int tcp_bus_open(ChatBus *bus, const char *address) {
+    const char *colon = strrchr(address, ':');
+    TcpBus *state = calloc(1, sizeof(TcpBus));
+    if (!state || !colon || colon == address || !colon[1] ||
+        (size_t)(colon - address) >= sizeof(state->host) || strlen(colon + 1) >= sizeof(state->port)) {
+        free(state);
+        return -1;
+    }
+
+    memcpy(state->host, address, colon - address);
+    strcpy(state->port, colon + 1);
+    state->fd = -1;
+    state->kick_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    state->rx = malloc(2 * (4 + TCP_BUS_FRAME_MAX));
+    if (!state->rx || state->kick_fd < 0) {
+        if (state->kick_fd >= 0) close(state->kick_fd);
+        free(state->rx);
+        free(state);
+        return -1;
+    }
+    pthread_mutex_init(&state->lock, NULL);
+    bus->state = state;
+
+    if (tcp_bus_connect(state) < 0) {
+        log_error("Message broker %s unreachable, retrying in the background", address);
+    }
+    return 0;
+}
+
+static int tcp_bus_send(ChatBus *bus, const struct iovec *msg, int msgcnt) {
+    TcpBus *state = bus->state;
+    struct iovec iov[4];
+    size_t len = 0;
+    int iovcnt = 1;
+
+    if (msgcnt > 3) return -1;
+    for (int i = 0; i < msgcnt; i++) {
+        len += msg[i].iov_len;
+        iov[iovcnt++] = msg[i];
+    }
+    unsigned char prefix[4] = {len & 0xFF, (len >> 8) & 0xFF, (len >> 16) & 0xFF, (len >> 24) & 0xFF};
+    iov[0].iov_base = prefix;
+    iov[0].iov_len = 4;
+
+    pthread_mutex_lock(&state->lock);
+    if (state->fd < 0) {
+        pthread_mutex_unlock(&state->lock);
+        atomic_fetch_add(&bus->dropped, 1);
+        return -1;
+    }
+
+    // Straight to the socket unless frames are already waiting ahead
+    size_t sent = 0;
+    if (state->tx_len == 0) {
+        struct msghdr header = {.msg_iov = iov, .msg_iovlen = iovcnt};
+        ssize_t n;
+        do {
+            n = sendmsg(state->fd, &header, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            // The bus thread sees the link fail and reconnects
+            shutdown(state->fd, SHUT_RDWR);
+            pthread_mutex_unlock(&state->lock);
+            atomic_fetch_add(&bus->dropped, 1);
+            return -1;
+        }
+        if (n > 0) sent = n;
+        if (sent == 4 + len) {
+            pthread_mutex_unlock(&state->lock);
+            return 0;
+        }
+    }
+
+    // The rest of a half-written frame has to follow it, or the stream
+    // would desynchronise: if even that cannot be queued, give the link up
+    int was_empty = state->tx_len == 0;
+    if (tcp_bus_queue(state, iov, iovcnt, 4 + len, sent) < 0) {
+        if (sent > 0) shutdown(state->fd, SHUT_RDWR);
+        pthread_mutex_unlock(&state->lock);
+        atomic_fetch_add(&bus->dropped, 1);
+        return -1;
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    // The bus thread only watches for POLLOUT while tx is non-empty
+    if (was_empty) {
+        uint64_t one = 1;
+        ssize_t ignored = write(state->kick_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+    return 0;
+}
+
+// Hand every complete frame in rx to the bus; -1 on a corrupt stream
+static int tcp_bus_dispatch_frames(ChatBus *bus, TcpBus *state) {
+    size_t pos = 0;
+
+    while (state->rx_len - pos >= 4) {
+        const unsigned char *p = state->rx + pos;
+        size_t len = p[0] | (p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24);
+        if (len > TCP_BUS_FRAME_MAX) return -1;
+        if (state->rx_len - pos - 4 < len) break;
+
+        chat_bus_dispatch(bus, p + 4, len);
+        pos += 4 + len;
+    }
+    memmove(state->rx, state->rx + pos, state->rx_len - pos);
+    state->rx_len -= pos;
+    return 0;
+}
+
+static void tcp_bus_run(ChatBus *bus) {
+    TcpBus *state = bus->state;
+    size_t rx_cap = 2 * (4 + TCP_BUS_FRAME_MAX);
+
+    for (;;) {
+        // Only this thread changes fd, so reading it unlocked is safe
+        int fd = state->fd;
+        pthread_mutex_lock(&state->lock);
+        int backlog = state->tx_len > 0;
+        pthread_mutex_unlock(&state->lock);
+
+        struct pollfd fds[3] = {
+            {.fd = bus->wake_fd, .events = POLLIN},
+            {.fd = state->kick_fd, .events = POLLIN},
+            {.fd = fd, .events = POLLIN | (backlog ? POLLOUT : 0)},
+        };
+        int ready = poll(fds, fd >= 0 ? 3 : 2, fd >= 0 ? -1 : TCP_BUS_RECONNECT_MS);
+        if (ready < 0 && errno != EINTR) break;
+        if (fds[0].revents) break;
+        if (fds[1].revents) {
+            uint64_t value;
+            while (read(state->kick_fd, &value, sizeof(value)) > 0) {}
+        }
+
+        if (fd < 0) {
+            if (ready == 0 && tcp_bus_connect(state) == 0) {
+                log_info("Message broker %s:%s connected", state->host, state->port);
+            }
+            continue;
+        }
+        if (fds[2].revents & POLLOUT) {
+            pthread_mutex_lock(&state->lock);
+            int flushed = tcp_bus_flush(state);
+            pthread_mutex_unlock(&state->lock);
+            if (flushed < 0) {
+                log_error("Message broker %s:%s disconnected", state->host, state->port);
+                tcp_bus_disconnect(bus, state);
+                continue;
+            }
+        }
+        if (!(fds[2].revents & ~POLLOUT)) continue;
+
+        ssize_t n = recv(fd, state->rx + state->rx_len, rx_cap - state->rx_len, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n > 0) {
+            state->rx_len += n;
+            if (tcp_bus_dispatch_frames(bus, state) == 0) continue;
+        }
+        log_error("Message broker %s:%s disconnected", state->host, state->port);
+        tcp_bus_disconnect(bus, state);
+    }
+}
+
+static void tcp_bus_close(ChatBus *bus) {
+    TcpBus *state = bus->state;
+    if (!state) return;
+
+    tcp_bus_disconnect(bus, state);
+    pthread_mutex_destroy(&state->lock);
+    close(state->kick_fd);
+    free(state->tx);
+    free(state->rx);
+    free(state);
+    bus->state = NULL;
+}
+
+const ChatBusTransport chat_bus_tcp_transport = {
+    .name = "tcp",
+    .open = tcp_bus_open,
+    .send = tcp_bus_send,
+    .run = tcp_bus_run,
+    .close = tcp_bus_close,
+};
@@ -0,0 +1,176 @@
+// Single-host bus transport: each process binds DIR/chat-<pid>.sock as a
+// datagram socket and publishes with one non-blocking sendmsg per peer.
+// Peers are found by listing DIR, at most once a second; sockets left by
+// a crashed process refuse datagrams and are removed.
+#define _GNU_SOURCE
+#include "chat_bus.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define UNIX_BUS_MAX_PEERS 64
+#define UNIX_BUS_RESCAN_MS 1000
+#define UNIX_BUS_SOCKET_BUFFER (4 * 1024 * 1024)
+
+typedef struct {
+    int fd;
+    char dir[80];
+    struct sockaddr_un self;
+    pthread_mutex_t peers_lock;
+    struct sockaddr_un peers[UNIX_BUS_MAX_PEERS];
+    int peer_count;
+    long long scanned_ms;     // 0 forces a rescan
+} UnixBus;
+
+static int unix_bus_is_socket_name(const char *name) {
+    size_t len = strlen(name);
+    return strncmp(name, "chat-", 5) == 0 && len > 10 && strcmp(name + len - 5, ".sock") == 0;
+}
+
+// Caller holds peers_lock
+static void unix_bus_scan(UnixBus *state) {
+    DIR *dir = opendir(state->dir);
+    struct dirent *entry;
+
+    state->peer_count = 0;
+    state->scanned_ms = get_monotonic_ms();
+    if (!dir) return;
+
+    while ((entry = readdir(dir)) && state->peer_count < UNIX_BUS_MAX_PEERS) {
+        if (!unix_bus_is_socket_name(entry->d_name)) continue;
+
+        struct sockaddr_un *peer = &state->peers[state->peer_count];
+        memset(peer, 0, sizeof(*peer));
+        peer->sun_family = AF_UNIX;
+        if (snprintf(peer->sun_path, sizeof(peer->sun_path), "%s/%s", state->dir,
+                     entry->d_name) >= (int)sizeof(peer->sun_path)) {
+            continue;
+        }
+        if (strcmp(peer->sun_path, state->self.sun_path) == 0) continue;
+        state->peer_count++;
+    }
+    closedir(dir);
+}
+
+static int unix_bus_open(ChatBus *bus, const char *address) {
+    UnixBus *state = calloc(1, sizeof(UnixBus));
+    if (!state) return -1;
+
+    if (snprintf(state->dir, sizeof(state->dir), "%s", address) >= (int)sizeof(state->dir)) {
+        free(state);
+        return -1;
+    }
+    if (mkdir(state->dir, 0700) < 0 && errno != EEXIST) {
+        free(state);
+        return -1;
+    }
+
+    state->self.sun_family = AF_UNIX;
+    snprintf(state->self.sun_path, sizeof(state->self.sun_path), "%s/chat-%d.sock",
+             state->dir, (int)getpid());
+    unlink(state->self.sun_path);
+
+    state->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (state->fd < 0 || bind(state->fd, (struct sockaddr*)&state->self, sizeof(state->self)) < 0) {
+        if (state->fd >= 0) close(state->fd);
+        free(state);
+        return -1;
+    }
+
+    // Room for bursts while the bus thread is busy fanning out
+    int size = UNIX_BUS_SOCKET_BUFFER;
+    setsockopt(state->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(state->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    pthread_mutex_init(&state->peers_lock, NULL);
+    bus->state = state;
+    return 0;
+}
+
+static int unix_bus_send(ChatBus *bus, const struct iovec *iov, int iovcnt) {
+    UnixBus *state = bus->state;
+    struct msghdr msg = {.msg_namelen = sizeof(struct sockaddr_un), .msg_iov = (struct iovec*)iov,
+                         .msg_iovlen = iovcnt};
+    size_t len = 0;
+    int delivered = 0;
+
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+
+    pthread_mutex_lock(&state->peers_lock);
+    if (state->scanned_ms == 0 || get_monotonic_ms() - state->scanned_ms >= UNIX_BUS_RESCAN_MS) {
+        unix_bus_scan(state);
+    }
+
+    for (int i = 0; i < state->peer_count; i++) {
+        struct sockaddr_un *peer = &state->peers[i];
+        msg.msg_name = peer;
+        if (sendmsg(state->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)len) {
+            delivered++;
+            continue;
+        }
+
+        if (errno == ECONNREFUSED) {
+            // Nobody is bound there any more: the process exited or crashed
+            unlink(peer->sun_path);
+            state->scanned_ms = 0;
+        } else if (errno == ENOENT) {
+            state->scanned_ms = 0;
+        } else {
+            // EAGAIN: the peer's queue is full; it misses this message
+            atomic_fetch_add(&bus->dropped, 1);
+        }
+    }
+    atomic_store(&bus->peers, state->peer_count);
+    pthread_mutex_unlock(&state->peers_lock);
+
+    return delivered == state->peer_count ? 0 : -1;
+}
+
+static void unix_bus_run(ChatBus *bus) {
+    UnixBus *state = bus->state;
+    unsigned char *buf = malloc(CHAT_BUS_HEADER_SIZE + CHAT_BUS_MAX_PAYLOAD);
+    if (!buf) return;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            {.fd = state->fd, .events = POLLIN},
+            {.fd = bus->wake_fd, .events = POLLIN},
+        };
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        if (fds[1].revents) break;
+
+        ssize_t n;
+        while ((n = recv(state->fd, buf, CHAT_BUS_HEADER_SIZE + CHAT_BUS_MAX_PAYLOAD,
+                         MSG_DONTWAIT)) > 0) {
+            chat_bus_dispatch(bus, buf, (size_t)n);
+        }
+    }
+    free(buf);
+}
+
+static void unix_bus_close(ChatBus *bus) {
+    UnixBus *state = bus->state;
+    if (!state) return;
+
+    close(state->fd);
+    unlink(state->self.sun_path);
+    pthread_mutex_destroy(&state->peers_lock);
+    free(state);
+    bus->state = NULL;
+}
+
+const ChatBusTransport chat_bus_unix_transport = {
+    .name = "unix",
+    .open = unix_bus_open,
+    .send = unix_bus_send,
+    .run = unix_bus_run,
+    .close = unix_bus_close,
+};
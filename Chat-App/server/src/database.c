@@ -217,6 +217,27 @@ int db_remove_user_from_room(int room_id, int user_id) {
     return -1;
 }
 
+// 1 if user_id is a member of room_id, 0 if not, -1 if the room does not exist
+int db_is_user_in_room(int room_id, int user_id) {
+    pthread_mutex_lock(&g_db.mutex_rooms);
+    
+    for (int i = 0; i < g_db.room_count; i++) {
+        if (g_db.rooms[i].room_id == room_id) {
+            for (int j = 0; j < g_db.rooms[i].current_user_count; j++) {
+                if (g_db.rooms[i].user_ids[j] == user_id) {
+                    pthread_mutex_unlock(&g_db.mutex_rooms);
+                    return 1;
+                }
+            }
+            pthread_mutex_unlock(&g_db.mutex_rooms);
+            return 0;
+        }
+    }
+    
+    pthread_mutex_unlock(&g_db.mutex_rooms);
+    return -1;
+}
+
 int db_get_room_users(int room_id, int *user_ids, int max_count) {
     pthread_mutex_lock(&g_db.mutex_rooms);
     
@@ -0,0 +1,137 @@
+#include "event_loop.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+#define MAX_EVENTS_PER_WAIT 256
+
+int event_loop_init(EventLoop *loop) {
+    memset(loop, 0, sizeof(EventLoop));
+    loop->wake_fd = -1;
+    loop->running = 1;        // so a stop before run() is not lost
+    timer_wheel_init(&loop->timers);
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        log_error("Failed to create epoll instance: %s", strerror(errno));
+        return -1;
+    }
+
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_fd < 0) {
+        log_error("Failed to create eventfd: %s", strerror(errno));
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    // The wake fd is the only registration with a NULL data pointer
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0) {
+        log_error("Failed to register eventfd: %s", strerror(errno));
+        close(loop->wake_fd);
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void event_loop_release_retired(EventLoop *loop) {
+    while (loop->retired) {
+        EventSource *src = loop->retired;
+        loop->retired = src->retired_next;
+        src->release(src);
+    }
+}
+
+void event_loop_cleanup(EventLoop *loop) {
+    event_loop_release_retired(loop);
+    if (loop->wake_fd >= 0) {
+        close(loop->wake_fd);
+        loop->wake_fd = -1;
+    }
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
+
+int event_loop_add(EventLoop *loop, EventSource *src, uint32_t events) {
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = src;
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+int event_loop_mod(EventLoop *loop, EventSource *src, uint32_t events) {
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = src;
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, src->fd, &ev);
+}
+
+int event_loop_del(EventLoop *loop, EventSource *src) {
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+}
+
+void event_loop_retire(EventLoop *loop, EventSource *src, event_release release) {
+    event_loop_del(loop, src);
+    src->retired = 1;
+    src->release = release;
+    src->retired_next = loop->retired;
+    loop->retired = src;
+}
+
+int event_loop_run(EventLoop *loop) {
+    struct epoll_event events[MAX_EVENTS_PER_WAIT];
+
+    while (loop->running) {
+        int timeout = timer_wheel_next_timeout(&loop->timers, get_monotonic_ms());
+        int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS_PER_WAIT, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_error("epoll_wait failed: %s", strerror(errno));
+            return -1;
+        }
+
+        // Timers first, so handlers see the current wheel time
+        timer_wheel_advance(&loop->timers, get_monotonic_ms());
+
+        for (int i = 0; i < n; i++) {
+            EventSource *src = events[i].data.ptr;
+
+            if (!src) {
+                uint64_t value;
+                while (read(loop->wake_fd, &value, sizeof(value)) > 0) {}
+                continue;
+            }
+
+            // Closed earlier in this batch, by a timer or another source
+            if (src->retired) continue;
+            src->on_event(src, events[i].events);
+        }
+
+        event_loop_release_retired(loop);
+    }
+
+    return 0;
+}
+
+void event_loop_wake(EventLoop *loop) {
+    uint64_t one = 1;
+
+    if (loop->wake_fd >= 0) {
+        ssize_t ignored = write(loop->wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void event_loop_stop(EventLoop *loop) {
+    loop->running = 0;
+    event_loop_wake(loop);
+}
@@ -0,0 +1,325 @@
+#include "http_parser.h"
+#include <string.h>
+#include <strings.h>
+
+#define HTTP_CHUNK_LINE_MAX 64        // size line, extensions included
+
+enum {
+    HTTP_STATE_REQUEST_LINE = 0,
+    HTTP_STATE_HEADERS,
+    HTTP_STATE_BODY,
+    HTTP_STATE_CHUNK_SIZE,
+    HTTP_STATE_CHUNK_DATA,
+    HTTP_STATE_CHUNK_END,
+    HTTP_STATE_TRAILERS,
+    HTTP_STATE_DONE,
+    HTTP_STATE_ERROR
+};
+
+void http_parser_init(HTTPParser *parser, size_t max_header_size, size_t max_body_size) {
+    memset(parser, 0, sizeof(HTTPParser));
+    parser->max_header_size = max_header_size ? max_header_size : HTTP_DEFAULT_MAX_HEADER_SIZE;
+    parser->max_body_size = max_body_size;
+}
+
+static HTTPParseResult http_parser_fail(HTTPParser *parser, int status) {
+    parser->state = HTTP_STATE_ERROR;
+    parser->status = status;
+    return HTTP_PARSE_ERROR;
+}
+
+static HTTPSpan http_span(size_t start, size_t end) {
+    HTTPSpan span = {(uint32_t)start, (uint32_t)(end - start)};
+    return span;
+}
+
+static int http_is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// RFC 7230 tchar
+static int http_is_token_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           (c && strchr("!#$%&'*+-.^_`|~", c));
+}
+
+static int http_name_is(const char *name, size_t len, const char *want) {
+    return strlen(want) == len && strncasecmp(name, want, len) == 0;
+}
+
+// 1 if the comma-separated value in span holds token (case-insensitive)
+static int http_span_has_token(const char *buf, HTTPSpan span, const char *token) {
+    const char *value = buf + span.off;
+    size_t token_len = strlen(token);
+    size_t i = 0;
+
+    while (i < span.len) {
+        while (i < span.len && (value[i] == ',' || http_is_space(value[i]))) i++;
+        size_t item = i;
+        while (i < span.len && value[i] != ',') i++;
+        size_t item_end = i;
+        while (item_end > item && http_is_space(value[item_end - 1])) item_end--;
+
+        if (item_end - item == token_len && strncasecmp(value + item, token, token_len) == 0) return 1;
+    }
+    return 0;
+}
+
+// Next complete line from line_start: 1 with [start, end) excluding the
+// line ending, 0 if it has not fully arrived
+static int http_next_line(HTTPParser *parser, const char *buf, size_t len, size_t *start, size_t *end) {
+    const char *nl = memchr(buf + parser->scanned, '\n', len - parser->scanned);
+    if (!nl) {
+        parser->scanned = len;
+        return 0;
+    }
+
+    *start = parser->line_start;
+    *end = nl - buf;
+    parser->scanned = parser->line_start = *end + 1;
+    if (*end > *start && buf[*end - 1] == '\r') (*end)--;
+    return 1;
+}
+
+// "METHOD SP target SP HTTP/1.x"; returns 0 or the status to refuse with
+static int http_parse_request_line(HTTPParser *parser, const char *buf, size_t start, size_t end) {
+    const char *line = buf + start;
+    size_t len = end - start;
+
+    const char *sp1 = memchr(line, ' ', len);
+    if (!sp1 || sp1 == line) return 400;
+    for (const char *p = line; p < sp1; p++) {
+        if (!http_is_token_char(*p)) return 400;
+    }
+
+    const char *target = sp1 + 1;
+    const char *sp2 = memchr(target, ' ', line + len - target);
+    if (!sp2 || sp2 == target) return 400;
+    for (const char *p = target; p < sp2; p++) {
+        if ((unsigned char)*p <= ' ' || *p == 0x7F) return 400;
+    }
+    // Origin form, or "*" for OPTIONS
+    if (*target != '/' && !(*target == '*' && sp2 == target + 1)) return 400;
+
+    const char *version = sp2 + 1;
+    size_t version_len = line + len - version;
+    if (version_len < 5 || memcmp(version, "HTTP/", 5) != 0) return 400;
+    if (version_len != 8 || version[5] != '1' || version[6] != '.' ||
+        (version[7] != '0' && version[7] != '1')) {
+        return 505;
+    }
+
+    parser->method = http_span(start, sp1 - buf);
+    parser->target = http_span(target - buf, sp2 - buf);
+    const char *query = memchr(target, '?', sp2 - target);
+    parser->path = http_span(target - buf, (query ? query : sp2) - buf);
+    parser->query = query ? http_span(query + 1 - buf, sp2 - buf) : http_span(sp2 - buf, sp2 - buf);
+    parser->version_minor = version[7] - '0';
+    return 0;
+}
+
+// Digits only; saturates past max so oversized bodies are told apart
+static int http_parse_length(const char *buf, HTTPSpan span, size_t max, size_t *out) {
+    size_t value = 0;
+
+    if (span.len == 0) return -1;
+    for (uint32_t i = 0; i < span.len; i++) {
+        char c = buf[span.off + i];
+        if (c < '0' || c > '9') return -1;
+        if (value <= max) value = value * 10 + (c - '0');
+    }
+    *out = value;
+    return 0;
+}
+
+// Record a header line; returns 0 or the status to refuse with
+static int http_parse_header_line(HTTPParser *parser, const char *buf, size_t start, size_t end) {
+    const char *line = buf + start;
+    const char *colon = memchr(line, ':', end - start);
+
+    // No name, or whitespace in it (which also rules out obsolete folding)
+    if (!colon || colon == line) return 400;
+    for (const char *p = line; p < colon; p++) {
+        if (!http_is_token_char(*p)) return 400;
+    }
+
+    size_t name_len = colon - line;
+    size_t value = colon + 1 - buf;
+    size_t value_end = end;
+    while (value < value_end && http_is_space(buf[value])) value++;
+    while (value_end > value && http_is_space(buf[value_end - 1])) value_end--;
+    HTTPSpan span = http_span(value, value_end);
+
+    if (parser->header_count == HTTP_PARSER_MAX_HEADERS) return 431;
+    HTTPHeader *header = &parser->headers[parser->header_count++];
+    header->name = http_span(start, colon - buf);
+    header->value = span;
+
+    if (http_name_is(line, name_len, "Content-Length")) {
+        size_t length;
+        if (http_parse_length(buf, span, parser->max_body_size, &length) < 0) return 400;
+        // Repeats must agree, or the body's end is ambiguous
+        if (parser->has_content_length && length != parser->content_length) return 400;
+        parser->has_content_length = 1;
+        parser->content_length = length;
+    } else if (http_name_is(line, name_len, "Transfer-Encoding")) {
+        if (parser->chunked || !http_name_is(buf + span.off, span.len, "chunked")) return 501;
+        parser->chunked = 1;
+    }
+    return 0;
+}
+
+// Headers are complete: settle connection reuse and how the body is framed
+static int http_headers_done(HTTPParser *parser, const char *buf) {
+    HTTPSpan connection;
+
+    // Both framings at once is how requests get smuggled past proxies
+    if (parser->chunked && parser->has_content_length) return 400;
+    if (parser->has_content_length && parser->content_length > parser->max_body_size) return 413;
+
+    parser->header_bytes = parser->scanned;
+    parser->keep_alive = parser->version_minor == 1;
+    if (http_parser_header(parser, buf, "Connection", &connection)) {
+        if (http_span_has_token(buf, connection, "close")) parser->keep_alive = 0;
+        else if (http_span_has_token(buf, connection, "keep-alive")) parser->keep_alive = 1;
+    }
+
+    parser->body = http_span(parser->scanned, parser->scanned);
+    if (parser->chunked) {
+        parser->state = HTTP_STATE_CHUNK_SIZE;
+    } else if (parser->content_length > 0) {
+        parser->state = HTTP_STATE_BODY;
+    } else {
+        parser->request_len = parser->scanned;
+        parser->state = HTTP_STATE_DONE;
+    }
+    return 0;
+}
+
+// "HEX[;extensions]"; returns 0 or the status to refuse with
+static int http_parse_chunk_size(HTTPParser *parser, const char *buf, size_t start, size_t end) {
+    size_t size = 0;
+    size_t i = start;
+
+    for (; i < end; i++) {
+        char c = buf[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else break;
+        if (size <= parser->max_body_size) size = size * 16 + digit;
+    }
+    if (i == start || (i < end && buf[i] != ';' && !http_is_space(buf[i]))) return 400;
+    if (size > parser->max_body_size - parser->body.len) return 413;
+
+    parser->chunk_left = size;
+    parser->state = size ? HTTP_STATE_CHUNK_DATA : HTTP_STATE_TRAILERS;
+    return 0;
+}
+
+HTTPParseResult http_parser_parse(HTTPParser *parser, char *buf, size_t len) {
+    size_t start, end;
+    int status;
+
+    for (;;) {
+        switch (parser->state) {
+        case HTTP_STATE_REQUEST_LINE:
+        case HTTP_STATE_HEADERS:
+            if (!http_next_line(parser, buf, len, &start, &end)) {
+                if (len > parser->max_header_size) return http_parser_fail(parser, 431);
+                return HTTP_PARSE_INCOMPLETE;
+            }
+            if (parser->scanned > parser->max_header_size) return http_parser_fail(parser, 431);
+
+            if (parser->state == HTTP_STATE_REQUEST_LINE) {
+                // Empty lines before the request line are allowed (RFC 7230 3.5)
+                if (end == start) continue;
+                status = http_parse_request_line(parser, buf, start, end);
+                parser->state = HTTP_STATE_HEADERS;
+            } else if (end == start) {
+                status = http_headers_done(parser, buf);
+            } else {
+                status = http_parse_header_line(parser, buf, start, end);
+            }
+            if (status) return http_parser_fail(parser, status);
+            break;
+
+        case HTTP_STATE_BODY:
+            if (len - parser->body.off < parser->content_length) {
+                parser->scanned = len;
+                return HTTP_PARSE_INCOMPLETE;
+            }
+            parser->body.len = (uint32_t)parser->content_length;
+            parser->scanned = parser->request_len = parser->body.off + parser->content_length;
+            parser->state = HTTP_STATE_DONE;
+            break;
+
+        case HTTP_STATE_CHUNK_SIZE:
+            if (!http_next_line(parser, buf, len, &start, &end)) {
+                if (len - parser->line_start > HTTP_CHUNK_LINE_MAX) return http_parser_fail(parser, 400);
+                return HTTP_PARSE_INCOMPLETE;
+            }
+            if (end - start > HTTP_CHUNK_LINE_MAX) return http_parser_fail(parser, 400);
+            status = http_parse_chunk_size(parser, buf, start, end);
+            if (status) return http_parser_fail(parser, status);
+            break;
+
+        case HTTP_STATE_CHUNK_DATA: {
+            // Slide the data down to the end of the body decoded so far
+            size_t avail = len - parser->scanned;
+            if (avail > parser->chunk_left) avail = parser->chunk_left;
+            memmove(buf + parser->body.off + parser->body.len, buf + parser->scanned, avail);
+            parser->body.len += (uint32_t)avail;
+            parser->scanned += avail;
+            parser->chunk_left -= avail;
+            if (parser->chunk_left > 0) return HTTP_PARSE_INCOMPLETE;
+            parser->state = HTTP_STATE_CHUNK_END;
+            break;
+        }
+
+        case HTTP_STATE_CHUNK_END:
+            if (len - parser->scanned < 1 || (buf[parser->scanned] == '\r' && len - parser->scanned < 2)) {
+                return HTTP_PARSE_INCOMPLETE;
+            }
+            if (buf[parser->scanned] == '\r') parser->scanned++;
+            if (buf[parser->scanned] != '\n') return http_parser_fail(parser, 400);
+            parser->scanned = parser->line_start = parser->scanned + 1;
+            parser->state = HTTP_STATE_CHUNK_SIZE;
+            break;
+
+        case HTTP_STATE_TRAILERS:
+            // Trailer fields are read past but not kept
+            if (!http_next_line(parser, buf, len, &start, &end)) {
+                if (parser->header_bytes + (len - parser->line_start) > parser->max_header_size) {
+                    return http_parser_fail(parser, 431);
+                }
+                return HTTP_PARSE_INCOMPLETE;
+            }
+            parser->header_bytes += parser->scanned - start;
+            if (parser->header_bytes > parser->max_header_size) return http_parser_fail(parser, 431);
+            if (end == start) {
+                parser->request_len = parser->scanned;
+                parser->state = HTTP_STATE_DONE;
+            }
+            break;
+
+        case HTTP_STATE_DONE:
+            return HTTP_PARSE_DONE;
+
+        default:
+            return HTTP_PARSE_ERROR;
+        }
+    }
+}
+
+int http_parser_header(const HTTPParser *parser, const char *buf, const char *name, HTTPSpan *value) {
+    for (int i = 0; i < parser->header_count; i++) {
+        const HTTPHeader *header = &parser->headers[i];
+        if (http_name_is(buf + header->name.off, header->name.len, name)) {
+            *value = header->value;
+            return 1;
+        }
+    }
+    return 0;
+}
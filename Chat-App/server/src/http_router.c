@@ -0,0 +1,252 @@
+#include "http_router.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define HTTP_PARAM_STATIC 0
+#define HTTP_PARAM_INT_MAX_DIGITS 18
+#define HTTP_ROUTER_MIN_SLOTS 8
+
+struct HTTPRouteNode {
+    int type;                 // HTTP_PARAM_STATIC or an HTTPParamType
+    char *text;               // literal segment, or parameter name
+    size_t text_len;
+    uint32_t hash;            // of a literal segment
+    HTTPRouteTarget targets[HTTP_METHOD_COUNT];
+    int has_target;
+
+    // Literal children in an open-addressed table, so a segment costs
+    // one hash however many siblings it has; at most one of each
+    // parameter kind sits beside them
+    HTTPRouteNode **literals;
+    size_t literal_count;
+    size_t literal_slots;     // power of two, or 0
+    HTTPRouteNode *int_param;
+    HTTPRouteNode *string_param;
+};
+
+static const char *g_method_names[HTTP_METHOD_COUNT] = {
+    "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS"
+};
+
+int http_method_from_name(const char *name) {
+    for (int method = 0; method < HTTP_METHOD_COUNT; method++) {
+        if (strcmp(g_method_names[method], name) == 0) return method;
+    }
+    return -1;
+}
+
+// FNV-1a
+static uint32_t route_hash(const char *seg, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)seg[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static HTTPRouteNode* route_node_create(int type, const char *text, size_t len) {
+    HTTPRouteNode *node = calloc(1, sizeof(HTTPRouteNode));
+    if (!node) return NULL;
+    node->type = type;
+    node->text = malloc(len + 1);
+    if (!node->text) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->text, text, len);
+    node->text[len] = '\0';
+    node->text_len = len;
+    node->hash = route_hash(text, len);
+    return node;
+}
+
+static void route_node_free(HTTPRouteNode *node) {
+    if (!node) return;
+    for (size_t i = 0; i < node->literal_slots; i++) route_node_free(node->literals[i]);
+    route_node_free(node->int_param);
+    route_node_free(node->string_param);
+    free(node->literals);
+    free(node->text);
+    free(node);
+}
+
+void http_router_init(HTTPRouter *router) {
+    router->root = route_node_create(HTTP_PARAM_STATIC, "", 0);
+}
+
+void http_router_destroy(HTTPRouter *router) {
+    route_node_free(router->root);
+    router->root = NULL;
+}
+
+static HTTPRouteNode* route_find_literal(const HTTPRouteNode *node, const char *seg, size_t len) {
+    if (node->literal_slots == 0) return NULL;
+
+    size_t mask = node->literal_slots - 1;
+    uint32_t hash = route_hash(seg, len);
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        HTTPRouteNode *child = node->literals[i];
+        if (!child) return NULL;
+        if (child->hash == hash && child->text_len == len && memcmp(child->text, seg, len) == 0) {
+            return child;
+        }
+    }
+}
+
+// ---- Registration ----
+
+// Keep the table at most half full
+static int route_insert_literal(HTTPRouteNode *node, HTTPRouteNode *child) {
+    if ((node->literal_count + 1) * 2 > node->literal_slots) {
+        size_t slots = node->literal_slots ? node->literal_slots * 2 : HTTP_ROUTER_MIN_SLOTS;
+        HTTPRouteNode **table = calloc(slots, sizeof(HTTPRouteNode*));
+        if (!table) return -1;
+        for (size_t i = 0; i < node->literal_slots; i++) {
+            HTTPRouteNode *moved = node->literals[i];
+            if (!moved) continue;
+            size_t j = moved->hash & (slots - 1);
+            while (table[j]) j = (j + 1) & (slots - 1);
+            table[j] = moved;
+        }
+        free(node->literals);
+        node->literals = table;
+        node->literal_slots = slots;
+    }
+
+    size_t i = child->hash & (node->literal_slots - 1);
+    while (node->literals[i]) i = (i + 1) & (node->literal_slots - 1);
+    node->literals[i] = child;
+    node->literal_count++;
+    return 0;
+}
+
+// Child of parent for one pattern segment, created if need be. NULL if
+// the segment is malformed or names a parameter differently from the
+// one already in its place.
+static HTTPRouteNode* route_child(HTTPRouteNode *parent, const char *seg, size_t len) {
+    int type = HTTP_PARAM_STATIC;
+
+    if (len > 0 && seg[0] == '{') {
+        if (len < 3 || seg[len - 1] != '}') return NULL;
+        seg++;
+        len -= 2;
+        type = HTTP_PARAM_STRING;
+        if (len > 4 && memcmp(seg + len - 4, ":int", 4) == 0) {
+            type = HTTP_PARAM_INT;
+            len -= 4;
+        }
+        if (len == 0 || memchr(seg, ':', len)) return NULL;
+    }
+    if (memchr(seg, '{', len) || memchr(seg, '}', len)) return NULL;
+
+    HTTPRouteNode *child;
+    if (type == HTTP_PARAM_STATIC) {
+        if ((child = route_find_literal(parent, seg, len)) != NULL) return child;
+        if (!(child = route_node_create(type, seg, len))) return NULL;
+        if (route_insert_literal(parent, child) < 0) {
+            route_node_free(child);
+            return NULL;
+        }
+        return child;
+    }
+
+    HTTPRouteNode **slot = type == HTTP_PARAM_INT ? &parent->int_param : &parent->string_param;
+    if (*slot) {
+        int same = (*slot)->text_len == len && memcmp((*slot)->text, seg, len) == 0;
+        return same ? *slot : NULL;
+    }
+    return *slot = route_node_create(type, seg, len);
+}
+
+int http_router_add(HTTPRouter *router, int method, const char *pattern, HTTPRouteTarget target) {
+    if (!router->root || method < 0 || method >= HTTP_METHOD_COUNT || !target || pattern[0] != '/') {
+        return -1;
+    }
+
+    HTTPRouteNode *node = router->root;
+    const char *p = pattern;
+    int params = 0;
+
+    while (*p == '/') {
+        const char *seg = p + 1;
+        const char *seg_end = strchr(seg, '/');
+        if (!seg_end) seg_end = seg + strlen(seg);
+
+        if (!(node = route_child(node, seg, seg_end - seg))) return -1;
+        if (node->type != HTTP_PARAM_STATIC && ++params > HTTP_ROUTER_MAX_PARAMS) return -1;
+        p = seg_end;
+    }
+    if (*p != '\0' || node->targets[method]) return -1;
+
+    node->targets[method] = target;
+    node->has_target = 1;
+    return 0;
+}
+
+// ---- Matching ----
+
+// Digits-only segment as a number; -1 if it is not one
+static long long route_parse_int(const char *seg, size_t len) {
+    long long value = 0;
+
+    if (len == 0 || len > HTTP_PARAM_INT_MAX_DIGITS) return -1;
+    for (size_t i = 0; i < len; i++) {
+        if (seg[i] < '0' || seg[i] > '9') return -1;
+        value = value * 10 + (seg[i] - '0');
+    }
+    return value;
+}
+
+// p is at the '/' before the next segment, or at end once node is the
+// last. *path_seen notes a node that matched the path under another method.
+static int route_match(const HTTPRouteNode *node, int method, const char *p, const char *end,
+                       HTTPRouteMatch *match, int *path_seen) {
+    if (p == end) {
+        if (!node->has_target) return 0;
+        if (method < 0 || !node->targets[method]) {
+            *path_seen = 1;
+            return 0;
+        }
+        match->target = node->targets[method];
+        return 1;
+    }
+
+    const char *seg = p + 1;
+    const char *seg_end = memchr(seg, '/', end - seg);
+    if (!seg_end) seg_end = end;
+    size_t len = seg_end - seg;
+
+    // Literal first, then {name:int}, then {name}
+    const HTTPRouteNode *literal = route_find_literal(node, seg, len);
+    if (literal && route_match(literal, method, seg_end, end, match, path_seen)) return 1;
+    if (len == 0 || match->param_count == HTTP_ROUTER_MAX_PARAMS) return 0;
+
+    long long number = 0;
+    const HTTPRouteNode *params[2] = {NULL, node->string_param};
+    if (node->int_param && (number = route_parse_int(seg, len)) >= 0) params[0] = node->int_param;
+
+    for (int i = 0; i < 2; i++) {
+        if (!params[i]) continue;
+        HTTPRouteParam *param = &match->params[match->param_count++];
+        param->name = params[i]->text;
+        param->value = seg;
+        param->len = len;
+        param->number = i == 0 ? number : 0;
+        if (route_match(params[i], method, seg_end, end, match, path_seen)) return 1;
+        match->param_count--;
+    }
+    return 0;
+}
+
+HTTPRouteResult http_router_match(const HTTPRouter *router, int method, const char *path, size_t len,
+                                  HTTPRouteMatch *match) {
+    int path_seen = 0;
+
+    match->target = NULL;
+    match->param_count = 0;
+    if (!router->root || len == 0 || path[0] != '/') return HTTP_ROUTE_NOT_FOUND;
+
+    if (route_match(router->root, method, path, path + len, match, &path_seen)) return HTTP_ROUTE_FOUND;
+    return path_seen ? HTTP_ROUTE_NO_METHOD : HTTP_ROUTE_NOT_FOUND;
+}
@@ -1,45 +1,123 @@
+#define _GNU_SOURCE
 #include "http_server.h"
 #include "authentication.h"
 #include "database.h"
 #include "utils.h"
 #include "thread_pool.h"
 #include "websocket_server.h"
+#include "event_loop.h"
+#include "json_index.h"
+#include "http_router.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 
-static int g_http_server_fd = -1;
+#define HTTP_LISTEN_BACKLOG 1024
+#define HTTP_CONN_INITIAL_BUFFER 4096
+#define HTTP_RESPONSE_MAX_IOV 7    // status, head, head end, chunk size, body, CRLF, last chunk
+
+typedef struct HTTPShard HTTPShard;
+
+// A client connection, owned by its shard's reactor. While a worker runs
+// its request (busy), the reactor leaves the connection alone apart from
+// noting that it died; the worker hands it back through the shard.
+typedef struct HTTPConn {
+    EventSource src;          // must stay first (event loop casts back to us)
+    HTTPShard *shard;
+    Timer idle_timer;
+    HTTPParser parser;        // for the request at the front of in
+    char *in;                 // bytes received, grown up to http_conn_max_buffer
+    size_t in_len;
+    size_t in_cap;            // not counting the byte kept for a terminator
+    size_t request_len;       // leading bytes of in taken by the current request
+    HTTPResponse *resp;       // being written; a streamed one between parts too
+    struct iovec iov[HTTP_RESPONSE_MAX_IOV];    // its current part, left to write
+    int iov_count;
+    int iov_index;
+    int requests;             // responses completed
+    int keep_alive;           // the current request allows another after it
+    int busy;
+    int peer_closed;          // no more input; finish buffered requests
+    int dead;                 // hang-up or error while busy
+    struct HTTPConn *prev, *next;
+    struct HTTPConn *done_next;
+} HTTPConn;
+
+// One reactor per shard with its own SO_REUSEPORT listener, so accepts
+// spread across cores instead of queueing on a single thread
+struct HTTPShard {
+    EventSource listen_src;   // must stay first (event loop casts back to us)
+    EventSource done_src;     // eventfd: workers finished requests
+    EventLoop loop;
+    int loop_ready;
+    pthread_t thread;
+    int thread_started;
+    HTTPConn *conns;
+    pthread_mutex_t done_lock;
+    HTTPConn *done;           // handed back by workers, newest first
+};
+
+static HTTPShard *g_http_shards = NULL;
+static int g_http_shard_count = 0;
+static int g_http_shard_config = 0;   // 0 = one per online CPU
 static int g_http_running = 0;
+static HTTPKeepAliveConfig g_keepalive_config = {
+    HTTP_DEFAULT_IDLE_TIMEOUT_MS,
+    HTTP_DEFAULT_MAX_REQUESTS,
+};
+static HTTPLimitsConfig g_limits_config = {
+    HTTP_DEFAULT_MAX_HEADER_SIZE,
+    HTTP_DEFAULT_MAX_BODY_SIZE,
+};
 
-void http_parse_request(const char *raw_request, HTTPRequest *req) {
-    memset(req, 0, sizeof(HTTPRequest));
-    
-    // Parse request line
-    char method[16], path[256], protocol[32];
-    sscanf(raw_request, "%s %s %s", method, path, protocol);
-    
-    strncpy(req->method, method, sizeof(req->method) - 1);
-    
-    // Parse path and query string
-    char *query_pos = strchr(path, '?');
-    if (query_pos) {
-        strncpy(req->query_string, query_pos + 1, sizeof(req->query_string) - 1);
-        *query_pos = '\0';
-    }
-    strncpy(req->path, path, sizeof(req->path) - 1);
-    
-    // Parse body (simple approach - find double CRLF)
-    const char *body_start = strstr(raw_request, "\r\n\r\n");
-    if (body_start) {
-        body_start += 4;
-        strncpy(req->body, body_start, sizeof(req->body) - 1);
-        req->content_length = strlen(req->body);
+typedef struct {
+    const char *method;
+    const char *pattern;
+    HTTPHandler handler;
+} HTTPRoute;
+
+static HTTPRouter g_router;   // filled before the shards start, then read-only
+
+// Point req at a parsed request, terminating its strings in buf. The
+// terminators overwrite delimiters the parser has already consumed; the
+// body's lands on the byte after the request, which the caller restores.
+static void http_request_bind(HTTPRequest *req, const HTTPParser *parser, char *buf) {
+    buf[parser->method.off + parser->method.len] = '\0';
+    buf[parser->path.off + parser->path.len] = '\0';
+    buf[parser->query.off + parser->query.len] = '\0';
+    for (int i = 0; i < parser->header_count; i++) {
+        const HTTPHeader *header = &parser->headers[i];
+        buf[header->value.off + header->value.len] = '\0';
     }
+    buf[parser->body.off + parser->body.len] = '\0';
+
+    req->method = buf + parser->method.off;
+    req->path = buf + parser->path.off;
+    req->query_string = buf + parser->query.off;
+    req->body = buf + parser->body.off;
+    req->content_length = parser->body.len;
+    req->parser = parser;
+    req->buf = buf;
+    req->json = NULL;
+    req->route = NULL;
+}
+
+const char* http_request_header(const HTTPRequest *req, const char *name) {
+    HTTPSpan value;
+    return http_parser_header(req->parser, req->buf, name, &value) ? req->buf + value.off : NULL;
 }
 
 // URL decode utility
@@ -62,478 +140,1206 @@ void http_url_decode(const char *src, char *dest, size_t dest_size) {
     dest[j] = '\0';
 }
 
-// Parse JSON-like string value (simple implementation)
-int http_parse_json_string(const char *json, const char *key, char *value, size_t max_len) {
-    char search_key[256];
-    snprintf(search_key, sizeof(search_key), "\"%s\":", key);
-    
-    const char *pos = strstr(json, search_key);
-    if (!pos) {
-        log_debug("Could not find key: %s", search_key);
-        return -1;
-    }
-    
-    pos += strlen(search_key);
-    
-    // Skip whitespace and colons
-    while (*pos && (*pos == ' ' || *pos == '\t' || *pos == ':')) pos++;
-    
-    // Check if value is string
-    if (*pos == '"') {
-        pos++;
-        size_t i = 0;
-        while (*pos && *pos != '"' && i < max_len - 1) {
-            value[i++] = *pos++;
-        }
-        value[i] = '\0';
-        log_debug("Parsed string value: %s", value);
-        return 0;
-    }
-    
-    log_debug("Expected quote but got: %c (ASCII %d)", *pos, *pos);
-    return -1;
+// s as a quoted JSON string in out, which needs 6 * strlen(s) + 3 bytes.
+// Request strings arrive unescaped, so they are escaped again on the way out.
+static const char* http_json_quote(char *out, const char *s) {
+    *json_put_string(out, s, strlen(s)) = '\0';
+    return out;
 }
 
-// Parse JSON-like integer value (simple implementation)
-int http_parse_json_int(const char *json, const char *key, int *value) {
-    char search_key[256];
-    snprintf(search_key, sizeof(search_key), "\"%s\":", key);
-    
-    const char *pos = strstr(json, search_key);
-    if (!pos) {
-        log_debug("Could not find key: %s", search_key);
-        return -1;
-    }
-    
-    pos += strlen(search_key);
-    
-    // Skip whitespace and colons
-    while (*pos && (*pos == ' ' || *pos == '\t' || *pos == ':')) pos++;
-    
-    // Parse integer value
-    if (*pos && (isdigit(*pos) || *pos == '-')) {
-        *value = atoi(pos);
-        log_debug("Parsed integer from position, value: %d", *value);
-        return 0;
+// ---- Responses ----
+
+#define HTTP_RESPONSE_POOL_MAX 256
+#define HTTP_RESPONSE_BODY_INITIAL 1024
+#define HTTP_RESPONSE_BODY_POOLED_MAX (64 * 1024)   // larger bodies are not kept
+#define HTTP_CONTENT_TYPE_MAX 96
+
+typedef struct {
+    int code;
+    const char *text;
+    const char *line;
+    size_t line_len;
+} HTTPStatus;
+
+#define HTTP_STATUS(code, text) \
+    {code, text, "HTTP/1.1 " #code " " text "\r\n", sizeof("HTTP/1.1 " #code " " text "\r\n") - 1}
+
+static const HTTPStatus g_http_statuses[] = {
+    HTTP_STATUS(200, "OK"),
+    HTTP_STATUS(400, "Bad Request"),
+    HTTP_STATUS(401, "Unauthorized"),
+    HTTP_STATUS(404, "Not Found"),
+    HTTP_STATUS(405, "Method Not Allowed"),
+    HTTP_STATUS(413, "Payload Too Large"),
+    HTTP_STATUS(431, "Request Header Fields Too Large"),
+    HTTP_STATUS(500, "Internal Server Error"),
+    HTTP_STATUS(501, "Not Implemented"),
+    HTTP_STATUS(503, "Service Unavailable"),
+    HTTP_STATUS(505, "HTTP Version Not Supported"),
+};
+
+// Every response ends its head with these
+#define HTTP_CORS_HEADERS \
+    "Access-Control-Allow-Origin: *\r\n" \
+    "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n" \
+    "Access-Control-Allow-Headers: Content-Type, Authorization\r\n" \
+    "Access-Control-Max-Age: 86400\r\n"
+static const char g_head_end_keep_alive[] = HTTP_CORS_HEADERS "Connection: keep-alive\r\n\r\n";
+static const char g_head_end_close[] = HTTP_CORS_HEADERS "Connection: close\r\n\r\n";
+static const char g_chunk_end[] = "\r\n";
+static const char g_last_chunk[] = "0\r\n\r\n";
+
+static pthread_mutex_t g_response_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static HTTPResponse *g_response_pool = NULL;
+static int g_response_pool_count = 0;
+
+static const HTTPStatus* http_status_find(int status_code) {
+    int count = sizeof(g_http_statuses) / sizeof(g_http_statuses[0]);
+    for (int i = 0; i < count; i++) {
+        if (g_http_statuses[i].code == status_code) return &g_http_statuses[i];
     }
-    
-    log_debug("Could not parse integer, char at pos: %c (ASCII %d)", *pos, *pos);
-    return -1;
+    return NULL;
+}
+
+static const char* http_status_text(int status_code) {
+    const HTTPStatus *status = http_status_find(status_code);
+    return status ? status->text : "OK";
 }
 
-// Response creators
 HTTPResponse* http_response_create(int status_code, const char *content_type) {
-    HTTPResponse *resp = malloc(sizeof(HTTPResponse));
-    if (!resp) return NULL;
-    
+    pthread_mutex_lock(&g_response_pool_lock);
+    HTTPResponse *resp = g_response_pool;
+    if (resp) {
+        g_response_pool = resp->pool_next;
+        g_response_pool_count--;
+    }
+    pthread_mutex_unlock(&g_response_pool_lock);
+
+    if (!resp && !(resp = calloc(1, sizeof(HTTPResponse)))) return NULL;
+
+    // The body buffer stays with a pooled response
     resp->status_code = status_code;
-    strncpy(resp->content_type, content_type, sizeof(resp->content_type) - 1);
-    memset(resp->body, 0, sizeof(resp->body));
-    
+    resp->content_type = content_type;
+    resp->body_len = 0;
+    resp->error = 0;
+    resp->writer = NULL;
+    resp->writer_arg = NULL;
+    resp->writer_free = NULL;
+    resp->started = 0;
+    resp->chunked = 0;
+    resp->pool_next = NULL;
     return resp;
 }
 
+static int http_response_reserve(HTTPResponse *resp, size_t extra) {
+    size_t need = resp->body_len + extra + 1;
+    if (need <= resp->body_cap) return 0;
+
+    size_t cap = resp->body_cap ? resp->body_cap : HTTP_RESPONSE_BODY_INITIAL;
+    while (cap < need) cap *= 2;
+    char *body = realloc(resp->body, cap);
+    if (!body) {
+        resp->error = 1;
+        return -1;
+    }
+    resp->body = body;
+    resp->body_cap = cap;
+    return 0;
+}
+
+int http_response_append(HTTPResponse *resp, const char *data, size_t len) {
+    if (!resp || http_response_reserve(resp, len) < 0) return -1;
+    memcpy(resp->body + resp->body_len, data, len);
+    resp->body_len += len;
+    resp->body[resp->body_len] = '\0';
+    return 0;
+}
+
+int http_response_appendf(HTTPResponse *resp, const char *fmt, ...) {
+    va_list args;
+    if (!resp || http_response_reserve(resp, 0) < 0) return -1;
+
+    // Format in place; only text longer than the room left is formatted twice
+    va_start(args, fmt);
+    int n = vsnprintf(resp->body + resp->body_len, resp->body_cap - resp->body_len, fmt, args);
+    va_end(args);
+    if (n < 0) return -1;
+    if ((size_t)n >= resp->body_cap - resp->body_len) {
+        if (http_response_reserve(resp, n) < 0) return -1;
+        va_start(args, fmt);
+        vsnprintf(resp->body + resp->body_len, resp->body_cap - resp->body_len, fmt, args);
+        va_end(args);
+    }
+    resp->body_len += n;
+    return 0;
+}
+
 void http_response_set_body(HTTPResponse *resp, const char *body) {
-    strncpy(resp->body, body, sizeof(resp->body) - 1);
+    if (!resp) return;
+    resp->body_len = 0;
+    http_response_append(resp, body, strlen(body));
 }
 
-void http_response_send(int client_fd, HTTPResponse *resp) {
-    const char *status_text = "OK";
-    
-    if (resp->status_code == 400) status_text = "Bad Request";
-    else if (resp->status_code == 401) status_text = "Unauthorized";
-    else if (resp->status_code == 404) status_text = "Not Found";
-    else if (resp->status_code == 500) status_text = "Internal Server Error";
-    
-    char header[2048];
-    snprintf(header, sizeof(header),
-             "HTTP/1.1 %d %s\r\n"
-             "Content-Type: %s\r\n"
-             "Content-Length: %zu\r\n"
-             "Access-Control-Allow-Origin: *\r\n"
-             "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
-             "Access-Control-Allow-Headers: Content-Type, Authorization\r\n"
-             "Access-Control-Max-Age: 86400\r\n"
-             "Connection: close\r\n"
-             "\r\n",
-             resp->status_code, status_text, resp->content_type, strlen(resp->body));
-    
-    send(client_fd, header, strlen(header), 0);
-    send(client_fd, resp->body, strlen(resp->body), 0);
+void http_response_stream(HTTPResponse *resp, HTTPBodyWriter writer, void *arg, void (*free_arg)(void *arg)) {
+    if (!resp) {
+        if (free_arg) free_arg(arg);
+        return;
+    }
+    resp->writer = writer;
+    resp->writer_arg = arg;
+    resp->writer_free = free_arg;
+}
+
+static void http_response_end_stream(HTTPResponse *resp) {
+    if (resp->writer_free) resp->writer_free(resp->writer_arg);
+    resp->writer = NULL;
+    resp->writer_arg = NULL;
+    resp->writer_free = NULL;
 }
 
 void http_response_free(HTTPResponse *resp) {
-    if (resp) free(resp);
+    if (!resp) return;
+    http_response_end_stream(resp);
+    if (resp->body_cap > HTTP_RESPONSE_BODY_POOLED_MAX) {
+        free(resp->body);
+        resp->body = NULL;
+        resp->body_cap = 0;
+    }
+
+    pthread_mutex_lock(&g_response_pool_lock);
+    if (g_response_pool_count < HTTP_RESPONSE_POOL_MAX) {
+        resp->pool_next = g_response_pool;
+        g_response_pool = resp;
+        g_response_pool_count++;
+        resp = NULL;
+    }
+    pthread_mutex_unlock(&g_response_pool_lock);
+
+    if (resp) {
+        free(resp->body);
+        free(resp);
+    }
 }
 
-// HTTP request handler (will be expanded with actual endpoints)
-static void handle_http_request(int client_fd) {
-    char buffer[4096] = {0};
-    ssize_t bytes = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    
-    if (bytes <= 0) {
-        close(client_fd);
-        return;
+// Run a streamed body's writer until the body holds a part's worth or
+// the writer is done (all of it with buffer_all); -1 on failure
+static int http_response_produce(HTTPResponse *resp, int buffer_all) {
+    while (resp->writer && !resp->error && (buffer_all || resp->body_len < HTTP_RESPONSE_CHUNK_SIZE)) {
+        int more = resp->writer(resp, resp->writer_arg);
+        if (more < 0) return -1;
+        if (more == 0) http_response_end_stream(resp);
     }
-    
-    HTTPRequest req = {0};
-    http_parse_request(buffer, &req);
-    req.client_fd = client_fd;
-    
-    // Log request details
-    log_debug("HTTP Request - Method: %s, Path: %s", req.method, req.path);
-    if (strlen(req.body) > 0) {
-        log_debug("Request Body: %s", req.body);
+    return resp->error ? -1 : 0;
+}
+
+static size_t http_put(char *p, const char *s, size_t len) {
+    memcpy(p, s, len);
+    return len;
+}
+
+// value in base 10 or 16, without leading zeros
+static size_t http_put_number(char *p, size_t value, unsigned base) {
+    char digits[24];
+    size_t n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value);
+    for (size_t i = 0; i < n; i++) p[i] = digits[n - 1 - i];
+    return n;
+}
+
+// Describe the response's next part for one vectored write: the head
+// and the body (or its first chunk) the first time, a further chunk of a
+// streamed body after that. iov needs HTTP_RESPONSE_MAX_IOV entries.
+static int http_response_iov(HTTPResponse *resp, int keep_alive, struct iovec *iov) {
+    int n = 0;
+
+    if (!resp->started) {
+        const HTTPStatus *status = http_status_find(resp->status_code);
+        const char *content_type = resp->content_type ? resp->content_type : "text/plain";
+        size_t type_len = strlen(content_type);
+        char *p = resp->head;
+
+        resp->started = 1;
+        resp->chunked = resp->writer != NULL;
+        if (status) {
+            iov[n].iov_base = (void*)status->line;
+            iov[n++].iov_len = status->line_len;
+        } else {
+            p += snprintf(p, 32, "HTTP/1.1 %d OK\r\n", resp->status_code % 1000);
+        }
+        if (type_len > HTTP_CONTENT_TYPE_MAX) type_len = HTTP_CONTENT_TYPE_MAX;
+        p += http_put(p, "Content-Type: ", 14);
+        p += http_put(p, content_type, type_len);
+        if (resp->chunked) {
+            p += http_put(p, "\r\nTransfer-Encoding: chunked\r\n", 30);
+        } else {
+            p += http_put(p, "\r\nContent-Length: ", 18);
+            p += http_put_number(p, resp->body_len, 10);
+            p += http_put(p, "\r\n", 2);
+        }
+        iov[n].iov_base = resp->head;
+        iov[n++].iov_len = p - resp->head;
+        iov[n].iov_base = (void*)(keep_alive ? g_head_end_keep_alive : g_head_end_close);
+        iov[n++].iov_len = keep_alive ? sizeof(g_head_end_keep_alive) - 1 : sizeof(g_head_end_close) - 1;
     }
-    
-    HTTPResponse *resp = NULL;
 
+    if (resp->body_len > 0) {
+        if (resp->chunked) {
+            size_t len = http_put_number(resp->chunk_line, resp->body_len, 16);
+            len += http_put(resp->chunk_line + len, "\r\n", 2);
+            iov[n].iov_base = resp->chunk_line;
+            iov[n++].iov_len = len;
+        }
+        iov[n].iov_base = resp->body;
+        iov[n++].iov_len = resp->body_len;
+        if (resp->chunked) {
+            iov[n].iov_base = (void*)g_chunk_end;
+            iov[n++].iov_len = sizeof(g_chunk_end) - 1;
+        }
+    }
+    if (resp->chunked && !resp->writer) {
+        iov[n].iov_base = (void*)g_last_chunk;
+        iov[n++].iov_len = sizeof(g_last_chunk) - 1;
+    }
+    return n;
+}
 
-    if (strcmp(req.method, "OPTIONS") == 0) {
-        resp = http_response_create(200, "application/json");
-        http_response_set_body(resp, "");
-        http_response_send(client_fd, resp);
-        http_response_free(resp);
-        close(client_fd);
-        return;
+// Step *index past n written bytes
+static void http_iov_consume(struct iovec *iov, int count, int *index, size_t n) {
+    while (*index < count && n >= iov[*index].iov_len) {
+        n -= iov[*index].iov_len;
+        (*index)++;
+    }
+    if (*index < count) {
+        iov[*index].iov_base = (char*)iov[*index].iov_base + n;
+        iov[*index].iov_len -= n;
+    }
+}
+
+static ssize_t http_sendv(int fd, struct iovec *iov, int count) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+// One-shot response on a blocking socket, which is then closed by the caller
+void http_response_send(int client_fd, HTTPResponse *resp) {
+    struct iovec iov[HTTP_RESPONSE_MAX_IOV];
+    int index = 0;
+
+    if (http_response_produce(resp, 1) < 0) return;
+    int count = http_response_iov(resp, 0, iov);
+    while (index < count) {
+        ssize_t n = http_sendv(client_fd, iov + index, count - index);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        http_iov_consume(iov, count, &index, n);
     }
+}
+
+// POST /api/register
+static HTTPResponse* handle_register(const HTTPRequest *req) {
+    HTTPResponse *resp = NULL;
+
+    char username[50], password[64], role_str[20];
     
-    if (strcmp(req.method, "POST") == 0 && strcmp(req.path, "/api/register") == 0) {
-        // Register endpoint
-        char username[50], password[64], role_str[20];
+    if (json_index_string(req->json, "username", username, sizeof(username)) < 0 ||
+        json_index_string(req->json, "password", password, sizeof(password)) < 0 ||
+        json_index_string(req->json, "role", role_str, sizeof(role_str)) < 0) {
+        
+        resp = http_response_create(400, "application/json");
+        http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid request\"}");
+    } else {
+        UserRole role = (strcmp(role_str, "admin") == 0) ? ROLE_ADMIN : ROLE_USER;
+        int user_id;
         
-        if (http_parse_json_string(req.body, "username", username, sizeof(username)) < 0 ||
-            http_parse_json_string(req.body, "password", password, sizeof(password)) < 0 ||
-            http_parse_json_string(req.body, "role", role_str, sizeof(role_str)) < 0) {
+        if (auth_register(username, password, role, &user_id) == 0) {
+            char body[512], quoted_username[6 * sizeof(username) + 3];
+            char quoted_role[6 * sizeof(role_str) + 3];
+            snprintf(body, sizeof(body), 
+                    "{\"status\": \"success\", \"user_id\": %d, \"username\": %s, \"role\": %s}",
+                    user_id, http_json_quote(quoted_username, username),
+                    http_json_quote(quoted_role, role_str));
             
-            resp = http_response_create(400, "application/json");
-            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid request\"}");
+            resp = http_response_create(200, "application/json");
+            http_response_set_body(resp, body);
         } else {
-            UserRole role = (strcmp(role_str, "admin") == 0) ? ROLE_ADMIN : ROLE_USER;
-            int user_id;
-            
-            if (auth_register(username, password, role, &user_id) == 0) {
-                char body[256];
-                snprintf(body, sizeof(body), 
-                        "{\"status\": \"success\", \"user_id\": %d, \"username\": \"%s\", \"role\": \"%s\"}",
-                        user_id, username, role_str);
-                
-                resp = http_response_create(200, "application/json");
-                http_response_set_body(resp, body);
-            } else {
-                resp = http_response_create(400, "application/json");
-                http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Registration failed\"}");
-            }
+            resp = http_response_create(400, "application/json");
+            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Registration failed\"}");
         }
-    } 
-    else if (strcmp(req.method, "POST") == 0 && strcmp(req.path, "/api/login") == 0) {
-        // Login endpoint
-        char username[50], password[64];
+    }
+
+    return resp;
+}
+
+// POST /api/login
+static HTTPResponse* handle_login(const HTTPRequest *req) {
+    HTTPResponse *resp = NULL;
+
+    char username[50], password[64];
+    
+    if (json_index_string(req->json, "username", username, sizeof(username)) < 0 ||
+        json_index_string(req->json, "password", password, sizeof(password)) < 0) {
         
-        if (http_parse_json_string(req.body, "username", username, sizeof(username)) < 0 ||
-            http_parse_json_string(req.body, "password", password, sizeof(password)) < 0) {
+        resp = http_response_create(400, "application/json");
+        http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid request\"}");
+    } else {
+        int user_id;
+        
+        if (auth_login(username, password, &user_id) == 0) {
+            char token[128];
+            auth_generate_token(user_id, token, sizeof(token));
             
-            resp = http_response_create(400, "application/json");
-            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid request\"}");
-        } else {
-            int user_id;
+            User *user = db_get_user_by_id(user_id);
+            char body[768], quoted_username[6 * sizeof(username) + 3];
+            snprintf(body, sizeof(body), 
+                    "{\"status\": \"success\", \"user_id\": %d, \"username\": %s, \"role\": \"%s\", \"token\": \"%s\"}",
+                    user_id, http_json_quote(quoted_username, username), user->role == ROLE_ADMIN ? "admin" : "user", token);
             
-            if (auth_login(username, password, &user_id) == 0) {
-                char token[128];
-                auth_generate_token(user_id, token, sizeof(token));
-                
-                User *user = db_get_user_by_id(user_id);
-                char body[512];
-                snprintf(body, sizeof(body), 
-                        "{\"status\": \"success\", \"user_id\": %d, \"username\": \"%s\", \"role\": \"%s\", \"token\": \"%s\"}",
-                        user_id, username, user->role == ROLE_ADMIN ? "admin" : "user", token);
-                
-                resp = http_response_create(200, "application/json");
-                http_response_set_body(resp, body);
-            } else {
-                resp = http_response_create(401, "application/json");
-                http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid credentials\"}");
-            }
+            resp = http_response_create(200, "application/json");
+            http_response_set_body(resp, body);
+        } else {
+            resp = http_response_create(401, "application/json");
+            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid credentials\"}");
         }
     }
-    else if (strcmp(req.method, "GET") == 0 && strcmp(req.path, "/api/rooms") == 0) {
-        // List rooms endpoint
-        int count;
-        ChatRoom *rooms = db_get_all_rooms(&count);
-        
-        char body[4096] = "{\"status\": \"success\", \"rooms\": [";
-        for (int i = 0; i < count; i++) {
-            if (i > 0) strcat(body, ",");
-            char room_json[512];
-            snprintf(room_json, sizeof(room_json),
-                    "{\"room_id\": %d, \"room_name\": \"%s\", \"user_count\": %d}",
-                    rooms[i].room_id, rooms[i].room_name, rooms[i].current_user_count);
-            strcat(body, room_json);
-        }
-        strcat(body, "]}");
-        
-        if (rooms) free(rooms);
+
+    return resp;
+}
+
+// GET /api/rooms
+typedef struct {
+    ChatRoom *rooms;
+    int count;
+    int next;
+} RoomsListState;
+
+static void rooms_list_free(void *arg) {
+    RoomsListState *state = arg;
+    free(state->rooms);
+    free(state);
+}
+
+// A chunk's worth of rooms per call, so any number of rooms goes out
+// without the whole list ever sitting in one buffer
+static int rooms_list_write(HTTPResponse *resp, void *arg) {
+    RoomsListState *state = arg;
+    size_t start = resp->body_len;
+
+    while (state->next < state->count && resp->body_len - start < HTTP_RESPONSE_CHUNK_SIZE) {
+        ChatRoom *room = &state->rooms[state->next];
+        char quoted_name[6 * sizeof(room->room_name) + 3];
+        if (http_response_appendf(resp, "%s{\"room_id\": %d, \"room_name\": %s, \"user_count\": %d}",
+                                  state->next > 0 ? "," : "", room->room_id,
+                                  http_json_quote(quoted_name, room->room_name),
+                                  room->current_user_count) < 0) {
+            return -1;
+        }
+        state->next++;
+    }
+    if (state->next < state->count) return 1;
+    return http_response_append(resp, "]}", 2) < 0 ? -1 : 0;
+}
+
+static HTTPResponse* handle_rooms_list(const HTTPRequest *req) {
+    HTTPResponse *resp = NULL;
+    (void)req;
+
+    RoomsListState *state = calloc(1, sizeof(RoomsListState));
+    if (!state) return NULL;
+    state->rooms = db_get_all_rooms(&state->count);
+
+    resp = http_response_create(200, "application/json");
+    http_response_set_body(resp, "{\"status\": \"success\", \"rooms\": [");
+    http_response_stream(resp, rooms_list_write, state, rooms_list_free);
+
+    return resp;
+}
+
+// GET /api/rooms/{id:int}/users
+static HTTPResponse* handle_room_users(const HTTPRequest *req) {
+    HTTPResponse *resp = NULL;
+
+    int room_id;
+    
+    if (http_request_param_int(req, "id", &room_id) < 0 || room_id <= 0) {
+        resp = http_response_create(400, "application/json");
+        http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid room ID\"}");
+    } else {
+        char response_body[2048];
+        snprintf(response_body, sizeof(response_body),
+                "{\"status\": \"success\", \"room_id\": %d, \"users\": []}", room_id);
         
         resp = http_response_create(200, "application/json");
-        http_response_set_body(resp, body);
+        http_response_set_body(resp, response_body);
     }
-    else if (strcmp(req.method, "GET") == 0 && str_starts_with(req.path, "/api/rooms/")) {
-        // Get room users endpoint: /api/rooms/{room_id}/users
-        const char *path_part = req.path + strlen("/api/rooms/");
-        int room_id = atoi(path_part);
-        
-        if (room_id <= 0) {
+
+    return resp;
+}
+
+// POST /api/rooms/{id:int}/join
+static HTTPResponse* handle_room_join(const HTTPRequest *req) {
+    HTTPResponse *resp = NULL;
+
+    int room_id;
+    
+    if (http_request_param_int(req, "id", &room_id) < 0 || room_id <= 0) {
+        resp = http_response_create(400, "application/json");
+        http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid room ID\"}");
+    } else {
+        int user_id;
+        if (json_index_int(req->json, "user_id", &user_id) < 0) {
             resp = http_response_create(400, "application/json");
-            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid room ID\"}");
+            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Missing user_id\"}");
         } else {
-            // Check if path contains /users
-            if (strstr(req.path, "/users")) {
-                char response_body[2048];
+            // Add user to room in in-memory database
+            int result = db_add_user_to_room(room_id, user_id);
+            
+            if (result == 0) {
+                char response_body[256];
                 snprintf(response_body, sizeof(response_body),
-                        "{\"status\": \"success\", \"room_id\": %d, \"users\": []}", room_id);
+                        "{\"status\": \"success\", \"room_id\": %d, \"user_id\": %d, \"message\": \"Joined room\"}",
+                        room_id, user_id);
                 
                 resp = http_response_create(200, "application/json");
                 http_response_set_body(resp, response_body);
+                printf("[HTTP] User %d successfully joined room %d\n", user_id, room_id);
             } else {
-                resp = http_response_create(404, "application/json");
-                http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Endpoint not found\"}");
-            }
-        }
-    }
-    else if (strcmp(req.method, "POST") == 0 && str_starts_with(req.path, "/api/rooms/")) {
-        // Join room endpoint: /api/rooms/{room_id}/join
-        const char *path_part = req.path + strlen("/api/rooms/");
-        int room_id = atoi(path_part);
-        
-        if (room_id <= 0 || !strstr(req.path, "/join")) {
-            resp = http_response_create(400, "application/json");
-            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid room ID\"}");
-        } else {
-            int user_id;
-            if (http_parse_json_int(req.body, "user_id", &user_id) < 0) {
-                resp = http_response_create(400, "application/json");
-                http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Missing user_id\"}");
-            } else {
-                // Add user to room in in-memory database
-                int result = db_add_user_to_room(room_id, user_id);
-                
-                if (result == 0) {
-                    char response_body[256];
-                    snprintf(response_body, sizeof(response_body),
-                            "{\"status\": \"success\", \"room_id\": %d, \"user_id\": %d, \"message\": \"Joined room\"}",
-                            room_id, user_id);
-                    
-                    resp = http_response_create(200, "application/json");
-                    http_response_set_body(resp, response_body);
-                    printf("[HTTP] User %d successfully joined room %d\n", user_id, room_id);
+                char error_msg[256];
+                if (result == -1) {
+                    snprintf(error_msg, sizeof(error_msg), "{\"status\": \"error\", \"message\": \"Room is full\", \"error_code\": %d}", result);
+                } else if (result == -2) {
+                    snprintf(error_msg, sizeof(error_msg), "{\"status\": \"error\", \"message\": \"User already in room\", \"error_code\": %d}", result);
+                } else if (result == -3) {
+                    snprintf(error_msg, sizeof(error_msg), "{\"status\": \"error\", \"message\": \"Room not found (ID: %d)\", \"error_code\": %d}", room_id, result);
                 } else {
-                    char error_msg[256];
-                    if (result == -1) {
-                        snprintf(error_msg, sizeof(error_msg), "{\"status\": \"error\", \"message\": \"Room is full\", \"error_code\": %d}", result);
-                    } else if (result == -2) {
-                        snprintf(error_msg, sizeof(error_msg), "{\"status\": \"error\", \"message\": \"User already in room\", \"error_code\": %d}", result);
-                    } else if (result == -3) {
-                        snprintf(error_msg, sizeof(error_msg), "{\"status\": \"error\", \"message\": \"Room not found (ID: %d)\", \"error_code\": %d}", room_id, result);
-                    } else {
-                        snprintf(error_msg, sizeof(error_msg), "{\"status\": \"error\", \"message\": \"Failed to join room\", \"error_code\": %d}", result);
-                    }
-                    
-                    resp = http_response_create(400, "application/json");
-                    http_response_set_body(resp, error_msg);
-                    printf("[HTTP] Failed to add user %d to room %d: error code %d\n", user_id, room_id, result);
+                    snprintf(error_msg, sizeof(error_msg), "{\"status\": \"error\", \"message\": \"Failed to join room\", \"error_code\": %d}", result);
                 }
+                
+                resp = http_response_create(400, "application/json");
+                http_response_set_body(resp, error_msg);
+                printf("[HTTP] Failed to add user %d to room %d: error code %d\n", user_id, room_id, result);
             }
         }
     }
-    else if (strcmp(req.method, "POST") == 0 && strcmp(req.path, "/api/rooms/create") == 0) {
-        // Create room endpoint
-        char room_name[100] = {0};
-        int user_id = 0;
-        
-        // Debug logging
-        log_debug("Create room request body: %s", req.body);
-        
-        int room_name_result = http_parse_json_string(req.body, "room_name", room_name, sizeof(room_name));
+
+    return resp;
+}
+
+// POST /api/rooms/create
+static HTTPResponse* handle_room_create(const HTTPRequest *req) {
+    HTTPResponse *resp = NULL;
+
+    char room_name[100] = {0};
+    int user_id = 0;
+    
+    // Debug logging
+    log_debug("Create room request body: %s", req->body);
+    
+    int room_name_result = json_index_string(req->json, "room_name", room_name, sizeof(room_name));
+    
+    // Try to parse user_id first, then created_by
+    int user_id_result = json_index_int(req->json, "user_id", &user_id);
+    if (user_id_result < 0) {
+        user_id_result = json_index_int(req->json, "created_by", &user_id);
+    }
+    
+    log_debug("room_name parse result: %d, room_name: %s", room_name_result, room_name);
+    log_debug("user_id parse result: %d, user_id: %d", user_id_result, user_id);
+    
+    if (room_name_result < 0 || user_id_result < 0) {
+        log_error("Invalid room creation request - missing room_name or user_id/created_by");
+        resp = http_response_create(400, "application/json");
+        http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid request - missing room_name or user_id/created_by\"}");
+    } else {
+        // Create room in in-memory database
+        int room_id = db_create_room(room_name, user_id);
         
-        // Try to parse user_id first, then created_by
-        int user_id_result = http_parse_json_int(req.body, "user_id", &user_id);
-        if (user_id_result < 0) {
-            user_id_result = http_parse_json_int(req.body, "created_by", &user_id);
+        // Add creator to room
+        if (room_id > 0) {
+            db_add_user_to_room(room_id, user_id);
         }
         
-        log_debug("room_name parse result: %d, room_name: %s", room_name_result, room_name);
-        log_debug("user_id parse result: %d, user_id: %d", user_id_result, user_id);
+        char body[768], quoted_name[6 * sizeof(room_name) + 3];
+        snprintf(body, sizeof(body), 
+                "{\"status\": \"success\", \"room_id\": %d, \"room_name\": %s}",
+                room_id, http_json_quote(quoted_name, room_name));
         
-        if (room_name_result < 0 || user_id_result < 0) {
-            log_error("Invalid room creation request - missing room_name or user_id/created_by");
-            resp = http_response_create(400, "application/json");
-            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid request - missing room_name or user_id/created_by\"}");
+        resp = http_response_create(200, "application/json");
+        http_response_set_body(resp, body);
+    }
+
+    return resp;
+}
+
+// POST /api/messages/send
+static HTTPResponse* handle_message_send(const HTTPRequest *req) {
+    HTTPResponse *resp = NULL;
+
+    char message_content[500];
+    int user_id, room_id;
+    
+    if (json_index_string(req->json, "message", message_content, sizeof(message_content)) < 0 ||
+        json_index_int(req->json, "user_id", &user_id) < 0 ||
+        json_index_int(req->json, "room_id", &room_id) < 0) {
+        
+        resp = http_response_create(400, "application/json");
+        http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid request - missing message, user_id, or room_id\"}");
+    } else {
+        // Get user info from in-memory DB for username
+        User *user = db_get_user_by_id(user_id);
+        if (!user) {
+            resp = http_response_create(404, "application/json");
+            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"User not found\"}");
         } else {
-            // Create room in in-memory database
-            int room_id = db_create_room(room_name, user_id);
+            // Store message in in-memory database
+            int message_id = db_create_message(user_id, room_id, user->username, message_content);
             
-            // Add creator to room
-            if (room_id > 0) {
-                db_add_user_to_room(room_id, user_id);
-            }
+            // Create message JSON for broadcasting
+            char message_json[4096], quoted_username[6 * sizeof(user->username) + 3];
+            char quoted_content[6 * sizeof(message_content) + 3];
+            snprintf(message_json, sizeof(message_json),
+                    "{\"type\": \"message\", \"message_id\": %d, \"user_id\": %d, \"username\": %s, \"content\": %s, \"room_id\": %d}",
+                    message_id, user_id, http_json_quote(quoted_username, user->username),
+                    http_json_quote(quoted_content, message_content), room_id);
             
-            char body[256];
-            snprintf(body, sizeof(body), 
-                    "{\"status\": \"success\", \"room_id\": %d, \"room_name\": \"%s\"}",
-                    room_id, room_name);
+            // Broadcast to WebSocket clients in the same room
+            websocket_broadcast_to_room(room_id, message_json);
+            
+            // Return success response
+            char response_body[512];
+            snprintf(response_body, sizeof(response_body),
+                    "{\"status\": \"success\", \"message_id\": %d, \"message\": \"Message sent successfully\"}",
+                    message_id);
             
             resp = http_response_create(200, "application/json");
-            http_response_set_body(resp, body);
+            http_response_set_body(resp, response_body);
         }
     }
-    else if (strcmp(req.method, "POST") == 0 && str_starts_with(req.path, "/api/messages/send")) {
-        // Send message endpoint
-        char message_content[500];
-        int user_id, room_id;
+
+    return resp;
+}
+
+// GET /api/messages/{room_id:int}
+static HTTPResponse* handle_room_messages(const HTTPRequest *req) {
+    HTTPResponse *resp = NULL;
+
+    int room_id;
+    
+    if (http_request_param_int(req, "room_id", &room_id) < 0 || room_id <= 0) {
+        resp = http_response_create(400, "application/json");
+        http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid room ID\"}");
+    } else {
+        // Get messages from database (this would need to be implemented in database.c)
+        char response_body[2048];
+        snprintf(response_body, sizeof(response_body),
+                "{\"status\": \"success\", \"room_id\": %d, \"messages\": []}", room_id);
         
-        if (http_parse_json_string(req.body, "message", message_content, sizeof(message_content)) < 0 ||
-            http_parse_json_int(req.body, "user_id", &user_id) < 0 ||
-            http_parse_json_int(req.body, "room_id", &room_id) < 0) {
-            
-            resp = http_response_create(400, "application/json");
-            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid request - missing message, user_id, or room_id\"}");
-        } else {
-            // Get user info from in-memory DB for username
-            User *user = db_get_user_by_id(user_id);
-            if (!user) {
-                resp = http_response_create(404, "application/json");
-                http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"User not found\"}");
-            } else {
-                // Store message in in-memory database
-                int message_id = db_create_message(user_id, room_id, user->username, message_content);
-                
-                // Create message JSON for broadcasting
-                char message_json[2048];
-                snprintf(message_json, sizeof(message_json),
-                        "{\"type\": \"message\", \"message_id\": %d, \"user_id\": %d, \"username\": \"%s\", \"content\": \"%s\", \"room_id\": %d}",
-                        message_id, user_id, user->username, message_content, room_id);
-                
-                // Broadcast to WebSocket clients in the same room
-                websocket_broadcast_to_room(room_id, message_json);
-                
-                // Return success response
-                char response_body[512];
-                snprintf(response_body, sizeof(response_body),
-                        "{\"status\": \"success\", \"message_id\": %d, \"message\": \"Message sent successfully\"}",
-                        message_id);
-                
-                resp = http_response_create(200, "application/json");
-                http_response_set_body(resp, response_body);
+        resp = http_response_create(200, "application/json");
+        http_response_set_body(resp, response_body);
+    }
+
+    return resp;
+}
+
+static const HTTPRoute g_default_routes[] = {
+    {"POST", "/api/register", handle_register},
+    {"POST", "/api/login", handle_login},
+    {"GET", "/api/rooms", handle_rooms_list},
+    {"POST", "/api/rooms/create", handle_room_create},
+    {"GET", "/api/rooms/{id:int}/users", handle_room_users},
+    {"POST", "/api/rooms/{id:int}/join", handle_room_join},
+    {"POST", "/api/messages/send", handle_message_send},
+    {"GET", "/api/messages/{room_id:int}", handle_room_messages},
+};
+
+int http_server_route(const char *method, const char *pattern, HTTPHandler handler) {
+    int method_index = http_method_from_name(method);
+
+    if (!g_router.root) http_router_init(&g_router);
+    if (method_index < 0 ||
+        http_router_add(&g_router, method_index, pattern, (HTTPRouteTarget)handler) < 0) {
+        log_error("Cannot route %s %s", method, pattern);
+        return -1;
+    }
+    return 0;
+}
+
+int http_request_param_int(const HTTPRequest *req, const char *name, int *out) {
+    for (int i = 0; req->route && i < req->route->param_count; i++) {
+        const HTTPRouteParam *param = &req->route->params[i];
+        if (strcmp(param->name, name) != 0) continue;
+
+        char *end;
+        long value = strtol(param->value, &end, 10);
+        if (end != param->value + param->len || value < INT_MIN || value > INT_MAX) return -1;
+        *out = (int)value;
+        return 0;
+    }
+    return -1;
+}
+
+// Run one request through the route table and build its response
+static HTTPResponse* handle_http_request(HTTPRequest *req) {
+    // Log request details
+    log_debug("HTTP Request - Method: %s, Path: %s", req->method, req->path);
+    if (strlen(req->body) > 0) {
+        log_debug("Request Body: %s", req->body);
+    }
+    
+    HTTPResponse *resp = NULL;
+
+    // CORS preflight, for any path
+    if (strcmp(req->method, "OPTIONS") == 0) {
+        resp = http_response_create(200, "application/json");
+        http_response_set_body(resp, "");
+        return resp;
+    }
+
+    // Bodies are JSON objects: index one once for all of a handler's lookups
+    JSONIndex json;
+    json_index_parse(&json, req->body, req->content_length);
+    req->json = &json;
+
+    HTTPRouteMatch route;
+    int method = http_method_from_name(req->method);
+    switch (http_router_match(&g_router, method, req->path, strlen(req->path), &route)) {
+        case HTTP_ROUTE_FOUND:
+            req->route = &route;
+            resp = ((HTTPHandler)route.target)(req);
+            req->route = NULL;
+            req->json = NULL;
+            return resp;
+        case HTTP_ROUTE_NO_METHOD:
+            resp = http_response_create(405, "application/json");
+            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Method not allowed\"}");
+            break;
+        default:
+            resp = http_response_create(404, "application/json");
+            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Endpoint not found\"}");
+            break;
+    }
+    req->json = NULL;
+    return resp;
+}
+
+// Head, trailers and body; chunk framing has to fit in here too
+static size_t http_conn_max_buffer() {
+    return 2 * g_limits_config.max_header_size + g_limits_config.max_body_size;
+}
+
+static void http_conn_reset_parser(HTTPConn *conn) {
+    http_parser_init(&conn->parser, g_limits_config.max_header_size, g_limits_config.max_body_size);
+}
+
+static void http_conn_release(EventSource *src) {
+    HTTPConn *conn = (HTTPConn*)src;
+    free(conn->in);
+    http_response_free(conn->resp);
+    free(conn);
+}
+
+static void http_conn_close(HTTPConn *conn) {
+    HTTPShard *shard = conn->shard;
+
+    timer_wheel_cancel(&shard->loop.timers, &conn->idle_timer);
+
+    // The idle timer and the done handler close connections whose events
+    // may still be queued in the batch being dispatched
+    event_loop_retire(&shard->loop, &conn->src, http_conn_release);
+    close(conn->src.fd);
+
+    if (conn->prev) conn->prev->next = conn->next;
+    else shard->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+}
+
+static void http_conn_on_idle(Timer *timer, void *arg) {
+    (void)timer;
+    HTTPConn *conn = arg;
+
+    // Cancelled while busy, so this is a connection nobody is using
+    log_debug("HTTP connection fd=%d idle, closing", conn->src.fd);
+    http_conn_close(conn);
+}
+
+static void http_conn_touch(HTTPConn *conn) {
+    if (g_keepalive_config.idle_timeout_ms > 0) {
+        timer_wheel_schedule(&conn->shard->loop.timers, &conn->idle_timer, g_keepalive_config.idle_timeout_ms);
+    }
+}
+
+// Write what the socket takes of the response's current part: 1 when
+// it is out, 0 if the rest waits for EPOLLOUT, -1 if the client is gone
+static int http_conn_flush(HTTPConn *conn) {
+    while (conn->iov_index < conn->iov_count) {
+        ssize_t n = http_sendv(conn->src.fd, conn->iov + conn->iov_index, conn->iov_count - conn->iov_index);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        http_iov_consume(conn->iov, conn->iov_count, &conn->iov_index, n);
+    }
+    return 1;
+}
+
+// Resize in to cap bytes (plus the terminator byte)
+static int http_conn_resize(HTTPConn *conn, size_t cap) {
+    char *in = realloc(conn->in, cap + 1);
+    if (!in) return -1;
+    conn->in = in;
+    conn->in_cap = cap;
+    return 0;
+}
+
+// Read until the socket is drained or the buffer is at its limit; -1 on
+// error
+static int http_conn_fill(HTTPConn *conn) {
+    size_t max = http_conn_max_buffer();
+    int got = 0;
+
+    while (!conn->peer_closed) {
+        if (conn->in_len == conn->in_cap) {
+            if (conn->in_cap >= max) break;
+            if (http_conn_resize(conn, conn->in_cap * 2 < max ? conn->in_cap * 2 : max) < 0) return -1;
+        }
+
+        ssize_t n = recv(conn->src.fd, conn->in + conn->in_len, conn->in_cap - conn->in_len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        if (n == 0) conn->peer_closed = 1;
+        conn->in_len += n;
+        got = 1;
+    }
+    if (got) http_conn_touch(conn);
+    return 0;
+}
+
+// Queue the response's next part for writing. HTTP/1.0 clients cannot
+// take chunks, so a streamed body is produced whole for them.
+static int http_conn_describe(HTTPConn *conn) {
+    if (http_response_produce(conn->resp, conn->parser.version_minor == 0) < 0) return -1;
+    conn->iov_count = http_response_iov(conn->resp, conn->keep_alive, conn->iov);
+    conn->iov_index = 0;
+    return 0;
+}
+
+// Worker side: hand the connection back to its reactor
+static void http_conn_done(HTTPConn *conn) {
+    HTTPShard *shard = conn->shard;
+
+    pthread_mutex_lock(&shard->done_lock);
+    int was_empty = shard->done == NULL;
+    conn->done_next = shard->done;
+    shard->done = conn;
+    pthread_mutex_unlock(&shard->done_lock);
+
+    if (was_empty) {
+        uint64_t one = 1;
+        ssize_t ignored = write(shard->done_src.fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+// Worker side: run the request and describe the first part of its reply
+static void http_conn_task(void *arg) {
+    HTTPConn *conn = arg;
+
+    // The reactor leaves in alone while busy, so the request's strings
+    // are terminated in place; the first byte of whatever is pipelined
+    // after it is put back
+    HTTPRequest req;
+    char saved = conn->in[conn->request_len];
+    http_request_bind(&req, &conn->parser, conn->in);
+    conn->resp = handle_http_request(&req);
+    conn->in[conn->request_len] = saved;
+
+    if (conn->resp && http_conn_describe(conn) < 0) {
+        // Nothing is written yet, so the failure can still be reported
+        log_error("Failed to produce HTTP response body");
+        http_response_free(conn->resp);
+        conn->resp = http_response_create(500, "application/json");
+        http_response_set_body(conn->resp, "{\"status\": \"error\", \"message\": \"Internal server error\"}");
+        conn->keep_alive = 0;
+        if (conn->resp && http_conn_describe(conn) < 0) {
+            http_response_free(conn->resp);
+            conn->resp = NULL;
+        }
+    }
+    if (!conn->resp) conn->keep_alive = 0;
+    http_conn_done(conn);
+}
+
+// Worker side: the next chunk of a streamed body, once the last is out
+static void http_conn_stream_task(void *arg) {
+    HTTPConn *conn = arg;
+
+    conn->resp->body_len = 0;
+    if (http_conn_describe(conn) < 0) {
+        // Part of the body is out already; all that is left is to hang up
+        log_error("Failed to produce HTTP response body");
+        http_response_free(conn->resp);
+        conn->resp = NULL;
+        conn->keep_alive = 0;
+    }
+    http_conn_done(conn);
+}
+
+// Hand conn to a worker; the reactor keeps off it until it comes back
+static int http_conn_submit(HTTPConn *conn, void (*task)(void *arg)) {
+    conn->busy = 1;
+    timer_wheel_cancel(&conn->shard->loop.timers, &conn->idle_timer);
+    if (thread_pool_submit(task, conn) < 0) {
+        conn->busy = 0;
+        http_conn_touch(conn);
+        return -1;
+    }
+    return 0;
+}
+
+// Reply on the reactor thread, for requests that never reach a handler
+static void http_conn_fail(HTTPConn *conn, int status_code) {
+    conn->keep_alive = 0;
+    conn->request_len = conn->in_len;
+    conn->resp = http_response_create(status_code, "application/json");
+    if (!conn->resp) return;
+
+    http_response_appendf(conn->resp, "{\"status\": \"error\", \"message\": \"%s\"}",
+                          http_status_text(status_code));
+    if (http_conn_describe(conn) < 0) {
+        http_response_free(conn->resp);
+        conn->resp = NULL;
+    }
+}
+
+// Drive a connection the reactor owns: finish writing the last response,
+// then serve the next buffered request. Requests on one connection run
+// one at a time, so pipelined responses keep their order.
+static void http_conn_advance(HTTPConn *conn) {
+    for (;;) {
+        if (conn->resp) {
+            int sent = http_conn_flush(conn);
+            if (sent < 0) {
+                http_conn_close(conn);
+                return;
+            }
+            if (sent == 0) return;
+
+            // A streamed body continues on a worker, one chunk at a time
+            if (conn->resp->writer) {
+                if (http_conn_submit(conn, http_conn_stream_task) < 0) {
+                    log_error("HTTP request queue full, dropping streamed response");
+                    http_conn_close(conn);
+                }
+                return;
+            }
+            http_response_free(conn->resp);
+            conn->resp = NULL;
+        }
+
+        if (conn->request_len > 0) {
+            conn->requests++;
+            if (!conn->keep_alive) {
+                http_conn_close(conn);
+                return;
+            }
+            memmove(conn->in, conn->in + conn->request_len, conn->in_len - conn->request_len);
+            conn->in_len -= conn->request_len;
+            conn->request_len = 0;
+            http_conn_reset_parser(conn);
+
+            // Give back what a large request needed
+            if (conn->in_cap > HTTP_CONN_INITIAL_BUFFER && conn->in_len <= HTTP_CONN_INITIAL_BUFFER) {
+                http_conn_resize(conn, HTTP_CONN_INITIAL_BUFFER);
             }
         }
+
+        if (http_conn_fill(conn) < 0) {
+            http_conn_close(conn);
+            return;
+        }
+
+        HTTPParseResult result = http_parser_parse(&conn->parser, conn->in, conn->in_len);
+        if (result == HTTP_PARSE_ERROR) {
+            http_conn_fail(conn, conn->parser.status);
+            continue;
+        }
+        if (result == HTTP_PARSE_INCOMPLETE) {
+            // Only a body past the limits can fill the buffer: the parser
+            // refuses long heads itself
+            if (conn->in_len >= http_conn_max_buffer()) {
+                http_conn_fail(conn, 413);
+                continue;
+            }
+            if (conn->peer_closed) http_conn_close(conn);
+            return;
+        }
+
+        int max_requests = g_keepalive_config.max_requests;
+        conn->request_len = conn->parser.request_len;
+        conn->keep_alive = conn->parser.keep_alive && g_http_running &&
+                           (max_requests == 0 || conn->requests + 1 < max_requests);
+        if (http_conn_submit(conn, http_conn_task) < 0) {
+            log_error("HTTP request queue full, refusing request");
+            http_conn_fail(conn, 503);
+            continue;
+        }
+        return;
     }
-    else if (strcmp(req.method, "GET") == 0 && str_starts_with(req.path, "/api/messages/")) {
-        // Get messages for a room endpoint
-        // Extract room_id from path like /api/messages/1
-        const char *room_id_str = req.path + strlen("/api/messages/");
-        int room_id = atoi(room_id_str);
-        
-        if (room_id <= 0) {
-            resp = http_response_create(400, "application/json");
-            http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Invalid room ID\"}");
+}
+
+static void http_conn_on_event(EventSource *src, uint32_t events) {
+    HTTPConn *conn = (HTTPConn*)src;
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        if (conn->busy) conn->dead = 1;
+        else http_conn_close(conn);
+        return;
+    }
+
+    // Edge-triggered, but advance reads and writes again once the worker
+    // is done, so nothing signalled meanwhile is lost
+    if (!conn->busy) http_conn_advance(conn);
+}
+
+static void http_shard_on_done(EventSource *src, uint32_t events) {
+    (void)events;
+    HTTPShard *shard = (HTTPShard*)((char*)src - offsetof(HTTPShard, done_src));
+    uint64_t value;
+    while (read(src->fd, &value, sizeof(value)) > 0) {}
+
+    pthread_mutex_lock(&shard->done_lock);
+    HTTPConn *conn = shard->done;
+    shard->done = NULL;
+    pthread_mutex_unlock(&shard->done_lock);
+
+    while (conn) {
+        HTTPConn *next = conn->done_next;
+        conn->busy = 0;
+        if (conn->dead) {
+            http_conn_close(conn);
         } else {
-            // Get messages from database (this would need to be implemented in database.c)
-            char response_body[2048];
-            snprintf(response_body, sizeof(response_body),
-                    "{\"status\": \"success\", \"room_id\": %d, \"messages\": []}", room_id);
-            
-            resp = http_response_create(200, "application/json");
-            http_response_set_body(resp, response_body);
+            http_conn_touch(conn);
+            http_conn_advance(conn);
         }
+        conn = next;
     }
-    else {
-        resp = http_response_create(404, "application/json");
-        http_response_set_body(resp, "{\"status\": \"error\", \"message\": \"Endpoint not found\"}");
+}
+
+static void http_listener_on_event(EventSource *src, uint32_t events) {
+    HTTPShard *shard = (HTTPShard*)src;
+    (void)events;
+
+    while (g_http_running) {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+
+        int client_fd = accept4(src->fd, (struct sockaddr *)&client_addr, &client_addr_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error("Failed to accept HTTP connection: %s", strerror(errno));
+            }
+            return;
+        }
+        
+        log_debug("HTTP client connected from %s:%d", 
+                 inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        
+        HTTPConn *conn = malloc(sizeof(HTTPConn));
+        if (!conn) {
+            close(client_fd);
+            continue;
+        }
+        memset(conn, 0, sizeof(HTTPConn));
+        if (http_conn_resize(conn, HTTP_CONN_INITIAL_BUFFER) < 0) {
+            close(client_fd);
+            free(conn);
+            continue;
+        }
+        http_conn_reset_parser(conn);
+
+        // Each response goes out in one sendmsg; Nagle would only hold back
+        // the next pipelined one until the client's delayed ACK
+        int one = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn->src.fd = client_fd;
+        conn->src.on_event = http_conn_on_event;
+        conn->shard = shard;
+        timer_init(&conn->idle_timer, http_conn_on_idle, conn);
+
+        if (event_loop_add(&shard->loop, &conn->src, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) < 0) {
+            log_error("Failed to register HTTP connection: %s", strerror(errno));
+            close(client_fd);
+            free(conn->in);
+            free(conn);
+            continue;
+        }
+        conn->next = shard->conns;
+        if (shard->conns) shard->conns->prev = conn;
+        shard->conns = conn;
+
+        // The request is usually queued behind the connection already
+        http_conn_touch(conn);
+        http_conn_advance(conn);
     }
-    
-    if (resp) {
-        http_response_send(client_fd, resp);
-        http_response_free(resp);
+}
+
+static void http_shard_close_listener(HTTPShard *shard) {
+    if (shard->listen_src.fd >= 0) {
+        if (shard->loop_ready) event_loop_del(&shard->loop, &shard->listen_src);
+        close(shard->listen_src.fd);
+        shard->listen_src.fd = -1;
     }
-    
-    close(client_fd);
 }
 
-// Task for thread pool
-static void http_handler_task(void *arg) {
-    int *client_fd_ptr = (int *)arg;
-    int client_fd = *client_fd_ptr;
-    free(client_fd_ptr);
-    
-    handle_http_request(client_fd);
+// Workers must be finished (thread pool shut down) before this runs
+static void http_shards_destroy() {
+    for (int i = 0; i < g_http_shard_count; i++) {
+        HTTPShard *shard = &g_http_shards[i];
+        http_shard_close_listener(shard);
+        while (shard->conns) http_conn_close(shard->conns);
+        if (shard->done_src.fd >= 0) close(shard->done_src.fd);
+        if (shard->loop_ready) {
+            event_loop_cleanup(&shard->loop);
+            pthread_mutex_destroy(&shard->done_lock);
+        }
+    }
+    free(g_http_shards);
+    g_http_shards = NULL;
+    g_http_shard_count = 0;
+}
+
+static int http_shard_run(HTTPShard *shard) {
+    int result = event_loop_run(&shard->loop);
+    http_shard_close_listener(shard);
+    return result;
+}
+
+static void* http_shard_thread(void *arg) {
+    http_shard_run(arg);
+    return NULL;
+}
+
+// Number of accept shards used by the next http_server_init (0 = one per CPU)
+void http_server_set_shard_count(int shards) {
+    g_http_shard_config = shards > 0 ? shards : 0;
+}
+
+void http_server_set_limits(const HTTPLimitsConfig *config) {
+    if (!config) return;
+    g_limits_config.max_header_size = config->max_header_size ? config->max_header_size
+                                                              : HTTP_DEFAULT_MAX_HEADER_SIZE;
+    g_limits_config.max_body_size = config->max_body_size ? config->max_body_size
+                                                          : HTTP_DEFAULT_MAX_BODY_SIZE;
+}
+
+void http_server_set_keepalive(const HTTPKeepAliveConfig *config) {
+    if (!config) return;
+    g_keepalive_config = *config;
+    if (g_keepalive_config.idle_timeout_ms < 0) g_keepalive_config.idle_timeout_ms = 0;
+    if (g_keepalive_config.max_requests < 0) g_keepalive_config.max_requests = 0;
 }
 
 int http_server_init(int port) {
-    g_http_server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (g_http_server_fd < 0) {
-        log_error("Failed to create HTTP server socket");
-        return -1;
+    int route_count = sizeof(g_default_routes) / sizeof(g_default_routes[0]);
+    for (int i = 0; i < route_count; i++) {
+        const HTTPRoute *route = &g_default_routes[i];
+        if (http_server_route(route->method, route->pattern, route->handler) < 0) return -1;
     }
-    
-    socket_set_reuseaddr(g_http_server_fd);
-    
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port);
-    
-    if (bind(g_http_server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        log_error("Failed to bind HTTP server to port %d", port);
+
+    g_http_shard_count = g_http_shard_config > 0 ? g_http_shard_config : get_cpu_count();
+    g_http_shards = calloc(g_http_shard_count, sizeof(HTTPShard));
+    if (!g_http_shards) {
+        log_error("Failed to allocate HTTP shards");
         return -1;
     }
+    for (int i = 0; i < g_http_shard_count; i++) {
+        g_http_shards[i].listen_src.fd = -1;
+        g_http_shards[i].done_src.fd = -1;
+    }
     
-    if (listen(g_http_server_fd, 128) < 0) {
-        log_error("Failed to listen on HTTP server");
-        return -1;
+    for (int i = 0; i < g_http_shard_count; i++) {
+        HTTPShard *shard = &g_http_shards[i];
+
+        if (event_loop_init(&shard->loop) < 0) {
+            http_shards_destroy();
+            return -1;
+        }
+        shard->loop_ready = 1;
+        pthread_mutex_init(&shard->done_lock, NULL);
+
+        shard->done_src.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        shard->done_src.on_event = http_shard_on_done;
+        if (shard->done_src.fd < 0 || event_loop_add(&shard->loop, &shard->done_src, EPOLLIN) < 0) {
+            log_error("Failed to set up HTTP shard %d: %s", i, strerror(errno));
+            http_shards_destroy();
+            return -1;
+        }
+
+        shard->listen_src.fd = socket_create_listener(port, HTTP_LISTEN_BACKLOG);
+        if (shard->listen_src.fd < 0) {
+            log_error("Failed to bind HTTP server to port %d", port);
+            http_shards_destroy();
+            return -1;
+        }
+        shard->listen_src.on_event = http_listener_on_event;
+        if (event_loop_add(&shard->loop, &shard->listen_src, EPOLLIN | EPOLLET) < 0) {
+            log_error("Failed to register HTTP listener: %s", strerror(errno));
+            http_shards_destroy();
+            return -1;
+        }
     }
     
     g_http_running = 1;
-    log_info("HTTP server initialized on port %d", port);
+    log_info("HTTP server initialized on port %d (%d shards)", port, g_http_shard_count);
     
     return 0;
 }
 
+// Shard 0 runs on the calling thread; blocks until http_server_stop
 int http_server_start() {
     log_info("HTTP server starting...");
     
-    while (g_http_running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_addr_len = sizeof(client_addr);
-        
-        int client_fd = accept(g_http_server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-        if (client_fd < 0) {
-            log_error("Failed to accept HTTP connection");
+    for (int i = 1; i < g_http_shard_count; i++) {
+        HTTPShard *shard = &g_http_shards[i];
+        if (pthread_create(&shard->thread, NULL, http_shard_thread, shard) != 0) {
+            log_error("Failed to start HTTP shard %d", i);
+            http_shard_close_listener(shard);
             continue;
         }
-        
-        log_debug("HTTP client connected from %s:%d", 
-                 inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        
-        int *client_fd_ptr = malloc(sizeof(int));
-        if (client_fd_ptr) {
-            *client_fd_ptr = client_fd;
-            thread_pool_submit(http_handler_task, client_fd_ptr);
+        shard->thread_started = 1;
+    }
+
+    int result = http_shard_run(&g_http_shards[0]);
+
+    for (int i = 1; i < g_http_shard_count; i++) {
+        if (g_http_shards[i].thread_started) {
+            pthread_join(g_http_shards[i].thread, NULL);
+            g_http_shards[i].thread_started = 0;
         }
     }
     
-    return 0;
+    return result;
 }
 
 void http_server_stop() {
     g_http_running = 0;
-    if (g_http_server_fd >= 0) {
-        close(g_http_server_fd);
-        g_http_server_fd = -1;
+    for (int i = 0; i < g_http_shard_count; i++) {
+        event_loop_stop(&g_http_shards[i].loop);
     }
     log_info("HTTP server stopped");
 }
 
 void http_server_cleanup() {
     http_server_stop();
+    http_shards_destroy();
 }
@@ -0,0 +1,365 @@
+#include "json_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// ---- Scanning ----
+
+static const char* skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return p;
+}
+
+// First quote, backslash or control character in [p, end), or end
+static const char* scan_plain(const char *p, const char *end) {
+#if defined(__SSE2__)
+    // 16 bytes at a time; message text is mostly long plain runs
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+        int mask = _mm_movemask_epi8(special);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && (unsigned char)*p >= 0x20 && *p != '"' && *p != '\\') p++;
+    return p;
+}
+
+// String starting at p (its opening quote); returns the byte after the
+// closing quote, or NULL. Escapes are only stepped over here and checked
+// when a string is decoded.
+static const char* skip_string(const char *p, const char *end) {
+    p++;
+    for (;;) {
+        p = scan_plain(p, end);
+        if (p == end || (unsigned char)*p < 0x20) return NULL;
+        if (*p == '"') return p + 1;
+        if (end - p < 2) return NULL;
+        p += 2;
+    }
+}
+
+static const char* skip_digits(const char *p, const char *end) {
+    const char *start = p;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+    return p > start ? p : NULL;
+}
+
+static const char* skip_number(const char *p, const char *end) {
+    if (p < end && *p == '-') p++;
+    if (!(p = skip_digits(p, end))) return NULL;
+    if (p < end && *p == '.' && !(p = skip_digits(p + 1, end))) return NULL;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (!(p = skip_digits(p, end))) return NULL;
+    }
+    return p;
+}
+
+static const char* skip_literal(const char *p, const char *end, const char *literal, size_t len) {
+    return (size_t)(end - p) >= len && memcmp(p, literal, len) == 0 ? p + len : NULL;
+}
+
+// Anything but an object or array
+static const char* skip_scalar(const char *p, const char *end, int *type) {
+    switch (*p) {
+        case '"': *type = JSON_STRING; return skip_string(p, end);
+        case 't': *type = JSON_TRUE;   return skip_literal(p, end, "true", 4);
+        case 'f': *type = JSON_FALSE;  return skip_literal(p, end, "false", 5);
+        case 'n': *type = JSON_NULL;   return skip_literal(p, end, "null", 4);
+        default:  *type = JSON_NUMBER; return skip_number(p, end);
+    }
+}
+
+// Member name and colon at p; returns the start of the value, or NULL
+static const char* skip_key(const char *p, const char *end) {
+    if (p == end || *p != '"' || !(p = skip_string(p, end))) return NULL;
+    p = skip_space(p, end);
+    if (p == end || *p != ':') return NULL;
+    p = skip_space(p + 1, end);
+    return p < end ? p : NULL;
+}
+
+// Nested object or array at p, checked without recursion: closers holds
+// the bracket each open level expects
+static const char* skip_container(const char *p, const char *end) {
+    char closers[JSON_INDEX_MAX_DEPTH];
+    int depth = 0;
+    int type;
+
+    for (;;) {
+        // p is at a value
+        if (*p == '{' || *p == '[') {
+            if (depth == JSON_INDEX_MAX_DEPTH) return NULL;
+            closers[depth++] = *p == '{' ? '}' : ']';
+            p = skip_space(p + 1, end);
+            if (p == end) return NULL;
+            if (*p != closers[depth - 1]) {
+                if (closers[depth - 1] == '}' && !(p = skip_key(p, end))) return NULL;
+                continue;
+            }
+        } else {
+            if (!(p = skip_scalar(p, end, &type))) return NULL;
+            p = skip_space(p, end);
+        }
+
+        // Close every level this value ends
+        while (p < end && *p == closers[depth - 1]) {
+            p++;
+            if (--depth == 0) return p;
+            p = skip_space(p, end);
+        }
+        if (p == end || *p != ',') return NULL;
+        p = skip_space(p + 1, end);
+        if (p == end) return NULL;
+        if (closers[depth - 1] == '}' && !(p = skip_key(p, end))) return NULL;
+    }
+}
+
+int json_index_parse(JSONIndex *index, const char *json, size_t len) {
+    const char *end = json + len;
+    const char *p = skip_space(json, end);
+
+    index->count = 0;
+    index->truncated = 0;
+    if (p == end || *p != '{') return -1;
+    p = skip_space(p + 1, end);
+    if (p < end && *p == '}') return skip_space(p + 1, end) == end ? 0 : -1;
+
+    for (;;) {
+        if (p == end || *p != '"') break;
+        const char *key = p;
+        const char *key_end = skip_string(p, end);
+        if (!key_end) break;
+        p = skip_space(key_end, end);
+        if (p == end || *p != ':') break;
+        p = skip_space(p + 1, end);
+        if (p == end) break;
+
+        const char *value = p;
+        int type;
+        if (*p == '{' || *p == '[') {
+            type = *p == '{' ? JSON_OBJECT : JSON_ARRAY;
+            p = skip_container(p, end);
+        } else {
+            p = skip_scalar(p, end, &type);
+        }
+        if (!p) break;
+
+        if (index->count < JSON_INDEX_MAX_FIELDS) {
+            JSONField *field = &index->fields[index->count++];
+            field->key = key + 1;
+            field->key_len = key_end - key - 2;
+            field->value = value;
+            field->value_len = p - value;
+            field->type = type;
+        } else {
+            index->truncated = 1;
+        }
+
+        p = skip_space(p, end);
+        if (p < end && *p == ',') {
+            p = skip_space(p + 1, end);
+            continue;
+        }
+        if (p < end && *p == '}' && skip_space(p + 1, end) == end) return 0;
+        break;
+    }
+    index->count = 0;
+    index->truncated = 0;
+    return -1;
+}
+
+// ---- Lookup ----
+
+const JSONField* json_index_get(const JSONIndex *index, const char *key) {
+    size_t len = strlen(key);
+
+    for (int i = 0; i < index->count; i++) {
+        const JSONField *field = &index->fields[i];
+        if (field->key_len == len && memcmp(field->key, key, len) == 0) return field;
+    }
+    return NULL;
+}
+
+int json_index_string(const JSONIndex *index, const char *key, char *out, size_t out_size) {
+    const JSONField *field = json_index_get(index, key);
+    long n;
+
+    if (!field || field->type != JSON_STRING || out_size == 0) return -1;
+
+    // Unescaping never grows a string, so short ones decode straight into out
+    const char *end = field->value + field->value_len;
+    if (field->value_len - 2 < out_size) {
+        n = json_read_string(field->value, end, out);
+    } else {
+        char *decoded = malloc(field->value_len);
+        if (!decoded) return -1;
+        n = json_read_string(field->value, end, decoded);
+        if (n >= 0 && (size_t)n < out_size) memcpy(out, decoded, n);
+        free(decoded);
+    }
+    if (n < 0 || (size_t)n >= out_size || memchr(out, '\0', n)) return -1;
+    out[n] = '\0';
+    return 0;
+}
+
+int json_index_int(const JSONIndex *index, const char *key, int *out) {
+    const JSONField *field = json_index_get(index, key);
+    if (!field || field->type != JSON_NUMBER) return -1;
+
+    const char *p = field->value;
+    const char *end = p + field->value_len;
+    int negative = *p == '-';
+    long long value = 0;
+
+    if (negative) p++;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') return -1;    // fraction or exponent
+        value = value * 10 + (*p - '0');
+        if (value > (long long)INT_MAX + 1) return -1;
+    }
+    if (negative) value = -value;
+    if (value > INT_MAX) return -1;
+    *out = (int)value;
+    return 0;
+}
+
+int json_index_uint(const JSONIndex *index, const char *key, uint64_t max, uint64_t *out) {
+    const JSONField *field = json_index_get(index, key);
+    if (!field || field->type != JSON_NUMBER) return -1;
+
+    uint64_t value = 0;
+    for (size_t i = 0; i < field->value_len; i++) {
+        char c = field->value[i];
+        if (c < '0' || c > '9') return -1;    // sign, fraction or exponent
+        if (value > (max - (c - '0')) / 10) return -1;
+        value = value * 10 + (c - '0');
+    }
+    *out = value;
+    return 0;
+}
+
+int json_index_string_is(const JSONIndex *index, const char *key, const char *value) {
+    char decoded[64];
+    return json_index_string(index, key, decoded, sizeof(decoded)) == 0 && strcmp(decoded, value) == 0;
+}
+
+// ---- Decoding ----
+
+static int hex4(const char *p, const char *end, unsigned *out) {
+    unsigned value = 0;
+    if (end - p < 4) return -1;
+    for (int i = 0; i < 4; i++) {
+        int c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+static size_t utf8_put(char *out, unsigned cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+long json_read_string(const char *v, const char *end, char *out) {
+    char *start = out;
+
+    if (v >= end || *v != '"') return -1;
+    v++;
+    while (v < end && *v != '"') {
+        // Copy the run up to the next escape whole
+        const char *run = scan_plain(v, end);
+        if (run == v && *v != '\\') run++;    // control characters pass through
+        if (run > v) {
+            memcpy(out, v, run - v);
+            out += run - v;
+            v = run;
+            continue;
+        }
+        if (++v >= end) return -1;
+        switch (*v++) {
+            case '"':  *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/':  *out++ = '/'; break;
+            case 'b':  *out++ = '\b'; break;
+            case 'f':  *out++ = '\f'; break;
+            case 'n':  *out++ = '\n'; break;
+            case 'r':  *out++ = '\r'; break;
+            case 't':  *out++ = '\t'; break;
+            case 'u': {
+                unsigned cp, low;
+                if (hex4(v, end, &cp) < 0) return -1;
+                v += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 && end - v >= 6 && v[0] == '\\' && v[1] == 'u' &&
+                    hex4(v + 2, end, &low) == 0 && low >= 0xDC00 && low < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    v += 6;
+                } else if (cp >= 0xD800 && cp < 0xE000) {
+                    cp = 0xFFFD;    // lone surrogate
+                }
+                out += utf8_put(out, cp);
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    return v < end ? out - start : -1;
+}
+
+// ---- Encoding ----
+
+char* json_put_string(char *p, const char *s, size_t len) {
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        switch (c) {
+            case '"':  *p++ = '\\'; *p++ = '"'; break;
+            case '\\': *p++ = '\\'; *p++ = '\\'; break;
+            case '\n': *p++ = '\\'; *p++ = 'n'; break;
+            case '\r': *p++ = '\\'; *p++ = 'r'; break;
+            case '\t': *p++ = '\\'; *p++ = 't'; break;
+            default:
+                if (c < 0x20) p += sprintf(p, "\\u%04x", c);
+                else *p++ = (char)c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
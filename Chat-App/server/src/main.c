@@ -4,14 +4,20 @@
 #include "websocket_server.h"
 #include "thread_pool.h"
 #include "utils.h"
+#include "timer_wheel.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <poll.h>
+
+#define STATS_INTERVAL_MS 10000
+#define MAIN_LOOP_MAX_WAIT_MS 1000
 
 // Global control
-static int g_running = 1;
+static volatile sig_atomic_t g_running = 1;
 
 // Signal handler
 void signal_handler(int sig) {
@@ -21,6 +27,14 @@ void signal_handler(int sig) {
     }
 }
 
+// Periodic stats
+static void print_stats_job(Timer *timer, void *arg) {
+    (void)timer;
+    (void)arg;
+    db_print_stats();
+    websocket_print_stats();
+}
+
 // HTTP server thread
 void* http_server_thread(void *arg) {
     log_info("HTTP server thread started");
@@ -78,17 +92,48 @@ int main() {
     db_print_users();
     db_print_rooms();
     
+    // CHAT_HTTP_MAX_BODY raises the request body limit (64 KB by default)
+    const char *max_body = getenv("CHAT_HTTP_MAX_BODY");
+    if (max_body) {
+        HTTPLimitsConfig limits = {0, strtoul(max_body, NULL, 10)};
+        http_server_set_limits(&limits);
+    }
+
     // Initialize HTTP server
     if (http_server_init(3005) < 0) {
         log_error("Failed to initialize HTTP server");
         return 1;
     }
     
-    // Initialize WebSocket server
+    // Initialize WebSocket server (CHAT_IO_BACKEND=io_uring opts in)
+    const char *io_backend = getenv("CHAT_IO_BACKEND");
+    if (io_backend && strcmp(io_backend, "io_uring") == 0) {
+        websocket_set_io_backend(WS_IO_URING);
+    }
     if (websocket_init(7070) < 0) {
         log_error("Failed to initialize WebSocket server");
         return 1;
     }
+
+    // CHAT_ALLOWED_ORIGINS restricts browser origins (any by default)
+    const char *allowed_origins = getenv("CHAT_ALLOWED_ORIGINS");
+    if (allowed_origins && websocket_set_allowed_origins(allowed_origins) < 0) {
+        log_error("CHAT_ALLOWED_ORIGINS is too long, allowing any origin");
+    }
+
+    // CHAT_BUS shares rooms with other processes (unix:DIR, shm:DIR or tcp:HOST:PORT)
+    const char *bus = getenv("CHAT_BUS");
+    if (bus && websocket_set_bus(bus) < 0) {
+        log_error("Failed to join message bus %s", bus);
+        return 1;
+    }
+
+    // CHAT_COALESCE_WINDOW_MS batches busy rooms (off by default)
+    const char *coalesce_window = getenv("CHAT_COALESCE_WINDOW_MS");
+    if (coalesce_window) {
+        WSCoalesceConfig coalesce = {atoi(coalesce_window), 0};
+        websocket_set_default_coalescing(&coalesce);
+    }
     
     // Start servers in separate threads
     pthread_t http_thread, ws_thread;
@@ -106,15 +151,19 @@ int main() {
     log_info("All servers started successfully!");
     printf("\n💡 Server is running. Press Ctrl+C to shutdown.\n\n");
     
-    // Main loop - monitor and wait for shutdown signal
+    // Main loop - run periodic jobs until a shutdown signal
+    TimerWheel jobs;
+    Timer stats_timer;
+    timer_wheel_init(&jobs);
+    timer_init(&stats_timer, print_stats_job, NULL);
+    timer_wheel_schedule_periodic(&jobs, &stats_timer, STATS_INTERVAL_MS);
+
     while (g_running) {
-        sleep(1);
-        
-        // Periodic stats (every 10 seconds)
-        static int tick = 0;
-        if (++tick % 10 == 0) {
-            db_print_stats();
-        }
+        // A signal interrupts the wait; the cap bounds it regardless
+        int timeout = timer_wheel_next_timeout(&jobs, get_monotonic_ms());
+        if (timeout < 0 || timeout > MAIN_LOOP_MAX_WAIT_MS) timeout = MAIN_LOOP_MAX_WAIT_MS;
+        poll(NULL, 0, timeout);
+        timer_wheel_advance(&jobs, get_monotonic_ms());
     }
     
     // Shutdown
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include "shm_ring.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define SHM_RING_MAGIC 0x474E5252u    // "RRNG"
+#define SHM_RING_VERSION 1
+#define SHM_RING_DATA_OFFSET 4096     // header page, then the data
+#define SHM_RING_MIN_CAPACITY 4096
+#define SHM_RING_MAX_CAPACITY (1ULL << 30)
+#define SHM_DOORBELL_SIZE 4096
+
+// Record header: length in the low 32 bits plus flags. Records start on
+// 8-byte boundaries and never wrap; a padding record fills the end of
+// the buffer when the next message does not fit there.
+#define SHM_RECORD_HEADER 8
+#define SHM_RECORD_COMMITTED (1ULL << 32)
+#define SHM_RECORD_PADDING (1ULL << 33)
+
+// Producers and the consumer write different cache lines
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    _Alignas(64) _Atomic uint64_t head;     // next byte producers reserve
+    _Alignas(64) _Atomic uint64_t tail;     // next byte the consumer reads
+    _Alignas(64) _Atomic uint64_t dropped;  // pushes refused for lack of space
+};
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~7ULL;
+}
+
+static _Atomic uint64_t* record_at(const ShmRing *ring, uint64_t offset) {
+    return (_Atomic uint64_t*)(ring->data + offset);
+}
+
+// Sealed against shrinking: a peer truncating the file would otherwise
+// turn our next access into SIGBUS
+static int shm_create_fd(const char *name, size_t size) {
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, size) < 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Size of a received memfd, or -1 unless it is sealed against shrinking
+static off_t shm_sealed_size(int fd) {
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fd, &st) < 0) return -1;
+    return st.st_size;
+}
+
+int shm_ring_create(ShmRing *ring, size_t capacity) {
+    uint64_t cap = SHM_RING_MIN_CAPACITY;
+    while (cap < capacity && cap < SHM_RING_MAX_CAPACITY) cap <<= 1;
+
+    memset(ring, 0, sizeof(ShmRing));
+    ring->map_size = SHM_RING_DATA_OFFSET + cap;
+    ring->fd = shm_create_fd("chat-ring", ring->map_size);
+    if (ring->fd < 0) return -1;
+
+    void *map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (map == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+
+    // A fresh memfd is zero-filled, which is an empty ring
+    ring->header = map;
+    ring->data = (unsigned char*)map + SHM_RING_DATA_OFFSET;
+    ring->capacity = cap;
+    ring->header->magic = SHM_RING_MAGIC;
+    ring->header->version = SHM_RING_VERSION;
+    ring->header->capacity = cap;
+    return 0;
+}
+
+int shm_ring_attach(ShmRing *ring, int fd) {
+    memset(ring, 0, sizeof(ShmRing));
+    ring->fd = fd;
+
+    off_t size = shm_sealed_size(fd);
+    if (size < SHM_RING_DATA_OFFSET + SHM_RING_MIN_CAPACITY) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    ShmRingHeader *header = map;
+    uint64_t cap = header->capacity;
+    if (header->magic != SHM_RING_MAGIC || header->version != SHM_RING_VERSION ||
+        cap < SHM_RING_MIN_CAPACITY || (cap & (cap - 1)) ||
+        (uint64_t)size != SHM_RING_DATA_OFFSET + cap) {
+        munmap(map, size);
+        close(fd);
+        return -1;
+    }
+
+    ring->header = header;
+    ring->data = (unsigned char*)map + SHM_RING_DATA_OFFSET;
+    ring->capacity = cap;
+    ring->map_size = size;
+    return 0;
+}
+
+void shm_ring_detach(ShmRing *ring) {
+    if (ring->header) munmap(ring->header, ring->map_size);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(ShmRing));
+    ring->fd = -1;
+}
+
+int shm_ring_push(ShmRing *ring, const struct iovec *iov, int iovcnt) {
+    ShmRingHeader *header = ring->header;
+    uint64_t cap = ring->capacity;
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+    uint64_t need = align8(SHM_RECORD_HEADER + len);
+    if (need > cap / 2) {
+        atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    // Reserve: one CAS claims the record and any padding before it
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+    uint64_t offset, total;
+    for (;;) {
+        uint64_t tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+        offset = head & (cap - 1);
+        uint64_t contiguous = cap - offset;
+        total = need <= contiguous ? need : contiguous + need;
+        if (head + total - tail > cap) {
+            atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+            return -1;
+        }
+        if (atomic_compare_exchange_weak_explicit(&header->head, &head, head + total,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    if (total != need) {
+        uint64_t contiguous = cap - offset;
+        atomic_store_explicit(record_at(ring, offset),
+                              (contiguous - SHM_RECORD_HEADER) | SHM_RECORD_COMMITTED | SHM_RECORD_PADDING,
+                              memory_order_release);
+        offset = 0;
+    }
+
+    unsigned char *out = ring->data + offset + SHM_RECORD_HEADER;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(out, iov[i].iov_base, iov[i].iov_len);
+        out += iov[i].iov_len;
+    }
+    atomic_store_explicit(record_at(ring, offset), (uint64_t)len | SHM_RECORD_COMMITTED,
+                          memory_order_release);
+    return 0;
+}
+
+int shm_ring_consume(ShmRing *ring, shm_ring_handler handler, void *arg, int max) {
+    ShmRingHeader *header = ring->header;
+    uint64_t cap = ring->capacity;
+    uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    int count = 0;
+
+    while (count < max) {
+        uint64_t offset = tail & (cap - 1);
+        uint64_t word = atomic_load_explicit(record_at(ring, offset), memory_order_acquire);
+        if (!(word & SHM_RECORD_COMMITTED)) break;
+
+        // The producer is another process: trust nothing it wrote
+        uint64_t len = word & 0xFFFFFFFFULL;
+        uint64_t size = align8(SHM_RECORD_HEADER + len);
+        if (size > cap - offset) return -1;
+
+        if (!(word & SHM_RECORD_PADDING)) {
+            handler(ring->data + offset + SHM_RECORD_HEADER, len, arg);
+            count++;
+        }
+
+        // Zero the record so stale bytes never look like a committed
+        // header when producers lay records out differently next lap
+        memset(ring->data + offset, 0, size);
+        tail += size;
+        atomic_store_explicit(&header->tail, tail, memory_order_release);
+    }
+    return count;
+}
+
+int shm_ring_empty(const ShmRing *ring) {
+    uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    uint64_t word = atomic_load_explicit(record_at(ring, tail & (ring->capacity - 1)),
+                                         memory_order_acquire);
+    return !(word & SHM_RECORD_COMMITTED);
+}
+
+uint64_t shm_ring_dropped(const ShmRing *ring) {
+    return atomic_load_explicit(&ring->header->dropped, memory_order_relaxed);
+}
+
+// Doorbell
+
+ShmDoorbell* shm_doorbell_create(int *fd_out) {
+    int fd = shm_create_fd("chat-doorbell", SHM_DOORBELL_SIZE);
+    if (fd < 0) return NULL;
+
+    void *map = mmap(NULL, SHM_DOORBELL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    *fd_out = fd;
+    return map;
+}
+
+ShmDoorbell* shm_doorbell_attach(int fd) {
+    off_t size = shm_sealed_size(fd);
+    void *map = size == SHM_DOORBELL_SIZE ?
+                mmap(NULL, SHM_DOORBELL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+    // The mapping keeps the memory alive on its own
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+void shm_doorbell_detach(ShmDoorbell *bell) {
+    if (bell) munmap(bell, SHM_DOORBELL_SIZE);
+}
+
+// Shared (not FUTEX_PRIVATE) operations: waiter and waker are different
+// processes mapping the same page
+static long shm_futex(_Atomic uint32_t *word, int op, uint32_t value, const struct timespec *timeout) {
+    return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+void shm_doorbell_ring(ShmDoorbell *bell) {
+    // Pairs with the fence in prepare: either the consumer sees our
+    // record when it re-checks, or we see it asleep here
+    atomic_thread_fence(memory_order_seq_cst);
+    // Whoever clears sleeping does the one wake; pushes that follow before
+    // the consumer runs again skip the syscall
+    if (atomic_load_explicit(&bell->sleeping, memory_order_relaxed) &&
+        atomic_exchange_explicit(&bell->sleeping, 0, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&bell->seq, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&bell->wakeups, 1, memory_order_relaxed);
+        shm_futex(&bell->seq, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+uint32_t shm_doorbell_prepare(ShmDoorbell *bell) {
+    uint32_t seq = atomic_load_explicit(&bell->seq, memory_order_relaxed);
+    atomic_store_explicit(&bell->sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    return seq;
+}
+
+void shm_doorbell_wait(ShmDoorbell *bell, uint32_t seq, int timeout_ms) {
+    struct timespec timeout = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L};
+
+    // Returns at once if a producer rang since prepare (seq moved on)
+    shm_futex(&bell->seq, FUTEX_WAIT, seq, timeout_ms >= 0 ? &timeout : NULL);
+    atomic_store_explicit(&bell->sleeping, 0, memory_order_relaxed);
+}
+
+void shm_doorbell_cancel(ShmDoorbell *bell) {
+    atomic_store_explicit(&bell->sleeping, 0, memory_order_relaxed);
+}
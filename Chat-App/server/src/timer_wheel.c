@@ -0,0 +1,151 @@
+#include "timer_wheel.h"
+#include "utils.h"
+#include <string.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_DELAY ((1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+void timer_wheel_init(TimerWheel *wheel) {
+    memset(wheel, 0, sizeof(TimerWheel));
+    wheel->origin_ms = (uint64_t)get_monotonic_ms();
+}
+
+void timer_init(Timer *timer, timer_callback on_expire, void *arg) {
+    memset(timer, 0, sizeof(Timer));
+    timer->on_expire = on_expire;
+    timer->arg = arg;
+}
+
+int timer_pending(const Timer *timer) {
+    return timer->slot != NULL;
+}
+
+static int slot_level(TimerWheel *wheel, Timer **slot) {
+    return (int)((slot - &wheel->slots[0][0]) / TIMER_WHEEL_SLOTS);
+}
+
+// Link timer into the slot its expiry falls in: the lowest level whose
+// span still covers the distance from now
+static void wheel_place(TimerWheel *wheel, Timer *timer) {
+    uint64_t delta = timer->expires - wheel->now;
+    int level = 0;
+
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    Timer **slot = &wheel->slots[level][(timer->expires >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK];
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot) (*slot)->prev = timer;
+    *slot = timer;
+    timer->slot = slot;
+    wheel->level_count[level]++;
+    wheel->count++;
+}
+
+static void wheel_unlink(TimerWheel *wheel, Timer *timer) {
+    if (timer->prev) timer->prev->next = timer->next;
+    else *timer->slot = timer->next;
+    if (timer->next) timer->next->prev = timer->prev;
+
+    wheel->level_count[slot_level(wheel, timer->slot)]--;
+    wheel->count--;
+    timer->slot = NULL;
+    timer->next = timer->prev = NULL;
+}
+
+static void wheel_arm(TimerWheel *wheel, Timer *timer, uint64_t delay_ms) {
+    if (timer->slot) wheel_unlink(wheel, timer);
+
+    // Never due in the tick being processed, which may already have run
+    if (delay_ms == 0) delay_ms = 1;
+    if (delay_ms > MAX_DELAY) delay_ms = MAX_DELAY;
+    timer->expires = wheel->now + delay_ms;
+    wheel_place(wheel, timer);
+}
+
+void timer_wheel_schedule(TimerWheel *wheel, Timer *timer, uint64_t delay_ms) {
+    timer->period = 0;
+    wheel_arm(wheel, timer, delay_ms);
+}
+
+void timer_wheel_schedule_periodic(TimerWheel *wheel, Timer *timer, uint64_t period_ms) {
+    wheel_arm(wheel, timer, period_ms);
+    timer->period = timer->expires - wheel->now;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer) {
+    if (timer->slot) wheel_unlink(wheel, timer);
+    timer->period = 0;
+}
+
+// Move one upper-level slot down now that its span has begun
+static void wheel_cascade(TimerWheel *wheel, int level) {
+    Timer **slot = &wheel->slots[level][(wheel->now >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK];
+    Timer *timer = *slot;
+
+    while (timer) {
+        Timer *next = timer->next;
+        wheel_unlink(wheel, timer);
+        wheel_place(wheel, timer);
+        timer = next;
+    }
+}
+
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms) {
+    uint64_t target = now_ms > wheel->origin_ms ? now_ms - wheel->origin_ms : 0;
+
+    while (wheel->now < target) {
+        if (wheel->count == 0) {
+            wheel->now = target;
+            break;
+        }
+
+        // Nothing can fire before the next cascade while level 0 is empty
+        if (wheel->level_count[0] == 0) {
+            uint64_t skip = wheel->now | SLOT_MASK;
+            wheel->now = skip < target ? skip : target;
+            if (wheel->now == target) break;
+        }
+
+        wheel->now++;
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if ((wheel->now >> (TIMER_WHEEL_SLOT_BITS * (level - 1))) & SLOT_MASK) break;
+            wheel_cascade(wheel, level);
+        }
+
+        // Pop one at a time: a callback may cancel timers in the same slot
+        Timer **slot = &wheel->slots[0][wheel->now & SLOT_MASK];
+        while (*slot) {
+            Timer *timer = *slot;
+            wheel_unlink(wheel, timer);
+            if (timer->period) {
+                timer->expires = wheel->now + timer->period;
+                wheel_place(wheel, timer);
+            }
+            timer->on_expire(timer, timer->arg);
+        }
+    }
+}
+
+int timer_wheel_next_timeout(const TimerWheel *wheel, uint64_t now_ms) {
+    if (wheel->count == 0) return -1;
+
+    int upper = wheel->count > wheel->level_count[0];
+    uint64_t due = wheel->now + TIMER_WHEEL_SLOTS;
+    for (uint64_t tick = wheel->now + 1; tick <= wheel->now + TIMER_WHEEL_SLOTS; tick++) {
+        if (wheel->slots[0][tick & SLOT_MASK] || (upper && (tick & SLOT_MASK) == 0)) {
+            due = tick;
+            break;
+        }
+    }
+
+    uint64_t due_ms = wheel->origin_ms + due;
+    return due_ms > now_ms ? (int)(due_ms - now_ms) : 0;
+}
+
+uint64_t timer_wheel_time_ms(const TimerWheel *wheel) {
+    return wheel->origin_ms + wheel->now;
+}
@@ -5,7 +5,11 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 // ============= STRING UTILITIES =============
 
@@ -89,6 +93,13 @@ time_t get_current_timestamp() {
     return time(NULL);
 }
 
+// Milliseconds from a clock that never jumps (for timeouts and lag)
+long long get_monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 char* timestamp_to_string(time_t timestamp) {
     static char buffer[32];
     struct tm *tm_info = localtime(&timestamp);
@@ -115,6 +126,54 @@ int socket_set_reuseaddr(int fd) {
     return setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 }
 
+int socket_set_reuseport(int fd) {
+    int opt = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+}
+
+// Non-blocking listener on all interfaces. SO_REUSEPORT lets several
+// listeners share the port; the kernel spreads connections across them.
+int socket_create_listener(int port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (socket_set_reuseaddr(fd) < 0 || socket_set_reuseport(fd) < 0) {
+        log_error("Failed to set socket options: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_error("Failed to bind to port %d: %s", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, backlog) < 0) {
+        log_error("Failed to listen on port %d: %s", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// ============= SYSTEM UTILITIES =============
+
+int get_cpu_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
 // ============= LOGGING =============
 
 void log_info(const char *format, ...) {
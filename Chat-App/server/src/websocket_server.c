@@ -1,5 +1,18 @@
+#define _GNU_SOURCE
 #include "websocket_server.h"
+#include "event_loop.h"
+#include "ws_frame.h"
+#include "ws_parser.h"
+#include "ws_deflate.h"
+#include "ws_protocol.h"
+#include "json_index.h"
+#include "ws_handshake.h"
+#include "chat_bus.h"
+#include "uring.h"
+#include "timer_wheel.h"
 #include "utils.h"
+#include "authentication.h"
+#include "database.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,323 +22,2264 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <errno.h>
-#include <openssl/sha.h>
-#include <openssl/bio.h>
-#include <openssl/evp.h>
-#include <openssl/buffer.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/resource.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/random.h>
 
-#define MAX_FRAME_SIZE 65536
-#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_RECV_BUFFER_SIZE 65536
+#define WS_MAX_IOV 64
+#define WS_STATS_MAX_LAGGING 16
+#define WS_ROOM_BUCKETS 1024
+#define WS_ROOM_HISTORY 256           // recent frames kept per room for resume
+#define WS_SEQ_COUNTER_BITS 32        // below the epoch in every seq
+#define WS_SEQ_EPOCH_BITS 21          // so seq stays within 2^53 for JavaScript
+#define WS_CLIENT_INITIAL_SLOTS 256
+#define WS_EXTENSIONS_SIZE 1024
+#define WS_ORIGINS_SIZE 1024
+#define WS_URING_ENTRIES 4096
+#define WS_URING_CQ_ENTRIES 16384
+#define WS_URING_BUF_COUNT 1024       // provided receive buffers per shard
+#define WS_URING_BUF_SIZE 4096
+#define WS_URING_SEND_IOV 16          // frames per in-flight sendmsg
+#define WS_TOKEN_SIZE 256
+#define WS_TOKEN_SWEEP_INTERVAL_MS 60000
 
 // Global server state
 static WebSocketServer g_server = {0};
-static int g_server_fd = -1;
 static int g_running = 0;
 static int g_ws_port = 7070;
-static pthread_t g_accept_thread;
 
-// Base64 encoding helper
-static void base64_encode(const unsigned char *input, int length, char *output) {
-    BIO *bio, *b64;
-    BUF_MEM *buffer_ptr;
+// A recent room message, as encoded for each wire format (the binary
+// encoding is built when a binary client first needs it)
+typedef struct {
+    WSOutFrame *plain;
+    WSOutFrame *binary;
+} WSHistoryEntry;
+
+// A message held back by coalescing
+typedef struct {
+    WSOutFrame *plain;        // already sequenced and recorded
+    WSOutFrame *binary;       // built when a binary recipient needs it
+    int sender_fd;            // gets the batch without its own messages
+} WSBatchEntry;
+
+// Room fan-out index: room_id -> fds of the clients in that room, plus
+// the room's message sequence and a ring of its most recent frames.
+// Guarded by g_server.clients_mutex.
+typedef struct WSRoom {
+    int room_id;
+    int *members;
+    int member_count;
+    int member_cap;
+    uint64_t last_seq;            // sequence of the newest message, 0 = none yet
+    WSHistoryEntry *history;      // the last history_count messages
+    int history_head;             // ring slot of the oldest
+    int history_count;
+    WSCoalesceConfig coalesce;
+    long long last_send_ms;       // when messages last went out to members
+    WSBatchEntry *batch;          // held messages, flushed by flush_timer
+    int batch_count;
+    Timer flush_timer;
+    struct WSRoom *next;
+} WSRoom;
+
+static WSRoom *g_rooms[WS_ROOM_BUCKETS];
+static WSCoalesceConfig g_default_coalesce = {0, 0};
+
+// Flush deadlines of coalescing rooms. Messages are published from every
+// shard and from HTTP workers, so the deadlines live on a wheel of their
+// own, run by a dedicated thread and guarded by clients_mutex like the
+// rooms themselves.
+static struct {
+    TimerWheel wheel;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int started;
+    int stopping;
+} g_coalescer;
+
+static atomic_ulong g_total_batches = 0;
+static atomic_ulong g_total_batched_messages = 0;
+
+// Client slot map helpers (caller holds clients_mutex)
+
+static WSClientHandle ws_client_handle(int slot) {
+    return ((uint64_t)g_server.clients[slot].generation << 32) | (uint32_t)slot;
+}
+
+// Slot of a live handle, or -1 if the client has gone
+static int ws_client_slot(WSClientHandle handle) {
+    uint32_t slot = (uint32_t)handle;
+    if (slot >= (uint32_t)g_server.capacity) return -1;
+
+    WebSocketClient *client = &g_server.clients[slot];
+    if (!client->is_connected || client->generation != (uint32_t)(handle >> 32)) return -1;
+    return (int)slot;
+}
+
+// Double the slot table; the new slots become the free list
+static int ws_clients_grow() {
+    int old_cap = g_server.capacity;
+    if (old_cap > INT_MAX / 2) return -1;
+    int new_cap = old_cap ? old_cap * 2 : WS_CLIENT_INITIAL_SLOTS;
+
+    WebSocketClient *clients = realloc(g_server.clients, new_cap * sizeof(WebSocketClient));
+    if (!clients) return -1;
+    g_server.clients = clients;
+
+    int *active = realloc(g_server.active, new_cap * sizeof(int));
+    if (!active) return -1;
+    g_server.active = active;
+
+    for (int i = old_cap; i < new_cap; i++) {
+        memset(&clients[i], 0, sizeof(WebSocketClient));
+        clients[i].fd = -1;
+        clients[i].generation = 1;
+        clients[i].link = i + 1 < new_cap ? i + 1 : g_server.free_head;
+    }
+    g_server.free_head = old_cap;
+    g_server.capacity = new_cap;
+    return 0;
+}
+
+// Make fd addressable in the fd -> slot index
+static int ws_clients_reserve_fd(int fd) {
+    if (fd < g_server.fd_capacity) return 0;
+
+    int new_cap = g_server.fd_capacity ? g_server.fd_capacity : WS_CLIENT_INITIAL_SLOTS;
+    while (new_cap <= fd) {
+        if (new_cap > INT_MAX / 2) return -1;
+        new_cap *= 2;
+    }
+
+    int *fd_slots = realloc(g_server.fd_slots, new_cap * sizeof(int));
+    if (!fd_slots) return -1;
+    for (int i = g_server.fd_capacity; i < new_cap; i++) {
+        fd_slots[i] = -1;
+    }
+    g_server.fd_slots = fd_slots;
+    g_server.fd_capacity = new_cap;
+    return 0;
+}
+
+static void ws_clients_clear() {
+    for (int i = 0; i < g_server.capacity; i++) {
+        free(g_server.clients[i].heap_rooms);
+    }
+    free(g_server.clients);
+    free(g_server.active);
+    free(g_server.fd_slots);
+    g_server.clients = NULL;
+    g_server.active = NULL;
+    g_server.fd_slots = NULL;
+    g_server.capacity = 0;
+    g_server.fd_capacity = 0;
+    g_server.client_count = 0;
+    g_server.free_head = -1;
+}
+
+// Find a room's index entry (caller holds clients_mutex)
+static WSRoom* ws_room_find(int room_id) {
+    WSRoom *room = g_rooms[(unsigned)room_id % WS_ROOM_BUCKETS];
+    while (room && room->room_id != room_id) {
+        room = room->next;
+    }
+    return room;
+}
+
+static void ws_room_on_flush_timer(Timer *timer, void *arg);
+
+static WSRoom* ws_room_get(int room_id) {
+    WSRoom *room = ws_room_find(room_id);
+
+    if (!room) {
+        room = calloc(1, sizeof(WSRoom));
+        if (!room) return NULL;
+        room->room_id = room_id;
+        room->coalesce = g_default_coalesce;
+        timer_init(&room->flush_timer, ws_room_on_flush_timer, room);
+        unsigned bucket = (unsigned)room_id % WS_ROOM_BUCKETS;
+        room->next = g_rooms[bucket];
+        g_rooms[bucket] = room;
+    }
+    return room;
+}
+
+static void ws_room_history_clear(WSRoom *room) {
+    for (int i = 0; i < room->history_count; i++) {
+        WSHistoryEntry *entry = &room->history[(room->history_head + i) % WS_ROOM_HISTORY];
+        ws_frame_unref(entry->plain);
+        ws_frame_unref(entry->binary);
+    }
+    room->history_head = 0;
+    room->history_count = 0;
+}
+
+static void ws_room_batch_clear(WSRoom *room) {
+    for (int i = 0; i < room->batch_count; i++) {
+        ws_frame_unref(room->batch[i].plain);
+        ws_frame_unref(room->batch[i].binary);
+    }
+    room->batch_count = 0;
+}
+
+static void ws_room_free(WSRoom *room) {
+    timer_wheel_cancel(&g_coalescer.wheel, &room->flush_timer);
+    ws_room_batch_clear(room);
+    free(room->batch);
+    ws_room_history_clear(room);
+    free(room->history);
+    free(room->members);
+    free(room);
+}
+
+static int ws_room_add_member(int room_id, int fd) {
+    WSRoom *room = ws_room_get(room_id);
+    if (!room) return -1;
+
+    if (room->member_count == room->member_cap) {
+        int new_cap = room->member_cap ? room->member_cap * 2 : 8;
+        int *grown = realloc(room->members, new_cap * sizeof(int));
+        if (!grown) return -1;
+        room->members = grown;
+        room->member_cap = new_cap;
+    }
+
+    room->members[room->member_count++] = fd;
+    return 0;
+}
+
+static int ws_room_has_member(WSRoom *room, int fd) {
+    for (int i = 0; i < room->member_count; i++) {
+        if (room->members[i] == fd) return 1;
+    }
+    return 0;
+}
+
+static void ws_room_remove_member(int room_id, int fd) {
+    unsigned bucket = (unsigned)room_id % WS_ROOM_BUCKETS;
+    WSRoom **link = &g_rooms[bucket];
+
+    while (*link && (*link)->room_id != room_id) {
+        link = &(*link)->next;
+    }
+    WSRoom *room = *link;
+    if (!room) return;
+
+    for (int i = 0; i < room->member_count; i++) {
+        if (room->members[i] == fd) {
+            // Order within a room does not matter: swap in the last member
+            room->members[i] = room->members[--room->member_count];
+            break;
+        }
+    }
+
+    // Drop empty rooms, unless they have a sequence to keep (it must not
+    // restart while clients may still resume from it) or settings
+    if (room->member_count == 0 && room->last_seq == 0 && room->coalesce.window_ms == 0) {
+        *link = room->next;
+        ws_room_free(room);
+    }
+}
+
+static void ws_rooms_clear() {
+    for (int i = 0; i < WS_ROOM_BUCKETS; i++) {
+        WSRoom *room = g_rooms[i];
+        while (room) {
+            WSRoom *next = room->next;
+            ws_room_free(room);
+            room = next;
+        }
+        g_rooms[i] = NULL;
+    }
+}
+
+// A client's subscribed rooms, sorted (caller holds clients_mutex)
+static int* ws_client_rooms(WebSocketClient *client) {
+    return client->heap_rooms ? client->heap_rooms : client->inline_rooms;
+}
+
+// Index of room_id in the client's set, or -(insertion point) - 1
+static int ws_client_find_room(WebSocketClient *client, int room_id) {
+    int *rooms = ws_client_rooms(client);
+    int lo = 0, hi = client->room_count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (rooms[mid] < room_id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < client->room_count && rooms[lo] == room_id ? lo : -lo - 1;
+}
+
+// Add a room to the client's set and to the fan-out index.
+// Returns 0, 1 if already subscribed, or -1.
+static int ws_client_subscribe(WebSocketClient *client, int room_id) {
+    int pos = ws_client_find_room(client, room_id);
+    if (pos >= 0) return 1;
+    pos = -pos - 1;
+
+    if (client->room_count >= WS_MAX_ROOMS_PER_CLIENT) return -1;
+    if (client->room_count == client->room_cap) {
+        int new_cap = client->room_cap * 2;
+        int *grown = realloc(client->heap_rooms, new_cap * sizeof(int));
+        if (!grown) return -1;
+        if (!client->heap_rooms) {
+            memcpy(grown, client->inline_rooms, client->room_count * sizeof(int));
+        }
+        client->heap_rooms = grown;
+        client->room_cap = new_cap;
+    }
+
+    if (ws_room_add_member(room_id, client->fd) < 0) return -1;
+
+    int *rooms = ws_client_rooms(client);
+    memmove(rooms + pos + 1, rooms + pos, (client->room_count - pos) * sizeof(int));
+    rooms[pos] = room_id;
+    client->room_count++;
+    return 0;
+}
+
+// Returns 0, or 1 if the client was not subscribed
+static int ws_client_unsubscribe(WebSocketClient *client, int room_id) {
+    int pos = ws_client_find_room(client, room_id);
+    if (pos < 0) return 1;
+
+    ws_room_remove_member(room_id, client->fd);
+    int *rooms = ws_client_rooms(client);
+    memmove(rooms + pos, rooms + pos + 1, (client->room_count - pos - 1) * sizeof(int));
+    client->room_count--;
+    if (client->room_id == room_id) client->room_id = 0;
+    return 0;
+}
+
+static void ws_client_reset_rooms(WebSocketClient *client) {
+    int *rooms = ws_client_rooms(client);
+    for (int i = 0; i < client->room_count; i++) {
+        ws_room_remove_member(rooms[i], client->fd);
+    }
+    free(client->heap_rooms);
+    client->heap_rooms = NULL;
+    client->room_count = 0;
+    client->room_cap = WS_CLIENT_INLINE_ROOMS;
+}
+
+// Per-connection state owned by the reactor
+typedef enum {
+    WS_STATE_HANDSHAKE = 0,   // waiting for the HTTP upgrade request
+    WS_STATE_OPEN,            // exchanging frames
+    WS_STATE_CLOSING          // close frame sent, connection being torn down
+} WSConnState;
+
+// Queued outbound frame
+typedef struct {
+    WSOutFrame *frame;
+    long long enqueued_ms;
+} WSOutEntry;
+
+typedef struct WSShard WSShard;
+
+// Upgrade request that did not arrive in one read, kept with its parser
+typedef struct {
+    WSHandshake parser;
+    size_t len;
+    char data[WS_HANDSHAKE_MAX_SIZE];
+} WSPendingUpgrade;
+
+typedef struct WSConnection {
+    EventSource src;          // must stay first (event loop casts back to us)
+    WSShard *shard;           // reactor that accepted and owns the socket
+    struct WSConnection *prev, *next;   // shard's connection list
+    WSConnState state;
+    WSPendingUpgrade *upgrade;  // upgrade request split across reads, freed after the handshake
+    WSParser parser;          // incremental frame parser / message reassembler
+    WSDeflateState deflate;   // permessage-deflate parameters, if negotiated
+    WSProtocol protocol;      // wire format chosen through Sec-WebSocket-Protocol
+    Timer timer;              // handshake deadline, then heartbeat
+    time_t token_expires;     // login token validity, checked by the sweep
+    int user_id;              // identity from the login token, stamped on
+    char username[sizeof(((User*)0)->username)];    // every relayed event
+    uint64_t last_active_ms;  // last inbound data (shard wheel time)
+    WSHeartbeatConfig heartbeat;
+
+    // Outbound queue, drained by non-blocking writes. Any thread may
+    // enqueue (holding clients_mutex, which keeps the connection alive);
+    // the reactor drains it on EPOLLOUT.
+    pthread_mutex_t out_lock;
+    WSOutEntry *out_queue;    // ring, only allocated while a backlog exists
+    int out_cap;
+    int out_head;
+    int out_count;
+    size_t out_offset;        // bytes of the head frame already written
+    size_t out_bytes;         // unsent bytes across the whole queue
+    int out_pinned;           // head frames an in-flight send still points at
+    int kill_pending;         // slow-consumer disconnect requested
+    unsigned long dropped_frames;
+    unsigned long coalesced_frames;
+    long long max_lag_ms;
+
+#ifdef HAVE_IO_URING
+    // io_uring backend: every submitted operation holds a reference and
+    // the connection is freed when the last one completes
+    atomic_int refs;
+    int closed;
+    int dirty;                // waiting on the shard's dirty list (out_lock)
+    int send_inflight;        // one sendmsg at a time keeps frames in order
+    int close_after_send;     // close once the queued close reply is out
+    struct WSConnection *dirty_next;
+    struct msghdr send_msg;
+    struct iovec send_iov[WS_URING_SEND_IOV];
+#endif
+} WSConnection;
+
+// One reactor per shard: its own SO_REUSEPORT listener, epoll loop and
+// thread. The kernel spreads new connections across the listeners and a
+// connection stays on the shard that accepted it. Rooms span shards:
+// broadcasts enqueue on each recipient's queue (see ws_conn_send) and the
+// owning shard drains it.
+struct WSShard {
+    EventSource listen_src;   // must stay first (event loop casts back to us)
+    EventLoop loop;
+    int loop_ready;
+    pthread_t thread;
+    int thread_started;
+    WSConnection *conns;      // owned connections, touched only by this shard
+    atomic_int conn_count;
+    Timer token_sweep;
+
+    // Per-reactor scratch buffers
+    unsigned char recv_buf[WS_RECV_BUFFER_SIZE];
+    unsigned char *inflate_buf;   // decompressed inbound message
+    size_t inflate_cap;
+
+#ifdef HAVE_IO_URING
+    // Completion-based backend: multishot accept and recv, and sends
+    // collected on a dirty list and submitted in one batch per loop turn
+    int uring_active;
+    Uring ring;
+    UringBufRing bufs;
+    pthread_t owner;
+    pthread_mutex_t dirty_lock;
+    WSConnection *dirty;      // connections with frames to submit
+    int zombies;              // closed connections awaiting completions
+    atomic_ulong sends_submitted;
+    atomic_ulong enters;      // io_uring_enter calls
+#endif
+};
+
+#ifdef HAVE_IO_URING
+// user_data: pointer with the operation in the low bits
+enum {
+    WS_URING_IGNORE = 0,
+    WS_URING_ACCEPT,
+    WS_URING_WAKE,
+    WS_URING_RECV,
+    WS_URING_SEND
+};
+#define WS_URING_OP_MASK 7ULL
+
+static void ws_conn_mark_dirty_locked(WSConnection *conn);
+static void ws_conn_close_after_flush(WSConnection *conn);
+#endif
+
+static WSIOBackend g_io_backend = WS_IO_EPOLL;
+
+static WSShard *g_shards = NULL;
+static int g_shard_count = 0;
+static int g_shard_config = 0;    // 0 = one per online CPU
+
+// Connection table indexed by fd, sized to the process fd limit
+static WSConnection **g_conns = NULL;
+static int g_conns_cap = 0;
+
+static size_t g_max_message_size = WS_DEFAULT_MAX_MESSAGE_SIZE;
+
+static WSDeflateConfig g_deflate_config = {
+    .enabled = 1,
+    .level = WS_DEFLATE_DEFAULT_LEVEL,
+    .server_max_window_bits = WS_DEFLATE_MAX_WINDOW_BITS,
+    .client_max_window_bits = WS_DEFLATE_MAX_WINDOW_BITS,
+    .client_no_context_takeover = 0,
+    .min_size = WS_DEFLATE_DEFAULT_MIN_SIZE
+};
+
+// Origin allow-list for upgrades, empty = any (guarded by clients_mutex)
+static char g_allowed_origins[WS_ORIGINS_SIZE] = "";
+
+static WSOutboundConfig g_out_config = {
+    .policy = WS_SLOW_DISCONNECT,
+    .max_queued_bytes = WS_DEFAULT_MAX_QUEUED_BYTES,
+    .max_queued_frames = WS_DEFAULT_MAX_QUEUED_FRAMES,
+    .max_lag_ms = WS_DEFAULT_MAX_LAG_MS
+};
+
+static WSHeartbeatConfig g_heartbeat_config = {
+    .ping_interval_ms = WS_DEFAULT_PING_INTERVAL_MS,
+    .idle_timeout_ms = WS_DEFAULT_IDLE_TIMEOUT_MS,
+    .handshake_timeout_ms = WS_DEFAULT_HANDSHAKE_TIMEOUT_MS
+};
+
+// Empty ping shared by every heartbeat
+static WSOutFrame *g_ping_frame = NULL;
+
+// Relay to other chat_server processes, if configured
+static ChatBus *g_bus = NULL;
+// Random per process, in the high bits of every seq it assigns: a resume
+// seq numbered by another process (or this one before a restart) is then
+// out of range and gets a resync instead of the wrong replay
+static uint64_t g_seq_epoch = 0;
+
+// Server-wide slow-consumer counters
+static atomic_ulong g_total_dropped = 0;
+static atomic_ulong g_total_coalesced = 0;
+static atomic_ulong g_total_slow_disconnects = 0;
+static atomic_ulong g_total_pings = 0;
+static atomic_ulong g_total_idle_timeouts = 0;
+
+// Compression counters (per encoded message, not per recipient)
+static atomic_ulong g_total_deflated = 0;
+static atomic_ulong g_total_deflate_in = 0;
+static atomic_ulong g_total_deflate_out = 0;
+
+static WSConnection* ws_conn_lookup(int fd) {
+    return (fd >= 0 && fd < g_conns_cap) ? g_conns[fd] : NULL;
+}
+
+static WSOutEntry* ws_out_at(WSConnection *conn, int i) {
+    return &conn->out_queue[(conn->out_head + i) % conn->out_cap];
+}
+
+static void ws_out_pop_head(WSConnection *conn) {
+    WSOutEntry *head = ws_out_at(conn, 0);
+    ws_frame_unref(head->frame);
+    head->frame = NULL;
+    conn->out_head = (conn->out_head + 1) % conn->out_cap;
+    conn->out_count--;
+    conn->out_offset = 0;
+}
+
+// Head frames that must be finished to keep the stream valid: a partially
+// written one, and any an in-flight send is still reading
+static int ws_out_first_droppable(WSConnection *conn) {
+    int first = conn->out_offset > 0 ? 1 : 0;
+    return conn->out_pinned > first ? conn->out_pinned : first;
+}
+
+// Drop the oldest frame that has not started going out on the wire
+static int ws_out_drop_oldest(WSConnection *conn) {
+    int first = ws_out_first_droppable(conn);
+    if (conn->out_count <= first) return 0;
+
+    WSOutEntry *victim = ws_out_at(conn, first);
+    conn->out_bytes -= victim->frame->len;
+    ws_frame_unref(victim->frame);
+
+    // Slide the frames in front of it into the freed slot
+    for (int i = first; i > 0; i--) {
+        *ws_out_at(conn, i) = *ws_out_at(conn, i - 1);
+    }
+    conn->out_head = (conn->out_head + 1) % conn->out_cap;
+    conn->out_count--;
+    return 1;
+}
+
+static void ws_out_clear(WSConnection *conn) {
+    while (conn->out_count > 0) {
+        ws_out_pop_head(conn);
+    }
+    free(conn->out_queue);
+    conn->out_queue = NULL;
+    conn->out_cap = 0;
+    conn->out_head = 0;
+    conn->out_bytes = 0;
+}
+
+static int ws_out_push(WSConnection *conn, WSOutFrame *frame, size_t offset, long long now) {
+    if (conn->out_count == conn->out_cap) {
+        int new_cap = conn->out_cap ? conn->out_cap * 2 : 8;
+        WSOutEntry *grown = malloc(new_cap * sizeof(WSOutEntry));
+        if (!grown) return -1;
+        for (int i = 0; i < conn->out_count; i++) {
+            grown[i] = *ws_out_at(conn, i);
+        }
+        free(conn->out_queue);
+        conn->out_queue = grown;
+        conn->out_cap = new_cap;
+        conn->out_head = 0;
+    }
+
+    WSOutEntry *slot = &conn->out_queue[(conn->out_head + conn->out_count) % conn->out_cap];
+    slot->frame = ws_frame_ref(frame);
+    slot->enqueued_ms = now;
+    if (conn->out_count == 0) {
+        conn->out_offset = offset;
+    }
+    conn->out_count++;
+    conn->out_bytes += frame->len - offset;
+    return 0;
+}
+
+// Ask the reactor to tear the connection down; safe from any thread
+static void ws_conn_kill_locked(WSConnection *conn) {
+    if (conn->kill_pending) return;
+    conn->kill_pending = 1;
+    if (conn->out_pinned == 0) {
+        ws_out_clear(conn);
+    } else {
+        // Pinned frames are released when their send completes
+        while (ws_out_drop_oldest(conn)) {}
+    }
+    shutdown(conn->src.fd, SHUT_RDWR);
+}
+
+// Describe up to max_iov queued frames for a vectored write
+static int ws_out_fill_iov(WSConnection *conn, struct iovec *iov, int max_iov) {
+    int n_iov = 0;
+
+    for (int i = 0; i < conn->out_count && n_iov < max_iov; i++) {
+        WSOutFrame *frame = ws_out_at(conn, i)->frame;
+        size_t skip = (i == 0) ? conn->out_offset : 0;
+        iov[n_iov].iov_base = frame->data + skip;
+        iov[n_iov].iov_len = frame->len - skip;
+        n_iov++;
+    }
+    return n_iov;
+}
+
+// Retire n bytes that reached the socket
+static void ws_out_consume(WSConnection *conn, size_t n) {
+    conn->out_bytes -= n;
+    while (n > 0) {
+        WSOutFrame *head = ws_out_at(conn, 0)->frame;
+        size_t remaining = head->len - conn->out_offset;
+        if (n >= remaining) {
+            n -= remaining;
+            ws_out_pop_head(conn);
+        } else {
+            conn->out_offset += n;
+            n = 0;
+        }
+    }
+}
+
+// Backlog gone: give the ring back so idle connections stay small
+static void ws_out_release_ring(WSConnection *conn) {
+    free(conn->out_queue);
+    conn->out_queue = NULL;
+    conn->out_cap = 0;
+    conn->out_head = 0;
+}
+
+// Write as much of the queue as the socket accepts (caller holds out_lock).
+// Returns 0 when drained or blocked, -1 on a socket error.
+static int ws_conn_flush_locked(WSConnection *conn) {
+    while (conn->out_count > 0) {
+        struct iovec iov[WS_MAX_IOV];
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = ws_out_fill_iov(conn, iov, WS_MAX_IOV);
+
+        ssize_t n = sendmsg(conn->src.fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+
+        ws_out_consume(conn, (size_t)n);
+    }
+
+    ws_out_release_ring(conn);
+    return 0;
+}
+
+// Apply the slow-consumer policy before queueing extra_bytes more.
+// Returns -1 if the connection was disconnected.
+static int ws_conn_enforce_limits_locked(WSConnection *conn, size_t extra_bytes, long long now) {
+    long long lag = conn->out_count > 0 ? now - ws_out_at(conn, 0)->enqueued_ms : 0;
+    if (lag > conn->max_lag_ms) conn->max_lag_ms = lag;
+
+    int over = conn->out_bytes + extra_bytes > g_out_config.max_queued_bytes ||
+               conn->out_count + 1 > g_out_config.max_queued_frames ||
+               (g_out_config.max_lag_ms > 0 && lag > g_out_config.max_lag_ms);
+    if (!over) return 0;
+
+    switch (g_out_config.policy) {
+    case WS_SLOW_DROP_OLDEST:
+        while ((conn->out_bytes + extra_bytes > g_out_config.max_queued_bytes ||
+                conn->out_count + 1 > g_out_config.max_queued_frames) &&
+               ws_out_drop_oldest(conn)) {
+            conn->dropped_frames++;
+            atomic_fetch_add(&g_total_dropped, 1);
+        }
+        // Frames that have waited too long are stale; drop those as well
+        while (g_out_config.max_lag_ms > 0 && conn->out_count > ws_out_first_droppable(conn) &&
+               now - ws_out_at(conn, ws_out_first_droppable(conn))->enqueued_ms > g_out_config.max_lag_ms &&
+               ws_out_drop_oldest(conn)) {
+            conn->dropped_frames++;
+            atomic_fetch_add(&g_total_dropped, 1);
+        }
+        return 0;
+
+    case WS_SLOW_COALESCE:
+        // Latest wins: everything not yet on the wire is replaced by the new frame
+        while (ws_out_drop_oldest(conn)) {
+            conn->coalesced_frames++;
+            atomic_fetch_add(&g_total_coalesced, 1);
+        }
+        return 0;
+
+    case WS_SLOW_DISCONNECT:
+    default:
+        log_error("Disconnecting slow WebSocket client fd=%d (%zu bytes, %d frames, %lld ms behind)",
+                  conn->src.fd, conn->out_bytes, conn->out_count, lag);
+        atomic_fetch_add(&g_total_slow_disconnects, 1);
+        ws_conn_kill_locked(conn);
+        return -1;
+    }
+}
+
+// Queue a frame for one connection, writing immediately when the socket
+// has room. Never blocks on the socket.
+static int ws_conn_send(WSConnection *conn, WSOutFrame *frame) {
+    int result = 0;
+
+    pthread_mutex_lock(&conn->out_lock);
+
+    if (conn->kill_pending || conn->state != WS_STATE_OPEN) {
+        pthread_mutex_unlock(&conn->out_lock);
+        return -1;
+    }
+
+#ifdef HAVE_IO_URING
+    if (conn->shard->uring_active) {
+        // Always queue; the owning shard submits all pending sends at once
+        long long now = get_monotonic_ms();
+        if (ws_conn_enforce_limits_locked(conn, frame->len, now) < 0) {
+            result = -1;
+        } else if (ws_out_push(conn, frame, 0, now) < 0) {
+            ws_conn_kill_locked(conn);
+            result = -1;
+        } else {
+            ws_conn_mark_dirty_locked(conn);
+        }
+        pthread_mutex_unlock(&conn->out_lock);
+        return result;
+    }
+#endif
+
+    size_t offset = 0;
+    if (conn->out_count == 0) {
+        // Fast path: nothing queued, try the socket directly
+        ssize_t n = send(conn->src.fd, frame->data, frame->len, MSG_NOSIGNAL);
+        if (n == (ssize_t)frame->len) {
+            pthread_mutex_unlock(&conn->out_lock);
+            return 0;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            ws_conn_kill_locked(conn);
+            pthread_mutex_unlock(&conn->out_lock);
+            return -1;
+        }
+        offset = n > 0 ? (size_t)n : 0;
+    }
+
+    long long now = get_monotonic_ms();
+    if (offset == 0 && ws_conn_enforce_limits_locked(conn, frame->len, now) < 0) {
+        result = -1;
+    } else if (ws_out_push(conn, frame, offset, now) < 0) {
+        ws_conn_kill_locked(conn);
+        result = -1;
+    }
+
+    pthread_mutex_unlock(&conn->out_lock);
+    return result;
+}
+
+// One outgoing message in each wire encoding recipients may need. An
+// encoding is built the first time a recipient needs it and then shared by
+// every other recipient that negotiated the same parameters.
+typedef struct {
+    int opcode;
+    const void *payload;
+    size_t len;
+    WSOutFrame *plain;
+    WSOutFrame *deflated[WS_DEFLATE_WINDOW_VARIANTS];   // by server window bits
+    unsigned char deflate_tried[WS_DEFLATE_WINDOW_VARIANTS];
+    WSOutFrame *binary;       // for WS_PROTOCOL_BINARY clients
+    int binary_tried;
+} WSMessageFrames;
+
+static void ws_frames_init(WSMessageFrames *frames, int opcode, const void *payload, size_t len) {
+    memset(frames, 0, sizeof(WSMessageFrames));
+    frames->opcode = opcode;
+    frames->payload = payload;
+    frames->len = len;
+}
+
+// Uncompressed encoding, which every recipient can take
+static WSOutFrame* ws_frames_plain(WSMessageFrames *frames) {
+    if (!frames->plain) {
+        frames->plain = ws_frame_create(frames->opcode, frames->payload, frames->len);
+    }
+    return frames->plain;
+}
+
+// Binary frame carrying the same event as a JSON text payload; NULL if
+// the payload cannot be expressed (not an object, oversized field)
+static WSOutFrame* ws_binary_frame_from_json(const void *json, size_t len) {
+    WSEvent event;
+    char *scratch = malloc(len ? len : 1);
+    unsigned char *encoded = NULL;
+    WSOutFrame *frame = NULL;
+
+    if (scratch && ws_event_from_json(&event, json, len, scratch) == 0) {
+        size_t size = ws_event_binary_size(&event);
+        encoded = size ? malloc(size) : NULL;
+        if (encoded) {
+            size = ws_event_to_binary(&event, encoded);
+            frame = ws_frame_create(WS_OPCODE_BINARY, encoded, size);
+        }
+    }
+
+    free(encoded);
+    free(scratch);
+    return frame;
+}
+
+// Text payload in the encoding a connection negotiated
+static WSOutFrame* ws_text_frame_for(WSConnection *conn, const void *text, size_t len) {
+    if (conn->protocol == WS_PROTOCOL_BINARY) return ws_binary_frame_from_json(text, len);
+    return ws_frame_create(WS_OPCODE_TEXT, text, len);
+}
+
+// Frame to send to conn; NULL on allocation failure.
+// Caller holds clients_mutex (which also guards g_deflate_config).
+static WSOutFrame* ws_frames_for(WSMessageFrames *frames, WSConnection *conn) {
+    // Binary clients get the compact encoding, never deflated
+    if (conn->protocol == WS_PROTOCOL_BINARY && frames->opcode == WS_OPCODE_TEXT) {
+        if (!frames->binary_tried) {
+            frames->binary_tried = 1;
+            frames->binary = ws_binary_frame_from_json(frames->payload, frames->len);
+        }
+        return frames->binary;
+    }
+
+    if (conn->deflate.active && g_deflate_config.enabled && frames->len >= g_deflate_config.min_size) {
+        int i = conn->deflate.server_window_bits - WS_DEFLATE_MIN_WINDOW_BITS;
+        if (!frames->deflate_tried[i]) {
+            frames->deflate_tried[i] = 1;
+            frames->deflated[i] = ws_deflate_frame_create(g_deflate_config.level,
+                                                          conn->deflate.server_window_bits,
+                                                          frames->opcode, frames->payload, frames->len);
+            if (frames->deflated[i]) {
+                atomic_fetch_add(&g_total_deflated, 1);
+                atomic_fetch_add(&g_total_deflate_in, frames->len);
+                atomic_fetch_add(&g_total_deflate_out, frames->deflated[i]->len);
+            }
+        }
+        // Incompressible payloads fall back to the plain frame
+        if (frames->deflated[i]) return frames->deflated[i];
+    }
+
+    return ws_frames_plain(frames);
+}
+
+static void ws_frames_release(WSMessageFrames *frames) {
+    ws_frame_unref(frames->plain);
+    ws_frame_unref(frames->binary);
+    for (int i = 0; i < WS_DEFLATE_WINDOW_VARIANTS; i++) {
+        ws_frame_unref(frames->deflated[i]);
+    }
+}
+
+// Append a message to the room's resume ring, evicting the oldest when full
+static void ws_room_record(WSRoom *room, WSMessageFrames *frames) {
+    WSOutFrame *plain = ws_frames_plain(frames);
+
+    if (!room->history) {
+        room->history = calloc(WS_ROOM_HISTORY, sizeof(WSHistoryEntry));
+    }
+    if (!room->history || !plain) {
+        // A gap would replay the wrong frames; fall back to a resync instead
+        ws_room_history_clear(room);
+        return;
+    }
+
+    int tail = (room->history_head + room->history_count) % WS_ROOM_HISTORY;
+    if (room->history_count == WS_ROOM_HISTORY) {
+        ws_frame_unref(room->history[room->history_head].plain);
+        ws_frame_unref(room->history[room->history_head].binary);
+        room->history_head = (room->history_head + 1) % WS_ROOM_HISTORY;
+        room->history_count--;
+    }
+    room->history[tail].plain = ws_frame_ref(plain);
+    room->history[tail].binary = ws_frame_ref(frames->binary);
+    room->history_count++;
+}
+
+// Send one message to every member but skip_fd. Caller holds clients_mutex.
+static int ws_room_fanout(WSRoom *room, int skip_fd, WSMessageFrames *frames) {
+    int sent_count = 0;
+    for (int i = 0; i < room->member_count; i++) {
+        if (room->members[i] == skip_fd) continue;
+        WSConnection *conn = ws_conn_lookup(room->members[i]);
+        WSOutFrame *frame = conn ? ws_frames_for(frames, conn) : NULL;
+        if (frame && ws_conn_send(conn, frame) == 0) {
+            sent_count++;
+        }
+    }
+    return sent_count;
+}
+
+// JSON for the held messages not sent by exclude_fd: a bare object when
+// there is one, an array otherwise. NULL if none remain.
+static unsigned char* ws_batch_json(WSBatchEntry *batch, int count, int exclude_fd, size_t *out_len) {
+    size_t total = 2;
+    int included = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (batch[i].sender_fd == exclude_fd) continue;
+        size_t len;
+        ws_frame_payload(batch[i].plain, &len);
+        total += len + 1;
+        included++;
+    }
+    unsigned char *json = included ? malloc(total) : NULL;
+    if (!json) return NULL;
+
+    size_t pos = 0;
+    if (included > 1) json[pos++] = '[';
+    for (int i = 0; i < count; i++) {
+        if (batch[i].sender_fd == exclude_fd) continue;
+        size_t len;
+        const unsigned char *payload = ws_frame_payload(batch[i].plain, &len);
+        if (pos > 1) json[pos++] = ',';
+        memcpy(json + pos, payload, len);
+        pos += len;
+    }
+    if (included > 1) json[pos++] = ']';
+    *out_len = pos;
+    return json;
+}
+
+// Binary frames of the held messages not sent by exclude_fd, back to back
+// in one buffer
+static WSOutFrame* ws_batch_binary(WSBatchEntry *batch, int count, int exclude_fd) {
+    WSOutFrame *parts[WS_COALESCE_MAX_MESSAGES];
+    int included = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (batch[i].sender_fd == exclude_fd) continue;
+        if (!batch[i].binary) {
+            size_t len;
+            const unsigned char *payload = ws_frame_payload(batch[i].plain, &len);
+            batch[i].binary = ws_binary_frame_from_json(payload, len);
+        }
+        if (batch[i].binary) parts[included++] = batch[i].binary;
+    }
+    return included ? ws_frame_concat(parts, included) : NULL;
+}
+
+// The batch as seen by one of its senders, without its own messages
+static WSOutFrame* ws_batch_frame_for_sender(WSBatchEntry *batch, int count, WSConnection *conn) {
+    if (conn->protocol == WS_PROTOCOL_BINARY) {
+        return ws_batch_binary(batch, count, conn->src.fd);
+    }
+
+    size_t len;
+    unsigned char *json = ws_batch_json(batch, count, conn->src.fd, &len);
+    WSOutFrame *frame = json ? ws_frame_create(WS_OPCODE_TEXT, json, len) : NULL;
+    free(json);
+    return frame;
+}
+
+static int ws_batch_has_sender(WSBatchEntry *batch, int count, int fd) {
+    for (int i = 0; i < count; i++) {
+        if (batch[i].sender_fd == fd) return 1;
+    }
+    return 0;
+}
+
+// Deliver the held messages, one frame per recipient. Caller holds
+// clients_mutex.
+static void ws_room_flush(WSRoom *room) {
+    int count = room->batch_count;
+    if (count == 0) return;
+
+    timer_wheel_cancel(&g_coalescer.wheel, &room->flush_timer);
+    room->last_send_ms = get_monotonic_ms();
+
+    // Shared by every member that sent nothing in this batch
+    size_t json_len = 0;
+    unsigned char *json = ws_batch_json(room->batch, count, -1, &json_len);
+    WSMessageFrames frames;
+    ws_frames_init(&frames, WS_OPCODE_TEXT, json, json_len);
+
+    for (int i = 0; json && i < room->member_count; i++) {
+        int fd = room->members[i];
+        WSConnection *conn = ws_conn_lookup(fd);
+        if (!conn) continue;
+
+        if (ws_batch_has_sender(room->batch, count, fd)) {
+            WSOutFrame *frame = ws_batch_frame_for_sender(room->batch, count, conn);
+            if (frame) ws_conn_send(conn, frame);
+            ws_frame_unref(frame);
+            continue;
+        }
+
+        if (conn->protocol == WS_PROTOCOL_BINARY && !frames.binary_tried) {
+            frames.binary_tried = 1;
+            frames.binary = ws_batch_binary(room->batch, count, -1);
+        }
+        WSOutFrame *frame = ws_frames_for(&frames, conn);
+        if (frame) ws_conn_send(conn, frame);
+    }
+
+    ws_frames_release(&frames);
+    free(json);
+    ws_room_batch_clear(room);
+    atomic_fetch_add(&g_total_batches, 1);
+    atomic_fetch_add(&g_total_batched_messages, count);
+}
+
+static void ws_room_on_flush_timer(Timer *timer, void *arg) {
+    (void)timer;
+    ws_room_flush(arg);
+}
+
+// Hold a message back if the room is busy. Returns 1 if it was queued,
+// 0 if the room is quiet and it should go out now.
+static int ws_room_coalesce(WSRoom *room, int skip_fd, WSMessageFrames *frames) {
+    long long now = get_monotonic_ms();
+    int max_messages = room->coalesce.max_messages > 0 ? room->coalesce.max_messages : WS_COALESCE_MAX_MESSAGES;
+
+    if (room->batch_count == 0 && now - room->last_send_ms >= room->coalesce.window_ms) {
+        room->last_send_ms = now;
+        return 0;
+    }
+
+    WSOutFrame *plain = ws_frames_plain(frames);
+    if (!room->batch) {
+        room->batch = calloc(WS_COALESCE_MAX_MESSAGES, sizeof(WSBatchEntry));
+    }
+    if (!room->batch || !plain) {
+        ws_room_flush(room);
+        return 0;
+    }
+
+    WSBatchEntry *entry = &room->batch[room->batch_count++];
+    entry->plain = ws_frame_ref(plain);
+    entry->binary = ws_frame_ref(frames->binary);
+    entry->sender_fd = skip_fd;
+
+    if (room->batch_count >= max_messages) {
+        ws_room_flush(room);
+    } else if (room->batch_count == 1) {
+        // Bring the wheel up to date first: it only advances on its thread
+        timer_wheel_advance(&g_coalescer.wheel, now);
+        timer_wheel_schedule(&g_coalescer.wheel, &room->flush_timer,
+                             room->last_send_ms + room->coalesce.window_ms - now);
+        pthread_cond_signal(&g_coalescer.wake);
+    }
+    return 1;
+}
+
+// Give a message the room's next sequence number, deliver it to every
+// member but skip_fd (now, or with the room's next batch) and keep it
+// for resume. JSON objects carry the number as a leading "seq" field;
+// other payloads are relayed unchanged. Caller holds clients_mutex.
+// Returns the number of recipients.
+static int ws_room_publish(WSRoom *room, int skip_fd, const void *payload, size_t len) {
+    const unsigned char *bytes = payload;
+    unsigned char *stamped = NULL;
+    uint64_t seq = room->last_seq ? room->last_seq + 1 : g_seq_epoch + 1;
+    room->last_seq = seq;
+
+    if (len > 0 && bytes[0] == '{') {
+        size_t rest = 1;
+        while (rest < len && isspace(bytes[rest])) rest++;
+        char prefix[48];
+        int prefix_len = snprintf(prefix, sizeof(prefix), "{\"seq\": %llu%s",
+                                  (unsigned long long)seq, rest < len && bytes[rest] != '}' ? ", " : "");
+        stamped = malloc(prefix_len + len - rest);
+        if (stamped) {
+            memcpy(stamped, prefix, prefix_len);
+            memcpy(stamped + prefix_len, bytes + rest, len - rest);
+            bytes = stamped;
+            len = prefix_len + len - rest;
+        }
+    }
+
+    // Encode once per wire format; recipients share the frames
+    WSMessageFrames frames;
+    ws_frames_init(&frames, WS_OPCODE_TEXT, bytes, len);
+
+    int sent_count;
+    if (room->coalesce.window_ms > 0 && stamped && ws_room_coalesce(room, skip_fd, &frames)) {
+        sent_count = room->member_count - (skip_fd >= 0 && ws_room_has_member(room, skip_fd));
+    } else {
+        // Anything held back goes first, so members see the room in order
+        ws_room_flush(room);
+        sent_count = ws_room_fanout(room, skip_fd, &frames);
+    }
+    ws_room_record(room, &frames);
+
+    ws_frames_release(&frames);
+    free(stamped);
+    return sent_count;
+}
+
+// Release everything a connection owns. No other thread can reach it
+// once it left the client list.
+static void ws_conn_free(WSConnection *conn) {
+    ws_out_clear(conn);
+    pthread_mutex_destroy(&conn->out_lock);
+    ws_parser_free(&conn->parser);
+    ws_deflate_state_free(&conn->deflate);
+    free(conn->upgrade);
+    free(conn);
+}
+
+static void ws_conn_release(EventSource *src) {
+    ws_conn_free((WSConnection*)src);
+}
+
+#ifdef HAVE_IO_URING
+// Drop one reference; the last one closes the socket and frees the connection
+static void ws_conn_put(WSConnection *conn) {
+    if (atomic_fetch_sub(&conn->refs, 1) == 1) {
+        conn->shard->zombies--;
+        close(conn->src.fd);
+        ws_conn_free(conn);
+    }
+}
+#endif
+
+static void ws_conn_close(WSConnection *conn) {
+    WSShard *shard = conn->shard;
+    int fd = conn->src.fd;
+
+#ifdef HAVE_IO_URING
+    if (conn->closed) return;
+    conn->closed = 1;
+#endif
+
+    timer_wheel_cancel(&shard->loop.timers, &conn->timer);
+
+    if (conn->state != WS_STATE_HANDSHAKE) {
+        websocket_remove_client(fd);
+        log_info("WebSocket client disconnected: fd=%d", fd);
+    }
+
+    // Free the table entry before the fd number can be handed to a
+    // connection on another shard
+    if (fd < g_conns_cap) {
+        g_conns[fd] = NULL;
+    }
+
+    if (conn->prev) conn->prev->next = conn->next;
+    else shard->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    atomic_fetch_sub(&shard->conn_count, 1);
+
+#ifdef HAVE_IO_URING
+    if (shard->uring_active) {
+        // Pending operations still point at the connection. Shutting the
+        // socket down completes them; the last completion frees it.
+        shutdown(fd, SHUT_RDWR);
+        shard->zombies++;
+        ws_conn_put(conn);
+        return;
+    }
+#endif
+
+    // Events for it may still be queued in the batch being dispatched
+    event_loop_retire(&shard->loop, &conn->src, ws_conn_release);
+    close(fd);
+}
+
+// Queue a close frame carrying code and reason, then close
+static void ws_conn_close_with_status(WSConnection *conn, int code, const char *reason) {
+    unsigned char payload[125];
+    size_t reason_len = strlen(reason);
+
+    if (reason_len > sizeof(payload) - 2) reason_len = sizeof(payload) - 2;
+    payload[0] = (unsigned char)(code >> 8);
+    payload[1] = (unsigned char)code;
+    memcpy(payload + 2, reason, reason_len);
+
+    WSOutFrame *frame = ws_frame_create(WS_OPCODE_CLOSE, payload, 2 + reason_len);
+    if (frame) {
+        ws_conn_send(conn, frame);
+        ws_frame_unref(frame);
+    }
+    conn->state = WS_STATE_CLOSING;
+
+#ifdef HAVE_IO_URING
+    if (conn->shard->uring_active) {
+        ws_conn_close_after_flush(conn);
+        return;
+    }
+#endif
+    ws_conn_close(conn);
+}
+
+// Schedule the next liveness check: the next ping or the idle deadline,
+// whichever comes first
+static void ws_conn_arm_heartbeat(WSConnection *conn) {
+    const WSHeartbeatConfig *hb = &conn->heartbeat;
+    TimerWheel *timers = &conn->shard->loop.timers;
+    uint64_t idle = timer_wheel_time_ms(timers) - conn->last_active_ms;
+    uint64_t delay = UINT64_MAX;
+
+    // One interval after a ping that has just gone out
+    if (hb->ping_interval_ms > 0) {
+        uint64_t interval = (uint64_t)hb->ping_interval_ms;
+        delay = idle < interval ? interval - idle : interval;
+    }
+    if (hb->idle_timeout_ms > 0) {
+        uint64_t timeout = (uint64_t)hb->idle_timeout_ms;
+        uint64_t left = idle < timeout ? timeout - idle : 0;
+        if (left < delay) delay = left;
+    }
+
+    if (delay != UINT64_MAX) {
+        timer_wheel_schedule(timers, &conn->timer, delay);
+    }
+}
+
+// Connection timer: handshake deadline while upgrading, heartbeat after
+static void ws_conn_on_timer(Timer *timer, void *arg) {
+    WSConnection *conn = arg;
+    const WSHeartbeatConfig *hb = &conn->heartbeat;
+    (void)timer;
+
+    if (conn->state == WS_STATE_HANDSHAKE) {
+        log_info("WebSocket handshake timed out: fd=%d", conn->src.fd);
+        ws_conn_close(conn);
+        return;
+    }
+    if (conn->state != WS_STATE_OPEN) {
+        // Peer never collected our close reply
+        ws_conn_close(conn);
+        return;
+    }
+
+    uint64_t idle = timer_wheel_time_ms(&conn->shard->loop.timers) - conn->last_active_ms;
+    if (hb->idle_timeout_ms > 0 && idle >= (uint64_t)hb->idle_timeout_ms) {
+        log_info("WebSocket client idle for %llu ms, closing: fd=%d",
+                 (unsigned long long)idle, conn->src.fd);
+        atomic_fetch_add(&g_total_idle_timeouts, 1);
+        ws_conn_close(conn);
+        return;
+    }
+    if (hb->ping_interval_ms > 0 && idle >= (uint64_t)hb->ping_interval_ms && g_ping_frame) {
+        ws_conn_send(conn, g_ping_frame);
+        atomic_fetch_add(&g_total_pings, 1);
+    }
+
+    ws_conn_arm_heartbeat(conn);
+}
+
+// Check the upgrade's login token (?token= or "Authorization: Bearer")
+// and room (?room_id= or X-Room-Id, optional). Returns 0 with the
+// connection's identity and *room_id_out filled in, or the HTTP status to
+// refuse the upgrade with.
+static int ws_authenticate_upgrade(WSConnection *conn, const WSHandshake *hs, const char *request,
+                                   int *room_id_out) {
+    char token[WS_TOKEN_SIZE];
+    char room[32];
+    int user_id;
+    User *user;
+
+    if (!ws_handshake_query_param(hs, request, "token", token, sizeof(token))) {
+        char authorization[WS_TOKEN_SIZE + 8];
+        if (!ws_handshake_copy(request, hs->authorization, authorization, sizeof(authorization)) ||
+            strncasecmp(authorization, "Bearer ", 7) != 0 ||
+            strlen(authorization + 7) >= sizeof(token)) {
+            return 401;
+        }
+        strcpy(token, authorization + 7);
+    }
+    if (auth_validate_token(token, &user_id) != 0 || !(user = db_get_user_by_id(user_id))) {
+        return 401;
+    }
+
+    int room_id = 0;
+    if (ws_handshake_query_param(hs, request, "room_id", room, sizeof(room)) ||
+        ws_handshake_copy(request, hs->room_id, room, sizeof(room))) {
+        char *end;
+        long value = strtol(room, &end, 10);
+        if (end == room || *end || value <= 0 || value > INT_MAX) return 400;
+
+        int member = db_is_user_in_room((int)value, user_id);
+        if (member < 0) return 404;
+        if (member == 0) return 403;
+        room_id = (int)value;
+    }
+
+    conn->user_id = user_id;
+    snprintf(conn->username, sizeof(conn->username), "%s", user->username);
+    conn->token_expires = auth_token_expires_at(token);
+    *room_id_out = room_id;
+    return 0;
+}
+
+// Refuse an upgrade with a bodiless HTTP error
+static void ws_conn_reject(WSConnection *conn, int status) {
+    const char *reason = status == 401 ? "Unauthorized" :
+                         status == 403 ? "Forbidden" :
+                         status == 404 ? "Not Found" :
+                         status == 426 ? "Upgrade Required" :
+                         status == 431 ? "Request Header Fields Too Large" : "Bad Request";
+    char response[192];
+
+    // 426 tells the client which protocol version to retry with
+    int len = snprintf(response, sizeof(response),
+                       "HTTP/1.1 %d %s\r\n%sContent-Length: 0\r\nConnection: close\r\n\r\n",
+                       status, reason, status == 426 ? "Sec-WebSocket-Version: 13\r\n" : "");
+    ssize_t ignored = send(conn->src.fd, response, len, MSG_NOSIGNAL);
+    (void)ignored;
+    log_info("WebSocket upgrade refused (%d %s): fd=%d", status, reason, conn->src.fd);
+}
+
+// Answer a complete upgrade request. Returns 0 once the connection is
+// open, -1 if it was refused or failed.
+static int ws_conn_upgrade(WSConnection *conn, const WSHandshake *hs, const char *request) {
+    char origins[WS_ORIGINS_SIZE];
+    char accept[WS_ACCEPT_KEY_SIZE];
+    char offers[WS_EXTENSIONS_SIZE];
+    char extension[256] = "";
+    const char *protocol = NULL;
+    char handshake_response[1024];
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    WSDeflateConfig deflate_config = g_deflate_config;
+    memcpy(origins, g_allowed_origins, sizeof(origins));
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    int status = ws_handshake_validate(hs, request, origins);
+    int room_id;
+    if (status == 0) {
+        status = ws_authenticate_upgrade(conn, hs, request, &room_id);
+    }
+    if (status != 0) {
+        ws_conn_reject(conn, status);
+        return -1;
+    }
+
+    ws_handshake_accept_key(request, hs->key, accept);
+
+    // permessage-deflate, if the client offers it and the server allows it
+    if (ws_handshake_join_list(request, hs->extensions, hs->extension_count,
+                               offers, sizeof(offers)) == 0 &&
+        offers[0] && ws_deflate_negotiate(&deflate_config, offers, &conn->deflate,
+                                          extension, sizeof(extension))) {
+        conn->parser.allow_compressed = 1;
+    }
+
+    // Wire format: the compact binary events when offered, JSON otherwise
+    if (ws_handshake_list_contains(request, hs->protocols, hs->protocol_count, WS_SUBPROTOCOL_BINARY)) {
+        conn->protocol = WS_PROTOCOL_BINARY;
+        protocol = WS_SUBPROTOCOL_BINARY;
+    } else if (ws_handshake_list_contains(request, hs->protocols, hs->protocol_count, WS_SUBPROTOCOL_JSON)) {
+        protocol = WS_SUBPROTOCOL_JSON;
+    }
+
+    int response_len = snprintf(handshake_response, sizeof(handshake_response),
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n"
+        "%s%s%s"
+        "%s%s%s"
+        "\r\n", accept,
+        extension[0] ? "Sec-WebSocket-Extensions: " : "", extension, extension[0] ? "\r\n" : "",
+        protocol ? "Sec-WebSocket-Protocol: " : "", protocol ? protocol : "", protocol ? "\r\n" : "");
+
+    // The socket buffer is empty right after accept, so this fits in one send
+    if (send(conn->src.fd, handshake_response, response_len, MSG_NOSIGNAL) != (ssize_t)response_len) {
+        log_error("Failed to send handshake response");
+        return -1;
+    }
+    
+    log_info("WebSocket client connected: fd=%d, user_id=%d, room_id=%d%s", conn->src.fd, conn->user_id, room_id,
+             conn->protocol == WS_PROTOCOL_BINARY ? " (binary)" : "");
+
+    conn->state = WS_STATE_OPEN;
+    ws_conn_arm_heartbeat(conn);
+    
+    // Add client to server
+    if (websocket_add_client(conn->src.fd, conn->user_id, room_id) == WS_INVALID_HANDLE) {
+        log_error("Failed to add client to server");
+        return -1;
+    }
+    return 0;
+}
+
+// Parse the upgrade request as it arrives and answer it once complete.
+// A request that arrives in one read is parsed in place; only one split
+// across reads is copied, into a buffer kept until the handshake ends.
+// Returns how many bytes of data belonged to the request (the rest are
+// frames), or -1 on error.
+static int ws_conn_handshake(WSConnection *conn, const unsigned char *data, size_t len) {
+    WSPendingUpgrade *pending = conn->upgrade;
+    WSHandshake in_place;
+    WSHandshake *hs;
+    const char *request;
+    size_t prev_len = 0;
+    WSHandshakeResult result;
+
+    if (!pending) {
+        hs = &in_place;
+        request = (const char*)data;
+        ws_handshake_init(hs);
+        result = ws_handshake_parse(hs, request, len);
+        if (result == WS_HANDSHAKE_INCOMPLETE) {
+            pending = malloc(sizeof(WSPendingUpgrade));
+            if (!pending) return -1;
+            pending->parser = in_place;
+            pending->len = len;
+            memcpy(pending->data, data, len);
+            conn->upgrade = pending;
+            return (int)len;
+        }
+    } else {
+        hs = &pending->parser;
+        request = pending->data;
+        prev_len = pending->len;
+
+        size_t copy = len;
+        if (copy > sizeof(pending->data) - pending->len) copy = sizeof(pending->data) - pending->len;
+        memcpy(pending->data + pending->len, data, copy);
+        pending->len += copy;
+        result = ws_handshake_parse(hs, request, pending->len);
+        if (result == WS_HANDSHAKE_INCOMPLETE) return (int)len;
+    }
+
+    if (result == WS_HANDSHAKE_ERROR) {
+        ws_conn_reject(conn, hs->status);
+        return -1;
+    }
+    if (ws_conn_upgrade(conn, hs, request) < 0) return -1;
+
+    size_t consumed = hs->request_len - prev_len;
+    free(conn->upgrade);
+    conn->upgrade = NULL;
+    return (int)consumed;
+}
+
+static void ws_conn_send_text(WSConnection *conn, const char *text) {
+    WSOutFrame *frame = ws_text_frame_for(conn, text, strlen(text));
+    if (frame) {
+        ws_conn_send(conn, frame);
+        ws_frame_unref(frame);
+    }
+}
+
+// In-band join: the user must be a member of the room in the database
+static int ws_conn_join_room(WSConnection *conn, int room_id) {
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int slot = websocket_get_client_index(conn->src.fd);
+    int user_id = slot >= 0 ? g_server.clients[slot].user_id : 0;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    if (slot < 0 || db_is_user_in_room(room_id, user_id) != 1) {
+        log_info("Client %d (user %d) may not join room %d", conn->src.fd, user_id, room_id);
+        return -1;
+    }
+    return websocket_join_room(conn->src.fd, room_id);
+}
 
-    b64 = BIO_new(BIO_f_base64());
-    bio = BIO_new(BIO_s_mem());
-    bio = BIO_push(b64, bio);
+// Deliver a text message to the other subscribers of *room_id (0 = the
+// sender's default room, written back). Fails unless the sender is
+// subscribed to that room.
+static int ws_conn_route_text(WSConnection *conn, int *room_id,
+                              const unsigned char *payload, size_t len) {
+    int client_fd = conn->src.fd;
 
-    BIO_set_flags(bio, BIO_FLAGS_BASE64_NO_NL);
-    BIO_write(bio, input, length);
-    BIO_flush(bio);
-    BIO_get_mem_ptr(bio, &buffer_ptr);
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int slot = websocket_get_client_index(client_fd);
+    WebSocketClient *client = slot >= 0 ? &g_server.clients[slot] : NULL;
+    if (client && *room_id == 0) *room_id = client->room_id;
+    int allowed = client && *room_id > 0 && ws_client_find_room(client, *room_id) >= 0;
+    WSRoom *room = allowed ? ws_room_find(*room_id) : NULL;
+    if (room) ws_room_publish(room, client_fd, payload, len);
+    pthread_mutex_unlock(&g_server.clients_mutex);
 
-    memcpy(output, buffer_ptr->data, buffer_ptr->length);
-    output[buffer_ptr->length] = '\0';
+    // Other processes' members get it through the bus, outside the lock
+    if (allowed && g_bus) chat_bus_publish(g_bus, *room_id, payload, len);
 
-    BIO_free_all(bio);
+    return allowed ? 0 : -1;
 }
 
-// WebSocket key acceptance header generator
-static void generate_accept_header(const char *key, char *accept) {
-    unsigned char hash[20];
-    char concat[256];
-    
-    snprintf(concat, sizeof(concat), "%s%s", key, WS_GUID);
-    
-    SHA1((unsigned char*)concat, strlen(concat), hash);
-    base64_encode(hash, 20, accept);
-}
+// Send a reconnecting client everything it missed in room_id after seq,
+// then {"type": "resumed"}, as one frame batch so it goes out in one
+// write. If seq is no longer in the ring, answer {"type": "resync"} so
+// the client reloads the history instead. Fails unless subscribed.
+static int ws_conn_resume(WSConnection *conn, int room_id, uint64_t seq) {
+    WSOutFrame *parts[WS_ROOM_HISTORY + 1];
+    char status[160];
+    int count = 0;
 
-// Parse WebSocket handshake request
-static int parse_websocket_handshake(const char *request, char *key) {
-    const char *line_start = request;
-    const char *line_end;
-    
-    while (*line_start) {
-        line_end = strstr(line_start, "\r\n");
-        if (!line_end) {
-            line_end = line_start + strlen(line_start);
-        }
-        
-        // Look for Sec-WebSocket-Key header
-        if (strncasecmp(line_start, "Sec-WebSocket-Key:", 18) == 0) {
-            const char *val_start = line_start + 18;
-            // Skip whitespace
-            while (val_start < line_end && isspace(*val_start)) {
-                val_start++;
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int slot = websocket_get_client_index(conn->src.fd);
+    int subscribed = slot >= 0 && ws_client_find_room(&g_server.clients[slot], room_id) >= 0;
+    if (subscribed) {
+        WSRoom *room = ws_room_find(room_id);
+        uint64_t last = room ? room->last_seq : 0;
+        uint64_t kept = room ? (uint64_t)room->history_count : 0;
+
+        if (seq <= last && last - seq <= kept) {
+            int missed = (int)(last - seq);
+            for (int i = 0; i < missed; i++) {
+                WSHistoryEntry *entry = &room->history[(room->history_head + room->history_count - missed + i) % WS_ROOM_HISTORY];
+                if (conn->protocol == WS_PROTOCOL_BINARY) {
+                    if (!entry->binary) {
+                        size_t payload_len;
+                        const unsigned char *payload = ws_frame_payload(entry->plain, &payload_len);
+                        entry->binary = ws_binary_frame_from_json(payload, payload_len);
+                    }
+                    if (entry->binary) parts[count++] = entry->binary;
+                } else {
+                    parts[count++] = entry->plain;
+                }
             }
-            int len = line_end - val_start;
-            strncpy(key, val_start, len);
-            key[len] = '\0';
-            return 1;
+            snprintf(status, sizeof(status),
+                     "{\"type\": \"resumed\", \"room_id\": %d, \"seq\": %llu, \"replayed\": %d}",
+                     room_id, (unsigned long long)last, missed);
+        } else {
+            snprintf(status, sizeof(status),
+                     "{\"type\": \"resync\", \"room_id\": %d, \"seq\": %llu}",
+                     room_id, (unsigned long long)last);
+        }
+
+        WSOutFrame *tail = ws_text_frame_for(conn, status, strlen(status));
+        if (tail) {
+            parts[count++] = tail;
+            WSOutFrame *batch = ws_frame_concat(parts, count);
+            if (batch) ws_conn_send(conn, batch);
+            ws_frame_unref(batch);
+            ws_frame_unref(tail);
         }
-        
-        if (line_end[0] == '\0') break;
-        line_start = line_end + 2; // Skip \r\n
+        log_info("Client %d resumes room %d from seq %llu: %s", conn->src.fd, room_id,
+                 (unsigned long long)seq, status);
+    }
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    return subscribed ? 0 : -1;
+}
+
+// Members of a relayed event that only the server may set
+static const char *g_relay_reserved[] = { "seq", "user_id", "username", NULL };
+
+static int ws_relay_is_reserved(const JSONField *field) {
+    // Compare unescaped so "s\u0065q" is caught too. No reserved name
+    // takes more than 6 bytes per character escaped, so longer keys pass.
+    char key[64];
+    if (field->key_len + 2 > sizeof(key)) return 0;
+    long n = json_read_string(field->key - 1, field->key + field->key_len + 1, key);
+    if (n < 0) return 1;
+
+    for (int i = 0; g_relay_reserved[i]; i++) {
+        if ((size_t)n == strlen(g_relay_reserved[i]) && memcmp(key, g_relay_reserved[i], n) == 0) return 1;
     }
-    
     return 0;
 }
 
-// WebSocket frame parsing
-typedef struct {
-    int fin;
-    int opcode;
-    int masked;
-    int payload_len;
-    unsigned char mask[4];
-    unsigned char *payload;
-} WSFrame;
-
-static int parse_ws_frame(const unsigned char *data, int data_len, WSFrame *frame) {
-    if (data_len < 2) return -1;
-    
-    frame->fin = (data[0] & 0x80) >> 7;
-    frame->opcode = data[0] & 0x0F;
-    frame->masked = (data[1] & 0x80) >> 7;
-    frame->payload_len = data[1] & 0x7F;
-    
-    int header_size = 2;
-    
-    // Extended payload length
-    if (frame->payload_len == 126) {
-        if (data_len < 4) return -1;
-        frame->payload_len = (data[2] << 8) | data[3];
-        header_size = 4;
-    } else if (frame->payload_len == 127) {
-        if (data_len < 10) return -1;
-        frame->payload_len = 0;
-        for (int i = 0; i < 8; i++) {
-            frame->payload_len = (frame->payload_len << 8) | data[2 + i];
-        }
-        header_size = 10;
+// Upper bound of ws_relay_object's output for a len-byte object
+#define WS_RELAY_SIZE(len, index) \
+    ((len) + 4 * (size_t)(index)->count + 6 * sizeof(((WSConnection*)0)->username) + 48)
+
+// Rebuild a client's object for relaying: the sender's authenticated
+// user_id and username first, then its members minus the reserved ones,
+// so nothing it sent can impersonate another user or shadow what
+// ws_room_publish stamps. out holds WS_RELAY_SIZE bytes. Returns the
+// bytes written.
+static size_t ws_relay_object(const WSConnection *conn, const JSONIndex *index, char *out) {
+    char *p = out;
+
+    p += sprintf(p, "{\"user_id\": %d, \"username\": ", conn->user_id);
+    p = json_put_string(p, conn->username, strlen(conn->username));
+    for (int i = 0; i < index->count; i++) {
+        const JSONField *field = &index->fields[i];
+        if (ws_relay_is_reserved(field)) continue;
+
+        memcpy(p, ", ", 2);
+        p += 2;
+        *p++ = '"';
+        memcpy(p, field->key, field->key_len);
+        p += field->key_len;
+        memcpy(p, "\": ", 3);
+        p += 3;
+        memcpy(p, field->value, field->value_len);
+        p += field->value_len;
     }
-    
-    // Masking key
-    if (frame->masked) {
-        if (data_len < header_size + 4) return -1;
-        memcpy(frame->mask, &data[header_size], 4);
-        header_size += 4;
+    *p++ = '}';
+    return p - out;
+}
+
+// A JSON event from the client: control messages, or chat traffic to relay
+static int ws_conn_on_text(WSConnection *conn, const unsigned char *payload, size_t len) {
+    int client_fd = conn->src.fd;
+
+    log_info("Received from client %d: %.*s", client_fd, (int)len, payload);
+
+    // Anything that is not a JSON object is plain text for the default room
+    JSONIndex index;
+    int is_object = json_index_parse(&index, (const char*)payload, len) == 0;
+    if (!is_object) {
+        size_t i = 0;
+        while (i < len && isspace(payload[i])) i++;
+        if (i < len && payload[i] == '{') {
+            ws_conn_send_text(conn, "{\"type\": \"error\", \"message\": \"Malformed event\"}");
+            return 0;
+        }
+        index.count = 0;
     }
-    
-    // Check if we have full payload
-    if (data_len < header_size + frame->payload_len) return -1;
-    
-    frame->payload = (unsigned char*)malloc(frame->payload_len);
-    if (!frame->payload) return -1;
-    
-    memcpy(frame->payload, &data[header_size], frame->payload_len);
-    
-    // Unmask payload if masked
-    if (frame->masked) {
-        for (int i = 0; i < frame->payload_len; i++) {
-            frame->payload[i] ^= frame->mask[i % 4];
+
+    int room_id = 0;
+    int has_room = json_index_int(&index, "room_id", &room_id) == 0 && room_id > 0;
+    int joining = json_index_string_is(&index, "type", "user_joined");
+    int leaving = json_index_string_is(&index, "type", "user_left");
+    char error[96];
+
+    if (json_index_string_is(&index, "type", "ping")) {
+        ws_conn_send_text(conn, "{\"type\": \"pong\"}");
+        return 0;
+    }
+
+    if (json_index_string_is(&index, "type", "resume")) {
+        uint64_t seq;
+        if (!has_room || json_index_uint(&index, "seq", UINT64_MAX, &seq) < 0) {
+            ws_conn_send_text(conn, "{\"type\": \"error\", \"message\": \"room_id and seq required\"}");
+        } else if (ws_conn_resume(conn, room_id, seq) < 0) {
+            snprintf(error, sizeof(error),
+                     "{\"type\": \"error\", \"message\": \"Not subscribed to room %d\"}", room_id);
+            ws_conn_send_text(conn, error);
+        }
+        return 0;
+    }
+
+    if (joining || leaving) {
+        if (!has_room) {
+            ws_conn_send_text(conn, "{\"type\": \"error\", \"message\": \"room_id required\"}");
+            return 0;
+        }
+        if (joining && ws_conn_join_room(conn, room_id) < 0) {
+            snprintf(error, sizeof(error),
+                     "{\"type\": \"error\", \"message\": \"Cannot join room %d\"}", room_id);
+            ws_conn_send_text(conn, error);
+            return 0;
         }
     }
-    
-    return header_size + frame->payload_len;
+
+    // Objects are relayed as rebuilt here, never as sent
+    char *relay = NULL;
+    if (is_object) {
+        if (index.truncated) {
+            ws_conn_send_text(conn, "{\"type\": \"error\", \"message\": \"Too many fields\"}");
+            return 0;
+        }
+        relay = malloc(WS_RELAY_SIZE(len, &index));
+        if (!relay) return -1;
+        len = ws_relay_object(conn, &index, relay);
+        payload = (const unsigned char*)relay;
+    }
+
+    // Tagged messages go to their room, others to the default room;
+    // leave notices reach the room before the subscription ends
+    int target = has_room ? room_id : 0;
+    int routed = ws_conn_route_text(conn, &target, payload, len);
+    free(relay);
+    if (routed < 0) {
+        if (target > 0) {
+            snprintf(error, sizeof(error),
+                     "{\"type\": \"error\", \"message\": \"Not subscribed to room %d\"}", target);
+            ws_conn_send_text(conn, error);
+        } else {
+            log_info("Client %d is not in a room, message dropped", client_fd);
+        }
+        return 0;
+    }
+
+    if (leaving) websocket_leave_room(client_fd, room_id);
+    return 0;
 }
 
-// Create WebSocket frame for sending
-static int create_ws_frame(const char *data, int data_len, unsigned char *frame, int frame_size) {
-    if (frame_size < 2 + data_len) return -1;
-    
-    int pos = 0;
-    
-    // FIN + opcode (text frame = 1)
-    frame[pos++] = 0x81;
-    
-    // Payload length
-    if (data_len < 126) {
-        frame[pos++] = data_len & 0x7F;
-    } else if (data_len < 65536) {
-        frame[pos++] = 126;
-        frame[pos++] = (data_len >> 8) & 0xFF;
-        frame[pos++] = data_len & 0xFF;
-    } else {
-        frame[pos++] = 127;
-        for (int i = 7; i >= 0; i--) {
-            frame[pos++] = (data_len >> (i * 8)) & 0xFF;
+// Parser callback: one complete message or control frame
+static int ws_conn_on_message(void *ctx, int opcode, int compressed,
+                              unsigned char *payload, size_t len) {
+    WSConnection *conn = ctx;
+    int client_fd = conn->src.fd;
+
+    if (compressed) {
+        WSShard *shard = conn->shard;
+        long inflated = ws_deflate_inflate(&conn->deflate, payload, len, &shard->inflate_buf,
+                                           &shard->inflate_cap, conn->parser.max_message_size);
+        if (inflated < 0) {
+            log_error("Failed to decompress message from client %d", client_fd);
+            return -1;
         }
+        payload = shard->inflate_buf;
+        len = (size_t)inflated;
     }
-    
-    // Payload
-    memcpy(&frame[pos], data, data_len);
-    pos += data_len;
-    
-    return pos;
+
+    // Handle different opcodes
+    if (opcode == WS_OPCODE_TEXT) {
+        return ws_conn_on_text(conn, payload, len);
+    } else if (opcode == WS_OPCODE_BINARY && conn->protocol == WS_PROTOCOL_BINARY) {
+        // Binary events are handled as their JSON equivalent
+        WSEvent event;
+        if (ws_event_from_binary(&event, payload, len) < 0) {
+            log_error("Malformed binary event from client %d", client_fd);
+            ws_conn_send_text(conn, "{\"type\": \"error\", \"message\": \"Malformed event\"}");
+            return 0;
+        }
+        // Sequence numbers are ours to assign, and the sender is whoever logged in
+        if (event.type != WS_EVENT_RESUME) event.seq = 0;
+        event.sender_id = (uint32_t)conn->user_id;
+
+        char *json = malloc(ws_event_json_size(&event));
+        if (!json) return -1;
+        size_t json_len = ws_event_to_json(&event, json);
+        int result = ws_conn_on_text(conn, (unsigned char*)json, json_len);
+        free(json);
+        return result;
+    } else if (opcode == WS_OPCODE_CLOSE) {
+        log_info("Client %d sent close frame", client_fd);
+        WSOutFrame *reply = ws_frame_create(WS_OPCODE_CLOSE, NULL, 0);
+        if (reply) {
+            ws_conn_send(conn, reply);
+            ws_frame_unref(reply);
+        }
+        conn->state = WS_STATE_CLOSING;
+        return 1;
+    } else if (opcode == WS_OPCODE_PING) {
+        // Pong echoes the ping payload
+        WSOutFrame *pong = ws_frame_create(WS_OPCODE_PONG, payload, len);
+        if (pong) {
+            ws_conn_send(conn, pong);
+            ws_frame_unref(pong);
+        }
+    }
+
+    return 0;
 }
 
-// Client handler thread
-void* websocket_client_handler(void *arg) {
-    int client_fd = *(int*)arg;
-    free(arg);
-    
-    unsigned char buffer[MAX_FRAME_SIZE];
-    char handshake_response[1024];
-    char key[256] = {0};
-    char accept[256] = {0};
-    
-    // Read handshake
-    ssize_t n = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (n <= 0) {
-        close(client_fd);
-        return NULL;
+// Feed received bytes through the connection state machine.
+// Returns 0 to keep reading, -1 if the connection should be closed.
+static int ws_conn_consume(WSConnection *conn, unsigned char *data, size_t len) {
+    conn->last_active_ms = timer_wheel_time_ms(&conn->shard->loop.timers);
+
+    if (conn->state == WS_STATE_HANDSHAKE) {
+        int used = ws_conn_handshake(conn, data, len);
+        if (used < 0) return -1;
+        data += used;
+        len -= used;
     }
-    
-    buffer[n] = '\0';
-    
-    // Parse and generate handshake response
-    if (!parse_websocket_handshake((const char*)buffer, key)) {
-        log_error("Failed to parse WebSocket key");
-        close(client_fd);
-        return NULL;
+
+    if (conn->state != WS_STATE_OPEN || len == 0) return 0;
+
+    if (ws_parser_feed(&conn->parser, data, len, ws_conn_on_message, conn) < 0) {
+        log_error("Failed to parse WebSocket frame: fd=%d", conn->src.fd);
+        return -1;
     }
-    
-    generate_accept_header(key, accept);
-    
-    snprintf(handshake_response, sizeof(handshake_response),
-        "HTTP/1.1 101 Switching Protocols\r\n"
-        "Upgrade: websocket\r\n"
-        "Connection: Upgrade\r\n"
-        "Sec-WebSocket-Accept: %s\r\n"
-        "\r\n", accept);
-    
-    if (send(client_fd, handshake_response, strlen(handshake_response), 0) < 0) {
-        log_error("Failed to send handshake response");
+    return 0;
+}
+
+static void ws_conn_on_event(EventSource *src, uint32_t events) {
+    WSConnection *conn = (WSConnection*)src;
+    unsigned char *recv_buf = conn->shard->recv_buf;
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        ws_conn_close(conn);
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        pthread_mutex_lock(&conn->out_lock);
+        int result = conn->kill_pending ? -1 : ws_conn_flush_locked(conn);
+        pthread_mutex_unlock(&conn->out_lock);
+        if (result < 0) {
+            ws_conn_close(conn);
+            return;
+        }
+    }
+
+    // Edge-triggered: drain the socket until it would block
+    while (conn->state != WS_STATE_CLOSING) {
+        ssize_t n = recv(src->fd, recv_buf, WS_RECV_BUFFER_SIZE, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            log_error("Error receiving from client: %s", strerror(errno));
+            ws_conn_close(conn);
+            return;
+        }
+        if (n == 0) {
+            ws_conn_close(conn);
+            return;
+        }
+
+        if (ws_conn_consume(conn, recv_buf, n) < 0) {
+            ws_conn_close(conn);
+            return;
+        }
+    }
+
+    if (conn->state == WS_STATE_CLOSING) {
+        ws_conn_close(conn);
+    }
+}
+
+// Allocate the state for an accepted socket (closes it on failure)
+static WSConnection* ws_conn_create(WSShard *shard, int client_fd) {
+    if (client_fd >= g_conns_cap) {
+        log_error("Connection fd %d exceeds table size %d", client_fd, g_conns_cap);
         close(client_fd);
         return NULL;
     }
-    
-    log_info("WebSocket client connected: fd=%d", client_fd);
-    
-    // Add client to server
-    int client_idx = websocket_add_client(client_fd, 0, 0);  // Default user_id=0, room_id=0
-    if (client_idx < 0) {
-        log_error("Failed to add client to server");
+
+    WSConnection *conn = calloc(1, sizeof(WSConnection));
+    if (!conn) {
         close(client_fd);
         return NULL;
     }
-    
-    // Main message loop
+    conn->src.fd = client_fd;
+    conn->src.on_event = ws_conn_on_event;
+    conn->shard = shard;
+    conn->state = WS_STATE_HANDSHAKE;
+    ws_parser_init(&conn->parser, g_max_message_size);
+    pthread_mutex_init(&conn->out_lock, NULL);
+#ifdef HAVE_IO_URING
+    atomic_init(&conn->refs, 1);      // dropped by ws_conn_close
+#endif
+
+    TimerWheel *timers = &shard->loop.timers;
+    pthread_mutex_lock(&g_server.clients_mutex);
+    conn->heartbeat = g_heartbeat_config;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    conn->last_active_ms = timer_wheel_time_ms(timers);
+    timer_init(&conn->timer, ws_conn_on_timer, conn);
+    if (conn->heartbeat.handshake_timeout_ms > 0) {
+        timer_wheel_schedule(timers, &conn->timer, conn->heartbeat.handshake_timeout_ms);
+    }
+    return conn;
+}
+
+// Publish a new connection in the fd table and its shard's list
+static void ws_conn_attach(WSConnection *conn) {
+    WSShard *shard = conn->shard;
+
+    g_conns[conn->src.fd] = conn;
+    conn->next = shard->conns;
+    if (shard->conns) shard->conns->prev = conn;
+    shard->conns = conn;
+    atomic_fetch_add(&shard->conn_count, 1);
+}
+
+static void ws_listener_on_event(EventSource *src, uint32_t events) {
+    WSShard *shard = (WSShard*)src;
+    (void)events;
+
     while (g_running) {
-        n = recv(client_fd, buffer, sizeof(buffer), 0);
-        
-        if (n <= 0) {
-            if (n < 0) {
-                log_error("Error receiving from client: %s", strerror(errno));
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_fd = accept4(src->fd, (struct sockaddr*)&client_addr, &client_addr_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error("Failed to accept connection: %s", strerror(errno));
             }
-            break;
+            return;
         }
-        
-        // Parse WebSocket frame
-        WSFrame frame = {0};
-        int frame_size = parse_ws_frame(buffer, n, &frame);
-        
-        if (frame_size < 0) {
-            log_error("Failed to parse WebSocket frame");
-            break;
+
+        WSConnection *conn = ws_conn_create(shard, client_fd);
+        if (!conn) continue;
+
+        if (event_loop_add(&shard->loop, &conn->src, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) < 0) {
+            log_error("Failed to register connection: %s", strerror(errno));
+            close(client_fd);
+            ws_conn_free(conn);
+            continue;
         }
-        
-        // Handle different opcodes
-        if (frame.opcode == 0x1) {  // Text frame
-            char message[4096];
-            if (frame.payload_len < sizeof(message)) {
-                memcpy(message, frame.payload, frame.payload_len);
-                message[frame.payload_len] = '\0';
-                
-                log_info("Received from client %d: %s", client_fd, message);
-                
-                // Broadcast to room (for now, broadcast to all)
-                pthread_mutex_lock(&g_server.clients_mutex);
-                for (int i = 0; i < g_server.client_count; i++) {
-                    if (g_server.clients[i].is_connected && g_server.clients[i].fd != client_fd) {
-                        int resp_size = create_ws_frame(message, frame.payload_len, buffer, sizeof(buffer));
-                        if (resp_size > 0) {
-                            send(g_server.clients[i].fd, buffer, resp_size, 0);
-                        }
-                    }
-                }
-                pthread_mutex_unlock(&g_server.clients_mutex);
+        ws_conn_attach(conn);
+
+        log_debug("New WebSocket connection from %s:%d",
+                  inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+
+        // Data may already be queued behind the connection
+        ws_conn_on_event(&conn->src, EPOLLIN);
+    }
+}
+
+static void ws_shard_close_listener(WSShard *shard) {
+    if (shard->listen_src.fd >= 0) {
+#ifdef HAVE_IO_URING
+        // Ends a pending multishot accept, which holds its own reference
+        if (shard->uring_active) shutdown(shard->listen_src.fd, SHUT_RDWR);
+#endif
+        if (shard->loop_ready) event_loop_del(&shard->loop, &shard->listen_src);
+        close(shard->listen_src.fd);
+        shard->listen_src.fd = -1;
+    }
+}
+
+#ifdef HAVE_IO_URING
+// SQE from the shard's ring, handing queued ones to the kernel if it is full
+static struct io_uring_sqe* ws_shard_get_sqe(WSShard *shard) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&shard->ring);
+    if (!sqe) {
+        uring_submit(&shard->ring);
+        sqe = uring_get_sqe(&shard->ring);
+    }
+    return sqe;
+}
+
+static uint64_t ws_uring_data(void *ptr, int op) {
+    return (uint64_t)(uintptr_t)ptr | (uint64_t)op;
+}
+
+static void ws_shard_arm_accept(WSShard *shard) {
+    struct io_uring_sqe *sqe = ws_shard_get_sqe(shard);
+    if (!sqe || shard->listen_src.fd < 0) return;
+    uring_prep_accept_multishot(sqe, shard->listen_src.fd, SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                ws_uring_data(shard, WS_URING_ACCEPT));
+}
+
+// The loop's eventfd wakes us for websocket_stop and cross-thread sends
+static void ws_shard_arm_wake(WSShard *shard) {
+    struct io_uring_sqe *sqe = ws_shard_get_sqe(shard);
+    if (!sqe) return;
+    uring_prep_poll_multishot(sqe, shard->loop.wake_fd, POLLIN, ws_uring_data(shard, WS_URING_WAKE));
+}
+
+static int ws_conn_arm_recv(WSConnection *conn) {
+    struct io_uring_sqe *sqe = ws_shard_get_sqe(conn->shard);
+    if (!sqe) return -1;
+    uring_prep_recv_multishot(sqe, conn->src.fd, conn->shard->bufs.group,
+                              ws_uring_data(conn, WS_URING_RECV));
+    atomic_fetch_add(&conn->refs, 1);
+    return 0;
+}
+
+// Put conn on its shard's dirty list (caller holds out_lock). The shard
+// turns the whole list into one batch of submissions per loop turn.
+static void ws_conn_mark_dirty_locked(WSConnection *conn) {
+    WSShard *shard = conn->shard;
+
+    // A send in flight picks up newly queued frames when it completes
+    if (conn->dirty || conn->send_inflight) return;
+    conn->dirty = 1;
+    atomic_fetch_add(&conn->refs, 1);
+
+    pthread_mutex_lock(&shard->dirty_lock);
+    int was_empty = shard->dirty == NULL;
+    conn->dirty_next = shard->dirty;
+    shard->dirty = conn;
+    pthread_mutex_unlock(&shard->dirty_lock);
+
+    // The shard flushes before it blocks; other threads have to wake it
+    if (was_empty && !pthread_equal(pthread_self(), shard->owner)) {
+        event_loop_wake(&shard->loop);
+    }
+}
+
+// Submit one sendmsg for the head of the queue (caller holds out_lock)
+static void ws_conn_submit_send_locked(WSConnection *conn) {
+    WSShard *shard = conn->shard;
+
+    struct io_uring_sqe *sqe = ws_shard_get_sqe(shard);
+    if (!sqe) {
+        ws_conn_mark_dirty_locked(conn);  // retry next turn
+        return;
+    }
+
+    int n_iov = ws_out_fill_iov(conn, conn->send_iov, WS_URING_SEND_IOV);
+    memset(&conn->send_msg, 0, sizeof(conn->send_msg));
+    conn->send_msg.msg_iov = conn->send_iov;
+    conn->send_msg.msg_iovlen = n_iov;
+
+    // The kernel reads these frames until the completion arrives
+    conn->out_pinned = n_iov;
+    conn->send_inflight = 1;
+    atomic_fetch_add(&conn->refs, 1);
+    uring_prep_sendmsg(sqe, conn->src.fd, &conn->send_msg, MSG_NOSIGNAL, ws_uring_data(conn, WS_URING_SEND));
+    atomic_fetch_add(&shard->sends_submitted, 1);
+}
+
+static void ws_shard_flush_dirty(WSShard *shard) {
+    pthread_mutex_lock(&shard->dirty_lock);
+    WSConnection *conn = shard->dirty;
+    shard->dirty = NULL;
+    pthread_mutex_unlock(&shard->dirty_lock);
+
+    while (conn) {
+        WSConnection *next = conn->dirty_next;
+
+        pthread_mutex_lock(&conn->out_lock);
+        conn->dirty = 0;
+        if (!conn->closed && !conn->kill_pending && !conn->send_inflight && conn->out_count > 0) {
+            ws_conn_submit_send_locked(conn);
+        }
+        pthread_mutex_unlock(&conn->out_lock);
+
+        ws_conn_put(conn);
+        conn = next;
+    }
+}
+
+// Close once the queued close reply has gone out
+static void ws_conn_close_after_flush(WSConnection *conn) {
+    pthread_mutex_lock(&conn->out_lock);
+    int pending = conn->out_count > 0;
+    conn->close_after_send = pending;
+    pthread_mutex_unlock(&conn->out_lock);
+
+    if (!pending) ws_conn_close(conn);
+}
+
+static void ws_conn_on_recv(WSConnection *conn, struct io_uring_cqe *cqe) {
+    WSShard *shard = conn->shard;
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    int bid = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+    if (!conn->closed) {
+        if (cqe->res > 0 && bid >= 0) {
+            unsigned char *data = uring_buf_ring_get(&shard->bufs, (uint16_t)bid);
+            if (ws_conn_consume(conn, data, cqe->res) < 0) {
+                ws_conn_close(conn);
+            } else if (conn->state == WS_STATE_CLOSING) {
+                ws_conn_close_after_flush(conn);
             }
-        } else if (frame.opcode == 0x8) {  // Close frame
-            log_info("Client %d sent close frame", client_fd);
-            free(frame.payload);
+        } else if (cqe->res != -ENOBUFS) {
+            // EOF or error; ENOBUFS only means the buffer ring ran dry
+            ws_conn_close(conn);
+        }
+    }
+
+    if (bid >= 0) uring_buf_ring_recycle(&shard->bufs, (uint16_t)bid);
+
+    if (!more) {
+        if (!conn->closed && ws_conn_arm_recv(conn) < 0) ws_conn_close(conn);
+        ws_conn_put(conn);
+    }
+}
+
+static void ws_conn_on_send(WSConnection *conn, struct io_uring_cqe *cqe) {
+    int close_now = 0;
+
+    pthread_mutex_lock(&conn->out_lock);
+    conn->send_inflight = 0;
+    conn->out_pinned = 0;
+    if (cqe->res < 0) {
+        close_now = 1;
+    } else {
+        ws_out_consume(conn, (size_t)cqe->res);
+        if (conn->kill_pending) {
+            close_now = 1;
+        } else if (conn->out_count > 0) {
+            if (!conn->closed) ws_conn_submit_send_locked(conn);
+        } else {
+            ws_out_release_ring(conn);
+            close_now = conn->close_after_send;
+        }
+    }
+    pthread_mutex_unlock(&conn->out_lock);
+
+    if (close_now) ws_conn_close(conn);
+    ws_conn_put(conn);
+}
+
+static void ws_shard_on_accept(WSShard *shard, struct io_uring_cqe *cqe) {
+    if (cqe->res >= 0) {
+        WSConnection *conn = g_running ? ws_conn_create(shard, cqe->res) : NULL;
+        if (!g_running) close(cqe->res);
+        if (conn) {
+            ws_conn_attach(conn);
+            if (ws_conn_arm_recv(conn) < 0) ws_conn_close(conn);
+        }
+    } else if (cqe->res != -EINVAL && cqe->res != -ECANCELED) {
+        log_error("Failed to accept connection: %s", strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && shard->loop.running) {
+        ws_shard_arm_accept(shard);
+    }
+}
+
+static void ws_shard_on_wake(WSShard *shard, struct io_uring_cqe *cqe) {
+    uint64_t value;
+    while (read(shard->loop.wake_fd, &value, sizeof(value)) > 0) {}
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && shard->loop.running) {
+        ws_shard_arm_wake(shard);
+    }
+}
+
+static void ws_shard_reap(WSShard *shard) {
+    struct io_uring_cqe *cqe;
+
+    while ((cqe = uring_peek_cqe(&shard->ring))) {
+        void *ptr = (void*)(uintptr_t)(cqe->user_data & ~WS_URING_OP_MASK);
+
+        switch (cqe->user_data & WS_URING_OP_MASK) {
+        case WS_URING_ACCEPT: ws_shard_on_accept(ptr, cqe); break;
+        case WS_URING_WAKE:   ws_shard_on_wake(ptr, cqe); break;
+        case WS_URING_RECV:   ws_conn_on_recv(ptr, cqe); break;
+        case WS_URING_SEND:   ws_conn_on_send(ptr, cqe); break;
+        default: break;
+        }
+        uring_cqe_seen(&shard->ring);
+    }
+}
+
+// Submit pending work and wait for a completion or the next timer
+static int ws_shard_turn(WSShard *shard) {
+    TimerWheel *timers = &shard->loop.timers;
+
+    ws_shard_flush_dirty(shard);
+    int timeout = timer_wheel_next_timeout(timers, get_monotonic_ms());
+    int ret = timeout < 0 ? uring_submit_and_wait(&shard->ring, 1)
+                          : uring_submit_and_wait_timeout(&shard->ring, 1, timeout);
+    atomic_store(&shard->enters, shard->ring.enters);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME) {
+        log_error("io_uring_enter failed: %s", strerror(errno));
+        return -1;
+    }
+
+    timer_wheel_advance(timers, get_monotonic_ms());
+    ws_shard_reap(shard);
+    return 0;
+}
+
+static int ws_shard_run_uring(WSShard *shard) {
+    int result = 0;
+
+    shard->owner = pthread_self();
+    ws_shard_arm_wake(shard);
+    ws_shard_arm_accept(shard);
+
+    while (shard->loop.running) {
+        if (ws_shard_turn(shard) < 0) {
+            result = -1;
             break;
-        } else if (frame.opcode == 0x9) {  // Ping frame
-            // Send pong (opcode 0xA)
-            unsigned char pong_frame[2] = {0x8A, 0x00};
-            send(client_fd, pong_frame, 2, 0);
         }
-        
-        if (frame.payload) {
-            free(frame.payload);
+    }
+
+    ws_shard_close_listener(shard);
+    while (shard->conns) {
+        ws_conn_close(shard->conns);
+    }
+    // Shut-down sockets finish their pending operations promptly
+    while (shard->zombies > 0 && ws_shard_turn(shard) == 0) {}
+
+    return result;
+}
+
+static int ws_shard_init_uring(WSShard *shard) {
+    if (uring_init(&shard->ring, WS_URING_ENTRIES, WS_URING_CQ_ENTRIES) < 0) return -1;
+
+    // Multishot recv needs Linux 6.0, the release that also added SEND_ZC
+    if (!uring_opcode_supported(&shard->ring, IORING_OP_SEND_ZC)) {
+        uring_cleanup(&shard->ring);
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (uring_buf_ring_init(&shard->ring, &shard->bufs, 0, WS_URING_BUF_COUNT, WS_URING_BUF_SIZE) < 0) {
+        int saved = errno;
+        uring_cleanup(&shard->ring);
+        errno = saved;
+        return -1;
+    }
+
+    pthread_mutex_init(&shard->dirty_lock, NULL);
+    shard->uring_active = 1;
+    return 0;
+}
+
+static void ws_shard_cleanup_uring(WSShard *shard) {
+    if (!shard->uring_active) return;
+    uring_buf_ring_free(&shard->ring, &shard->bufs);
+    uring_cleanup(&shard->ring);
+    pthread_mutex_destroy(&shard->dirty_lock);
+    shard->uring_active = 0;
+}
+#endif
+
+// Close connections whose login token expired after the upgrade
+static void ws_shard_sweep_tokens(Timer *timer, void *arg) {
+    WSShard *shard = arg;
+    time_t now = time(NULL);
+    (void)timer;
+
+    WSConnection *conn = shard->conns;
+    while (conn) {
+        WSConnection *next = conn->next;
+        if (conn->state == WS_STATE_OPEN && conn->token_expires <= now) {
+            log_info("WebSocket token expired: fd=%d", conn->src.fd);
+            ws_conn_close_with_status(conn, WS_CLOSE_POLICY_VIOLATION, "Token expired");
         }
+        conn = next;
     }
-    
-    // Remove client
-    websocket_remove_client(client_fd);
-    close(client_fd);
-    log_info("WebSocket client disconnected: fd=%d", client_fd);
-    
-    return NULL;
 }
 
-// Accept connections thread
-void* websocket_accept_connections(void *arg) {
-    struct sockaddr_in client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    
-    log_info("WebSocket server accepting connections on port %d", g_ws_port);
-    
-    while (g_running) {
-        int client_fd = accept(g_server_fd, (struct sockaddr*)&client_addr, &client_addr_len);
-        
-        if (client_fd < 0) {
-            if (g_running) {
-                log_error("Failed to accept connection: %s", strerror(errno));
-            }
-            continue;
-        }
-        
-        log_info("New WebSocket connection from %s:%d", 
-                 inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        
-        // Create thread to handle client
-        pthread_t client_thread;
-        int *client_fd_ptr = malloc(sizeof(int));
-        *client_fd_ptr = client_fd;
-        
-        if (pthread_create(&client_thread, NULL, websocket_client_handler, client_fd_ptr) != 0) {
-            log_error("Failed to create client handler thread");
-            free(client_fd_ptr);
-            close(client_fd);
-        } else {
-            pthread_detach(client_thread);
-        }
+// Run one shard's reactor until websocket_stop, then tear down the
+// connections it owns from its own thread
+static int ws_shard_run(WSShard *shard) {
+    timer_init(&shard->token_sweep, ws_shard_sweep_tokens, shard);
+    timer_wheel_schedule_periodic(&shard->loop.timers, &shard->token_sweep, WS_TOKEN_SWEEP_INTERVAL_MS);
+
+#ifdef HAVE_IO_URING
+    if (shard->uring_active) return ws_shard_run_uring(shard);
+#endif
+
+    int result = event_loop_run(&shard->loop);
+
+    ws_shard_close_listener(shard);
+    while (shard->conns) {
+        ws_conn_close(shard->conns);
+    }
+
+    return result;
+}
+
+static void ws_shards_destroy() {
+    for (int i = 0; i < g_shard_count; i++) {
+        WSShard *shard = &g_shards[i];
+        ws_shard_close_listener(shard);
+#ifdef HAVE_IO_URING
+        ws_shard_cleanup_uring(shard);
+#endif
+        if (shard->loop_ready) event_loop_cleanup(&shard->loop);
+        free(shard->inflate_buf);
+    }
+    free(g_shards);
+    g_shards = NULL;
+    g_shard_count = 0;
+}
+
+// Raise the soft fd limit so one process can hold tens of thousands of sockets
+static int ws_raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return -1;
+
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
     }
-    
-    return NULL;
+
+    return rl.rlim_cur > INT_MAX ? INT_MAX : (int)rl.rlim_cur;
 }
 
 // Initialize WebSocket server
@@ -333,68 +2287,183 @@ int websocket_init(int port) {
     g_ws_port = port;
     
     // Initialize server structure
-    g_server.client_count = 0;
+    ws_clients_clear();
     pthread_mutex_init(&g_server.clients_mutex, NULL);
-    
-    // Create listening socket
-    g_server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (g_server_fd < 0) {
-        log_error("Failed to create WebSocket server socket: %s", strerror(errno));
+
+    g_conns_cap = ws_raise_fd_limit();
+    if (g_conns_cap <= 0) g_conns_cap = 1024;
+    g_conns = calloc(g_conns_cap, sizeof(WSConnection*));
+    if (!g_conns) {
+        log_error("Failed to allocate WebSocket connection table");
         return -1;
     }
-    
-    // Set socket options
-    int reuse = 1;
-    if (setsockopt(g_server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
-        log_error("Failed to set socket options: %s", strerror(errno));
-        close(g_server_fd);
-        return -1;
+
+    g_ping_frame = ws_frame_create(WS_OPCODE_PING, NULL, 0);
+
+    uint64_t epoch;
+    if (getrandom(&epoch, sizeof(epoch), 0) != sizeof(epoch)) {
+        epoch = ((uint64_t)getpid() << 20) ^ (uint64_t)time(NULL);
     }
+    epoch &= (1ULL << WS_SEQ_EPOCH_BITS) - 1;
+    g_seq_epoch = (epoch ? epoch : 1) << WS_SEQ_COUNTER_BITS;
+
+    pthread_condattr_t wake_attr;
+    pthread_condattr_init(&wake_attr);
+    pthread_condattr_setclock(&wake_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_coalescer.wake, &wake_attr);
+    pthread_condattr_destroy(&wake_attr);
+    timer_wheel_init(&g_coalescer.wheel);
+    g_coalescer.stopping = 0;
     
-    // Bind to port
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_addr.sin_port = htons(port);
-    
-    if (bind(g_server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        log_error("Failed to bind WebSocket server to port %d: %s", port, strerror(errno));
-        close(g_server_fd);
+    g_shard_count = g_shard_config > 0 ? g_shard_config : get_cpu_count();
+    g_shards = calloc(g_shard_count, sizeof(WSShard));
+    if (!g_shards) {
+        log_error("Failed to allocate WebSocket shards");
         return -1;
     }
-    
-    // Listen for connections
-    if (listen(g_server_fd, 128) < 0) {
-        log_error("Failed to listen on WebSocket server: %s", strerror(errno));
-        close(g_server_fd);
-        return -1;
+
+    for (int i = 0; i < g_shard_count; i++) {
+        g_shards[i].listen_src.fd = -1;
+    }
+
+    for (int i = 0; i < g_shard_count; i++) {
+        if (event_loop_init(&g_shards[i].loop) < 0) {
+            ws_shards_destroy();
+            return -1;
+        }
+        g_shards[i].loop_ready = 1;
+    }
+
+    // The shard loops keep their eventfd and running flag under io_uring;
+    // if any ring cannot be set up every shard stays on epoll
+    if (g_io_backend == WS_IO_URING) {
+#ifdef HAVE_IO_URING
+        for (int i = 0; i < g_shard_count; i++) {
+            if (ws_shard_init_uring(&g_shards[i]) < 0) {
+                log_error("io_uring unavailable (%s), using epoll", strerror(errno));
+                for (int j = 0; j < i; j++) {
+                    ws_shard_cleanup_uring(&g_shards[j]);
+                }
+                g_io_backend = WS_IO_EPOLL;
+                break;
+            }
+        }
+#else
+        log_error("Built without io_uring support, using epoll");
+        g_io_backend = WS_IO_EPOLL;
+#endif
+    }
+
+    // Every shard binds its own listener to the same port
+    for (int i = 0; i < g_shard_count; i++) {
+        WSShard *shard = &g_shards[i];
+
+        shard->listen_src.fd = socket_create_listener(port, SOMAXCONN);
+        if (shard->listen_src.fd < 0) {
+            log_error("Failed to create WebSocket listener %d on port %d", i, port);
+            ws_shards_destroy();
+            return -1;
+        }
+        shard->listen_src.on_event = ws_listener_on_event;
+#ifdef HAVE_IO_URING
+        if (shard->uring_active) continue;   // accepted by the ring instead
+#endif
+        if (event_loop_add(&shard->loop, &shard->listen_src, EPOLLIN | EPOLLET) < 0) {
+            log_error("Failed to register WebSocket listener: %s", strerror(errno));
+            ws_shards_destroy();
+            return -1;
+        }
     }
     
-    log_info("WebSocket server initialized on port %d", port);
+    log_info("WebSocket server initialized on port %d (%d %s shards, fd limit %d)",
+             port, g_shard_count, g_io_backend == WS_IO_URING ? "io_uring" : "epoll", g_conns_cap);
     return 0;
 }
 
-// Start WebSocket server
+static void* ws_shard_thread(void *arg) {
+    ws_shard_run(arg);
+    return NULL;
+}
+
+// Flush coalesced batches as their windows close
+static void* ws_coalescer_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    while (!g_coalescer.stopping) {
+        uint64_t now = (uint64_t)get_monotonic_ms();
+        timer_wheel_advance(&g_coalescer.wheel, now);
+
+        int timeout = timer_wheel_next_timeout(&g_coalescer.wheel, now);
+        if (timeout < 0) {
+            pthread_cond_wait(&g_coalescer.wake, &g_server.clients_mutex);
+            continue;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&g_coalescer.wake, &g_server.clients_mutex, &deadline);
+    }
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    return NULL;
+}
+
+// Start WebSocket server: shard 0 runs on the calling thread, the rest on
+// their own threads. Blocks until websocket_stop.
 int websocket_start() {
     g_running = 1;
     
-    if (pthread_create(&g_accept_thread, NULL, websocket_accept_connections, NULL) != 0) {
-        log_error("Failed to create accept thread");
-        return -1;
+    log_info("WebSocket server accepting connections on port %d", g_ws_port);
+
+    if (pthread_create(&g_coalescer.thread, NULL, ws_coalescer_thread, NULL) == 0) {
+        g_coalescer.started = 1;
+    } else {
+        log_error("Failed to start the coalescing thread");
     }
-    
-    pthread_join(g_accept_thread, NULL);
-    return 0;
+
+    for (int i = 1; i < g_shard_count; i++) {
+        WSShard *shard = &g_shards[i];
+        if (pthread_create(&shard->thread, NULL, ws_shard_thread, shard) != 0) {
+            // Without a reactor its listener must not keep receiving connections
+            log_error("Failed to start WebSocket shard %d", i);
+            ws_shard_close_listener(shard);
+            continue;
+        }
+        shard->thread_started = 1;
+    }
+
+    int result = ws_shard_run(&g_shards[0]);
+
+    for (int i = 1; i < g_shard_count; i++) {
+        if (g_shards[i].thread_started) {
+            pthread_join(g_shards[i].thread, NULL);
+            g_shards[i].thread_started = 0;
+        }
+    }
+
+    if (g_coalescer.started) {
+        pthread_join(g_coalescer.thread, NULL);
+        g_coalescer.started = 0;
+    }
+
+    return result;
 }
 
 // Stop WebSocket server
 void websocket_stop() {
     g_running = 0;
-    
-    if (g_server_fd >= 0) {
-        close(g_server_fd);
-        g_server_fd = -1;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    g_coalescer.stopping = 1;
+    pthread_cond_signal(&g_coalescer.wake);
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    for (int i = 0; i < g_shard_count; i++) {
+        event_loop_stop(&g_shards[i].loop);
     }
     
     log_info("WebSocket server stopped");
@@ -402,79 +2471,213 @@ void websocket_stop() {
 
 // Cleanup WebSocket server
 void websocket_cleanup() {
+    // The bus thread publishes into rooms, so it goes before the connections
+    chat_bus_close(g_bus);
+    g_bus = NULL;
+    ws_shards_destroy();
+    free(g_conns);
+    g_conns = NULL;
+    g_conns_cap = 0;
+    if (g_ping_frame) {
+        ws_frame_unref(g_ping_frame);
+        g_ping_frame = NULL;
+    }
+    ws_rooms_clear();
+    ws_clients_clear();
+    pthread_cond_destroy(&g_coalescer.wake);
     pthread_mutex_destroy(&g_server.clients_mutex);
     log_info("WebSocket server cleaned up");
 }
 
+// Number of reactor shards used by the next websocket_init (0 = one per CPU)
+void websocket_set_shard_count(int shards) {
+    g_shard_config = shards > 0 ? shards : 0;
+}
+
+void websocket_set_io_backend(WSIOBackend backend) {
+    g_io_backend = backend;
+}
+
+WSIOBackend websocket_get_io_backend() {
+    return g_io_backend;
+}
+
 // Add client to server
-int websocket_add_client(int fd, int user_id, int room_id) {
+WSClientHandle websocket_add_client(int fd, int user_id, int room_id) {
+    if (fd < 0) return WS_INVALID_HANDLE;
+
     pthread_mutex_lock(&g_server.clients_mutex);
-    
-    if (g_server.client_count >= 1000) {
+
+    if (websocket_get_client_index(fd) >= 0) {
         pthread_mutex_unlock(&g_server.clients_mutex);
-        return -1;
+        log_error("Client fd=%d is already registered", fd);
+        return WS_INVALID_HANDLE;
     }
-    
-    int idx = g_server.client_count++;
-    g_server.clients[idx].fd = fd;
-    g_server.clients[idx].user_id = user_id;
-    g_server.clients[idx].room_id = room_id;
-    g_server.clients[idx].is_connected = 1;
-    
+
+    if ((g_server.free_head < 0 && ws_clients_grow() < 0) ||
+        ws_clients_reserve_fd(fd) < 0) {
+        pthread_mutex_unlock(&g_server.clients_mutex);
+        return WS_INVALID_HANDLE;
+    }
+
+    int slot = g_server.free_head;
+    WebSocketClient *client = &g_server.clients[slot];
+
+    client->fd = fd;
+    client->room_count = 0;
+    client->room_cap = WS_CLIENT_INLINE_ROOMS;
+    client->heap_rooms = NULL;
+    if (room_id > 0 && ws_client_subscribe(client, room_id) < 0) {
+        client->fd = -1;
+        pthread_mutex_unlock(&g_server.clients_mutex);
+        return WS_INVALID_HANDLE;
+    }
+    g_server.free_head = client->link;
+
+    client->user_id = user_id;
+    client->room_id = room_id > 0 ? room_id : 0;
+    client->is_connected = 1;
+    client->link = g_server.client_count;
+    g_server.active[g_server.client_count++] = slot;
+    g_server.fd_slots[fd] = slot;
+
+    WSClientHandle handle = ws_client_handle(slot);
+
     pthread_mutex_unlock(&g_server.clients_mutex);
     
     log_info("Client added: fd=%d, user_id=%d, room_id=%d", fd, user_id, room_id);
-    return idx;
+    return handle;
 }
 
-// Remove client from server
+// Remove client from server; returns the slot it occupied, or -1
 int websocket_remove_client(int fd) {
     pthread_mutex_lock(&g_server.clients_mutex);
     
-    int idx = websocket_get_client_index(fd);
-    if (idx >= 0) {
-        g_server.clients[idx].is_connected = 0;
-        // Shift remaining clients
-        for (int i = idx; i < g_server.client_count - 1; i++) {
-            g_server.clients[i] = g_server.clients[i + 1];
-        }
-        g_server.client_count--;
+    int slot = websocket_get_client_index(fd);
+    if (slot >= 0) {
+        WebSocketClient *client = &g_server.clients[slot];
+        ws_client_reset_rooms(client);
+
+        // Swap the last active slot into our place in the dense list
+        int last = g_server.active[--g_server.client_count];
+        g_server.active[client->link] = last;
+        g_server.clients[last].link = client->link;
+
+        // Retire the slot; outstanding handles no longer match
+        client->is_connected = 0;
+        client->fd = -1;
+        if (++client->generation == 0) client->generation = 1;
+        client->link = g_server.free_head;
+        g_server.free_head = slot;
+        g_server.fd_slots[fd] = -1;
     }
     
     pthread_mutex_unlock(&g_server.clients_mutex);
     
-    return idx;
+    return slot;
 }
 
-// Get client index by file descriptor
-int websocket_get_client_index(int fd) {
-    for (int i = 0; i < g_server.client_count; i++) {
-        if (g_server.clients[i].fd == fd && g_server.clients[i].is_connected) {
-            return i;
+// Move a connected client's default room: subscribe to the new one and
+// drop the old one (0 leaves the client without a default room)
+int websocket_set_client_room(int fd, int room_id) {
+    pthread_mutex_lock(&g_server.clients_mutex);
+
+    int idx = websocket_get_client_index(fd);
+    if (idx < 0) {
+        pthread_mutex_unlock(&g_server.clients_mutex);
+        return -1;
+    }
+
+    WebSocketClient *client = &g_server.clients[idx];
+    int old_room = client->room_id;
+    if (old_room != room_id) {
+        if (room_id > 0 && ws_client_subscribe(client, room_id) < 0) {
+            pthread_mutex_unlock(&g_server.clients_mutex);
+            return -1;
         }
+        if (old_room > 0) ws_client_unsubscribe(client, old_room);
+        client->room_id = room_id > 0 ? room_id : 0;
     }
-    return -1;
+
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    log_info("Client moved: fd=%d, room %d -> %d", fd, old_room, room_id);
+    return 0;
 }
 
-// Broadcast message to room
-int websocket_broadcast_to_room(int room_id, const char *message) {
-    if (!message) return -1;
-    
-    int msg_len = strlen(message);
-    unsigned char frame[MAX_FRAME_SIZE];
-    int frame_size = create_ws_frame(message, msg_len, frame, sizeof(frame));
-    
-    if (frame_size < 0) return -1;
-    
+// Subscribe a client to one more room; the first becomes its default
+int websocket_join_room(int fd, int room_id) {
+    if (room_id <= 0) return -1;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int idx = websocket_get_client_index(fd);
+    int result = -1;
+    if (idx >= 0) {
+        WebSocketClient *client = &g_server.clients[idx];
+        result = ws_client_subscribe(client, room_id) < 0 ? -1 : 0;
+        if (result == 0 && client->room_id == 0) client->room_id = room_id;
+    }
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    if (result == 0) log_info("Client fd=%d joined room %d", fd, room_id);
+    return result;
+}
+
+int websocket_leave_room(int fd, int room_id) {
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int idx = websocket_get_client_index(fd);
+    int result = idx >= 0 && ws_client_unsubscribe(&g_server.clients[idx], room_id) == 0 ? 0 : -1;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    if (result == 0) log_info("Client fd=%d left room %d", fd, room_id);
+    return result;
+}
+
+int websocket_is_subscribed(int fd, int room_id) {
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int idx = websocket_get_client_index(fd);
+    int subscribed = idx >= 0 && ws_client_find_room(&g_server.clients[idx], room_id) >= 0;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    return subscribed;
+}
+
+// Get client slot by file descriptor (caller holds clients_mutex)
+int websocket_get_client_index(int fd) {
+    if (fd < 0 || fd >= g_server.fd_capacity) return -1;
+    return g_server.fd_slots[fd];
+}
+
+// Current handle for a connected fd
+WSClientHandle websocket_get_client_handle(int fd) {
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int slot = websocket_get_client_index(fd);
+    WSClientHandle handle = slot >= 0 ? ws_client_handle(slot) : WS_INVALID_HANDLE;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    return handle;
+}
+
+// Copy a client's record; returns -1 if the handle is stale
+int websocket_get_client(WSClientHandle handle, WebSocketClient *out) {
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int slot = ws_client_slot(handle);
+    if (slot >= 0 && out) {
+        *out = g_server.clients[slot];
+    }
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    return slot >= 0 ? 0 : -1;
+}
+
+// Publish to this process's members of a room
+static int ws_broadcast_local(int room_id, const void *payload, size_t len) {
+    // Sequence messages for known rooms even while nobody is connected
+    int known = db_get_room_by_id(room_id) != NULL;
+
     pthread_mutex_lock(&g_server.clients_mutex);
     
     int sent_count = 0;
-    for (int i = 0; i < g_server.client_count; i++) {
-        if (g_server.clients[i].is_connected && g_server.clients[i].room_id == room_id) {
-            if (send(g_server.clients[i].fd, frame, frame_size, 0) > 0) {
-                sent_count++;
-            }
-        }
+    WSRoom *room = known ? ws_room_get(room_id) : ws_room_find(room_id);
+    if (room) {
+        sent_count = ws_room_publish(room, -1, payload, len);
     }
     
     pthread_mutex_unlock(&g_server.clients_mutex);
@@ -482,21 +2685,82 @@ int websocket_broadcast_to_room(int room_id, const char *message) {
     return sent_count;
 }
 
+// Broadcast from another process: local fan-out only, never back onto
+// the bus (runs on the bus thread)
+static void ws_bus_deliver(int room_id, const unsigned char *payload, size_t len, void *arg) {
+    (void)arg;
+    ws_broadcast_local(room_id, payload, len);
+}
+
+// Broadcast message to room
+int websocket_broadcast_to_room(int room_id, const char *message) {
+    if (!message || room_id <= 0) return -1;
+
+    size_t len = strlen(message);
+    int sent_count = ws_broadcast_local(room_id, message, len);
+    if (g_bus) chat_bus_publish(g_bus, room_id, (const unsigned char*)message, len);
+    return sent_count;
+}
+
+int websocket_set_bus(const char *spec) {
+    if (g_bus) return -1;
+    g_bus = chat_bus_open(spec, ws_bus_deliver, NULL);
+    return g_bus ? 0 : -1;
+}
+
+uint64_t websocket_get_room_seq(int room_id) {
+    pthread_mutex_lock(&g_server.clients_mutex);
+    WSRoom *room = ws_room_find(room_id);
+    uint64_t seq = room ? room->last_seq : 0;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    return seq;
+}
+
+// Number of live connections in a room
+int websocket_get_room_member_count(int room_id) {
+    pthread_mutex_lock(&g_server.clients_mutex);
+    WSRoom *room = ws_room_find(room_id);
+    int count = room ? room->member_count : 0;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    return count;
+}
+
 // Send message to specific client
 int websocket_send_to_client(int fd, const char *message) {
     if (!message) return -1;
     
-    int msg_len = strlen(message);
-    unsigned char frame[MAX_FRAME_SIZE];
-    int frame_size = create_ws_frame(message, msg_len, frame, sizeof(frame));
-    
-    if (frame_size < 0) return -1;
-    
-    if (send(fd, frame, frame_size, 0) > 0) {
-        return 0;
-    }
+    WSMessageFrames frames;
+    ws_frames_init(&frames, WS_OPCODE_TEXT, message, strlen(message));
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    WSConnection *conn = websocket_get_client_index(fd) >= 0 ? ws_conn_lookup(fd) : NULL;
+    WSOutFrame *frame = conn ? ws_frames_for(&frames, conn) : NULL;
+    int result = frame ? ws_conn_send(conn, frame) : -1;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    ws_frames_release(&frames);
     
-    return -1;
+    return result;
+}
+
+// Send message to a client by handle; fails once that client has left,
+// even if its fd now belongs to someone else
+int websocket_send_to_handle(WSClientHandle handle, const char *message) {
+    if (!message) return -1;
+
+    WSMessageFrames frames;
+    ws_frames_init(&frames, WS_OPCODE_TEXT, message, strlen(message));
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    int slot = ws_client_slot(handle);
+    WSConnection *conn = slot >= 0 ? ws_conn_lookup(g_server.clients[slot].fd) : NULL;
+    WSOutFrame *frame = conn ? ws_frames_for(&frames, conn) : NULL;
+    int result = frame ? ws_conn_send(conn, frame) : -1;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    ws_frames_release(&frames);
+
+    return result;
 }
 
 // Get active connections count
@@ -507,3 +2771,178 @@ int websocket_get_active_connections() {
     pthread_mutex_unlock(&g_server.clients_mutex);
     return count;
 }
+
+// Largest message (after reassembly) accepted from a client; applies to
+// connections accepted afterwards
+void websocket_set_max_message_size(size_t max_bytes) {
+    g_max_message_size = max_bytes ? max_bytes : WS_DEFAULT_MAX_MESSAGE_SIZE;
+}
+
+// Enable, disable or tune permessage-deflate. Negotiation applies to new
+// connections; level and min_size apply to subsequent sends, and disabling
+// sends everything uncompressed from now on.
+void websocket_set_compression(const WSDeflateConfig *config) {
+    if (!config) return;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    g_deflate_config = *config;
+    if (g_deflate_config.level < 1 || g_deflate_config.level > 9) {
+        g_deflate_config.level = WS_DEFLATE_DEFAULT_LEVEL;
+    }
+    if (g_deflate_config.server_max_window_bits < WS_DEFLATE_MIN_WINDOW_BITS ||
+        g_deflate_config.server_max_window_bits > WS_DEFLATE_MAX_WINDOW_BITS) {
+        g_deflate_config.server_max_window_bits = WS_DEFLATE_MAX_WINDOW_BITS;
+    }
+    if (g_deflate_config.client_max_window_bits < 8 ||
+        g_deflate_config.client_max_window_bits > WS_DEFLATE_MAX_WINDOW_BITS) {
+        g_deflate_config.client_max_window_bits = WS_DEFLATE_MAX_WINDOW_BITS;
+    }
+    pthread_mutex_unlock(&g_server.clients_mutex);
+}
+
+int websocket_set_allowed_origins(const char *origins) {
+    if (origins && strlen(origins) >= sizeof(g_allowed_origins)) return -1;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    snprintf(g_allowed_origins, sizeof(g_allowed_origins), "%s", origins ? origins : "");
+    pthread_mutex_unlock(&g_server.clients_mutex);
+    return 0;
+}
+
+// Change ping / idle / handshake timeouts (negative values count as 0)
+void websocket_set_heartbeat_config(const WSHeartbeatConfig *config) {
+    if (!config) return;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    g_heartbeat_config = *config;
+    if (g_heartbeat_config.ping_interval_ms < 0) g_heartbeat_config.ping_interval_ms = 0;
+    if (g_heartbeat_config.idle_timeout_ms < 0) g_heartbeat_config.idle_timeout_ms = 0;
+    if (g_heartbeat_config.handshake_timeout_ms < 0) g_heartbeat_config.handshake_timeout_ms = 0;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+}
+
+static int ws_coalesce_config_valid(const WSCoalesceConfig *config) {
+    return config && config->window_ms >= 0 && config->window_ms <= WS_COALESCE_MAX_WINDOW_MS &&
+           config->max_messages >= 0 && config->max_messages <= WS_COALESCE_MAX_MESSAGES;
+}
+
+int websocket_set_room_coalescing(int room_id, const WSCoalesceConfig *config) {
+    if (room_id <= 0 || !ws_coalesce_config_valid(config)) return -1;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    WSRoom *room = ws_room_get(room_id);
+    if (room) {
+        ws_room_flush(room);
+        room->coalesce = *config;
+    }
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    if (!room) return -1;
+    log_info("Room %d coalescing: %d ms window, up to %d messages", room_id,
+             config->window_ms, config->max_messages ? config->max_messages : WS_COALESCE_MAX_MESSAGES);
+    return 0;
+}
+
+void websocket_set_default_coalescing(const WSCoalesceConfig *config) {
+    if (!ws_coalesce_config_valid(config)) return;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    g_default_coalesce = *config;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+}
+
+// Change the slow-consumer policy (applies to subsequent sends)
+void websocket_set_outbound_config(const WSOutboundConfig *config) {
+    if (!config) return;
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+    g_out_config = *config;
+    if (g_out_config.max_queued_frames < 1) g_out_config.max_queued_frames = 1;
+    pthread_mutex_unlock(&g_server.clients_mutex);
+}
+
+// Collect connections that currently have unsent data
+int websocket_get_lagging_clients(WSClientLag *out, int max_count) {
+    int found = 0;
+    long long now = get_monotonic_ms();
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+
+    for (int i = 0; i < g_server.client_count && found < max_count; i++) {
+        WebSocketClient *client = &g_server.clients[g_server.active[i]];
+        WSConnection *conn = ws_conn_lookup(client->fd);
+        if (!conn) continue;
+
+        pthread_mutex_lock(&conn->out_lock);
+        if (conn->out_count > 0) {
+            WSClientLag *lag = &out[found++];
+            lag->fd = conn->src.fd;
+            lag->user_id = client->user_id;
+            lag->room_id = client->room_id;
+            lag->queued_bytes = conn->out_bytes;
+            lag->queued_frames = conn->out_count;
+            lag->lag_ms = now - ws_out_at(conn, 0)->enqueued_ms;
+            lag->max_lag_ms = conn->max_lag_ms;
+            lag->dropped_frames = conn->dropped_frames;
+            lag->coalesced_frames = conn->coalesced_frames;
+        }
+        pthread_mutex_unlock(&conn->out_lock);
+    }
+
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    return found;
+}
+
+void websocket_print_stats() {
+    WSClientLag lagging[WS_STATS_MAX_LAGGING];
+    int count = websocket_get_lagging_clients(lagging, WS_STATS_MAX_LAGGING);
+
+    printf("\n========== WEBSOCKET STATISTICS ==========\n");
+    printf("Connections: %d | Shards: %d (connections per shard:", websocket_get_active_connections(),
+           g_shard_count);
+    for (int i = 0; i < g_shard_count; i++) {
+        printf(" %d", atomic_load(&g_shards[i].conn_count));
+    }
+    printf(")\n");
+#ifdef HAVE_IO_URING
+    if (g_io_backend == WS_IO_URING) {
+        unsigned long sends = 0, enters = 0;
+        for (int i = 0; i < g_shard_count; i++) {
+            sends += atomic_load(&g_shards[i].sends_submitted);
+            enters += atomic_load(&g_shards[i].enters);
+        }
+        printf("I/O backend: io_uring | %lu sends in %lu io_uring_enter calls\n", sends, enters);
+    }
+#endif
+    if (g_io_backend == WS_IO_EPOLL) {
+        printf("I/O backend: epoll\n");
+    }
+    printf("Dropped frames: %lu | Coalesced frames: %lu | Slow disconnects: %lu\n",
+           atomic_load(&g_total_dropped), atomic_load(&g_total_coalesced),
+           atomic_load(&g_total_slow_disconnects));
+    printf("Heartbeat pings: %lu | Idle timeouts: %lu\n",
+           atomic_load(&g_total_pings), atomic_load(&g_total_idle_timeouts));
+    printf("Coalesced: %lu messages in %lu batches\n",
+           atomic_load(&g_total_batched_messages), atomic_load(&g_total_batches));
+    if (g_bus) {
+        ChatBusStats bus;
+        chat_bus_get_stats(g_bus, &bus);
+        printf("Bus (%s): published %lu | received %lu | dropped %lu | peers %d\n",
+               bus.transport, bus.published, bus.received, bus.dropped, bus.peers);
+    }
+    unsigned long deflate_in = atomic_load(&g_total_deflate_in);
+    unsigned long deflate_out = atomic_load(&g_total_deflate_out);
+    printf("Compressed messages: %lu | %lu -> %lu bytes (%.1fx)\n",
+           atomic_load(&g_total_deflated), deflate_in, deflate_out,
+           deflate_out ? (double)deflate_in / deflate_out : 0.0);
+    printf("Lagging connections: %d%s\n", count, count == WS_STATS_MAX_LAGGING ? "+" : "");
+    for (int i = 0; i < count; i++) {
+        printf("  fd: %d | user: %d | room: %d | queued: %zu bytes / %d frames | lag: %lld ms (max %lld) | dropped: %lu\n",
+               lagging[i].fd, lagging[i].user_id, lagging[i].room_id,
+               lagging[i].queued_bytes, lagging[i].queued_frames,
+               lagging[i].lag_ms, lagging[i].max_lag_ms,
+               lagging[i].dropped_frames + lagging[i].coalesced_frames);
+    }
+    printf("==========================================\n\n");
+}
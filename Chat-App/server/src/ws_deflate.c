@@ -0,0 +1,331 @@
+#include "ws_deflate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define WS_DEFLATE_MAX_OFFERS_LEN 1024
+#define WS_DEFLATE_MEM_LEVEL 8
+#define WS_INFLATE_INITIAL_SIZE 4096
+
+// Every Z_SYNC_FLUSH ends with an empty stored block; senders strip it
+// and receivers put it back (RFC 7692 section 7.2.1)
+static const unsigned char g_sync_tail[4] = {0x00, 0x00, 0xff, 0xff};
+
+typedef struct {
+    int server_no_context_takeover;
+    int client_no_context_takeover;
+    int server_max_window_bits;      // 0 = not offered
+    int client_max_window_bits;      // 0 = not offered, -1 = offered without a value
+} WSDeflateOffer;
+
+void ws_deflate_config_default(WSDeflateConfig *config) {
+    config->enabled = 1;
+    config->level = WS_DEFLATE_DEFAULT_LEVEL;
+    config->server_max_window_bits = WS_DEFLATE_MAX_WINDOW_BITS;
+    config->client_max_window_bits = WS_DEFLATE_MAX_WINDOW_BITS;
+    config->client_no_context_takeover = 0;
+    config->min_size = WS_DEFLATE_DEFAULT_MIN_SIZE;
+}
+
+static char* trim(char *s) {
+    while (*s == ' ' || *s == '\t') s++;
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+    return s;
+}
+
+// Window bits are 8..15, optionally quoted, without leading zeros
+static int parse_window_bits(const char *value) {
+    size_t n = strlen(value);
+    if (n >= 2 && value[0] == '"' && value[n - 1] == '"') {
+        value++;
+        n -= 2;
+    }
+    if (n == 0 || n > 2 || value[0] == '0') return -1;
+
+    int bits = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (value[i] < '0' || value[i] > '9') return -1;
+        bits = bits * 10 + (value[i] - '0');
+    }
+    return (bits >= 8 && bits <= 15) ? bits : -1;
+}
+
+// Parse one "permessage-deflate; param; param=value" offer in place.
+// Unknown, duplicate or malformed parameters make the offer unusable.
+static int parse_offer(char *offer, WSDeflateOffer *out) {
+    char *save = NULL;
+    char *token = strtok_r(offer, ";", &save);
+
+    memset(out, 0, sizeof(WSDeflateOffer));
+    if (!token || strcasecmp(trim(token), "permessage-deflate") != 0) return 0;
+
+    while ((token = strtok_r(NULL, ";", &save))) {
+        char *param = token;
+        char *value = strchr(param, '=');
+        if (value) {
+            *value++ = '\0';
+            value = trim(value);
+        }
+        param = trim(param);
+
+        if (strcasecmp(param, "server_no_context_takeover") == 0) {
+            if (value || out->server_no_context_takeover) return 0;
+            out->server_no_context_takeover = 1;
+        } else if (strcasecmp(param, "client_no_context_takeover") == 0) {
+            if (value || out->client_no_context_takeover) return 0;
+            out->client_no_context_takeover = 1;
+        } else if (strcasecmp(param, "server_max_window_bits") == 0) {
+            if (!value || out->server_max_window_bits) return 0;
+            out->server_max_window_bits = parse_window_bits(value);
+            if (out->server_max_window_bits < 0) return 0;
+        } else if (strcasecmp(param, "client_max_window_bits") == 0) {
+            if (out->client_max_window_bits) return 0;
+            out->client_max_window_bits = value ? parse_window_bits(value) : -1;
+            if (value && out->client_max_window_bits < 0) return 0;
+        } else {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int ws_deflate_negotiate(const WSDeflateConfig *config, const char *offers,
+                         WSDeflateState *state, char *response, size_t response_size) {
+    char copy[WS_DEFLATE_MAX_OFFERS_LEN];
+    char *save = NULL;
+
+    memset(state, 0, sizeof(WSDeflateState));
+    if (!config->enabled || !offers || strlen(offers) >= sizeof(copy)) return 0;
+    strcpy(copy, offers);
+
+    for (char *offer = strtok_r(copy, ",", &save); offer; offer = strtok_r(NULL, ",", &save)) {
+        WSDeflateOffer o;
+        if (!parse_offer(offer, &o)) continue;
+
+        // A client may shrink our window; below 9 bits zlib cannot honour it
+        int server_bits = config->server_max_window_bits;
+        if (o.server_max_window_bits && o.server_max_window_bits < server_bits) {
+            server_bits = o.server_max_window_bits;
+        }
+        if (server_bits < WS_DEFLATE_MIN_WINDOW_BITS) continue;
+
+        // We can only limit the client's window if it said it supports that
+        int client_bits = WS_DEFLATE_MAX_WINDOW_BITS;
+        if (o.client_max_window_bits) {
+            client_bits = config->client_max_window_bits;
+            if (o.client_max_window_bits > 0 && o.client_max_window_bits < client_bits) {
+                client_bits = o.client_max_window_bits;
+            }
+        }
+
+        state->active = 1;
+        state->server_window_bits = server_bits;
+        state->client_window_bits = client_bits;
+        state->client_no_context_takeover = o.client_no_context_takeover ||
+                                            config->client_no_context_takeover;
+
+        char server_param[48] = "";
+        char client_param[48] = "";
+        if (o.server_max_window_bits || server_bits < WS_DEFLATE_MAX_WINDOW_BITS) {
+            snprintf(server_param, sizeof(server_param), "; server_max_window_bits=%d", server_bits);
+        }
+        if (o.client_max_window_bits) {
+            snprintf(client_param, sizeof(client_param), "; client_max_window_bits=%d", client_bits);
+        }
+        snprintf(response, response_size, "permessage-deflate; server_no_context_takeover%s%s%s",
+                 state->client_no_context_takeover ? "; client_no_context_takeover" : "",
+                 server_param, client_param);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Compressors are cached per thread and window size and reset between
+// messages, so each broadcast pays for compression but not for setup
+typedef struct {
+    z_stream streams[WS_DEFLATE_WINDOW_VARIANTS];
+    int levels[WS_DEFLATE_WINDOW_VARIANTS];   // 0 = not initialised
+} WSDeflaters;
+
+static pthread_key_t g_deflater_key;
+static pthread_once_t g_deflater_once = PTHREAD_ONCE_INIT;
+
+static void deflaters_free(void *ptr) {
+    WSDeflaters *deflaters = ptr;
+    for (int i = 0; i < WS_DEFLATE_WINDOW_VARIANTS; i++) {
+        if (deflaters->levels[i]) deflateEnd(&deflaters->streams[i]);
+    }
+    free(deflaters);
+}
+
+static void deflater_key_init() {
+    pthread_key_create(&g_deflater_key, deflaters_free);
+}
+
+static z_stream* thread_deflater(int level, int window_bits) {
+    pthread_once(&g_deflater_once, deflater_key_init);
+
+    WSDeflaters *deflaters = pthread_getspecific(g_deflater_key);
+    if (!deflaters) {
+        deflaters = calloc(1, sizeof(WSDeflaters));
+        if (!deflaters) return NULL;
+        pthread_setspecific(g_deflater_key, deflaters);
+    }
+
+    int i = window_bits - WS_DEFLATE_MIN_WINDOW_BITS;
+    z_stream *strm = &deflaters->streams[i];
+
+    if (deflaters->levels[i] == level) {
+        deflateReset(strm);
+        return strm;
+    }
+    if (deflaters->levels[i]) {
+        deflateEnd(strm);
+        deflaters->levels[i] = 0;
+    }
+
+    memset(strm, 0, sizeof(z_stream));
+    if (deflateInit2(strm, level, Z_DEFLATED, -window_bits, WS_DEFLATE_MEM_LEVEL,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    deflaters->levels[i] = level;
+    return strm;
+}
+
+WSOutFrame* ws_deflate_frame_create(int level, int window_bits, int opcode,
+                                    const void *payload, size_t len) {
+    if (len == 0 || len > UINT_MAX / 2) return NULL;
+    if (window_bits < WS_DEFLATE_MIN_WINDOW_BITS || window_bits > WS_DEFLATE_MAX_WINDOW_BITS) return NULL;
+    if (level < 1 || level > 9) level = WS_DEFLATE_DEFAULT_LEVEL;
+
+    z_stream *strm = thread_deflater(level, window_bits);
+    if (!strm) return NULL;
+
+    // Output only has to beat the raw payload (plus the flush marker we
+    // strip and one spare byte so a full buffer means "did not fit")
+    size_t cap = len + sizeof(g_sync_tail) + 1;
+    WSOutFrame *frame = malloc(sizeof(WSOutFrame) + 10 + cap);
+    if (!frame) return NULL;
+
+    unsigned char *out = frame->data + 10;
+    strm->next_in = (Bytef*)payload;
+    strm->avail_in = (uInt)len;
+    strm->next_out = out;
+    strm->avail_out = (uInt)cap;
+
+    int rc = deflate(strm, Z_SYNC_FLUSH);
+    size_t produced = cap - strm->avail_out;
+    if (rc != Z_OK || strm->avail_in != 0 || strm->avail_out == 0 ||
+        produced < sizeof(g_sync_tail) ||
+        memcmp(out + produced - sizeof(g_sync_tail), g_sync_tail, sizeof(g_sync_tail)) != 0) {
+        free(frame);
+        return NULL;
+    }
+
+    size_t compressed = produced - sizeof(g_sync_tail);
+    if (compressed >= len) {
+        free(frame);
+        return NULL;
+    }
+
+    // Header size depends on the compressed length, so slide the payload
+    // down behind it
+    unsigned char header[10];
+    size_t header_len = ws_frame_write_header(header, opcode, 1, compressed);
+    header[0] |= WS_FRAME_RSV1;
+    memmove(frame->data + header_len, out, compressed);
+    memcpy(frame->data, header, header_len);
+
+    atomic_init(&frame->refcount, 1);
+    frame->len = header_len + compressed;
+    return frame;
+}
+
+long ws_deflate_inflate(WSDeflateState *state, const unsigned char *in, size_t in_len,
+                        unsigned char **buf, size_t *buf_cap, size_t max_len) {
+    if (in_len > UINT_MAX) return -1;
+
+    if (!state->inflater) {
+        z_stream *strm = calloc(1, sizeof(z_stream));
+        if (!strm) return -1;
+
+        // A larger window than the client uses still decodes its output
+        int bits = state->client_window_bits;
+        if (bits < WS_DEFLATE_MIN_WINDOW_BITS) bits = WS_DEFLATE_MIN_WINDOW_BITS;
+        if (inflateInit2(strm, -bits) != Z_OK) {
+            free(strm);
+            return -1;
+        }
+        state->inflater = strm;
+    }
+
+    z_stream *strm = state->inflater;
+    size_t out_len = 0;
+    int finished = 0;
+
+    // One byte past max_len so an exactly full buffer is not mistaken
+    // for an oversized message
+    size_t limit = max_len + 1;
+
+    for (int pass = 0; pass < 2 && !finished; pass++) {
+        strm->next_in = pass ? (Bytef*)g_sync_tail : (Bytef*)in;
+        strm->avail_in = pass ? sizeof(g_sync_tail) : (uInt)in_len;
+
+        for (;;) {
+            if (out_len == *buf_cap) {
+                if (*buf_cap >= limit) goto fail;
+                size_t cap = *buf_cap ? *buf_cap * 2 : WS_INFLATE_INITIAL_SIZE;
+                if (cap > limit) cap = limit;
+                unsigned char *grown = realloc(*buf, cap);
+                if (!grown) goto fail;
+                *buf = grown;
+                *buf_cap = cap;
+            }
+
+            strm->next_out = *buf + out_len;
+            strm->avail_out = (uInt)(*buf_cap - out_len);
+
+            int rc = inflate(strm, Z_SYNC_FLUSH);
+            out_len = *buf_cap - strm->avail_out;
+
+            if (rc == Z_STREAM_END) {
+                // BFINAL block: the message is complete and the stream
+                // starts over; whatever follows is ignored
+                inflateReset(strm);
+                finished = 1;
+                break;
+            }
+            if (rc != Z_OK && rc != Z_BUF_ERROR) goto fail;
+            if (strm->avail_in == 0 && strm->avail_out > 0) break;
+        }
+    }
+
+    if (out_len > max_len) goto fail;
+
+    if (state->client_no_context_takeover) {
+        inflateEnd(strm);
+        free(strm);
+        state->inflater = NULL;
+    }
+
+    return (long)out_len;
+
+fail:
+    ws_deflate_state_free(state);
+    return -1;
+}
+
+void ws_deflate_state_free(WSDeflateState *state) {
+    if (state->inflater) {
+        inflateEnd(state->inflater);
+        free(state->inflater);
+        state->inflater = NULL;
+    }
+}
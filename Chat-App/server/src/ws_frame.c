@@ -0,0 +1,80 @@
+#include "ws_frame.h"
+#include <stdlib.h>
+#include <string.h>
+
+size_t ws_frame_write_header(unsigned char *out, int opcode, int fin, size_t payload_len) {
+    size_t pos = 0;
+
+    out[pos++] = (fin ? 0x80 : 0x00) | (opcode & 0x0F);
+
+    // Payload length (server frames are never masked)
+    if (payload_len < 126) {
+        out[pos++] = payload_len & 0x7F;
+    } else if (payload_len < 65536) {
+        out[pos++] = 126;
+        out[pos++] = (payload_len >> 8) & 0xFF;
+        out[pos++] = payload_len & 0xFF;
+    } else {
+        out[pos++] = 127;
+        for (int i = 7; i >= 0; i--) {
+            out[pos++] = ((unsigned long long)payload_len >> (i * 8)) & 0xFF;
+        }
+    }
+
+    return pos;
+}
+
+WSOutFrame* ws_frame_create(int opcode, const void *payload, size_t payload_len) {
+    WSOutFrame *frame = malloc(sizeof(WSOutFrame) + 10 + payload_len);
+    if (!frame) return NULL;
+
+    atomic_init(&frame->refcount, 1);
+
+    size_t pos = ws_frame_write_header(frame->data, opcode, 1, payload_len);
+    if (payload_len > 0) {
+        memcpy(&frame->data[pos], payload, payload_len);
+    }
+    frame->len = pos + payload_len;
+
+    return frame;
+}
+
+WSOutFrame* ws_frame_concat(WSOutFrame *const *frames, int count) {
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        len += frames[i]->len;
+    }
+
+    WSOutFrame *batch = malloc(sizeof(WSOutFrame) + len);
+    if (!batch) return NULL;
+
+    atomic_init(&batch->refcount, 1);
+    batch->len = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(&batch->data[batch->len], frames[i]->data, frames[i]->len);
+        batch->len += frames[i]->len;
+    }
+
+    return batch;
+}
+
+const unsigned char* ws_frame_payload(const WSOutFrame *frame, size_t *len) {
+    size_t length_code = frame->data[1] & 0x7F;
+    size_t header = length_code == 127 ? 10 : length_code == 126 ? 4 : 2;
+
+    *len = frame->len - header;
+    return frame->data + header;
+}
+
+WSOutFrame* ws_frame_ref(WSOutFrame *frame) {
+    if (frame) {
+        atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+    }
+    return frame;
+}
+
+void ws_frame_unref(WSOutFrame *frame) {
+    if (frame && atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_acq_rel) == 1) {
+        free(frame);
+    }
+}
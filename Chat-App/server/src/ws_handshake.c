@@ -0,0 +1,343 @@
+#include "ws_handshake.h"
+#include <string.h>
+#include <strings.h>
+#include <openssl/sha.h>
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_LENGTH 24              // base64 of the 16-byte nonce
+
+static const char g_base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void ws_handshake_init(WSHandshake *hs) {
+    memset(hs, 0, sizeof(WSHandshake));
+    hs->header_count = -1;
+}
+
+static WSHandshakeResult ws_handshake_fail(WSHandshake *hs, int status) {
+    hs->status = status;
+    return WS_HANDSHAKE_ERROR;
+}
+
+static WSSpan ws_span(size_t start, size_t end) {
+    WSSpan span = {(uint16_t)start, (uint16_t)(end - start)};
+    return span;
+}
+
+static int ws_is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// "METHOD SP target SP version"
+static int ws_parse_request_line(WSHandshake *hs, const char *buf, size_t start, size_t end) {
+    const char *line = buf + start;
+    size_t len = end - start;
+
+    const char *sp1 = memchr(line, ' ', len);
+    if (!sp1 || sp1 == line) return -1;
+    const char *target = sp1 + 1;
+    const char *sp2 = memchr(target, ' ', line + len - target);
+    if (!sp2 || sp2 == target) return -1;
+    const char *version = sp2 + 1;
+    if (version == line + len || memchr(version, ' ', line + len - version)) return -1;
+
+    hs->method = ws_span(start, sp1 - buf);
+    hs->target = ws_span(target - buf, sp2 - buf);
+    hs->version = ws_span(version - buf, end);
+    return 0;
+}
+
+static int ws_name_is(const char *name, size_t len, const char *want) {
+    return strlen(want) == len && strncasecmp(name, want, len) == 0;
+}
+
+// Record a header the upgrade cares about; everything else is skipped.
+// Returns 0, or the HTTP status to refuse a malformed line with.
+static int ws_parse_header_line(WSHandshake *hs, const char *buf, size_t start, size_t end) {
+    const char *line = buf + start;
+    const char *colon = memchr(line, ':', end - start);
+
+    // No name, or whitespace in it (which also rules out obsolete folding)
+    if (!colon || colon == line) return 400;
+    for (const char *p = line; p < colon; p++) {
+        if (ws_is_space(*p)) return 400;
+    }
+
+    size_t name_len = colon - line;
+    size_t value = colon + 1 - buf;
+    size_t value_end = end;
+    while (value < value_end && ws_is_space(buf[value])) value++;
+    while (value_end > value && ws_is_space(buf[value_end - 1])) value_end--;
+    WSSpan span = ws_span(value, value_end);
+
+    WSSpan *single = NULL;
+    int unique = 0;
+    if (ws_name_is(line, name_len, "Host")) {
+        single = &hs->host;
+        unique = 1;
+    } else if (ws_name_is(line, name_len, "Upgrade")) {
+        single = &hs->upgrade;
+    } else if (ws_name_is(line, name_len, "Connection")) {
+        single = &hs->connection;
+    } else if (ws_name_is(line, name_len, "Sec-WebSocket-Key")) {
+        single = &hs->key;
+        unique = 1;
+    } else if (ws_name_is(line, name_len, "Sec-WebSocket-Version")) {
+        single = &hs->ws_version;
+        unique = 1;
+    } else if (ws_name_is(line, name_len, "Origin")) {
+        single = &hs->origin;
+        unique = 1;
+    } else if (ws_name_is(line, name_len, "Authorization")) {
+        single = &hs->authorization;
+        unique = 1;
+    } else if (ws_name_is(line, name_len, "X-Room-Id")) {
+        single = &hs->room_id;
+        unique = 1;
+    } else if (ws_name_is(line, name_len, "Sec-WebSocket-Extensions")) {
+        if (hs->extension_count == WS_HANDSHAKE_MAX_LIST) return 431;
+        hs->extensions[hs->extension_count++] = span;
+        return 0;
+    } else if (ws_name_is(line, name_len, "Sec-WebSocket-Protocol")) {
+        if (hs->protocol_count == WS_HANDSHAKE_MAX_LIST) return 431;
+        hs->protocols[hs->protocol_count++] = span;
+        return 0;
+    }
+
+    if (single) {
+        // A second key, host or credential makes the request ambiguous
+        if (single->len) {
+            if (unique) return 400;
+            return 0;
+        }
+        *single = span;
+    }
+    return 0;
+}
+
+WSHandshakeResult ws_handshake_parse(WSHandshake *hs, const char *buf, size_t len) {
+    if (hs->request_len) return WS_HANDSHAKE_DONE;
+    if (hs->status) return WS_HANDSHAKE_ERROR;
+
+    // Spans are 16-bit; nothing past the size limit can belong to a request
+    if (len > WS_HANDSHAKE_MAX_SIZE) len = WS_HANDSHAKE_MAX_SIZE;
+
+    while (hs->scanned < len) {
+        const char *nl = memchr(buf + hs->scanned, '\n', len - hs->scanned);
+        if (!nl) {
+            hs->scanned = len;
+            break;
+        }
+
+        size_t start = hs->line_start;
+        size_t end = nl - buf;
+        hs->scanned = hs->line_start = end + 1;
+        if (end > start && buf[end - 1] == '\r') end--;
+
+        if (hs->header_count < 0) {
+            // Empty lines before the request line are allowed (RFC 7230 3.5)
+            if (end == start) continue;
+            if (ws_parse_request_line(hs, buf, start, end) < 0) return ws_handshake_fail(hs, 400);
+            hs->header_count = 0;
+            continue;
+        }
+
+        if (end == start) {
+            hs->request_len = hs->scanned;
+            return WS_HANDSHAKE_DONE;
+        }
+        if (++hs->header_count > WS_HANDSHAKE_MAX_HEADERS) return ws_handshake_fail(hs, 431);
+
+        int status = ws_parse_header_line(hs, buf, start, end);
+        if (status) return ws_handshake_fail(hs, status);
+    }
+
+    if (len == WS_HANDSHAKE_MAX_SIZE) return ws_handshake_fail(hs, 431);
+    return WS_HANDSHAKE_INCOMPLETE;
+}
+
+static int ws_span_equals(const char *buf, WSSpan span, const char *text) {
+    return strlen(text) == span.len && memcmp(buf + span.off, text, span.len) == 0;
+}
+
+// 1 if the comma-separated value in span holds token
+static int ws_span_has_token(const char *buf, WSSpan span, const char *token, int ignore_case) {
+    const char *value = buf + span.off;
+    size_t token_len = strlen(token);
+    size_t i = 0;
+
+    while (i < span.len) {
+        while (i < span.len && (value[i] == ',' || ws_is_space(value[i]))) i++;
+        size_t item = i;
+        while (i < span.len && value[i] != ',') i++;
+        size_t item_end = i;
+        while (item_end > item && ws_is_space(value[item_end - 1])) item_end--;
+
+        if (item_end - item == token_len &&
+            (ignore_case ? strncasecmp(value + item, token, token_len)
+                         : memcmp(value + item, token, token_len)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int ws_is_base64(char c) {
+    return c && strchr(g_base64_alphabet, c) != NULL;
+}
+
+// 24 base64 characters ending in "==", i.e. exactly 16 bytes
+static int ws_key_is_valid(const char *buf, WSSpan key) {
+    const char *p = buf + key.off;
+
+    if (key.len != WS_KEY_LENGTH || p[22] != '=' || p[23] != '=') return 0;
+    for (int i = 0; i < 22; i++) {
+        if (!ws_is_base64(p[i])) return 0;
+    }
+    // The last digit carries 2 data bits; the other 4 must be zero
+    return ((strchr(g_base64_alphabet, p[21]) - g_base64_alphabet) & 0x0F) == 0;
+}
+
+// origins is "a, b, c"; compared exactly (origins are already normalized)
+static int ws_origin_allowed(const char *buf, WSSpan origin, const char *origins) {
+    size_t origin_len = origin.len;
+    const char *item = origins;
+
+    while (*item) {
+        while (*item == ',' || ws_is_space(*item)) item++;
+        const char *end = item;
+        while (*end && *end != ',') end++;
+        const char *trimmed = end;
+        while (trimmed > item && ws_is_space(trimmed[-1])) trimmed--;
+
+        if ((size_t)(trimmed - item) == origin_len && memcmp(item, buf + origin.off, origin_len) == 0) {
+            return 1;
+        }
+        item = end;
+    }
+    return 0;
+}
+
+int ws_handshake_validate(const WSHandshake *hs, const char *buf, const char *origins) {
+    if (!ws_span_equals(buf, hs->method, "GET") ||
+        !ws_span_equals(buf, hs->version, "HTTP/1.1") ||
+        !hs->host.len) {
+        return 400;
+    }
+    if (!ws_span_has_token(buf, hs->upgrade, "websocket", 1) ||
+        !ws_span_has_token(buf, hs->connection, "upgrade", 1)) {
+        return 400;
+    }
+    if (!ws_span_equals(buf, hs->ws_version, "13")) return 426;
+    if (!ws_key_is_valid(buf, hs->key)) return 400;
+    if (origins && origins[0] && hs->origin.len && !ws_origin_allowed(buf, hs->origin, origins)) {
+        return 403;
+    }
+    return 0;
+}
+
+int ws_handshake_list_contains(const char *buf, const WSSpan *spans, int count, const char *token) {
+    for (int i = 0; i < count; i++) {
+        if (ws_span_has_token(buf, spans[i], token, 0)) return 1;
+    }
+    return 0;
+}
+
+int ws_handshake_join_list(const char *buf, const WSSpan *spans, int count,
+                           char *out, size_t out_size) {
+    size_t out_len = 0;
+
+    out[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        size_t sep = out_len ? 2 : 0;
+        if (out_len + sep + spans[i].len >= out_size) {
+            out[0] = '\0';
+            return -1;
+        }
+        if (sep) memcpy(out + out_len, ", ", 2);
+        memcpy(out + out_len + sep, buf + spans[i].off, spans[i].len);
+        out_len += sep + spans[i].len;
+        out[out_len] = '\0';
+    }
+    return 0;
+}
+
+int ws_handshake_copy(const char *buf, WSSpan span, char *out, size_t out_size) {
+    if (!span.len || span.len >= out_size) return 0;
+    memcpy(out, buf + span.off, span.len);
+    out[span.len] = '\0';
+    return 1;
+}
+
+static int hex_digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int ws_handshake_query_param(const WSHandshake *hs, const char *buf, const char *name,
+                             char *out, size_t out_size) {
+    const char *target = buf + hs->target.off;
+    const char *target_end = target + hs->target.len;
+    const char *param = memchr(target, '?', hs->target.len);
+    if (!param) return 0;
+    param++;
+
+    size_t name_len = strlen(name);
+    while (param < target_end) {
+        const char *param_end = memchr(param, '&', target_end - param);
+        if (!param_end) param_end = target_end;
+
+        if ((size_t)(param_end - param) > name_len && strncmp(param, name, name_len) == 0 &&
+            param[name_len] == '=') {
+            const char *val = param + name_len + 1;
+            size_t len = 0;
+            while (val < param_end) {
+                char c = *val++;
+                if (c == '+') {
+                    c = ' ';
+                } else if (c == '%' && param_end - val >= 2 &&
+                           hex_digit_value(val[0]) >= 0 && hex_digit_value(val[1]) >= 0) {
+                    c = (char)(hex_digit_value(val[0]) * 16 + hex_digit_value(val[1]));
+                    val += 2;
+                }
+                if (len + 1 >= out_size) return 0;
+                out[len++] = c;
+            }
+            out[len] = '\0';
+            return 1;
+        }
+        param = param_end + 1;
+    }
+    return 0;
+}
+
+// Standard base64 with padding; out needs 4 * ceil(len / 3) + 1 bytes
+static size_t ws_base64_encode(const unsigned char *in, size_t len, char *out) {
+    size_t o = 0;
+
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t n = (uint32_t)in[i] << 16;
+        if (i + 1 < len) n |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < len) n |= in[i + 2];
+
+        out[o++] = g_base64_alphabet[(n >> 18) & 0x3F];
+        out[o++] = g_base64_alphabet[(n >> 12) & 0x3F];
+        out[o++] = i + 1 < len ? g_base64_alphabet[(n >> 6) & 0x3F] : '=';
+        out[o++] = i + 2 < len ? g_base64_alphabet[n & 0x3F] : '=';
+    }
+    out[o] = '\0';
+    return o;
+}
+
+void ws_handshake_accept_key(const char *buf, WSSpan key, char accept[WS_ACCEPT_KEY_SIZE]) {
+    unsigned char concat[WS_KEY_LENGTH + sizeof(WS_GUID) - 1];
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    size_t key_len = key.len < WS_KEY_LENGTH ? key.len : WS_KEY_LENGTH;
+
+    memcpy(concat, buf + key.off, key_len);
+    memcpy(concat + key_len, WS_GUID, sizeof(WS_GUID) - 1);
+    SHA1(concat, key_len + sizeof(WS_GUID) - 1, hash);
+    ws_base64_encode(hash, sizeof(hash), accept);
+}
@@ -0,0 +1,124 @@
+#include "ws_mask.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static ws_unmask_fn g_unmask_kernel = ws_unmask_scalar;
+static const char *g_unmask_kernel_name = "scalar";
+
+// Key rotated so that byte 0 lines up with data[0]
+static uint32_t rotated_mask(const unsigned char mask[4], uint64_t offset) {
+    unsigned char rotated[4];
+    uint32_t key;
+
+    for (int i = 0; i < 4; i++) {
+        rotated[i] = mask[(offset + i) & 3];
+    }
+    memcpy(&key, rotated, 4);
+    return key;
+}
+
+void ws_unmask_scalar(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] ^= mask[(offset + i) & 3];
+    }
+}
+
+void ws_unmask_word(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset) {
+    uint32_t key32 = rotated_mask(mask, offset);
+    uint64_t key = ((uint64_t)key32 << 32) | key32;
+    size_t i = 0;
+
+    // 8 is a multiple of 4, so the key phase is the same for every word
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word ^= key;
+        memcpy(data + i, &word, 8);
+    }
+
+    ws_unmask_scalar(data + i, len - i, mask, offset + i);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+void ws_unmask_sse2(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset) {
+    __m128i key = _mm_set1_epi32((int)rotated_mask(mask, offset));
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(data + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(data + i + 48));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(a, key));
+        _mm_storeu_si128((__m128i*)(data + i + 16), _mm_xor_si128(b, key));
+        _mm_storeu_si128((__m128i*)(data + i + 32), _mm_xor_si128(c, key));
+        _mm_storeu_si128((__m128i*)(data + i + 48), _mm_xor_si128(d, key));
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(a, key));
+    }
+
+    ws_unmask_word(data + i, len - i, mask, offset + i);
+}
+
+__attribute__((target("avx2")))
+void ws_unmask_avx2(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset) {
+    __m256i key = _mm256_set1_epi32((int)rotated_mask(mask, offset));
+    size_t i = 0;
+
+    for (; i + 128 <= len; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(data + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(data + i + 96));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(a, key));
+        _mm256_storeu_si256((__m256i*)(data + i + 32), _mm256_xor_si256(b, key));
+        _mm256_storeu_si256((__m256i*)(data + i + 64), _mm256_xor_si256(c, key));
+        _mm256_storeu_si256((__m256i*)(data + i + 96), _mm256_xor_si256(d, key));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(a, key));
+    }
+
+    ws_unmask_sse2(data + i, len - i, mask, offset + i);
+}
+
+#endif
+
+// Pick the kernel once, before main() runs
+__attribute__((constructor))
+static void ws_unmask_select_kernel() {
+    g_unmask_kernel = ws_unmask_word;
+    g_unmask_kernel_name = "word64";
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        g_unmask_kernel = ws_unmask_avx2;
+        g_unmask_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        g_unmask_kernel = ws_unmask_sse2;
+        g_unmask_kernel_name = "sse2";
+    }
+#endif
+}
+
+void ws_unmask(unsigned char *data, size_t len, const unsigned char mask[4], uint64_t offset) {
+    // Short payloads (typing indicators, acks) are not worth a vector setup
+    if (len < 64) {
+        ws_unmask_word(data, len, mask, offset);
+        return;
+    }
+    g_unmask_kernel(data, len, mask, offset);
+}
+
+const char* ws_unmask_kernel_name() {
+    return g_unmask_kernel_name;
+}
@@ -0,0 +1,230 @@
+#include "ws_parser.h"
+#include "ws_frame.h"
+#include "ws_mask.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Keep a reassembly buffer up to this size between messages
+#define WS_PARSER_RETAIN_BYTES 16384
+
+void ws_parser_init(WSParser *parser, size_t max_message_size) {
+    memset(parser, 0, sizeof(WSParser));
+    parser->max_message_size = max_message_size ? max_message_size : WS_DEFAULT_MAX_MESSAGE_SIZE;
+}
+
+void ws_parser_free(WSParser *parser) {
+    free(parser->msg_buf);
+    parser->msg_buf = NULL;
+    parser->msg_len = 0;
+    parser->msg_cap = 0;
+}
+
+static int is_control_opcode(int opcode) {
+    return opcode & 0x8;
+}
+
+// Bytes needed for the full header given what has been read so far
+static size_t header_size_needed(const unsigned char *header, size_t have) {
+    if (have < 2) return 2;
+
+    size_t size = 2;
+    int len7 = header[1] & 0x7F;
+    if (len7 == 126) size += 2;
+    else if (len7 == 127) size += 8;
+    if (header[1] & 0x80) size += 4;
+    return size;
+}
+
+// Validate a complete header and load it into the current-frame fields
+static int load_header(WSParser *parser, const unsigned char *header) {
+    parser->fin = (header[0] & 0x80) >> 7;
+    parser->opcode = header[0] & 0x0F;
+    int masked = (header[1] & 0x80) >> 7;
+    uint64_t len = header[1] & 0x7F;
+    size_t pos = 2;
+
+    if (len == 126) {
+        len = ((uint64_t)header[2] << 8) | header[3];
+        pos = 4;
+    } else if (len == 127) {
+        len = 0;
+        for (int i = 0; i < 8; i++) {
+            len = (len << 8) | header[2 + i];
+        }
+        pos = 10;
+    }
+
+    // RSV1 marks a compressed message and is only valid on its first frame
+    parser->compressed = (header[0] & 0x40) != 0;
+    if ((header[0] & 0x30) ||
+        (parser->compressed && (!parser->allow_compressed ||
+                                parser->opcode == WS_OPCODE_CONTINUATION ||
+                                is_control_opcode(parser->opcode)))) {
+        log_error("WebSocket frame uses reserved bits");
+        return -1;
+    }
+    if (!masked) {
+        log_error("WebSocket client frame is not masked");
+        return -1;
+    }
+    memcpy(parser->mask, &header[pos], 4);
+
+    if (is_control_opcode(parser->opcode)) {
+        if (!parser->fin || len > WS_MAX_CONTROL_PAYLOAD) {
+            log_error("Invalid WebSocket control frame");
+            return -1;
+        }
+    } else if (parser->opcode == WS_OPCODE_CONTINUATION) {
+        if (!parser->msg_opcode) {
+            log_error("WebSocket continuation frame without a message");
+            return -1;
+        }
+    } else if (parser->opcode == WS_OPCODE_TEXT || parser->opcode == WS_OPCODE_BINARY) {
+        if (parser->msg_opcode) {
+            log_error("WebSocket data frame interrupts a fragmented message");
+            return -1;
+        }
+    } else {
+        log_error("Unknown WebSocket opcode 0x%x", parser->opcode);
+        return -1;
+    }
+
+    if (!is_control_opcode(parser->opcode)) {
+        // Compare without adding first so a 2^63 length cannot wrap
+        if (len > parser->max_message_size ||
+            parser->msg_len > parser->max_message_size - len) {
+            log_error("WebSocket message exceeds %zu bytes", parser->max_message_size);
+            return -1;
+        }
+    }
+
+    parser->payload_len = len;
+    parser->payload_read = 0;
+    return 0;
+}
+
+static int reserve_message(WSParser *parser, size_t extra) {
+    size_t need = parser->msg_len + extra;
+    if (need <= parser->msg_cap) return 0;
+
+    size_t cap = parser->msg_cap ? parser->msg_cap : 1024;
+    while (cap < need) cap *= 2;
+    if (cap > parser->max_message_size) cap = parser->max_message_size;
+
+    unsigned char *grown = realloc(parser->msg_buf, cap);
+    if (!grown) return -1;
+    parser->msg_buf = grown;
+    parser->msg_cap = cap;
+    return 0;
+}
+
+// A frame's payload is complete: deliver it (or the whole message on FIN)
+static int finish_frame(WSParser *parser, unsigned char *payload, size_t len,
+                        ws_message_callback on_message, void *ctx) {
+    parser->state = WS_PARSE_HEADER;
+
+    if (is_control_opcode(parser->opcode)) {
+        return on_message(ctx, parser->opcode, 0, payload, len);
+    }
+
+    if (!parser->fin) return 0;
+
+    int opcode = parser->opcode;
+    int compressed = parser->compressed;
+    if (parser->msg_opcode) {
+        opcode = parser->msg_opcode;
+        compressed = parser->msg_compressed;
+    }
+    int result = on_message(ctx, opcode, compressed, payload, len);
+
+    parser->msg_opcode = 0;
+    parser->msg_len = 0;
+    if (parser->msg_cap > WS_PARSER_RETAIN_BYTES) {
+        ws_parser_free(parser);
+    }
+    return result;
+}
+
+int ws_parser_feed(WSParser *parser, unsigned char *data, size_t len,
+                   ws_message_callback on_message, void *ctx) {
+    size_t pos = 0;
+
+    while (pos < len) {
+        if (parser->state == WS_PARSE_HEADER) {
+            size_t avail = len - pos;
+            size_t need = header_size_needed(data + pos, avail);
+
+            if (parser->header_len == 0 && avail >= need) {
+                // Header is contiguous in the caller's buffer
+                if (load_header(parser, data + pos) < 0) return -1;
+                pos += need;
+
+                // Fast path: the whole frame is here and is not part of a
+                // fragmented message, so unmask it in place and deliver it
+                // without copying
+                if (parser->fin && parser->payload_len <= len - pos &&
+                    (is_control_opcode(parser->opcode) || !parser->msg_opcode)) {
+                    size_t plen = (size_t)parser->payload_len;
+                    unsigned char *payload = data + pos;
+                    ws_unmask(payload, plen, parser->mask, 0);
+                    pos += plen;
+                    int result = finish_frame(parser, payload, plen, on_message, ctx);
+                    if (result != 0) return result;
+                    continue;
+                }
+            } else {
+                // Header split across reads: accumulate it byte by byte
+                need = header_size_needed(parser->header, parser->header_len);
+                while (parser->header_len < need && pos < len) {
+                    parser->header[parser->header_len++] = data[pos++];
+                    need = header_size_needed(parser->header, parser->header_len);
+                }
+                if (parser->header_len < need) break;
+
+                if (load_header(parser, parser->header) < 0) return -1;
+            }
+
+            if (is_control_opcode(parser->opcode)) {
+                parser->ctrl_len = 0;
+            } else if (parser->opcode != WS_OPCODE_CONTINUATION) {
+                parser->msg_opcode = parser->opcode;
+                parser->msg_compressed = parser->compressed;
+            }
+            parser->header_len = 0;
+            parser->state = WS_PARSE_PAYLOAD;
+        }
+
+        // WS_PARSE_PAYLOAD: copy what we have of the current frame
+        uint64_t remaining = parser->payload_len - parser->payload_read;
+        size_t chunk = len - pos;
+        if ((uint64_t)chunk > remaining) chunk = (size_t)remaining;
+
+        unsigned char *src = data + pos;
+        ws_unmask(src, chunk, parser->mask, parser->payload_read);
+
+        if (is_control_opcode(parser->opcode)) {
+            memcpy(parser->ctrl_buf + parser->ctrl_len, src, chunk);
+            parser->ctrl_len += chunk;
+        } else if (chunk > 0) {
+            if (reserve_message(parser, chunk) < 0) return -1;
+            memcpy(parser->msg_buf + parser->msg_len, src, chunk);
+            parser->msg_len += chunk;
+        }
+
+        pos += chunk;
+        parser->payload_read += chunk;
+
+        if (parser->payload_read == parser->payload_len) {
+            int result;
+            if (is_control_opcode(parser->opcode)) {
+                result = finish_frame(parser, parser->ctrl_buf, parser->ctrl_len, on_message, ctx);
+            } else {
+                result = finish_frame(parser, parser->msg_buf, parser->msg_len, on_message, ctx);
+            }
+            if (result != 0) return result;
+        }
+    }
+
+    return 0;
+}
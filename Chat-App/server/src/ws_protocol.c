@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+#include "ws_protocol.h"
+#include "json_index.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *g_type_names[WS_EVENT_TYPE_COUNT] = {
+    NULL, "message", "user_joined", "user_left", "ping", "pong",
+    "resume", "resumed", "resync", "error"
+};
+
+// JSON keys of the string fields, by tag
+static const char *g_field_keys[] = {
+    NULL, "username", "content", "message_id", "message", NULL
+};
+#define FIELD_KEY_COUNT (int)(sizeof(g_field_keys) / sizeof(g_field_keys[0]))
+
+const char* ws_event_type_name(int type) {
+    return type > 0 && type < WS_EVENT_TYPE_COUNT ? g_type_names[type] : NULL;
+}
+
+static int event_type_from_name(const char *name, size_t len) {
+    for (int type = 1; type < WS_EVENT_TYPE_COUNT; type++) {
+        if (strlen(g_type_names[type]) == len && memcmp(g_type_names[type], name, len) == 0) {
+            return type;
+        }
+    }
+    return WS_EVENT_OTHER;
+}
+
+static void event_add_field(WSEvent *event, int tag, const char *data, size_t len) {
+    if (event->field_count < WS_EVENT_MAX_FIELDS) {
+        WSEventValue *field = &event->fields[event->field_count++];
+        field->tag = tag;
+        field->data = data;
+        field->len = len;
+    }
+}
+
+// ---- JSON decoding ----
+
+int ws_event_from_json(WSEvent *event, const unsigned char *json, size_t len, char *scratch) {
+    JSONIndex index;
+    const JSONField *field;
+    uint64_t value;
+    char *out = scratch;
+
+    if (json_index_parse(&index, (const char*)json, len) < 0) return -1;
+
+    memset(event, 0, sizeof(WSEvent));
+    if (json_index_uint(&index, "room_id", UINT32_MAX, &value) == 0) event->room_id = (uint32_t)value;
+    if (json_index_uint(&index, "seq", UINT64_MAX, &value) == 0) event->seq = value;
+    if (json_index_uint(&index, "user_id", UINT32_MAX, &value) == 0) event->sender_id = (uint32_t)value;
+    if (json_index_uint(&index, "timestamp", UINT64_MAX, &value) == 0) event->timestamp = value;
+
+    if ((field = json_index_get(&index, "type")) != NULL && field->type == JSON_STRING) {
+        long n = json_read_string(field->value, field->value + field->value_len, out);
+        if (n >= 0) {
+            event->type = event_type_from_name(out, n);
+            if (event->type == WS_EVENT_OTHER) {
+                event_add_field(event, WS_FIELD_TYPE_NAME, out, n);
+                out += n;
+            }
+        }
+    }
+
+    for (int tag = 1; tag < FIELD_KEY_COUNT; tag++) {
+        if (!g_field_keys[tag] || !(field = json_index_get(&index, g_field_keys[tag]))) continue;
+
+        if (field->type == JSON_STRING) {
+            long n = json_read_string(field->value, field->value + field->value_len, out);
+            if (n < 0) continue;
+            event_add_field(event, tag, out, n);
+            out += n;
+        } else if (field->type == JSON_NUMBER) {
+            // Numbers (e.g. a numeric message_id) travel as their text
+            memcpy(out, field->value, field->value_len);
+            event_add_field(event, tag, out, field->value_len);
+            out += field->value_len;
+        }
+    }
+    return 0;
+}
+
+// ---- JSON encoding ----
+
+size_t ws_event_json_size(const WSEvent *event) {
+    // Type and the four numbers fit in 192 bytes; a string may grow 6x
+    size_t size = 192;
+    for (int i = 0; i < event->field_count; i++) {
+        size += 24 + event->fields[i].len * 6;
+    }
+    return size;
+}
+
+size_t ws_event_to_json(const WSEvent *event, char *out) {
+    char *p = out;
+    const char *name = ws_event_type_name(event->type);
+    const char *sep = "";
+
+    *p++ = '{';
+    if (name) {
+        p += sprintf(p, "\"type\": \"%s\"", name);
+        sep = ", ";
+    }
+    for (int i = 0; !name && i < event->field_count; i++) {
+        if (event->fields[i].tag == WS_FIELD_TYPE_NAME) {
+            p += sprintf(p, "\"type\": ");
+            p = json_put_string(p, event->fields[i].data, event->fields[i].len);
+            sep = ", ";
+            break;
+        }
+    }
+
+    if (event->room_id) {
+        p += sprintf(p, "%s\"room_id\": %u", sep, event->room_id);
+        sep = ", ";
+    }
+    if (event->seq) {
+        p += sprintf(p, "%s\"seq\": %llu", sep, (unsigned long long)event->seq);
+        sep = ", ";
+    }
+    if (event->sender_id) {
+        p += sprintf(p, "%s\"user_id\": %u", sep, event->sender_id);
+        sep = ", ";
+    }
+    if (event->timestamp) {
+        p += sprintf(p, "%s\"timestamp\": %llu", sep, (unsigned long long)event->timestamp);
+        sep = ", ";
+    }
+
+    for (int i = 0; i < event->field_count; i++) {
+        const WSEventValue *field = &event->fields[i];
+        if (field->tag <= 0 || field->tag >= FIELD_KEY_COUNT || !g_field_keys[field->tag]) continue;
+        p += sprintf(p, "%s\"%s\": ", sep, g_field_keys[field->tag]);
+        p = json_put_string(p, field->data, field->len);
+        sep = ", ";
+    }
+    *p++ = '}';
+    return p - out;
+}
+
+// ---- Binary encoding ----
+
+static void put_le16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_le64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint16_t get_le16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const unsigned char *p) {
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+// Returns 0 if a field exceeds the 16-bit length prefix
+size_t ws_event_binary_size(const WSEvent *event) {
+    size_t size = WS_BINARY_HEADER_SIZE;
+    for (int i = 0; i < event->field_count; i++) {
+        if (event->fields[i].len > UINT16_MAX) return 0;
+        size += 3 + event->fields[i].len;
+    }
+    return size;
+}
+
+size_t ws_event_to_binary(const WSEvent *event, unsigned char *out) {
+    out[0] = WS_BINARY_VERSION;
+    out[1] = (unsigned char)event->type;
+    put_le16(out + 2, (uint16_t)event->field_count);
+    put_le32(out + 4, event->room_id);
+    put_le64(out + 8, event->seq);
+    put_le32(out + 16, event->sender_id);
+    put_le64(out + 20, event->timestamp);
+
+    size_t pos = WS_BINARY_HEADER_SIZE;
+    for (int i = 0; i < event->field_count; i++) {
+        const WSEventValue *field = &event->fields[i];
+        out[pos] = (unsigned char)field->tag;
+        put_le16(out + pos + 1, (uint16_t)field->len);
+        memcpy(out + pos + 3, field->data, field->len);
+        pos += 3 + field->len;
+    }
+    return pos;
+}
+
+// Strict UTF-8 check (no overlongs, surrogates or code points past U+10FFFF)
+static int utf8_valid(const unsigned char *s, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c = s[i];
+        size_t n;
+        unsigned cp;
+
+        if (c < 0x80) { i++; continue; }
+        else if ((c & 0xE0) == 0xC0) { n = 1; cp = c & 0x1F; }
+        else if ((c & 0xF0) == 0xE0) { n = 2; cp = c & 0x0F; }
+        else if ((c & 0xF8) == 0xF0) { n = 3; cp = c & 0x07; }
+        else return 0;
+
+        if (len - i <= n) return 0;
+        for (size_t k = 1; k <= n; k++) {
+            if ((s[i + k] & 0xC0) != 0x80) return 0;
+            cp = (cp << 6) | (s[i + k] & 0x3F);
+        }
+        if ((n == 1 && cp < 0x80) || (n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000) ||
+            cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000)) {
+            return 0;
+        }
+        i += n + 1;
+    }
+    return 1;
+}
+
+int ws_event_from_binary(WSEvent *event, const unsigned char *data, size_t len) {
+    if (len < WS_BINARY_HEADER_SIZE || data[0] != WS_BINARY_VERSION ||
+        data[1] >= WS_EVENT_TYPE_COUNT) {
+        return -1;
+    }
+
+    memset(event, 0, sizeof(WSEvent));
+    event->type = data[1];
+    int count = get_le16(data + 2);
+    if (count > WS_EVENT_MAX_FIELDS) return -1;
+    event->room_id = get_le32(data + 4);
+    event->seq = get_le64(data + 8);
+    event->sender_id = get_le32(data + 16);
+    event->timestamp = get_le64(data + 20);
+
+    size_t pos = WS_BINARY_HEADER_SIZE;
+    for (int i = 0; i < count; i++) {
+        if (len - pos < 3) return -1;
+        int tag = data[pos];
+        size_t field_len = get_le16(data + pos + 1);
+        pos += 3;
+        if (len - pos < field_len || !utf8_valid(data + pos, field_len)) return -1;
+        event_add_field(event, tag, (const char*)data + pos, field_len);
+        pos += field_len;
+    }
+    return pos == len ? 0 : -1;
+}